@@ -30,6 +30,17 @@
 
 _Static_assert(RENDER_NCHARS_MAX <= 126, "Too many glyphs to render");
 
+/**
+ * The patch has no RAM of its own, so both of the following live on the stack of render_sjis, on
+ * top of its 708-byte glyph buffer. Larger values barely save cycles, see bench/render.c.
+ */
+
+/* Glyphs uploaded by a single DMA when there is no delay between them, 136 bytes of stack each */
+#define RENDER_GLYPH_BATCH 2
+
+/* Distinct glyphs whose tiles are reused within a string, 4 bytes of stack each */
+#define RENDER_GLYPH_CACHE 32
+
 /* Force wrap line if it does not fit */
 #define RENDER_AUTO_WRAP 1
 
@@ -0,0 +1,101 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "glyph_layout.h"
+#include "glyph_margins.h"
+
+void glyph_layout_init(struct glyph_layout* l, const char* sjis, uint32_t row, uint16_t xoffs) {
+    l->sjis = sjis;
+    l->i = 0;
+    l->row = row;
+    l->col = 0;
+    l->nbreaks = 0;
+    l->xoffs = xoffs;
+    l->xpos_prev = RENDER_TEXT_LMARGIN;
+    l->rmargin_prev = 0;
+    l->in_quotes = false;
+}
+
+/* Skip line breaks, spaces and unknown bytes up to the next glyph or wait command */
+enum glyph_layout_tok glyph_layout_next(struct glyph_layout* l) {
+    const char* sjis = l->sjis;
+
+    while (sjis[l->i]) {
+        uint32_t first = sjis[l->i] & UINT8_MAX;
+
+        /* Skip delay digit */
+        if (glyph_is_wait_cmd(&sjis[l->i])) {
+            l->i += 2;
+            return GLYPH_LAYOUT_WAIT;
+        } else if (first == '\r') {
+            /* The strtab decoder replaces \n with \r */
+            l->col = 0;
+            l->row++;
+            l->i++;
+            l->nbreaks++;
+            l->xpos_prev = RENDER_TEXT_LMARGIN;
+            continue;
+        } else if (first == ' ') {
+            l->i++;
+            l->xpos_prev += RENDER_SPACE_W;
+            continue;
+        }
+
+        l->quoted = l->in_quotes;
+
+        if (glyph_is_hw(first)) { /* Known single-byte half-width */
+            l->c = first;
+
+            uint16_t fw = glyph_hw_to_fw(first, l->in_quotes);
+            l->first = fw >> 8;
+            l->second = fw & UINT8_MAX;
+
+            if (sjis[l->i] == '"')
+                l->in_quotes = !l->in_quotes;
+
+            l->i++;
+        } else if (sjis[l->i + 1]) { /* Try to interpret as two-byte full-width */
+            l->first = first;
+            l->second = sjis[l->i + 1] & UINT8_MAX;
+            l->c = (first << 8) | l->second;
+            l->i += 2;
+        } else { /* Unknown char; skip */
+            l->i++;
+            continue;
+        }
+
+        return GLYPH_LAYOUT_GLYPH;
+    }
+
+    return GLYPH_LAYOUT_END;
+}
+
+void glyph_layout_place(struct glyph_layout* l) {
+    struct glyph_margins margins = glyph_margin(l->c, l->quoted);
+
+#ifdef RENDER_AUTO_WRAP
+    /* Automatic line wrap */
+    if (l->xpos_prev - RENDER_GLYPH_DIM + margins.lmargin +
+        (RENDER_GLYPH_DIM - margins.lmargin - margins.rmargin) - l->rmargin_prev
+            >= RENDER_TEXT_RMARGIN) {
+        l->col = 0;
+        l->xpos_prev = RENDER_TEXT_LMARGIN;
+        l->row++;
+        l->nbreaks++;
+    }
+#endif
+
+    if (l->col == 0) {
+        l->rmargin_prev = 0;
+        l->xpos_prev = l->xoffs + RENDER_TEXT_LMARGIN;
+    }
+
+    l->hpos = RENDER_TEXT_LMARGIN;
+    if (l->xpos_prev > RENDER_TEXT_LMARGIN)
+        l->hpos = (l->xpos_prev - margins.lmargin - l->rmargin_prev) & GLYPH_LAYOUT_HPOS_MASK;
+
+    l->xpos_prev = l->hpos + RENDER_GLYPH_DIM;
+    l->rmargin_prev = margins.rmargin;
+    l->col++;
+}
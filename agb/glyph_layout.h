@@ -0,0 +1,43 @@
+#ifndef GLYPH_LAYOUT_H
+#define GLYPH_LAYOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Placement of glyphs as render_sjis does it, shared with the tool so that it can precompute it.
+ * Call glyph_layout_next until it returns GLYPH_LAYOUT_END and glyph_layout_place on each glyph
+ * that is rendered.
+ */
+struct glyph_layout {
+    const char* sjis; /* with \r line breaks, as decoded from strtab */
+    uint32_t i; /* offset of the next byte */
+    uint32_t row;
+    uint32_t col;
+    unsigned nbreaks; /* line breaks, including automatic ones */
+    uint16_t xoffs; /* horizontal offset in pixels */
+    uint8_t xpos_prev; /* right edge of the previous glyph */
+    uint8_t rmargin_prev; /* previous character's right margin */
+    bool in_quotes;
+
+    /* Glyph found by glyph_layout_next */
+    uint16_t c; /* as by glyph_margin */
+    bool quoted; /* in_quotes of c */
+    uint8_t first, second; /* full-width SJIS */
+
+    uint16_t hpos; /* set by glyph_layout_place, at row */
+};
+
+enum glyph_layout_tok {
+    GLYPH_LAYOUT_END,
+    GLYPH_LAYOUT_WAIT, /* a wait command right before i */
+    GLYPH_LAYOUT_GLYPH
+};
+
+#define GLYPH_LAYOUT_HPOS_MASK 0x1ff /* OAM X coordinate */
+
+void glyph_layout_init(struct glyph_layout* l, const char* sjis, uint32_t row, uint16_t xoffs);
+enum glyph_layout_tok glyph_layout_next(struct glyph_layout* l);
+void glyph_layout_place(struct glyph_layout* l);
+
+#endif
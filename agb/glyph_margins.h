@@ -4,6 +4,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/* Half-width chars, see glyph_is_hw */
+#define GLYPH_HW_MIN 0x21
+#define GLYPH_HW_MAX 0x7a
+
 struct glyph_margins {
     uint8_t lmargin;
     uint8_t rmargin;
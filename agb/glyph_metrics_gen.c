@@ -0,0 +1,186 @@
+/**
+ * Generates glyph_metrics.h, the lookup tables behind glyph_margins.c, from the margin arrays
+ * below. Run on the host for both the tool and the ROM patches.
+ */
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "glyph_margins.h"
+
+static const struct glyph_margins margins_az[] = {
+    {2, 5}, {2, 5}, {2, 5}, {2, 5}, {2, 5}, {3, 6}, {2, 5}, {2, 5}, {5, 8}, {3, 6}, {3, 5}, /* k */
+    {4, 8}, {1, 4}, {2, 5}, {2, 5}, {2, 5}, {2, 5}, {4, 6}, {2, 5}, {3, 5}, {2, 5}, {2, 5}, /* v */
+    {1, 4}, {2, 5}, {2, 5}, {2, 5} /* z */
+};
+_Static_assert(sizeof(margins_az) / sizeof(*margins_az) == 'z' - 'a' + 1, "");
+
+static const struct glyph_margins margins_AZ[] = {
+    {1, 4}, {2, 5}, {2, 4}, {2, 4}, {2, 5}, {2, 5}, {2, 4}, {2, 5}, {5, 8}, {2, 5}, {2, 4}, /* K */
+    {2, 5}, {1, 4}, {2, 4}, {2, 4}, {2, 5}, {2, 4}, {2, 5}, {2, 5}, {1, 4}, {2, 4}, {1, 4}, /* V */
+    {1, 4}, {1, 4}, {1, 4}, {2, 5} /* Z */
+};
+_Static_assert(sizeof(margins_AZ) / sizeof(*margins_AZ) == 'Z' - 'A' + 1, "");
+
+static const struct glyph_margins margins_cyr_lo[] = {
+    {2, 5}, {2, 5}, {2, 5}, {2, 6}, {1, 5}, {2, 5}, {2, 5}, {1, 4}, {2, 5}, {2, 5}, {2, 5}, /* й */
+    {2, 6}, {2, 5}, {1, 4}, {2, 5}, {0, 0}, /* Placeholder for 847f */
+    {2, 5}, {2, 5}, {2, 5}, {2, 5}, {2, 5}, {3, 5}, {0, 3}, /* ф */
+    {2, 5}, {1, 5}, {2, 5}, {1, 4}, {0, 5}, {1, 4}, {1, 5}, {2, 5}, {2, 5}, {1, 4}, {2, 5} /* я */
+};
+_Static_assert(sizeof(margins_cyr_lo) / sizeof(*margins_cyr_lo) == 33 + 1, "");
+
+static const struct glyph_margins margins_cyr_cap[] = {
+    {1, 4}, {2, 5}, {2, 5}, {2, 6}, {1, 5}, {2, 5}, {2, 5}, {0, 3}, {2, 5}, {1, 5}, {1, 5}, /* Й */
+    {2, 5}, {2, 5}, {1, 4}, {2, 5}, {1, 5}, {2, 5}, {2, 5}, {1, 5}, {2, 5}, {2, 5}, {1, 4}, /* Ф */
+    {2, 5}, {1, 5}, {2, 5}, {1, 4}, {0, 4}, {1, 4}, {1, 4}, {2, 5}, {1, 5}, {0, 4}, {2, 5} /* Я */
+};
+_Static_assert(sizeof(margins_cyr_cap) / sizeof(*margins_cyr_cap) == 33, "");
+
+static const struct glyph_margins margins_digit[] = {
+    {2, 5}, {5, 8}, {2, 5}, {2, 5}, {2, 4}, {2, 6}, {2, 5}, {2, 5}, {2, 5}, {2, 5}
+};
+_Static_assert(sizeof(margins_digit) / sizeof(*margins_digit) == '9' - '0' + 1, "");
+
+static struct glyph_margins margin_of(uint16_t c) {
+    if ('a' <= c && c <= 'z')
+        return margins_az[c - 'a'];
+    if ('A' <= c && c <= 'Z')
+        return margins_AZ[c - 'A'];
+    if (/* a */ 0x8470 <= c && c <= 0x8491 /* я */)
+        return margins_cyr_lo[c - 0x8470];
+    if (/* А */ 0x8440 <= c && c <= 0x8460 /* Я */)
+        return margins_cyr_cap[c - 0x8440];
+
+    /* FIXME: Objects for quotes appear swapped? */
+    if (c == 0x8168) /* “ */
+        return (struct glyph_margins){0, 9};
+    if (c == 0x8167) /* ” */
+        return (struct glyph_margins){6, 3};
+    if ('0' <= c && c <= '9')
+        return margins_digit[c - '0'];
+    switch (c) {
+        case '!': return (struct glyph_margins){5, 8};
+        case '?': return (struct glyph_margins){2, 6};
+        case '&': return (struct glyph_margins){2, 5};
+        case '(': return (struct glyph_margins){7, 4};
+        case ')': return (struct glyph_margins){1, 8};
+        case ',': return (struct glyph_margins){0, 12};
+        case '.': return (struct glyph_margins){1, 11};
+        case '-': return (struct glyph_margins){3, 6};
+        case ';': return (struct glyph_margins){4, 8};
+        case ':': return (struct glyph_margins){4, 8};
+        case '\'': return (struct glyph_margins){0, 12};
+        case '[': return (struct glyph_margins){6, 4};
+        case ']': return (struct glyph_margins){1, 9};
+        case '*': return (struct glyph_margins){2, 5};
+    }
+
+    return (struct glyph_margins){0, 0};
+}
+
+static uint16_t fw_of(char c) {
+    if ('a' <= c && c <= 'z')
+        return 0x8281 + c - 'a';
+    if ('A' <= c && c <= 'Z')
+        return 0x8260 + c - 'A';
+    if (isdigit(c))
+        return 0x824f + c - '0';
+    switch (c) {
+        case '!': return 0x8149;
+        case '?': return 0x8148;
+        case '&': return 0x8195;
+        case '(': return 0x8169;
+        case ')': return 0x816a;
+        case ',': return 0x8143;
+        case '.': return 0x8144;
+        case '-': return 0x815d;
+        case ';': return 0x8147;
+        case ':': return 0x8146;
+        case '\'': return 0x8166;
+        case '[': return 0x816d;
+        case ']': return 0x816e;
+        case '*': return 0x8196;
+    }
+    return c;
+}
+
+#define NLEADS 256
+#define NTRAILS 256
+
+static void print_bytes(const uint8_t* bytes, size_t n, const char* indent) {
+    for (size_t i = 0; i < n; i++)
+        printf("%s0x%02x,%s", i % 12 ? " " : indent, bytes[i],
+            i % 12 == 11 || i + 1 == n ? "\n" : "");
+}
+
+int main() {
+    static uint8_t packed[NLEADS][NTRAILS];
+    unsigned lead_max = 0, trail_min = NTRAILS - 1, trail_max = 0;
+
+    for (unsigned c = 0; c <= UINT16_MAX; c++) {
+        struct glyph_margins m = margin_of(c);
+        if (!m.lmargin && !m.rmargin)
+            continue;
+
+        if (m.lmargin > 0xf || m.rmargin > 0xf) {
+            fprintf(stderr, "Margins of 0x%x do not fit in 4 bits\n", c);
+            return EXIT_FAILURE;
+        }
+
+        unsigned lead = c >> 8, trail = c & 0xff;
+        packed[lead][trail] = m.lmargin << 4 | m.rmargin;
+
+        if (lead > lead_max)
+            lead_max = lead;
+        if (trail < trail_min)
+            trail_min = trail;
+        if (trail > trail_max)
+            trail_max = trail;
+    }
+
+    /* Pages are numbered from 1 in order of lead bytes, 0 is for leads without margins */
+    uint8_t pages[NLEADS] = {0};
+    unsigned npages = 0;
+
+    for (unsigned lead = 0; lead <= lead_max; lead++)
+        for (unsigned trail = trail_min; trail <= trail_max; trail++)
+            if (packed[lead][trail]) {
+                pages[lead] = ++npages;
+                break;
+            }
+
+    printf("/* Generated by glyph_metrics_gen.c, do not edit */\n\n");
+    printf("#define GLYPH_METRICS_LEAD_MAX 0x%x\n", lead_max);
+    printf("#define GLYPH_METRICS_TRAIL_MIN 0x%x\n", trail_min);
+    printf("#define GLYPH_METRICS_TRAIL_MAX 0x%x\n", trail_max);
+    printf("#define GLYPH_METRICS_NPAGES %u\n\n", npages);
+
+    printf("/* Lead byte to page, 0 if no glyph with it has margins */\n");
+    printf("static const uint8_t glyph_metrics_page[GLYPH_METRICS_LEAD_MAX + 1] = {\n");
+    print_bytes(pages, lead_max + 1, "    ");
+    printf("};\n\n");
+
+    printf("/* lmargin << 4 | rmargin by page and trail byte */\n");
+    printf("static const uint8_t glyph_metrics[GLYPH_METRICS_NPAGES]\n"
+        "    [GLYPH_METRICS_TRAIL_MAX - GLYPH_METRICS_TRAIL_MIN + 1] = {\n");
+    for (unsigned lead = 0; lead <= lead_max; lead++) {
+        if (!pages[lead])
+            continue;
+        printf("    /* 0x%02x */ {\n", lead);
+        print_bytes(&packed[lead][trail_min], trail_max - trail_min + 1, "        ");
+        printf("    },\n");
+    }
+    printf("};\n\n");
+
+    printf("/* Full-width equivalent of every half-width char */\n");
+    printf("static const uint16_t glyph_metrics_fw[GLYPH_HW_MAX - GLYPH_HW_MIN + 1] = {\n");
+    for (unsigned c = GLYPH_HW_MIN; c <= GLYPH_HW_MAX; c++)
+        printf("%s0x%04x,%s", (c - GLYPH_HW_MIN) % 8 ? " " : "    ", fw_of(c),
+            (c - GLYPH_HW_MIN) % 8 == 7 || c == GLYPH_HW_MAX ? "\n" : "");
+    printf("};\n");
+
+    return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "glyph_pos.h"
+
+/* 32-bit FNV-1a */
+uint32_t glyph_pos_hash(const char* sjis, size_t* len) {
+    uint32_t h = 0x811c9dc5;
+    size_t i;
+
+    for (i = 0; sjis[i]; i++)
+        h = (h ^ (sjis[i] & UINT8_MAX)) * 0x1000193;
+
+    *len = i;
+    return h;
+}
+
+/* Return the positions of the glyphs of sjis, or NULL if there is no table or they are not in it */
+const struct glyph_pos* glyph_pos_find(const struct glyph_pos_hdr* hdr, const char* sjis,
+    size_t* npos) {
+    if (hdr->magic != GLYPH_POS_MAGIC)
+        return NULL;
+
+    size_t len;
+    uint32_t h = glyph_pos_hash(sjis, &len);
+
+    const uint32_t* buckets = (const void*)(hdr + 1);
+    const struct glyph_pos_entry* entries = (const void*)&buckets[hdr->nbuckets + 1];
+    uint32_t b = h & (hdr->nbuckets - 1);
+
+    for (uint32_t e = buckets[b]; e < buckets[b + 1]; e++) {
+        if (entries[e].hash == h && entries[e].len == len) {
+            *npos = entries[e].npos;
+            return (const void*)((const uint8_t*)hdr + entries[e].offs);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef GLYPH_POS_H
+#define GLYPH_POS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Glyph positions of script strings, precomputed by the tool with --glyph-pos so that render_sjis
+ * does not have to lay them out. Strings are looked up by hash and length in a hash table:
+ *
+ *   struct glyph_pos_hdr
+ *   uint32_t buckets[nbuckets + 1] -- index of the first entry of each bucket
+ *   struct glyph_pos_entry entries[buckets[nbuckets]]
+ *   struct glyph_pos positions[]
+ *
+ * Positions are those of glyph_layout from row 0 with no horizontal offset. Strings that share a
+ * hash and length but not content are left out, so a string of the strtab is never matched with
+ * the positions of another one.
+ *
+ * The table may be past the end of the ROM, so render_sjis only looks it up if the word at
+ * GLYPH_POS_PTR_VMA is GLYPH_POS_VMA. The tool writes either that or 0 whenever it embeds a script.
+ * The word is the last one of the space that agb.ld reserves for the patch, which its code does
+ * not reach.
+ */
+
+#define GLYPH_POS_VMA 0x8a80000
+#define GLYPH_POS_PTR_VMA 0x87972e8
+#define GLYPH_POS_SZ_MAX 0x80000
+#define GLYPH_POS_MAGIC 0x53505047 /* GPPS */
+
+struct glyph_pos_hdr {
+    uint32_t magic;
+    uint32_t nbuckets; /* power of two */
+};
+
+struct glyph_pos_entry {
+    uint32_t hash;
+    uint16_t len; /* in bytes */
+    uint16_t npos;
+    uint32_t offs; /* of the positions from the header */
+};
+
+struct glyph_pos {
+    uint8_t hpos;
+    uint8_t row;
+};
+
+uint32_t glyph_pos_hash(const char* sjis, size_t* len);
+const struct glyph_pos* glyph_pos_find(const struct glyph_pos_hdr* hdr, const char* sjis,
+    size_t* npos);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef RENDER_SIM_H
+#define RENDER_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Host build of render_sjis.c, see bench/render.c.
+ *
+ * The memory map from EWRAM to ROM is backed by render_sim_mem, a region of
+ * RENDER_SIM_REGION_SZ bytes for each of them, so that AGB_PTR is still an address constant. DMA3
+ * transfers are carried out and accounted for by render_sim_dma3, and the ROM routines that the
+ * renderer calls are replaced by stubs.
+ */
+
+#define RENDER_SIM_REGION_FIRST 0x2 /* EWRAM */
+#define RENDER_SIM_REGION_LAST 0x8 /* ROM, as much of it as a region */
+#define RENDER_SIM_REGION_SZ 0x200000 /* GLYPH_POS_PTR_VMA is not within GLYPH_POS_SZ_MAX */
+
+extern uint8_t render_sim_mem[
+    (RENDER_SIM_REGION_LAST - RENDER_SIM_REGION_FIRST + 1) * RENDER_SIM_REGION_SZ];
+
+#define AGB_PTR(addr) ((void*)&render_sim_mem[ \
+    (((addr) >> 24) - RENDER_SIM_REGION_FIRST) * RENDER_SIM_REGION_SZ + \
+    ((addr) & (RENDER_SIM_REGION_SZ - 1))])
+#define AGB_SECTION(name)
+
+/* Count is in units of 16 bits, or 32 if words is set */
+void render_sim_dma3(const volatile void* src, volatile void* dst, uint16_t count, bool words);
+
+uint32_t parse_wait_command(const char* buf, uint32_t idx);
+void sub_8004CD4(uint32_t idx, uint32_t* buf);
+void sub_8004C34(uint32_t* src, uint32_t* dst, char color);
+void await_input(void);
+void* lineToSJIS_Menu(uint32_t idx);
+
+/* Entries of render_sjis.c */
+void render_sjis_entry(const char* sjis, uint32_t len, uint16_t start_at_y, uint16_t color,
+    uint16_t no_delay, uint16_t a6, uint16_t a7);
+void render_sjis_menu_entry(const char* sjis, uint32_t unused, uint32_t row, uint32_t chosen_row,
+    uint16_t no_delay);
+void clear_oam();
+
+#endif
@@ -5,20 +5,29 @@
 #include <stdint.h>
 
 #include "config.h"
+#include "glyph_layout.h"
 #include "glyph_margins.h"
+#include "glyph_pos.h"
 #include "static_strings.h"
 
+#ifdef RENDER_SIM
+#include "render_sim.h"
+#else
+#define AGB_PTR(addr) ((void*)(addr))
+#define AGB_SECTION(name) __attribute__ ((section(name)))
+
 static uint32_t (*parse_wait_command)(const char* buf, uint32_t idx) =
     (uint32_t (*)(const char*, uint32_t))0x8004D85;
 static void (*sub_8004CD4)(uint32_t idx, uint32_t* buf) = (void (*)(uint32_t, uint32_t*))0x8004CD5;
 static void (*sub_8004C34)(uint32_t*, uint32_t*, char) = (void (*)(uint32_t*, uint32_t*, char))0x8004C35;
 static void (*await_input)(void) = (void (*)(void))0x80130A1;
 static void* (*lineToSJIS_Menu)(uint32_t) = (void* (*)(uint32_t))0x8004BAD;
+#endif
 
-static volatile uint16_t* new_keys = (void*)0x3002AE6;
-static uint32_t* cursor_col = (uint32_t*)0x300234C;
-static uint32_t* cursor_row = (uint32_t*)0x3002340;
-static uint32_t glyphTilesVRAM = 0x600F800;
+static volatile uint16_t* new_keys = AGB_PTR(0x3002AE6);
+static uint32_t* cursor_col = AGB_PTR(0x300234C);
+static uint32_t* cursor_row = AGB_PTR(0x3002340);
+static uint8_t* glyphTilesVRAM = AGB_PTR(0x600F800);
 
 struct oam_affine {
     uint16_t fill0[3];
@@ -50,7 +59,7 @@ static struct oam_data {
     uint16_t Priority:2;         // Display priority
     uint16_t Pltt:4;             // Palette No.
     uint16_t AffineParam;        // Affine Trasnformation Parameter
-} * oam_base = (void*)0x7000000;
+} * oam_base = AGB_PTR(0x7000000);
 _Static_assert(sizeof(struct oam_data) == sizeof(uint64_t), "");
 
 union dma_cnt {
@@ -70,13 +79,31 @@ union dma_cnt {
 };
 _Static_assert(sizeof(union dma_cnt) == sizeof(uint32_t), "");
 
-static volatile union dma_cnt* dma3_cnt = (void*)0x40000DC;
-static volatile uint32_t* dma3_src = (void*)0x40000D4;
-static volatile uint32_t* dma3_dst = (void*)0x40000D8;
+static volatile union dma_cnt* dma3_cnt = AGB_PTR(0x40000DC);
+static volatile uint32_t* dma3_src = AGB_PTR(0x40000D4);
+static volatile uint32_t* dma3_dst = AGB_PTR(0x40000D8);
+
+/* Start a DMA3 transfer once the previous one is done */
+static inline void dma3_start(const volatile void* src, volatile void* dst, union dma_cnt cnt) {
+    while (dma3_cnt->Enable)
+        ;
 
+#ifdef RENDER_SIM
+    render_sim_dma3(src, dst, cnt.Count, cnt.BusSize);
+    (void)dma3_src;
+    (void)dma3_dst;
+#else
+    *dma3_src = (uint32_t)src;
+    *dma3_dst = (uint32_t)dst;
+    *dma3_cnt = cnt;
+#endif
+}
+
+#ifndef RENDER_SIM
 bool isdigit(char c) {
     return '0' <= c && c <= '9';
 }
+#endif
 
 #define TILE_DIM 8
 #define NTILES_GLYPH 4
@@ -93,50 +120,131 @@ enum {
 };
 
 struct glyph_blit_cfg {
-    void* tiles; /* glyph tile data */
     uint16_t oam_idx; /* OAM glyph object index */
+    uint16_t tiles_idx; /* index of the glyph tiles in VRAM, as oam_idx */
     uint8_t ctx;
     uint16_t row; /* character row the glyph is at */
-    uint16_t xoffs; /* horizontal offset in pixels */
+    uint16_t hpos; /* horizontal position in pixels */
     uint16_t yoffs; /* vertical offset in pixels */
-    uint8_t rmargin_prev; /* previous character's right margin */
-    uint8_t lmargin; /* left margin */
 };
 
+/* 16x16 at 4bpp, though sub_8004C34 writes twice as much */
+#define GLYPH_TILES_SZ (TILE_DIM * TILE_DIM * NTILES_GLYPH / 2)
+
+/**
+ * Glyphs waiting to be uploaded, their OAM entries and the tiles of those that are not in VRAM
+ * yet, each in consecutive slots
+ */
+struct glyph_batch {
+    /* One more to take the second half of what is written for the last glyph */
+    uint32_t tiles[RENDER_GLYPH_BATCH + 1][GLYPH_TILES_SZ / sizeof(uint32_t)];
+    struct oam_data objs[RENDER_GLYPH_BATCH];
+    uint16_t first_tiles; /* VRAM index of the first tiles */
+    uint16_t first_obj; /* OAM index of the first glyph */
+    uint8_t ctx;
+    uint8_t ntiles;
+    uint8_t nobjs;
+};
+
+/* Tiles uploaded by a render_sjis call, direct-mapped by glyph */
+struct glyph_cache {
+    struct {
+        uint16_t csum; /* GLYPH_CACHE_NONE if unused */
+        uint16_t tiles_idx;
+    } entries[RENDER_GLYPH_CACHE];
+};
+
+#define GLYPH_CACHE_NONE UINT16_MAX
+
+_Static_assert((RENDER_GLYPH_CACHE & (RENDER_GLYPH_CACHE - 1)) == 0, "");
+
 static void* glyph_vram_addr_normal(uint16_t idx) {
-    return (void*)(TILE_DIM * TILE_DIM * sizeof(uint16_t) * idx + 0x800 +
-        glyphTilesVRAM);
+    return TILE_DIM * TILE_DIM * sizeof(uint16_t) * idx + 0x800 + glyphTilesVRAM;
 }
 
 static void* glyph_vram_addr_menu(uint16_t idx) {
-    return (void*)(0x06010f00 + (idx - 15) * TILE_DIM * TILE_DIM * sizeof(uint16_t));
+    return (uint8_t*)AGB_PTR(0x06010f00) + (idx - 15) * TILE_DIM * TILE_DIM * sizeof(uint16_t);
 }
 
-static uint8_t upload_glyph(const struct glyph_blit_cfg* cfg) {
-    uint16_t idx = cfg->oam_idx;
-    volatile void* glyph_tiles_vram;
-
+/* OAM index of the nchars-th glyph */
+static uint16_t glyph_oam_idx(uint8_t ctx, uint16_t nchars) {
     /* Cursor steals OAM slot 112... */
-    if (cfg->ctx == CTX_RENDER_FRAME && idx >= CURSOR_OAM_IDX)
-        idx++;
-
-    if (cfg->ctx == CTX_RENDER_MENU)
-        glyph_tiles_vram = glyph_vram_addr_menu(idx);
-    else
-        glyph_tiles_vram = glyph_vram_addr_normal(idx);
-
-    while (dma3_cnt->Enable)
-        ;
+    if (ctx == CTX_RENDER_FRAME && nchars >= CURSOR_OAM_IDX)
+        return nchars + 1;
+    return nchars;
+}
 
+static void glyph_batch_flush(struct glyph_batch* batch) {
     union dma_cnt dma_cnt;
     dma_cnt.val = 0;
 
     dma_cnt.Enable = 1;
-    dma_cnt.Count = TILE_DIM * TILE_DIM * NTILES_GLYPH / sizeof(uint16_t);
+    dma_cnt.BusSize = 1;
+
+    if (batch->ntiles) {
+        volatile void* glyph_tiles_vram;
+
+        if (batch->ctx == CTX_RENDER_MENU)
+            glyph_tiles_vram = glyph_vram_addr_menu(batch->first_tiles);
+        else
+            glyph_tiles_vram = glyph_vram_addr_normal(batch->first_tiles);
 
-    *dma3_src = (uint32_t)cfg->tiles;
-    *dma3_dst = (uint32_t)glyph_tiles_vram;
-    *dma3_cnt = dma_cnt;
+        dma_cnt.Count = batch->ntiles * sizeof(*batch->tiles) / sizeof(uint32_t);
+        dma3_start(batch->tiles, glyph_tiles_vram, dma_cnt);
+    }
+
+    if (batch->nobjs) {
+        dma_cnt.Count = batch->nobjs * sizeof(*batch->objs) / sizeof(uint32_t);
+        dma3_start(batch->objs, &oam_base[batch->first_obj], dma_cnt);
+    }
+
+    batch->ntiles = 0;
+    batch->nobjs = 0;
+}
+
+/**
+ * Make room in the batch for the glyph of cfg and return where its tiles go, or NULL if they are
+ * in VRAM already. The batch is flushed first if it is full or a slot does not follow the last
+ * one. The tiles are uploaded by glyph_batch_flush along with the OAM entry set by stage_glyph.
+ */
+static uint32_t* glyph_batch_slot(struct glyph_batch* batch, const struct glyph_blit_cfg* cfg,
+    bool new_tiles) {
+    uint16_t idx = glyph_oam_idx(cfg->ctx, cfg->oam_idx);
+    uint16_t tiles_idx = glyph_oam_idx(cfg->ctx, cfg->tiles_idx);
+
+    if (batch->nobjs == RENDER_GLYPH_BATCH ||
+        (batch->nobjs && idx != batch->first_obj + batch->nobjs) ||
+        (new_tiles && batch->ntiles && tiles_idx != batch->first_tiles + batch->ntiles))
+        glyph_batch_flush(batch);
+
+    batch->ctx = cfg->ctx;
+    if (!batch->nobjs)
+        batch->first_obj = idx;
+    if (!new_tiles)
+        return NULL;
+
+    if (!batch->ntiles)
+        batch->first_tiles = tiles_idx;
+    return batch->tiles[batch->ntiles++];
+}
+
+/* Look up the glyph, or add it as uploaded to tiles_idx */
+static bool glyph_cache_find(struct glyph_cache* cache, uint16_t csum, uint16_t* tiles_idx) {
+    unsigned h = csum & (RENDER_GLYPH_CACHE - 1);
+
+    if (cache->entries[h].csum == csum) {
+        *tiles_idx = cache->entries[h].tiles_idx;
+        return true;
+    }
+
+    cache->entries[h].csum = csum;
+    cache->entries[h].tiles_idx = *tiles_idx;
+    return false;
+}
+
+/* Stage the OAM entry of the glyph in its batch slot */
+static void stage_glyph(const struct glyph_blit_cfg* cfg, struct glyph_batch* batch) {
+    uint16_t tiles_idx = glyph_oam_idx(cfg->ctx, cfg->tiles_idx);
 
     struct oam_data gly_obj = {
         .VPos = cfg->row * RENDER_VSPACE + RENDER_TEXT_UMARGIN + cfg->yoffs,
@@ -149,7 +257,7 @@ static uint8_t upload_glyph(const struct glyph_blit_cfg* cfg) {
         .HFlip = 0,
         .VFlip = 0,
         .Size = 1,
-        .CharNo = 4 * idx,
+        .CharNo = 4 * tiles_idx,
         .Priority = 0,
         .Pltt = cfg->ctx != CTX_RENDER_MENU ? PALETTE_SCRIPT : PALETTE_MENU,
         .AffineParam = 0
@@ -158,21 +266,9 @@ static uint8_t upload_glyph(const struct glyph_blit_cfg* cfg) {
     if (cfg->ctx == CTX_RENDER_MENU)
         gly_obj.CharNo += 60;
 
-    gly_obj.HPos = RENDER_TEXT_LMARGIN;
-    if (cfg->xoffs > RENDER_TEXT_LMARGIN)
-        gly_obj.HPos = cfg->xoffs - cfg->lmargin - cfg->rmargin_prev;
-
-    /* FIXME: Is it faster to have tiles uploaded asynchronously and copy gly_obj manually? */
-    while (dma3_cnt->Enable)
-        ;
-
-    *dma3_src = (uint32_t)&gly_obj;
-    *dma3_dst = (uint32_t)&oam_base[idx];
-    dma_cnt.Enable = 1;
-    dma_cnt.Count = sizeof(struct oam_data) / sizeof(uint16_t);
-    *dma3_cnt = dma_cnt;
+    gly_obj.HPos = cfg->hpos;
 
-    return gly_obj.HPos + RENDER_GLYPH_DIM;
+    batch->objs[batch->nobjs++] = gly_obj;
 }
 
 /* FIXME: This results in unreadable text. The hope was to scale it down so that it fits in menus,
@@ -208,7 +304,16 @@ uint8_t render_sjis(const char* sjis, uint32_t len, struct glyph_blit_cfg* cfg,
     buf[5] = 0;
     buf[6] = 0x272;
 
-    uint32_t col = 0, row = 0;
+    struct glyph_batch batch;
+    batch.ntiles = 0;
+    batch.nobjs = 0;
+
+    /* Repeated glyphs share the tiles of the first one */
+    struct glyph_cache cache;
+    for (unsigned i = 0; i < RENDER_GLYPH_CACHE; i++)
+        cache.entries[i].csum = GLYPH_CACHE_NONE;
+
+    uint32_t row = 0;
 
     if (start_at_y)
         row = *cursor_row + 1;
@@ -217,37 +322,25 @@ uint8_t render_sjis(const char* sjis, uint32_t len, struct glyph_blit_cfg* cfg,
     if (cfg->ctx == CTX_RENDER_MENU)
         delay = RENDER_DELAY_MENU;
 
-    uint8_t rmargin_prev = 0, xpos_prev = RENDER_TEXT_LMARGIN;
-    unsigned nchars = nchars_offs;
-    unsigned nbreaks = 0;
+    unsigned nchars = nchars_offs, ntiles = nchars_offs;
 
     // set_transform(cfg);
 
-    bool in_quotes = false;
+    struct glyph_layout layout;
+    glyph_layout_init(&layout, sjis, row, xoffs);
 
-    for (uint32_t i = 0; sjis[i];) {
-        uint16_t csum = 0;
+    /* Script text may have its glyphs placed by the tool */
+    const struct glyph_pos* pos = NULL;
+    size_t npos = 0;
+    if (cfg->ctx == CTX_RENDER_FRAME && !start_at_y && !xoffs &&
+            *(const uint32_t*)AGB_PTR(GLYPH_POS_PTR_VMA) == GLYPH_POS_VMA)
+        pos = glyph_pos_find(AGB_PTR(GLYPH_POS_VMA), sjis, &npos);
 
-        uint32_t first = sjis[i] & UINT8_MAX;
-        uint32_t second;
-        struct glyph_margins margins = {0, 0};
+    for (enum glyph_layout_tok tok; (tok = glyph_layout_next(&layout)) != GLYPH_LAYOUT_END;) {
+        uint16_t csum = 0;
 
-        /* Skip delay digit */
-        if (glyph_is_wait_cmd(&sjis[i])) {
-            delay = parse_wait_command(sjis, i);
-            i += 2;
-            continue;
-        } else if (first == '\r') {
-            /* The strtab decoder replaces \n with \r */
-            col = 0;
-            row++;
-            i++;
-            nbreaks++;
-            xpos_prev = RENDER_TEXT_LMARGIN;
-            continue;
-        } else if (first == ' ') {
-            i++;
-            xpos_prev += RENDER_SPACE_W;
+        if (tok == GLYPH_LAYOUT_WAIT) {
+            delay = parse_wait_command(sjis, layout.i - 2);
             continue;
         }
 
@@ -256,37 +349,20 @@ uint8_t render_sjis(const char* sjis, uint32_t len, struct glyph_blit_cfg* cfg,
             (cfg->ctx == CTX_RENDER_MENU && nchars > RENDER_NCHARS_MAX + 1))
             break;
 
-        if (glyph_is_hw(first)) { /* Known single-byte half-width */
-            margins = glyph_margin(first, in_quotes);
-
-            uint16_t fw = glyph_hw_to_fw(first, in_quotes);
-            first = fw >> 8;
-            second = fw & UINT8_MAX;
+        uint32_t first = layout.first, second = layout.second;
 
-            if (sjis[i] == '"')
-                in_quotes = !in_quotes;
-
-            i++;
-        } else if (sjis[i+1]) { /* Try to interpret as two-byte full-width */
-            second = sjis[i + 1] & UINT8_MAX;
-            margins = glyph_margin((first << 8) | second, in_quotes);
-            i += 2;
-        } else { /* Unknown char; skip */
-            i++;
-            continue;
-        }
+        if (pos && nchars - nchars_offs < npos) {
+            /* Count automatic line breaks too */
+            layout.nbreaks += pos[nchars - nchars_offs].row - layout.row;
+            layout.row = pos[nchars - nchars_offs].row;
 
-#ifdef RENDER_AUTO_WRAP
-        /* Automatic line wrap */
-        if (xpos_prev - RENDER_GLYPH_DIM + margins.lmargin +
-            (RENDER_GLYPH_DIM - margins.lmargin - margins.rmargin) - rmargin_prev
-                >= RENDER_TEXT_RMARGIN) {
-            col = 0;
-            xpos_prev = RENDER_TEXT_LMARGIN;
-            row++;
-            nbreaks++;
+            cfg->hpos = pos[nchars - nchars_offs].hpos;
+            cfg->row = layout.row;
+        } else {
+            glyph_layout_place(&layout);
+            cfg->hpos = layout.hpos;
+            cfg->row = layout.row;
         }
-#endif
 
         uint32_t offs_first = 0;
         uint32_t offs_second = second - 0x40;
@@ -303,6 +379,10 @@ uint8_t render_sjis(const char* sjis, uint32_t len, struct glyph_blit_cfg* cfg,
             offs_first = 0xbc * (first - 0x88) + 0x270;
         csum = offs_first + offs_second;
 
+        /* Show what is staged before waiting */
+        if (delay && !no_delay)
+            glyph_batch_flush(&batch);
+
         /* On button press, render the rest of the text without delay */
         while (delay-- && !no_delay) {
             await_input();
@@ -313,33 +393,29 @@ uint8_t render_sjis(const char* sjis, uint32_t len, struct glyph_blit_cfg* cfg,
         }
         delay = RENDER_DELAY_DEFAULT;
 
-        sub_8004CD4(csum, &buf[7]);
-        sub_8004C34(&buf[7], &buf[0x47], color);
-
-        if (col == 0) {
-            rmargin_prev = 0;
-            xpos_prev = xoffs + RENDER_TEXT_LMARGIN;
-        }
+        uint16_t tiles_idx = ntiles;
+        bool cached = glyph_cache_find(&cache, csum, &tiles_idx);
 
-        cfg->tiles = &buf[0x47];
         cfg->oam_idx = nchars;
-        cfg->row = row;
-        cfg->xoffs = xpos_prev;
+        cfg->tiles_idx = tiles_idx;
         cfg->yoffs = yoffs;
-        cfg->rmargin_prev = rmargin_prev;
-        cfg->lmargin = margins.lmargin;
 
-        xpos_prev = upload_glyph(cfg);
+        uint32_t* tiles = glyph_batch_slot(&batch, cfg, !cached);
+        if (tiles) {
+            sub_8004CD4(csum, &buf[7]);
+            sub_8004C34(&buf[7], tiles, color);
+            ntiles++;
+        }
 
-        rmargin_prev = margins.rmargin;
+        stage_glyph(cfg, &batch);
 
         nchars++;
-
-        col++;
     }
 
+    glyph_batch_flush(&batch);
+
     if (nbreaksp)
-        *nbreaksp += nbreaks;
+        *nbreaksp += layout.nbreaks;
 
     return nchars;
 }
@@ -347,7 +423,7 @@ uint8_t render_sjis(const char* sjis, uint32_t len, struct glyph_blit_cfg* cfg,
 /**
  * FIXME: Investigate random glyph corruption when rendering backlog here.
  */
-__attribute__ ((section(".entry")))
+AGB_SECTION(".entry")
 void render_sjis_entry(const char* sjis, uint32_t len, uint16_t start_at_y, uint16_t color,
     uint16_t no_delay, uint16_t a6, uint16_t a7) {
     /**
@@ -370,12 +446,12 @@ void render_sjis_entry(const char* sjis, uint32_t len, uint16_t start_at_y, uint
     *cursor_row = RENDER_CURSOR_ROW;
 }
 
-__attribute__ ((section(".entry_menu")))
+AGB_SECTION(".entry_menu")
 void render_sjis_menu_entry(const char* sjis, uint32_t unused, uint32_t row, uint32_t chosen_row,
     uint16_t no_delay) {
     (void)unused;
 
-    uint32_t* nchars_rendered = (uint32_t*)0x3002134;
+    uint32_t* nchars_rendered = AGB_PTR(0x3002134);
 
     /**
      * HACK: We don't draw a cursor for choice so this variable can be safely reused for storing
@@ -404,13 +480,13 @@ void render_sjis_menu_entry(const char* sjis, uint32_t unused, uint32_t row, uin
     *nchars_rendered = *cursor_col;
 }
 
-__attribute__ ((section(".clear_oam")))
+AGB_SECTION(".clear_oam")
 void clear_oam() {
     for (unsigned i = 0; i < RENDER_NCHARS_MAX + 2; i++)
         oam_base[i].AffineMode = 2; /* Hide */
 }
 
-__attribute__ ((section(".render_backlog_controls")))
+AGB_SECTION(".render_backlog_controls")
 void render_backlog_controls(uint32_t arg) {
     (void)arg;
 }
@@ -459,10 +535,11 @@ struct __attribute__((packed)) RenderRequest
   uint32_t sym_count_last;
 };
 
-_Static_assert(offsetof(struct RenderRequest, has_prev_offsets) == 0x24, "");
+_Static_assert(offsetof(struct RenderRequest, has_prev_offsets) ==
+    8 * sizeof(uint32_t) + sizeof(struct RendererContent*), "");
 
 // FIXME: Corruption when drawing last choice item on 2nd screen
-__attribute__ ((section(".render_load_menu")))
+AGB_SECTION(".render_load_menu")
 void render_load_menu(const char* sjis, uint32_t len, uint32_t x, uint32_t y,
     struct RenderRequest* req, uint8_t flags) {
     (void)len;
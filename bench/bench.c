@@ -0,0 +1,494 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defs.h"
+#include "embed.h"
+#include "script_as.h"
+#include "script_disass.h"
+#include "script_parse_ctx.h"
+#include "strtab.h"
+#include "test/rng.h"
+
+/**
+ * End-to-end benchmark on synthetic workloads.
+ *
+ * usage: bench [csv]
+ *        bench gen <scale> <script> <strtab_script> <strtab_menu> [seed [strs_scale]]
+ *
+ * The first form times every stage on each workload below and writes a CSV to "csv" or stdout.
+ * The second one writes a single generated script and its strtabs, e.g. for profiling shpn_tool.
+ *
+ * A single script cannot grow much past scripts/EN/Harry, as its offsets are 16-bit, so workloads
+ * scale it up to Harry. Its strtabs can hold up to EMBED_STRTAB_SZ strings, about 10 times as many
+ * as those of Harry, and the last workload grows them to that with the same script.
+ */
+
+#define ROM_SZ 0x800000
+#define STRTAB_SCRIPT_OFFS 0x400000
+#define STRTAB_MENU_OFFS 0x500000
+#define STRTAB_SZ 0x100000
+#define SCRIPT_SZ_MAX 0x10000
+
+/* Counts in scripts/EN/Harry, which the generator scales */
+#define HARRY_NSCENES 410
+#define HARRY_NSTRS_SCRIPT 850
+#define HARRY_NSTRS_MENU 370
+
+#define SHOW_TEXT_IDX_FIRST 1001
+
+enum bench_stage {BENCH_PARSE, BENCH_ASSEMBLE, BENCH_ENCODE, BENCH_DECODE, BENCH_DUMP,
+    BENCH_NSTAGES};
+
+/**
+ * Per-item time of a workload may grow at most by ratio_max relative to the first one, whose
+ * script is large enough that fixed costs do not dominate. Every stage should be linear.
+ */
+static const struct {
+    const char* name;
+    const char* unit;
+    double ratio_max;
+} stages[BENCH_NSTAGES] = {
+    [BENCH_PARSE] = {"parse", "statements", 2.0},
+    [BENCH_ASSEMBLE] = {"assemble", "bytes", 2.0},
+    [BENCH_ENCODE] = {"strtab encode", "bytes", 2.0},
+    [BENCH_DECODE] = {"strtab decode", "bytes", 2.0},
+    [BENCH_DUMP] = {"dump", "bytes", 2.0}
+};
+
+/* Small workloads are repeated so that every workload runs for a comparable time */
+static const struct workload {
+    const char* name;
+    double scale; /* of the script relative to Harry */
+    double strs_scale; /* of its strtabs */
+    size_t nreps;
+} workloads[] = {
+    {"0.1x", 0.1, 0.1, 100},
+    {"0.3x", 0.3, 0.3, 30},
+    {"1x", 1, 1, 10},
+    {"1x/10x strings", 1, 10, 1}
+};
+
+#define NWORKLOADS (sizeof(workloads) / sizeof(*workloads))
+
+struct bench_acc {
+    uint64_t ns, items;
+};
+
+/* Generator */
+
+static const char* words_latin[] = {
+    "the", "fog", "town", "Cheryl", "I", "can", "hear", "a", "siren", "in", "distance", "door",
+    "is", "locked", "school", "hospital", "darkness", "footsteps", "radio", "static", "map", "of",
+    "street", "key", "knife", "what", "happened", "here", "nobody", "answers", "cold", "lake"
+};
+
+static const char* words_cyrillic[] = {
+    "туман", "город", "Шерил", "я", "слышу", "сирену", "вдалеке", "дверь", "заперта", "школа",
+    "больница", "темнота", "шаги", "радио", "помехи", "карта", "улица", "ключ", "нож", "что",
+    "здесь", "случилось", "никто", "не", "отвечает", "холодное", "озеро", "и", "в"
+};
+
+/* Joined without spaces */
+static const char* words_sjis[] = {
+    "霧", "町", "シェリル", "私は", "サイレンが", "遠くで", "聞こえる", "ドアは", "鍵が", "かかっている",
+    "学校", "病院", "暗闇の", "中で", "足音", "ラジオの", "雑音", "地図を", "見る", "通り", "ナイフ",
+    "何が", "起きた", "誰も", "答えない", "湖", "の", "に", "を"
+};
+
+#define NWORDS(words) (sizeof(words) / sizeof(*words))
+
+struct gen {
+    FILE* fout;
+    uint32_t rng;
+    size_t nscenes;
+    size_t show_text_idx;
+    size_t choice_idx;
+    size_t branch_idx;
+    size_t nbranch_blocks;
+};
+
+static void gen_sentence(struct gen* g, FILE* fout, size_t nwords_max) {
+    size_t nwords = 3 + rng_below(&g->rng, nwords_max - 2);
+    uint32_t lang = rng_below(&g->rng, 10);
+
+    for (size_t i = 0; i < nwords; i++) {
+        if (lang < 5)
+            fprintf(fout, "%s%s", i ? " " : "", words_latin[rng_below(&g->rng, NWORDS(words_latin))]);
+        else if (lang < 8)
+            fprintf(fout, "%s%s", i ? " " : "",
+                words_cyrillic[rng_below(&g->rng, NWORDS(words_cyrillic))]);
+        else
+            fprintf(fout, "%s", words_sjis[rng_below(&g->rng, NWORDS(words_sjis))]);
+    }
+    fprintf(fout, "%s", lang < 8 ? "." : "。");
+}
+
+/* Either a narration, or a line of speech in quotes with breaks and waits in between */
+static void gen_text(struct gen* g, FILE* fout) {
+    bool quoted = rng_below(&g->rng, 4) == 0;
+    size_t nsentences = 1 + rng_below(&g->rng, 3);
+
+    fprintf(fout, "%s", quoted ? u8"¥\"" : "");
+    for (size_t i = 0; i < nsentences; i++) {
+        if (i > 0)
+            fprintf(fout, "%s", rng_below(&g->rng, 2) ? u8"¥nW2" : " ");
+        gen_sentence(g, fout, 12);
+    }
+    fprintf(fout, "%s", quoted ? u8"¥\"" : "");
+}
+
+static void gen_strtab(struct gen* g, FILE* fout, size_t nstrs) {
+    for (size_t i = 1; i <= nstrs; i++) {
+        fprintf(fout, "%zu: ", i);
+        gen_text(g, fout);
+        fprintf(fout, "\n");
+    }
+}
+
+/* Dispatch to nentries random scenes depending on variables, like the start of Harry */
+static void gen_branches(struct gen* g, size_t nentries) {
+    size_t block = g->nbranch_blocks++;
+
+    for (size_t i = 0; i < nentries; i++) {
+        if (i > 0)
+            fprintf(g->fout, "B_%zu_%zu:\n", block, i);
+        fprintf(g->fout, "Branch%d(0x%zx, B_%zu_%zu);\n", i == 0 ? 4 : 5, g->branch_idx++ % 0x100,
+            block, i + 1);
+        fprintf(g->fout, "Jump(S_%u);\n", rng_below(&g->rng, g->nscenes));
+    }
+    fprintf(g->fout, "B_%zu_%zu:\nNop7();\n", block, nentries);
+}
+
+static void gen_scene(struct gen* g, size_t scene) {
+    FILE* fout = g->fout;
+
+    fprintf(fout, "S_%zu:\n", scene);
+    if (rng_below(&g->rng, 2) == 0)
+        fprintf(fout, "Area(0x%x);\n", rng_below(&g->rng, 0x20));
+    fprintf(fout, "LoadBackground(0x%x);\nCleanScreen();\nDrawBackground();\n",
+        rng_below(&g->rng, 0x100));
+    if (rng_below(&g->rng, 2) == 0)
+        fprintf(fout, "PlayMusic(0x%x);\n", 0x60 + rng_below(&g->rng, 0x20));
+    if (rng_below(&g->rng, 2) == 0)
+        fprintf(fout, "LoadEffect(0x3, 0x%x, 0x0);\n", rng_below(&g->rng, 0x10));
+
+    size_t ntexts = 1 + rng_below(&g->rng, 6);
+    for (size_t i = 0; i < ntexts; i++) {
+        fprintf(fout, "ShowText((%zu)\"", g->show_text_idx++);
+        gen_text(g, fout);
+        fprintf(fout, "\");\nHandleInput();\n");
+
+        if (rng_below(&g->rng, 8) == 0)
+            fprintf(fout, "PlaySecondSoundFx(0x%x);\n", rng_below(&g->rng, 0x40));
+        if (rng_below(&g->rng, 16) == 0)
+            fprintf(fout, "WaitTime(0x%x);\n", 0x10 + rng_below(&g->rng, 0x70));
+    }
+
+    /* Choice pretext idx must be divisible by 10 to not be selectable, and all rows fit a frame */
+    if (rng_below(&g->rng, 6) == 0) {
+        size_t idx = g->choice_idx;
+        g->choice_idx += 10;
+
+        fprintf(fout, "Choice((%zu)\"", idx);
+        gen_sentence(g, fout, 5);
+        fprintf(fout, "\", (%zu)\"A) ", idx + 1);
+        gen_sentence(g, fout, 4);
+        fprintf(fout, "\", (%zu)\"B) ", idx + 2);
+        gen_sentence(g, fout, 4);
+        fprintf(fout, "\");\n");
+    }
+
+    if (rng_below(&g->rng, 4) == 0)
+        gen_branches(g, 2 + rng_below(&g->rng, 3));
+
+    /* Scenes are chained, so that every label is referenced as the assembler warns otherwise */
+    fprintf(fout, "Jump(S_%zu);\n", (scene + 1) % g->nscenes);
+}
+
+/* About scale times nstrs strings, up to what a strtab holds */
+static size_t gen_nstrs(size_t nstrs, double scale) {
+    if (nstrs * scale < 1)
+        return 1;
+    return nstrs * scale < EMBED_STRTAB_SZ - 1 ? nstrs * scale : EMBED_STRTAB_SZ - 1;
+}
+
+/**
+ * Write a script of about scale times the size of Harry into fscript, and the strtabs it is
+ * embedded with, of strs_scale times as many strings, into fstrtab_script and fstrtab_menu
+ */
+static void gen_workload(double scale, double strs_scale, uint32_t seed, FILE* fscript,
+    FILE* fstrtab_script, FILE* fstrtab_menu) {
+    struct gen g = {.fout = fscript, .rng = seed * 2654435761u + 1};
+
+    g.nscenes = HARRY_NSCENES * scale > 1 ? HARRY_NSCENES * scale : 1;
+    g.show_text_idx = SHOW_TEXT_IDX_FIRST;
+
+    gen_branches(&g, g.nscenes / 8 > 1 ? g.nscenes / 8 : 1);
+    for (size_t i = 0; i < g.nscenes; i++)
+        gen_scene(&g, i);
+    fprintf(fscript, "Stop();\n"
+        ".begin branch_info\n.4byte 0x363d3173\n.byte 0x0\n.end branch_info\n"
+        ".byte 0xff\n.byte 0xff\n");
+
+    gen_strtab(&g, fstrtab_script, gen_nstrs(HARRY_NSTRS_SCRIPT, strs_scale));
+    gen_strtab(&g, fstrtab_menu, gen_nstrs(HARRY_NSTRS_MENU, strs_scale));
+}
+
+/* Benchmark */
+
+struct script_src {
+    char* script;
+    FILE* fstrtab_script, * fstrtab_menu;
+    size_t strtab_script_sz, strtab_menu_sz;
+};
+
+static size_t fsz(FILE* f) {
+    assert(fseek(f, 0, SEEK_END) == 0);
+    long end = ftell(f);
+    assert(end >= 0);
+    rewind(f);
+    return end;
+}
+
+static char* slurp(FILE* f) {
+    size_t sz = fsz(f);
+    char* buf = malloc(sz + 1);
+    assert(buf);
+    assert(fread(buf, 1, sz, f) == sz);
+    buf[sz] = '\0';
+    return buf;
+}
+
+static void src_init(struct script_src* src, const struct workload* wl, uint32_t seed) {
+    FILE* fscript = tmpfile();
+    src->fstrtab_script = tmpfile();
+    src->fstrtab_menu = tmpfile();
+    assert(fscript && src->fstrtab_script && src->fstrtab_menu);
+
+    gen_workload(wl->scale, wl->strs_scale, seed, fscript, src->fstrtab_script,
+        src->fstrtab_menu);
+
+    src->script = slurp(fscript);
+    src->strtab_script_sz = fsz(src->fstrtab_script);
+    src->strtab_menu_sz = fsz(src->fstrtab_menu);
+    fclose(fscript);
+}
+
+static void src_free(struct script_src* src) {
+    free(src->script);
+    fclose(src->fstrtab_script);
+    fclose(src->fstrtab_menu);
+}
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void acc_add(struct bench_acc* acc, uint64_t t0, uint64_t items) {
+    acc->ns += now_ns() - t0;
+    acc->items += items;
+}
+
+static void decode_strtab(const uint8_t* rom, size_t offs, size_t nstrs, iconv_t conv) {
+    static char buf[SJIS_TO_U8_MIN_SZ(DEC_BUF_SZ_SJIS)];
+    size_t nwritten;
+
+    for (size_t i = 0; i < nstrs; i++)
+        assert(strtab_dec_str(&rom[offs], &rom[ROM_SZ], i, buf, sizeof(buf), &nwritten, conv,
+            true));
+}
+
+/* Run every stage once for the script in src and add up the results in acc */
+static void run_script(const struct script_src* src, uint8_t* rom, FILE* fdump,
+    iconv_t conv_enc, iconv_t conv_dec, struct bench_acc acc[BENCH_NSTAGES]) {
+    struct script_desc desc = *script_for_name("Harry");
+    uint8_t* hdr = &rom[VMA2OFFS(desc.vma)];
+
+    struct script_parse_ctx* pctx = malloc(sizeof(*pctx));
+    assert(pctx);
+
+    uint64_t t0 = now_ns();
+    assert(script_parse_ctx_init(pctx, src->script));
+    assert(script_parse_ctx_parse(pctx));
+    acc_add(&acc[BENCH_PARSE], t0, pctx->nstmts);
+
+    struct strtab_embed_ctx* ectx_script = strtab_embed_ctx_new();
+    struct strtab_embed_ctx* ectx_menu = strtab_embed_ctx_new();
+    assert(ectx_script && ectx_menu);
+    assert(strtab_embed_ctx_with_file(src->fstrtab_script, src->strtab_script_sz, ectx_script));
+    assert(strtab_embed_ctx_with_file(src->fstrtab_menu, src->strtab_menu_sz, ectx_menu));
+
+    /* Strings have to be converted before splitting, which is accounted to encoding */
+    t0 = now_ns();
+    struct script_as_ctx* actx = script_as_ctx_new(pctx, hdr, SCRIPT_SZ_MAX, ectx_script,
+        ectx_menu);
+    assert(actx && script_fill_strtabs(actx));
+    acc_add(&acc[BENCH_ASSEMBLE], t0, 0);
+
+    t0 = now_ns();
+    assert(strtab_embed_ctx_to_sjis(ectx_script, conv_enc));
+    assert(strtab_embed_ctx_to_sjis(ectx_menu, conv_enc));
+    acc_add(&acc[BENCH_ENCODE], t0, 0);
+
+    t0 = now_ns();
+    assert(split_Choice_stmts(actx) && split_ShowText_stmts(actx) && script_assemble(actx));
+    size_t sz = script_sz((void*)hdr);
+    acc_add(&acc[BENCH_ASSEMBLE], t0, sz);
+
+    /* Strtabs are measured in encoded bytes, as placeholders for unused indices cost nearly nothing */
+    size_t nwritten_script, nwritten_menu;
+    t0 = now_ns();
+    assert(make_strtab((void*)ectx_script->strs, ectx_script->nstrs, &rom[STRTAB_SCRIPT_OFFS],
+        STRTAB_SZ, &nwritten_script));
+    assert(make_strtab((void*)ectx_menu->strs, ectx_menu->nstrs, &rom[STRTAB_MENU_OFFS],
+        STRTAB_SZ, &nwritten_menu));
+    acc_add(&acc[BENCH_ENCODE], t0, nwritten_script + nwritten_menu);
+
+    t0 = now_ns();
+    decode_strtab(rom, STRTAB_SCRIPT_OFFS, ectx_script->nstrs, conv_dec);
+    decode_strtab(rom, STRTAB_MENU_OFFS, ectx_menu->nstrs, conv_dec);
+    acc_add(&acc[BENCH_DECODE], t0, nwritten_script + nwritten_menu);
+
+    /* Dump from a matching desc to not warn about the checksum */
+    desc.cksum = script_cksum(hdr, sz + sizeof(struct script_hdr), SCRIPT_CKSUM_SEED);
+    rewind(fdump);
+    t0 = now_ns();
+    assert(script_dump(rom, ROM_SZ, desc.vma, &desc, fdump, SCRIPT_DUMP_TEXT,
+        OFFS2VMA(STRTAB_SCRIPT_OFFS), OFFS2VMA(STRTAB_MENU_OFFS)));
+    acc_add(&acc[BENCH_DUMP], t0, sz);
+
+    script_as_ctx_free(actx);
+    script_parse_ctx_free(pctx);
+    free(pctx);
+    strtab_embed_ctx_free(ectx_script);
+    strtab_embed_ctx_free(ectx_menu);
+}
+
+static bool bench(FILE* fcsv) {
+    uint8_t* rom = malloc(ROM_SZ);
+    assert(rom);
+    memset(rom, 0xff, ROM_SZ);
+
+    FILE* fdump = tmpfile();
+    assert(fdump);
+
+    iconv_t conv_enc = conv_for_embedding(), conv_dec = (iconv_t)-1;
+#ifdef HAS_ICONV
+    conv_dec = iconv_open("UTF-8", "SJIS");
+#endif
+    assert(conv_enc != (iconv_t)-1 && conv_dec != (iconv_t)-1);
+
+    struct bench_acc accs[NWORKLOADS][BENCH_NSTAGES];
+    memset(accs, 0, sizeof(accs));
+    bool ok = true;
+
+    fprintf(fcsv, "workload,stage,items,unit,ms,ns_per_item,ratio,ratio_max,ok\n");
+
+    for (size_t w = 0; w < NWORKLOADS; w++) {
+        const struct workload* wl = &workloads[w];
+        struct script_src src;
+        src_init(&src, wl, 1);
+
+        for (size_t rep = 0; rep < wl->nreps; rep++)
+            run_script(&src, rom, fdump, conv_enc, conv_dec, accs[w]);
+
+        src_free(&src);
+
+        for (size_t s = 0; s < BENCH_NSTAGES; s++) {
+            const struct bench_acc* acc = &accs[w][s];
+            double ns_per_item = acc->items ? (double)acc->ns / acc->items : 0;
+            double ns_per_item_base = accs[0][s].items ?
+                (double)accs[0][s].ns / accs[0][s].items : 0;
+            double ratio = ns_per_item_base > 0 ? ns_per_item / ns_per_item_base : 0;
+            bool stage_ok = ratio <= stages[s].ratio_max;
+
+            fprintf(fcsv, "%s,%s,%llu,%s,%.3f,%.3f,%.3f,%.1f,%d\n", wl->name, stages[s].name,
+                (unsigned long long)acc->items, stages[s].unit, acc->ns / 1e6, ns_per_item, ratio, stages[s].ratio_max, stage_ok);
+            fflush(fcsv);
+
+            if (!stage_ok) {
+                fprintf(stderr, "%s on %s is %.2f times slower per item than on %s, "
+                    "limit is %.1f\n", stages[s].name, wl->name, ratio, workloads[0].name,
+                    stages[s].ratio_max);
+                ok = false;
+            }
+        }
+    }
+
+#ifdef HAS_ICONV
+    iconv_close(conv_enc);
+    iconv_close(conv_dec);
+#endif
+    fclose(fdump);
+    free(rom);
+    return ok;
+}
+
+static bool gen(int argc, char** argv) {
+    if (argc < 6) {
+        fprintf(stderr, "usage: %s gen <scale> <script> <strtab_script> <strtab_menu> "
+            "[seed [strs_scale]]\n", argv[0]);
+        return false;
+    }
+
+    double scale = strtod(argv[2], NULL);
+    if (scale <= 0 || scale > 1) {
+        fprintf(stderr, "Scale must be within (0, 1], larger scripts would not fit\n");
+        return false;
+    }
+
+    double strs_scale = argc > 7 ? strtod(argv[7], NULL) : scale;
+    if (strs_scale <= 0) {
+        fprintf(stderr, "Strings scale must be positive\n");
+        return false;
+    }
+
+    FILE* fscript = fopen(argv[3], "wb");
+    FILE* fstrtab_script = fopen(argv[4], "wb");
+    FILE* fstrtab_menu = fopen(argv[5], "wb");
+    bool ret = fscript && fstrtab_script && fstrtab_menu;
+
+    if (ret)
+        gen_workload(scale, strs_scale, argc > 6 ? strtoul(argv[6], NULL, 0) : 1, fscript,
+            fstrtab_script, fstrtab_menu);
+    else
+        perror("fopen");
+
+    if (fscript && fclose(fscript))
+        ret = false;
+    if (fstrtab_script && fclose(fstrtab_script))
+        ret = false;
+    if (fstrtab_menu && fclose(fstrtab_menu))
+        ret = false;
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "gen"))
+        return gen(argc, argv) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    assert(HAS_ICONV);
+
+    FILE* fcsv = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (!fcsv) {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+
+    bool ok = bench(fcsv);
+
+    if (fcsv != stdout && fclose(fcsv)) {
+        perror("fclose");
+        ok = false;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
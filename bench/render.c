@@ -0,0 +1,447 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "embed.h"
+#include "glyph.h"
+#include "agb/config.h"
+#include "agb/glyph_pos.h"
+#include "agb/render_sim.h"
+
+/**
+ * Host simulation of the text renderer in agb/render_sjis.c.
+ *
+ * usage: render [csv [scripts]]
+ *
+ * Renders every string of the real strtabs in "scripts" (scripts/ by default) the way the game
+ * does, with the renderer built for the host against the stubs below, and writes a CSV to "csv" or
+ * stdout. Script strings are split into the frames they are shown in, menu strings are rendered as
+ * a single choice row. Each table is rendered twice, with the per-glyph delay and without it, as if
+ * a button had been pressed.
+ *
+ * A VBlank ends whenever the renderer awaits input. DMA3 transfers are carried out at once and
+ * their cost in cycles is estimated from the bus width and wait states of the regions they access:
+ * 2 cycles to start plus one access per unit and bus width on either side, each taking 1 + wait
+ * states. This ignores sequential access timing and the CPU, but it is what decides whether
+ * uploads fit in VBLANK_CYCLES.
+ *
+ * Strings that spill past the right margin or the bottom of the screen, or that have more glyphs
+ * than RENDER_NCHARS_MAX, are reported on stderr.
+ *
+ * Script frames are rendered with glyph positions stored by glyph_pos_build, as with --glyph-pos.
+ * Each frame is first rendered without them, and any difference in OAM or object tiles is reported
+ * as a mismatch and fails the run.
+ */
+
+#define SCREEN_W 240
+#define SCREEN_H 160
+#define VBLANK_CYCLES (68 * 1232) /* 68 lines of 1232 cycles */
+
+#define OAM_NOBJS 128
+#define OAM_OBJ_SZ 8
+#define OAM_AFFINE_HIDE 2
+
+#define STR_SZ_MAX 0x1000
+
+#define OBJ_TILES_VMA 0x6010000
+#define OBJ_TILES_SZ 0x8000
+
+enum region {REGION_EWRAM, REGION_IWRAM, REGION_IO, REGION_PAL, REGION_VRAM, REGION_OAM,
+    REGION_ROM, REGION_NREGIONS};
+
+static const struct {
+    unsigned bus; /* in bits */
+    unsigned waits; /* per access */
+} regions[REGION_NREGIONS] = {
+    [REGION_EWRAM] = {16, 2},
+    [REGION_IWRAM] = {32, 0},
+    [REGION_IO] = {32, 0},
+    [REGION_PAL] = {16, 0},
+    [REGION_VRAM] = {16, 0},
+    [REGION_OAM] = {32, 0},
+    [REGION_ROM] = {16, 3} /* WS0 at 3/1 */
+};
+
+_Static_assert(REGION_NREGIONS == RENDER_SIM_REGION_LAST - RENDER_SIM_REGION_FIRST + 1, "");
+
+uint8_t render_sim_mem[REGION_NREGIONS * RENDER_SIM_REGION_SZ];
+
+enum mode {MODE_DELAY, MODE_NO_DELAY, MODE_NMODES};
+
+static const char* mode_names[MODE_NMODES] = {
+    [MODE_DELAY] = "delay",
+    [MODE_NO_DELAY] = "no_delay"
+};
+
+/* DMA of the VBlank in progress */
+static struct vblank {
+    size_t bytes;
+    size_t vram_bytes;
+    size_t transfers;
+    size_t glyphs;
+    uint64_t cycles;
+} vblank;
+
+/* Totals of a table in one mode */
+struct totals {
+    size_t strs;
+    size_t renders;
+    size_t glyphs;
+    size_t vblanks;
+    size_t dma_transfers;
+    size_t dma_bytes;
+    size_t dma_bytes_max; /* in a VBlank */
+    size_t vram_bytes;
+    uint64_t cycles_max; /* in a VBlank */
+    size_t over_budget; /* VBlanks over VBLANK_CYCLES */
+    size_t overflows;
+    size_t spills;
+};
+
+static struct totals totals;
+static size_t pos_mismatches;
+
+/* Anything outside of the simulated memory map is on the stack, which is in IWRAM */
+static enum region region_of(const volatile void* p) {
+    const volatile uint8_t* b = p;
+    if (b < render_sim_mem || b >= render_sim_mem + sizeof(render_sim_mem))
+        return REGION_IWRAM;
+    return (b - render_sim_mem) / RENDER_SIM_REGION_SZ;
+}
+
+static unsigned access_cycles(enum region r, unsigned unit_bits) {
+    unsigned naccesses = unit_bits > regions[r].bus ? unit_bits / regions[r].bus : 1;
+    return naccesses * (1 + regions[r].waits);
+}
+
+void render_sim_dma3(const volatile void* src, volatile void* dst, uint16_t count, bool words) {
+    unsigned unit = words ? sizeof(uint32_t) : sizeof(uint16_t);
+    enum region rsrc = region_of(src), rdst = region_of(dst);
+
+    memcpy((void*)dst, (const void*)src, count * unit);
+
+    vblank.bytes += count * unit;
+    vblank.transfers++;
+    vblank.cycles += 2 + count *
+        (uint64_t)(access_cycles(rsrc, 8 * unit) + access_cycles(rdst, 8 * unit));
+    if (rdst == REGION_VRAM)
+        vblank.vram_bytes += count * unit;
+    if (rdst == REGION_OAM)
+        vblank.glyphs += count * unit / OAM_OBJ_SZ;
+}
+
+static void vblank_end(void) {
+    totals.vblanks++;
+    totals.glyphs += vblank.glyphs;
+    totals.dma_transfers += vblank.transfers;
+    totals.dma_bytes += vblank.bytes;
+    totals.vram_bytes += vblank.vram_bytes;
+    if (vblank.bytes > totals.dma_bytes_max)
+        totals.dma_bytes_max = vblank.bytes;
+    if (vblank.cycles > totals.cycles_max)
+        totals.cycles_max = vblank.cycles;
+    if (vblank.cycles > VBLANK_CYCLES)
+        totals.over_budget++;
+    memset(&vblank, 0, sizeof(vblank));
+}
+
+/* ROM routines */
+
+uint32_t parse_wait_command(const char* buf, uint32_t idx) {
+    return buf[idx + 1] - '0';
+}
+
+/* Stands in for decompressing a glyph, so that equal glyphs get equal tiles */
+void sub_8004CD4(uint32_t idx, uint32_t* buf) {
+    for (size_t i = 0; i < 0x40; i++)
+        buf[i] = idx * 0x9e3779b9u + i;
+}
+
+/* Stands in for expanding the glyph to 4bpp in the given color */
+void sub_8004C34(uint32_t* src, uint32_t* dst, char color) {
+    for (size_t i = 0; i < 0x40; i++)
+        dst[i] = src[i] ^ (uint32_t)(color & 0xf);
+}
+
+void await_input(void) {
+    vblank_end();
+}
+
+void* lineToSJIS_Menu(uint32_t idx) {
+    (void)idx;
+    return NULL;
+}
+
+uint16_t static_str_map(const char* sjis) {
+    (void)sjis;
+    return 0;
+}
+
+/* Rendering */
+
+struct table {
+    const char* path;
+    bool menu;
+};
+
+static const struct table tables[] = {
+    {"JA/strtab_script", false}, {"JA/strtab_menu", true},
+    {"EN/strtab_script", false}, {"EN/strtab_menu", true},
+    {"RU/strtab_script", false}, {"RU/strtab_menu", true}
+};
+
+#define NTABLES (sizeof(tables) / sizeof(*tables))
+
+/* Check the objects left in OAM, return a reason to flag the render or NULL */
+static const char* check_oam(void) {
+    const uint8_t* oam = AGB_PTR(0x7000000);
+
+    for (size_t i = 0; i < OAM_NOBJS; i++) {
+        const uint8_t* obj = &oam[i * OAM_OBJ_SZ];
+        uint16_t attr0 = obj[0] | obj[1] << 8, attr1 = obj[2] | obj[3] << 8;
+
+        if ((attr0 >> 8 & 3) == OAM_AFFINE_HIDE)
+            continue;
+        if ((attr1 & 0x1ff) > RENDER_TEXT_RMARGIN)
+            return "spills past the right margin";
+        if ((attr0 & 0xff) + RENDER_GLYPH_DIM > SCREEN_H)
+            return "spills past the bottom of the screen";
+    }
+    return NULL;
+}
+
+/**
+ * Render a script frame without glyph positions, off the record, and keep what ends up in OAM and
+ * object tiles
+ */
+static void render_frame_unpositioned(const char* sjis, enum mode mode, uint8_t* oam,
+    uint8_t* tiles) {
+    uint32_t* ptr = AGB_PTR(GLYPH_POS_PTR_VMA);
+    uint32_t vma = *ptr;
+    struct totals totals_prev = totals;
+
+    *ptr = 0;
+    clear_oam();
+    render_sjis_entry(sjis, strlen(sjis), 0, 15, mode == MODE_NO_DELAY, 0, 0);
+    vblank_end();
+    *ptr = vma;
+    totals = totals_prev;
+
+    memcpy(oam, AGB_PTR(0x7000000), OAM_NOBJS * OAM_OBJ_SZ);
+    memcpy(tiles, AGB_PTR(OBJ_TILES_VMA), OBJ_TILES_SZ);
+}
+
+/* Render one frame of text, sjis is in the encoding of the ROM strtab */
+static void render_frame(const char* tname, size_t idx, const char* sjis, bool menu,
+    enum mode mode) {
+    static uint8_t oam[OAM_NOBJS * OAM_OBJ_SZ], tiles[OBJ_TILES_SZ];
+    size_t glyphs = totals.glyphs;
+
+    if (!menu)
+        render_frame_unpositioned(sjis, mode, oam, tiles);
+
+    clear_oam();
+    if (menu)
+        render_sjis_menu_entry(sjis, 0, 0, 1, mode == MODE_NO_DELAY);
+    else
+        render_sjis_entry(sjis, strlen(sjis), 0, 15, mode == MODE_NO_DELAY, 0, 0);
+    vblank_end();
+
+    totals.renders++;
+    glyphs = totals.glyphs - glyphs;
+
+    if (!menu && (memcmp(oam, AGB_PTR(0x7000000), sizeof(oam)) ||
+            memcmp(tiles, AGB_PTR(OBJ_TILES_VMA), sizeof(tiles)))) {
+        pos_mismatches++;
+        fprintf(stderr, "%s %zu: rendered differently with glyph positions\n", tname, idx);
+    }
+
+    const char* spill = check_oam();
+    if (spill)
+        totals.spills++;
+    if (glyphs > RENDER_NCHARS_MAX)
+        totals.overflows++;
+
+    if (mode != MODE_DELAY)
+        return;
+    if (spill)
+        fprintf(stderr, "%s %zu: %s\n", tname, idx, spill);
+    if (glyphs > RENDER_NCHARS_MAX)
+        fprintf(stderr, "%s %zu: %zu glyphs, over RENDER_NCHARS_MAX\n", tname, idx, glyphs);
+}
+
+static void render_str(const char* tname, size_t idx, const char* str, bool menu, enum mode mode) {
+    static char sjis[STR_SZ_MAX];
+
+    size_t len = strlen(str);
+    if (len >= sizeof(sjis)) {
+        fprintf(stderr, "%s %zu: too long to render\n", tname, idx);
+        return;
+    }
+
+    /* The strtab decoder replaces \n with \r */
+    memcpy(sjis, str, len + 1);
+    for (size_t i = 0; i < len; i++)
+        if (sjis[i] == '\n')
+            sjis[i] = '\r';
+
+    totals.strs++;
+
+    if (menu) {
+        render_frame(tname, idx, sjis, true, mode);
+        return;
+    }
+
+    struct sjis_layout* layout = sjis_layout_new(str);
+    assert(layout);
+
+    size_t start = 0;
+    for (size_t f = 0; f < layout->nframes; f++) {
+        size_t end = f + 1 < layout->nframes ? layout->frame_breaks[f] : len;
+        char save = sjis[end];
+
+        sjis[end] = '\0';
+        render_frame(tname, idx, &sjis[start], false, mode);
+        sjis[end] = save;
+        start = end + 1;
+    }
+
+    sjis_layout_free(layout);
+}
+
+/* Store glyph positions of the frames of script strings, as the tool does for the split script */
+static void store_glyph_pos(const struct strtab_embed_ctx* ectx) {
+    size_t nframes = 0, cap = ectx->nstrs;
+    char** frames = malloc(sizeof(char*[cap]));
+    assert(frames);
+
+    for (size_t i = 0; i < ectx->nstrs; i++) {
+        const char* str = ectx->strs[i];
+        if (!str)
+            continue;
+
+        struct sjis_layout* layout = sjis_layout_new(str);
+        assert(layout);
+
+        size_t start = 0, len = strlen(str);
+        for (size_t f = 0; f < layout->nframes; f++) {
+            size_t end = f + 1 < layout->nframes ? layout->frame_breaks[f] : len;
+
+            if (nframes == cap) {
+                cap *= 2;
+                frames = realloc(frames, sizeof(char*[cap]));
+                assert(frames);
+            }
+            frames[nframes] = malloc(end - start + 1);
+            assert(frames[nframes]);
+            memcpy(frames[nframes], &str[start], end - start);
+            frames[nframes++][end - start] = '\0';
+            start = end + 1;
+        }
+
+        sjis_layout_free(layout);
+    }
+
+    size_t written = 0, nstored = 0;
+    if (glyph_pos_build(frames, nframes, AGB_PTR(GLYPH_POS_VMA), GLYPH_POS_SZ_MAX, &written,
+            &nstored)) {
+        *(uint32_t*)AGB_PTR(GLYPH_POS_PTR_VMA) = GLYPH_POS_VMA;
+        fprintf(stderr, "Stored glyph positions of %zu of %zu frames using %zu B\n", nstored,
+            nframes, written);
+    }
+
+    for (size_t i = 0; i < nframes; i++)
+        free(frames[i]);
+    free(frames);
+}
+
+static bool render_table(FILE* fcsv, const char* scripts, const struct table* t, iconv_t conv) {
+    char fpath[256];
+    snprintf(fpath, sizeof(fpath), "%s/%s", scripts, t->path);
+
+    FILE* fin = fopen(fpath, "rb");
+    if (!fin) {
+        perror(fpath);
+        return false;
+    }
+
+    assert(fseek(fin, 0, SEEK_END) == 0);
+    long sz = ftell(fin);
+    assert(sz >= 0);
+
+    struct strtab_embed_ctx* ectx = strtab_embed_ctx_new();
+    assert(ectx);
+
+    bool ret = strtab_embed_ctx_with_file(fin, sz, ectx) && strtab_embed_ctx_to_sjis(ectx, conv);
+    fclose(fin);
+    if (!ret) {
+        fprintf(stderr, "Failed to load %s\n", fpath);
+        strtab_embed_ctx_free(ectx);
+        return false;
+    }
+
+    if (!t->menu)
+        store_glyph_pos(ectx);
+
+    for (size_t m = 0; m < MODE_NMODES; m++) {
+        memset(&totals, 0, sizeof(totals));
+
+        for (size_t i = 0; i < ectx->nstrs; i++)
+            if (ectx->strs[i])
+                render_str(t->path, i, ectx->strs[i], t->menu, m);
+
+        fprintf(fcsv, "%s,%s,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%llu,%zu,%zu,%zu\n", t->path,
+            mode_names[m], totals.strs, totals.renders, totals.glyphs, totals.vblanks,
+            totals.dma_transfers, totals.dma_bytes, totals.dma_bytes_max, totals.vram_bytes,
+            (unsigned long long)totals.cycles_max, totals.over_budget, totals.overflows,
+            totals.spills);
+        fflush(fcsv);
+    }
+
+    *(uint32_t*)AGB_PTR(GLYPH_POS_PTR_VMA) = 0;
+    strtab_embed_ctx_free(ectx);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    assert(HAS_ICONV);
+
+    FILE* fcsv = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (!fcsv) {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+
+    const char* scripts = argc > 2 ? argv[2] : "scripts";
+
+    iconv_t conv = conv_for_embedding();
+    assert(conv != (iconv_t)-1);
+
+    fprintf(fcsv, "table,mode,strings,renders,glyphs,vblanks,dma_transfers,dma_bytes,"
+        "dma_bytes_max,vram_bytes,cycles_max,over_budget,overflows,spills\n");
+
+    bool ok = true;
+    for (size_t i = 0; i < NTABLES; i++)
+        ok = render_table(fcsv, scripts, &tables[i], conv) && ok;
+
+#ifdef HAS_ICONV
+    iconv_close(conv);
+#endif
+
+    if (pos_mismatches) {
+        fprintf(stderr, "%zu frames rendered differently with glyph positions\n", pos_mismatches);
+        ok = false;
+    }
+
+    if (fcsv != stdout && fclose(fcsv)) {
+        perror("fclose");
+        ok = false;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,422 @@
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAS_ICONV
+#include <iconv.h>
+#endif
+
+#include "defs.h"
+#include "embed.h"
+#include "strtab.h"
+#include "test/rng.h"
+
+/**
+ * Strtab codec microbenchmark.
+ *
+ * usage: strtab [csv [scripts]]
+ *
+ * Times the encoder and every decoder path on the real strtabs in "scripts" (scripts/ by default)
+ * and on synthetic tables of single alphabets, and writes a CSV to "csv" or stdout. Each codec runs
+ * NWARMUP times untimed and then NREPS times, rows have percentiles of the time of a whole table.
+ * Throughput is measured in SJIS bytes and strings of the table, whichever direction is timed.
+ *
+ * Sizes are the same for every row of a table. Messages are compared to the order-0 Shannon
+ * entropy of their characters, which is what the Huffman coding of strtab can reach at best.
+ */
+
+#define NWARMUP 3
+#define NREPS 50
+
+#define STRTAB_OFFS 0
+#define STRTAB_SZ 0x200000
+
+#define NSYNTH_STRS 1000
+#define SYNTH_LEN_MAX 80 /* in characters */
+
+/* Layout of the strtab header, see strtab.c */
+enum {HDR_DICT_OFFS, HDR_MSGS_OFFS, HDR_NENTRIES, HDR_NWORDS};
+#define MSG_OFFS_SZ 3
+
+enum codec {CODEC_ENCODE, CODEC_DEC_RAW, CODEC_DEC_HEX, CODEC_DEC_ICONV, CODEC_FROM_ROM,
+    CODEC_NCODECS};
+
+static const char* codec_names[CODEC_NCODECS] = {
+    [CODEC_ENCODE] = "make_strtab",
+    [CODEC_DEC_RAW] = "strtab_dec_str raw",
+    [CODEC_DEC_HEX] = "strtab_dec_str hex", /* escapes, as without iconv */
+    [CODEC_DEC_ICONV] = "strtab_dec_str iconv",
+    [CODEC_FROM_ROM] = "strtab_from_rom"
+};
+
+struct table {
+    char name[32];
+    const uint8_t** strs;
+    size_t nstrs;
+    size_t sz; /* SJIS bytes including NUL */
+    struct strtab_embed_ctx* ectx; /* owns strs of a real table */
+    uint8_t* synth; /* owns strs of a synthetic one */
+};
+
+static const char* real_tables[] = {
+    "JA/strtab_script", "JA/strtab_menu", "EN/strtab_script", "EN/strtab_menu",
+    "RU/strtab_script", "RU/strtab_menu"
+};
+
+#define NREAL_TABLES (sizeof(real_tables) / sizeof(*real_tables))
+
+/* Synthetic alphabets, emit a random character of each into dst and return its length */
+
+/* Skewed towards lower values, roughly like letter frequencies of a natural language */
+static uint32_t rand_skewed(uint32_t* rng, uint32_t n) {
+    uint32_t a = rng_below(rng, n), b = rng_below(rng, n);
+    return a < b ? a : b;
+}
+
+static size_t ascii_char(uint32_t* rng, uint8_t* dst) {
+    static const char letters[] = " etaoinshrdlcumwfgypbvkjxqz";
+    dst[0] = letters[rand_skewed(rng, sizeof(letters) - 1)];
+    return 1;
+}
+
+/* Lowercase SJIS Cyrillic, 0x847f is unassigned */
+static size_t cyrillic_char(uint32_t* rng, uint8_t* dst) {
+    uint32_t c = 0x8470 + rand_skewed(rng, 33);
+    if (c >= 0x847f)
+        c++;
+    dst[0] = c >> 8;
+    dst[1] = c & 0xff;
+    return 2;
+}
+
+static size_t kana_char(uint32_t* rng, uint8_t* dst) {
+    uint32_t c = 0x829f + rand_skewed(rng, 83);
+    dst[0] = c >> 8;
+    dst[1] = c & 0xff;
+    return 2;
+}
+
+/* Fully assigned rows of level 1 kanji: many distinct trail bytes and nearly uniform */
+static size_t kanji_char(uint32_t* rng, uint8_t* dst) {
+    uint32_t trail = rng_below(rng, 188);
+    dst[0] = 0x89 + rng_below(rng, 0x97 - 0x89 + 1);
+    dst[1] = trail < 0x3f ? 0x40 + trail : 0x80 + trail - 0x3f;
+    return 2;
+}
+
+static const struct {
+    const char* name;
+    size_t (*char_)(uint32_t* rng, uint8_t* dst);
+} synth_tables[] = {
+    {"ascii", ascii_char},
+    {"cyrillic", cyrillic_char},
+    {"kana", kana_char},
+    {"kanji", kanji_char}
+};
+
+#define NSYNTH_TABLES (sizeof(synth_tables) / sizeof(*synth_tables))
+
+static void table_synth(struct table* t, size_t alphabet) {
+    snprintf(t->name, sizeof(t->name), "%s", synth_tables[alphabet].name);
+
+    t->synth = malloc(NSYNTH_STRS * (2 * SYNTH_LEN_MAX + 1));
+    t->strs = malloc(NSYNTH_STRS * sizeof(*t->strs));
+    assert(t->synth && t->strs);
+    t->ectx = NULL;
+    t->nstrs = NSYNTH_STRS;
+    t->sz = 0;
+
+    uint32_t rng = alphabet + 1;
+    uint8_t* p = t->synth;
+
+    for (size_t i = 0; i < NSYNTH_STRS; i++) {
+        size_t len = 8 + rng_below(&rng, SYNTH_LEN_MAX - 8);
+
+        t->strs[i] = p;
+        for (size_t j = 0; j < len; j++)
+            p += synth_tables[alphabet].char_(&rng, p);
+        *p++ = '\0';
+        t->sz += p - t->strs[i];
+    }
+}
+
+static bool table_real(struct table* t, const char* scripts, const char* path, iconv_t conv) {
+    char fpath[256];
+    snprintf(fpath, sizeof(fpath), "%s/%s", scripts, path);
+    snprintf(t->name, sizeof(t->name), "%s", path);
+
+    FILE* fin = fopen(fpath, "rb");
+    if (!fin) {
+        perror(fpath);
+        return false;
+    }
+
+    assert(fseek(fin, 0, SEEK_END) == 0);
+    long sz = ftell(fin);
+    assert(sz >= 0);
+
+    t->synth = NULL;
+    t->ectx = strtab_embed_ctx_new();
+    assert(t->ectx);
+
+    bool ret = strtab_embed_ctx_with_file(fin, sz, t->ectx) &&
+        strtab_embed_ctx_to_sjis(t->ectx, conv);
+    fclose(fin);
+    if (!ret) {
+        fprintf(stderr, "Failed to load %s\n", fpath);
+        strtab_embed_ctx_free(t->ectx);
+        return false;
+    }
+
+    t->strs = (void*)t->ectx->strs;
+    t->nstrs = t->ectx->nstrs;
+    t->sz = 0;
+    for (size_t i = 0; i < t->nstrs; i++)
+        t->sz += strlen((const char*)t->strs[i]) + 1;
+    return true;
+}
+
+static void table_free(struct table* t) {
+    if (t->ectx)
+        strtab_embed_ctx_free(t->ectx);
+    else
+        free(t->strs);
+    free(t->synth);
+}
+
+/* Sizes */
+
+struct sizes {
+    size_t strtab, msgs; /* as encoded */
+    double entropy; /* of msgs, in bytes */
+};
+
+static int cmp_strs(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/* Only unique strings are encoded, so the entropy is that of their characters and NULs */
+static double entropy_sz(const struct table* t) {
+    const uint8_t** strs = malloc(t->nstrs * sizeof(*strs));
+    assert(strs);
+    memcpy(strs, t->strs, t->nstrs * sizeof(*strs));
+    qsort(strs, t->nstrs, sizeof(*strs), cmp_strs);
+
+    uint64_t freqs[UINT8_MAX + 1] = {0};
+    uint64_t nchars = 0;
+
+    for (size_t i = 0; i < t->nstrs; i++) {
+        if (i > 0 && !strcmp((const char*)strs[i], (const char*)strs[i - 1]))
+            continue;
+        for (const uint8_t* s = strs[i]; ; s++) {
+            freqs[*s]++;
+            nchars++;
+            if (!*s)
+                break;
+        }
+    }
+    free(strs);
+
+    double bits = 0;
+    for (size_t c = 0; c <= UINT8_MAX; c++)
+        if (freqs[c])
+            bits -= freqs[c] * log2((double)freqs[c] / nchars);
+    return bits / 8;
+}
+
+static struct sizes sizes_for(const struct table* t, const uint8_t* strtab, size_t nwritten) {
+    uint32_t hdr[HDR_NWORDS];
+    memcpy(hdr, strtab, sizeof(hdr));
+
+    /* nwritten is one past the last byte written */
+    return (struct sizes){
+        .strtab = nwritten - 1,
+        .msgs = nwritten - 1 - hdr[HDR_MSGS_OFFS] - MSG_OFFS_SZ * hdr[HDR_NENTRIES],
+        .entropy = entropy_sz(t)
+    };
+}
+
+/* Codecs, each returns the time it took to process the whole table */
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static uint64_t run_encode(const struct table* t, uint8_t* rom) {
+    size_t nwritten;
+    uint64_t t0 = now_ns();
+    assert(make_strtab(t->strs, t->nstrs, &rom[STRTAB_OFFS], STRTAB_SZ, &nwritten));
+    return now_ns() - t0;
+}
+
+static uint64_t run_dec(const struct table* t, const uint8_t* rom, iconv_t conv,
+    bool should_conv) {
+    static char buf[SJIS_TO_U8_MIN_SZ(DEC_BUF_SZ_SJIS)];
+    size_t nwritten;
+
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < t->nstrs; i++)
+        assert(strtab_dec_str(&rom[STRTAB_OFFS], &rom[STRTAB_SZ], i, buf, sizeof(buf), &nwritten,
+            conv, should_conv));
+    return now_ns() - t0;
+}
+
+static uint64_t run_from_rom(const uint8_t* rom) {
+    struct strtab_embed_ctx* ectx = strtab_embed_ctx_new();
+    assert(ectx);
+
+    uint64_t t0 = now_ns();
+    assert(strtab_from_rom(rom, STRTAB_SZ, OFFS2VMA(STRTAB_OFFS), ectx));
+    uint64_t ns = now_ns() - t0;
+
+    strtab_embed_ctx_free(ectx);
+    return ns;
+}
+
+static uint64_t run(enum codec codec, const struct table* t, uint8_t* rom, iconv_t conv_dec) {
+    switch (codec) {
+        case CODEC_ENCODE:
+            return run_encode(t, rom);
+        case CODEC_DEC_RAW:
+            return run_dec(t, rom, (iconv_t)-1, false);
+        case CODEC_DEC_HEX:
+            return run_dec(t, rom, (iconv_t)-1, true);
+        case CODEC_DEC_ICONV:
+            return run_dec(t, rom, conv_dec, true);
+        case CODEC_FROM_ROM:
+            return run_from_rom(rom);
+        default:
+            assert(false);
+            return 0;
+    }
+}
+
+/* The decoder escapes newlines and quotes for the dump, see esc_for_buf in strtab.c */
+static bool eq_escaped(const char* dec, const uint8_t* str) {
+    for (; *str; str++) {
+        const char* esc = *str == '\n' ? "\\n" : *str == '\r' ? "\\r" :
+            *str == '"' ? "\\\"" : NULL;
+        size_t len = esc ? 2 : 1;
+        if (strncmp(dec, esc ? esc : (const char*)str, len))
+            return false;
+        dec += len;
+    }
+    return *dec == '\0';
+}
+
+/* Decoding raw must give back exactly what was encoded */
+static void check_roundtrip(const struct table* t, const uint8_t* rom) {
+    static char buf[SJIS_TO_U8_MIN_SZ(DEC_BUF_SZ_SJIS)];
+    size_t nwritten;
+
+    for (size_t i = 0; i < t->nstrs; i++) {
+        assert(strtab_dec_str(&rom[STRTAB_OFFS], &rom[STRTAB_SZ], i, buf, sizeof(buf), &nwritten,
+            (iconv_t)-1, false));
+        assert(eq_escaped(buf, t->strs[i]));
+    }
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank */
+static uint64_t percentile(const uint64_t* sorted, size_t n, unsigned p) {
+    size_t rank = (p * n + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void bench_table(FILE* fcsv, const struct table* t, uint8_t* rom, iconv_t conv_dec) {
+    size_t nwritten;
+    assert(make_strtab(t->strs, t->nstrs, &rom[STRTAB_OFFS], STRTAB_SZ, &nwritten));
+    check_roundtrip(t, rom);
+    struct sizes sz = sizes_for(t, rom, nwritten);
+
+    for (size_t c = 0; c < CODEC_NCODECS; c++) {
+        uint64_t ns[NREPS];
+
+        for (size_t i = 0; i < NWARMUP; i++)
+            run(c, t, rom, conv_dec);
+        for (size_t i = 0; i < NREPS; i++)
+            ns[i] = run(c, t, rom, conv_dec);
+        qsort(ns, NREPS, sizeof(*ns), cmp_u64);
+
+        double p50_s = percentile(ns, NREPS, 50) / 1e9;
+
+        fprintf(fcsv, "%s,%s,%zu,%zu,%zu,%zu,%.0f,%.3f,%d,%.1f,%.1f,%.1f,%.1f,%.2f,%.0f\n",
+            t->name, codec_names[c], t->nstrs, t->sz, sz.strtab, sz.msgs, sz.entropy,
+            sz.msgs / sz.entropy, NREPS, ns[0] / 1e3, p50_s * 1e6,
+            percentile(ns, NREPS, 90) / 1e3, percentile(ns, NREPS, 99) / 1e3,
+            t->sz / p50_s / 1e6, t->nstrs / p50_s);
+        fflush(fcsv);
+    }
+}
+
+static bool bench(FILE* fcsv, const char* scripts) {
+    uint8_t* rom = malloc(STRTAB_SZ);
+    assert(rom);
+    memset(rom, 0xff, STRTAB_SZ);
+
+    iconv_t conv_enc = conv_for_embedding(), conv_dec = (iconv_t)-1;
+#ifdef HAS_ICONV
+    conv_dec = iconv_open("UTF-8", "SJIS");
+#endif
+    assert(conv_enc != (iconv_t)-1 && conv_dec != (iconv_t)-1);
+
+    bool ret = true;
+
+    fprintf(fcsv, "table,codec,strings,bytes,strtab_bytes,msgs_bytes,entropy_bytes,"
+        "msgs_to_entropy,reps,min_us,p50_us,p90_us,p99_us,mb_per_s,strings_per_s\n");
+
+    for (size_t i = 0; i < NREAL_TABLES; i++) {
+        struct table t;
+        if (!table_real(&t, scripts, real_tables[i], conv_enc)) {
+            ret = false;
+            continue;
+        }
+        bench_table(fcsv, &t, rom, conv_dec);
+        table_free(&t);
+    }
+
+    for (size_t i = 0; i < NSYNTH_TABLES; i++) {
+        struct table t;
+        table_synth(&t, i);
+        bench_table(fcsv, &t, rom, conv_dec);
+        table_free(&t);
+    }
+
+#ifdef HAS_ICONV
+    iconv_close(conv_enc);
+    iconv_close(conv_dec);
+#endif
+    free(rom);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    assert(HAS_ICONV);
+
+    FILE* fcsv = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (!fcsv) {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+
+    bool ok = bench(fcsv, argc > 2 ? argv[2] : "scripts");
+
+    if (fcsv != stdout && fclose(fcsv)) {
+        perror("fclose");
+        ok = false;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,6 +1,7 @@
 CC ?= cc
 LD := $(CC)
 STRIP ?= strip
+AR ?= ar
 FLIPS ?= flips
 
 YACC ?= bison
@@ -13,6 +14,7 @@ CFLAGS_OPT := \
     -DNDEBUG
 
 CFLAGS := \
+    -pthread \
     -std=c11 \
     -Wall \
     -Wextra \
@@ -21,7 +23,7 @@ CFLAGS := \
     -fno-strict-aliasing \
     -I.
 
-LDFLAGS :=
+LDFLAGS := -pthread
 
 LDLIBS :=
 
@@ -43,6 +45,10 @@ else
     CFLAGS += $(CFLAGS_OPT)
 endif
 
+ifeq ($(STATS),1)
+	CFLAGS += -DSHPN_STATS
+endif
+
 ifneq ($(SANITIZE),)
 	CFLAGS += -fsanitize=$(SANITIZE)
 	LDFLAGS += -fsanitize=$(SANITIZE)
@@ -12,7 +12,14 @@ ifeq ($$(HAS_ICONV),0)
 specify iconv installation prefix.
 endif
 	@echo ld $$(notdir $$@)
-	$$(VERBOSE) $$(ENV) $$(LD) $$(LDFLAGS) $$(LDLIBS) -o $$@ $2
+	$$(VERBOSE) $$(ENV) $$(LD) $$(LDFLAGS) -o $$@ $2 $$(LDLIBS)
+endef
+
+define ARCHIVE_LIB
+$(1): $(2)
+	@echo ar $$(notdir $$@)
+	@rm -f $$@
+	$$(VERBOSE) $$(ENV) $$(AR) rcs $$@ $2
 endef
 
 NUL :=
@@ -20,7 +20,7 @@ void branch_dst(const struct script_state* state, uint16_t* dst) {
         union script_cmd* cmd = (void*)((uint8_t*)state->cmds + *dst);
 
         /* This will place a label at branch_info, which will not be disassembled */
-        if ((char*)cmd >= state->branch_info && !state->dumping) {
+        if ((char*)cmd >= state->branch_info) {
             fprintf(stderr, "Cannot find branch destination for op at 0x%x\n", state->cmd_offs);
             break;
         }
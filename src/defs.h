@@ -33,4 +33,17 @@ typedef int iconv_t;
 #define UNUSED
 #endif
 
+#ifdef SHPN_STATS
+/* Count allocations per stage. The prototypes are included first so that they are not renamed */
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+#define malloc(sz) stats_malloc(sz)
+#define calloc(n, sz) stats_calloc(n, sz)
+#define realloc(p, sz) stats_realloc(p, sz)
+#define strdup(s) stats_strdup(s)
+#endif
+
 #endif
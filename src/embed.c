@@ -8,50 +8,173 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+#include "agb/glyph_pos.h"
 #include "defs.h"
 #include "embed.h"
 #include "glyph.h"
+#include "pool.h"
 #include "script_as.h"
+#include "script_ir.h"
 #include "script_parse_ctx.h"
+#include "stats.h"
 #include "strtab.h"
+#include "task.h"
 
 void strtab_embed_ctx_free(struct strtab_embed_ctx* ctx) {
-    for (size_t i = 0; i < ctx->nstrs; i++)
+    for (size_t i = 0; i < ctx->nstrs; i++) {
+        strtab_embed_layout_drop(ctx, i);
         if (ctx->strs[i] && ctx->allocated[i].allocated)
             free(ctx->strs[i]);
+    }
     free(ctx);
 }
 
-static bool ctx_conv(iconv_t conv, struct strtab_embed_ctx* ctx) {
-    for (size_t i = 0; i < ctx->nstrs; i++) {
+const struct sjis_layout* strtab_embed_layout(struct strtab_embed_ctx* ctx, size_t idx) {
+    assert(ctx->enc == STRTAB_ENC_SJIS);
+    assert(idx < ctx->nstrs);
+
+    if (!ctx->allocated[idx].layout)
+        ctx->allocated[idx].layout = sjis_layout_new(ctx->strs[idx]);
+    return ctx->allocated[idx].layout;
+}
+
+void strtab_embed_layout_drop(struct strtab_embed_ctx* ctx, size_t idx) {
+    sjis_layout_free(ctx->allocated[idx].layout);
+    ctx->allocated[idx].layout = NULL;
+}
+
+#define CTX_CHUNK_SZ 64 /* strings per work item when processing a strtab */
+
+struct ctx_conv_job {
+    struct strtab_embed_ctx* ctx;
+
+    /* Indexed by tid. Each string is converted into its own slot in ctx, nothing else is shared */
+    iconv_t convs[POOL_NTHREADS_MAX];
+    size_t failed[POOL_NTHREADS_MAX]; /* lowest index that failed to convert */
+};
+
+static size_t ctx_nchunks(const struct strtab_embed_ctx* ctx) {
+    return (ctx->nstrs + CTX_CHUNK_SZ - 1) / CTX_CHUNK_SZ;
+}
+
+static size_t ctx_chunk_end(const struct strtab_embed_ctx* ctx, size_t chunk) {
+    return (chunk + 1) * CTX_CHUNK_SZ < ctx->nstrs ? (chunk + 1) * CTX_CHUNK_SZ : ctx->nstrs;
+}
+
+static bool ctx_conv_chunk(size_t chunk, size_t tid, void* arg) {
+    struct ctx_conv_job* job = arg;
+    struct strtab_embed_ctx* ctx = job->ctx;
+    bool ret = true;
+    STATS_BEGIN_WORKER(span, STATS_CONV);
+
+    /* iconv state cannot be shared, so every worker but the caller opens its own */
+    if (job->convs[tid] == (iconv_t)-1) {
+        job->convs[tid] = conv_for_embedding();
+        if (job->convs[tid] == (iconv_t)-1) {
+            ret = false;
+            goto done;
+        }
+    }
+
+    for (size_t i = chunk * CTX_CHUNK_SZ; i < ctx_chunk_end(ctx, chunk); i++) {
         assert(ctx->strs[i]);
 
         if (ctx->allocated[i].allocated) {
-            char* res = mk_strtab_str(ctx->strs[i], conv);
+            char* res = mk_strtab_str(ctx->strs[i], job->convs[tid]);
             if (!res) {
-                fprintf(stderr, "failed to convert string at %zu\n", i);
-                return false;
+                if (i < job->failed[tid])
+                    job->failed[tid] = i;
+                ret = false;
+                goto done;
             }
             free(ctx->strs[i]);
             ctx->strs[i] = res;
         }
     }
-    ctx->enc = STRTAB_ENC_SJIS;
-    return true;
+
+done:
+    STATS_END(span);
+    return ret;
 }
 
-static void ctx_hard_wrap(struct strtab_embed_ctx* ctx) {
-    assert(ctx->enc == STRTAB_ENC_SJIS);
+static bool ctx_conv(iconv_t conv, struct strtab_embed_ctx* ctx) {
+    STATS_BEGIN(span, STATS_CONV);
 
-    for (size_t i = 0; i < ctx->nstrs; i++) {
+    struct ctx_conv_job* job = malloc(sizeof(*job));
+    if (!job) {
+        perror("malloc");
+        STATS_END(span);
+        return false;
+    }
+
+    job->ctx = ctx;
+    for (size_t i = 0; i < POOL_NTHREADS_MAX; i++) {
+        job->convs[i] = (iconv_t)-1;
+        job->failed[i] = SIZE_MAX;
+    }
+    job->convs[0] = conv;
+
+    bool ret = pool_for(ctx_nchunks(ctx), 0, ctx_conv_chunk, job);
+
+    /**
+     * Items are handed out in ascending order, and those started before a failure are finished,
+     * so this is the index where a sequential loop would have stopped
+     */
+    size_t failed = SIZE_MAX;
+    for (size_t i = 0; i < POOL_NTHREADS_MAX; i++) {
+        if (job->failed[i] < failed)
+            failed = job->failed[i];
+        if (i > 0 && job->convs[i] != (iconv_t)-1) {
+#ifdef HAS_ICONV
+            iconv_close(job->convs[i]);
+#endif
+        }
+    }
+    if (failed != SIZE_MAX)
+        fprintf(stderr, "failed to convert string at %zu\n", failed);
+
+    free(job);
+
+    if (ret)
+        ctx->enc = STRTAB_ENC_SJIS;
+    STATS_ITEMS(STATS_CONV, ctx->nstrs);
+    STATS_END(span);
+    return ret;
+}
+
+static bool ctx_hard_wrap_chunk(size_t chunk, UNUSED size_t tid, void* arg) {
+    struct strtab_embed_ctx* ctx = arg;
+    STATS_BEGIN_WORKER(span, STATS_WRAP);
+
+    for (size_t i = chunk * CTX_CHUNK_SZ; i < ctx_chunk_end(ctx, chunk); i++) {
         assert(ctx->strs[i]);
 
-        if (ctx->allocated[i].allocated)
+        if (!ctx->allocated[i].allocated)
+            continue;
+
+        if (ctx->fit_frames)
+            fit_wrap_sjis(ctx->strs[i]);
+        else
             hard_wrap_sjis(ctx->strs[i]);
     }
+
+    STATS_END(span);
+    return true;
+}
+
+static void ctx_hard_wrap(struct strtab_embed_ctx* ctx) {
+    assert(ctx->enc == STRTAB_ENC_SJIS);
+    STATS_BEGIN(span, STATS_WRAP);
+
+    /* Strings are wrapped in place, each by a single thread */
+    pool_for(ctx_nchunks(ctx), 0, ctx_hard_wrap_chunk, ctx);
     ctx->wrapped = true;
+
+    STATS_ITEMS(STATS_WRAP, ctx->nstrs);
+    STATS_END(span);
 }
 
 iconv_t conv_for_embedding() {
@@ -73,24 +196,34 @@ static bool patch_ptr(uint8_t* rom, size_t rom_sz, uint32_t repl_vma, uint32_t p
     return true;
 }
 
-bool embed_strtab(uint8_t* rom, size_t rom_sz, struct strtab_embed_ctx* ectx, size_t max_sz,
-    uint32_t ptr_vma, iconv_t conv) {
-    assert(HAS_ICONV && conv != (iconv_t)-1);
-    assert(max_sz + VMA2OFFS(ectx->rom_vma) <= rom_sz);
-
+bool strtab_embed_ctx_to_sjis(struct strtab_embed_ctx* ctx, iconv_t conv) {
     /**
      * FIXME: Move length until newline check from ctx_conv to after ctx_hard_wrap, as the latter
      * creates more wraps.
      */
-    if (ectx->enc != STRTAB_ENC_SJIS && !ctx_conv(conv, ectx))
+    if (ctx->enc != STRTAB_ENC_SJIS && !ctx_conv(conv, ctx))
         return false;
 
-    if (!ectx->wrapped)
-        ctx_hard_wrap(ectx);
+    if (!ctx->wrapped)
+        ctx_hard_wrap(ctx);
+    return true;
+}
+
+bool embed_strtab(uint8_t* rom, size_t rom_sz, struct strtab_embed_ctx* ectx, size_t max_sz,
+    uint32_t ptr_vma, iconv_t conv) {
+    assert(HAS_ICONV && conv != (iconv_t)-1);
+    assert(max_sz + VMA2OFFS(ectx->rom_vma) <= rom_sz);
+
+    if (!strtab_embed_ctx_to_sjis(ectx, conv))
+        return false;
 
-    size_t nwritten;
-    if (!make_strtab((void*)ectx->strs, ectx->nstrs, &rom[VMA2OFFS(ectx->rom_vma)], max_sz,
-        &nwritten))
+    size_t nwritten = 0;
+    STATS_BEGIN(span, STATS_MAKE_STRTAB);
+    bool made = make_strtab((void*)ectx->strs, ectx->nstrs, &rom[VMA2OFFS(ectx->rom_vma)], max_sz,
+        &nwritten);
+    STATS_ITEMS(STATS_MAKE_STRTAB, nwritten);
+    STATS_END(span);
+    if (!made)
         return false;
 
     if (!patch_ptr(rom, rom_sz, ectx->rom_vma, ptr_vma))
@@ -125,6 +258,8 @@ struct strtab_embed_ctx* strtab_embed_ctx_new() {
     }
     ret->nstrs = 1; /* reserve placeholder */
     ret->enc = STRTAB_ENC_UTF8;
+    ret->wrapped = false;
+    ret->fit_frames = false;
 
     ret->strs[0] = EMBED_STR_PLACEHOLDER;
 
@@ -246,6 +381,220 @@ static bool patch_cksum_sz(uint8_t* rom, size_t rom_sz, size_t script_sz, uint32
     return true;
 }
 
+/* State of a single strtab while embedding a script */
+struct embed_strtab_job {
+    struct embed_job* job;
+    struct strtab_embed_ctx* ectx;
+    iconv_t conv;
+
+    FILE* fin;
+    size_t fsz;
+    uint32_t vma, sz, ptr_vma;
+};
+
+struct embed_job {
+    uint8_t* rom;
+    size_t rom_sz, script_sz_max, script_offs;
+    bool use_rom_strtab;
+
+    FILE* fscript;
+    const char* script_path;
+    size_t script_fsz;
+    uint32_t sz_to_patch_vma, script_ptr_vma;
+
+    struct script_parse_ctx* pctx;
+    struct script_as_ctx* actx;
+    char* fbuf;
+    void* ir;
+
+    struct embed_strtab_job strtabs[2]; /* script, menu */
+};
+
+static bool embed_parse(void* arg) {
+    struct embed_job* job = arg;
+
+    rewind(job->fscript);
+
+    /* A binary IR script can be used in place without parsing */
+    if (job->script_fsz > 0)
+        job->ir = mmap(NULL, job->script_fsz, PROT_READ, MAP_PRIVATE, fileno(job->fscript), 0);
+
+    struct script_parse_ctx* pctx = job->pctx;
+    bool parsed = false;
+    STATS_BEGIN(span, STATS_PARSE);
+
+    if (job->ir != MAP_FAILED && script_ir_is_ir(job->ir, job->script_fsz))
+        parsed = script_ir_load(pctx, job->ir, job->script_fsz);
+    else {
+        job->fbuf = malloc(job->script_fsz + 1);
+        if (!job->fbuf) {
+            perror("malloc");
+            goto done;
+        }
+
+        if (fread(job->fbuf, 1, job->script_fsz, job->fscript) < job->script_fsz) {
+            fprintf(stderr, "Failed to fread (error %d)\n", ferror(job->fscript));
+            goto done;
+        }
+        job->fbuf[job->script_fsz] = '\0';
+
+        pctx->script = job->fbuf;
+        parsed = script_parse_ctx_parse(pctx);
+    }
+    STATS_ITEMS(STATS_PARSE, pctx->nstmts);
+
+done:
+    STATS_END(span);
+    for (size_t i = 0; i < pctx->ndiags; i++)
+        fprintf(stderr, "%s:%zu:%zu: %s\n", job->script_path, pctx->diags[i].line,
+            pctx->diags[i].col, pctx->diags[i].msg);
+
+    return parsed;
+}
+
+/* Each strtab gets its own converter, as they are converted concurrently */
+static bool embed_iconv(void* arg) {
+    struct embed_job* job = arg;
+
+    for (size_t i = 0; i < 2; i++) {
+        job->strtabs[i].conv = conv_for_embedding();
+        if (job->strtabs[i].conv == (iconv_t)-1)
+            return false;
+    }
+    return true;
+}
+
+static bool embed_strtab_rom(void* arg) {
+    struct embed_strtab_job* sjob = arg;
+    struct embed_job* job = sjob->job;
+
+    return !job->use_rom_strtab || strtab_from_rom(job->rom, job->rom_sz, sjob->vma, sjob->ectx);
+}
+
+static bool embed_strtab_file(void* arg) {
+    struct embed_strtab_job* sjob = arg;
+
+    if (!strtab_embed_ctx_with_file(sjob->fin, sjob->fsz, sjob->ectx))
+        return false;
+    sjob->ectx->rom_vma = sjob->vma;
+    return true;
+}
+
+static bool embed_fill(void* arg) {
+    struct embed_job* job = arg;
+    STATS_BEGIN(span, STATS_FILL);
+
+    job->actx = script_as_ctx_new(job->pctx, &job->rom[job->script_offs], job->script_sz_max,
+        job->strtabs[0].ectx, job->strtabs[1].ectx);
+    bool ret = job->actx && script_fill_strtabs(job->actx);
+
+    STATS_ITEMS(STATS_FILL, job->strtabs[0].ectx->nstrs + job->strtabs[1].ectx->nstrs);
+    STATS_END(span);
+    return ret;
+}
+
+static bool embed_conv(void* arg) {
+    struct embed_strtab_job* sjob = arg;
+    return ctx_conv(sjob->conv, sjob->ectx);
+}
+
+static bool embed_wrap(void* arg) {
+    struct embed_strtab_job* sjob = arg;
+    ctx_hard_wrap(sjob->ectx);
+    return true;
+}
+
+static bool embed_split_Choice(void* arg) {
+    struct embed_job* job = arg;
+    STATS_BEGIN(span, STATS_SPLIT);
+    bool ret = split_Choice_stmts(job->actx);
+    STATS_ITEMS(STATS_SPLIT, job->pctx->nstmts);
+    STATS_END(span);
+    return ret;
+}
+
+static bool embed_split_ShowText(void* arg) {
+    struct embed_job* job = arg;
+    STATS_BEGIN(span, STATS_SPLIT);
+    bool ret = split_ShowText_stmts(job->actx);
+    STATS_ITEMS(STATS_SPLIT, job->pctx->nstmts);
+    STATS_END(span);
+    return ret;
+}
+
+static bool embed_assemble(void* arg) {
+    struct embed_job* job = arg;
+    uint8_t* rom = job->rom;
+    STATS_BEGIN(span, STATS_ASSEMBLE);
+
+    bool ret = script_assemble(job->actx) &&
+        patch_cksum_sz(rom, job->rom_sz,
+            script_sz((void*)&rom[job->script_offs]) + sizeof(struct script_hdr),
+            job->sz_to_patch_vma) &&
+        patch_ptr(rom, job->rom_sz, OFFS2VMA(job->script_offs), job->script_ptr_vma);
+
+    if (ret) {
+        STATS_ITEMS(STATS_ASSEMBLE, script_sz((void*)&rom[job->script_offs]));
+        fprintf(stderr, "Embedded script at 0x%lx using %zu B, %zu statements inserted by "
+            "splitting\n", OFFS2VMA(job->script_offs),
+            script_sz((void*)&rom[job->script_offs]) + sizeof(struct script_hdr),
+            script_as_nstmts_inserted(job->actx));
+    }
+    STATS_END(span);
+    return ret;
+}
+
+static bool embed_encode(void* arg) {
+    struct embed_strtab_job* sjob = arg;
+    struct embed_job* job = sjob->job;
+
+    if (!embed_strtab(job->rom, job->rom_sz, sjob->ectx, sjob->sz, sjob->ptr_vma, sjob->conv)) {
+        fprintf(stderr, "Failed to embed %s strtab\n", sjob == &job->strtabs[0] ? "script" :
+            "menu");
+        return false;
+    }
+    return true;
+}
+
+/* Script strings are final once ShowText is split */
+static bool embed_glyph_pos(void* arg) {
+    struct embed_job* job = arg;
+    struct strtab_embed_ctx* ectx = job->strtabs[0].ectx;
+
+    if (VMA2OFFS(GLYPH_POS_VMA) + GLYPH_POS_SZ_MAX > job->rom_sz) {
+        fprintf(stderr, "ROM too small for glyph positions at 0x%x\n", GLYPH_POS_VMA);
+        return false;
+    }
+
+    size_t written, nstored;
+    if (!glyph_pos_build(ectx->strs, ectx->nstrs, &job->rom[VMA2OFFS(GLYPH_POS_VMA)],
+            GLYPH_POS_SZ_MAX, &written, &nstored))
+        return false;
+
+    uint32_t vma = GLYPH_POS_VMA;
+    memcpy(&job->rom[VMA2OFFS(GLYPH_POS_PTR_VMA)], &vma, sizeof(vma));
+
+    fprintf(stderr, "Stored glyph positions of %zu strings at 0x%x using %zu B\n", nstored,
+        GLYPH_POS_VMA, written);
+    return true;
+}
+
+/**
+ * The stages of embedding form a task graph, so that independent ones run concurrently:
+ *
+ *   rom strtab -> strtab file --.
+ *   parse ----------------------+-> fill --.
+ *   iconv ---------------------------------+-> conv -> wrap
+ *
+ * where the stages from rom strtab to wrap run for both the script and the menu strtab, then
+ *
+ *   wrap script, wrap menu -> split Choice -> split ShowText -> assemble, encode script
+ *   wrap menu -> encode menu
+ *   split ShowText -> glyph pos, if enabled
+ *
+ * Nothing but the menu strtab is read by Choice splitting, so it can be encoded right after
+ * wrapping, while the script strtab gets new strings until ShowText is split.
+ */
 bool embed_script(uint8_t* rom, size_t rom_sz, size_t script_sz_max, size_t script_offs,
         bool use_rom_strtab,
         FILE* fscript, FILE* strtab_scr, FILE* strtab_menu,
@@ -253,121 +602,142 @@ bool embed_script(uint8_t* rom, size_t rom_sz, size_t script_sz_max, size_t scri
         size_t script_fsz, size_t strtab_scr_fsz, size_t strtab_menu_fsz,
         uint32_t strtab_scr_vma, uint32_t strtab_menu_vma,
         uint32_t strtab_scr_sz, uint32_t strtab_menu_sz,
-        uint32_t sz_to_patch_vma, uint32_t script_ptr_vma) {
+        uint32_t sz_to_patch_vma, uint32_t script_ptr_vma,
+        bool fit_frames, bool glyph_pos, bool print_critical_path) {
     bool ret = false;
-    struct script_parse_ctx* pctx = NULL;
-    iconv_t conv = (iconv_t)-1;
-    struct strtab_embed_ctx* ectx_scr = NULL, * ectx_menu = NULL;
-    struct script_as_ctx* actx = NULL;
 
     if (!fscript)
         return false;
 
-    rewind(fscript);
+    struct embed_job job = {
+        .rom = rom,
+        .rom_sz = rom_sz,
+        .script_sz_max = script_sz_max,
+        .script_offs = script_offs,
+        .use_rom_strtab = use_rom_strtab,
+        .fscript = fscript,
+        .script_path = script_path,
+        .script_fsz = script_fsz,
+        .sz_to_patch_vma = sz_to_patch_vma,
+        .script_ptr_vma = script_ptr_vma,
+        .ir = MAP_FAILED,
+        .strtabs = {
+            {.fin = strtab_scr, .fsz = strtab_scr_fsz, .vma = strtab_scr_vma,
+                .sz = strtab_scr_sz, .ptr_vma = STRTAB_SCRIPT_PTR_VMA},
+            {.fin = strtab_menu, .fsz = strtab_menu_fsz, .vma = strtab_menu_vma,
+                .sz = strtab_menu_sz, .ptr_vma = STRTAB_MENU_PTR_VMA}
+        }
+    };
+
+    for (size_t i = 0; i < 2; i++) {
+        job.strtabs[i].job = &job;
+        job.strtabs[i].conv = (iconv_t)-1;
+        job.strtabs[i].ectx = strtab_embed_ctx_new();
+        if (!job.strtabs[i].ectx)
+            goto done;
+    }
+    /* Only script strings are split into frames */
+    job.strtabs[0].ectx->fit_frames = fit_frames;
 
-    char* fbuf = malloc(script_fsz + 1);
-    if (!fbuf) {
+    job.pctx = malloc(sizeof(*job.pctx));
+    if (!job.pctx) {
         perror("malloc");
         goto done;
     }
 
-    if (fread(fbuf, 1, script_fsz, fscript) < script_fsz) {
-        fprintf(stderr, "Failed to fread (error %d)\n", ferror(fscript));
+    if (!script_parse_ctx_init(job.pctx, NULL)) {
+        free(job.pctx);
+        job.pctx = NULL;
         goto done;
     }
-    fbuf[script_fsz] = '\0';
+    job.pctx->filename = script_path;
 
-    pctx = malloc(sizeof(*pctx));
-    if (!pctx) {
+    struct task_graph* g = malloc(sizeof(*g));
+    if (!g) {
         perror("malloc");
         goto done;
     }
-
-    if (!script_parse_ctx_init(pctx, fbuf)) {
-        pctx = NULL;
-        goto done;
+    task_graph_init(g);
+
+    size_t parse = task_add(g, "parse", embed_parse, &job);
+    size_t iconv = task_add(g, "iconv", embed_iconv, &job);
+    size_t file[2], wrap[2];
+
+    for (size_t i = 0; i < 2; i++) {
+        struct embed_strtab_job* sjob = &job.strtabs[i];
+        size_t rom_strtab = task_add(g, i ? "rom strtab menu" : "rom strtab script",
+            embed_strtab_rom, sjob);
+        file[i] = task_add(g, i ? "strtab file menu" : "strtab file script", embed_strtab_file,
+            sjob);
+        task_dep(g, file[i], rom_strtab);
     }
-    pctx->filename = script_path;
 
-    bool parsed = script_parse_ctx_parse(pctx);
-    for (size_t i = 0; i < pctx->ndiags; i++)
-        fprintf(stderr, "%s:%zu:%zu: %s\n", script_path, pctx->diags[i].line, pctx->diags[i].col,
-            pctx->diags[i].msg);
-
-    if (!parsed)
-        goto done;
-
-    conv = conv_for_embedding();
-    if (conv == (iconv_t)-1)
-        goto done;
-
-    ectx_scr = strtab_embed_ctx_new();
-    ectx_menu = strtab_embed_ctx_new();
-
-    if (!ectx_scr || !ectx_menu)
-        goto done;
-
-    if (use_rom_strtab &&
-        (!strtab_from_rom(rom, rom_sz, strtab_scr_vma, ectx_scr) ||
-        !strtab_from_rom(rom, rom_sz, strtab_menu_vma, ectx_menu)))
-        goto done;
+    size_t fill = task_add(g, "fill", embed_fill, &job);
+    task_dep(g, fill, parse);
+    task_dep(g, fill, file[0]);
+    task_dep(g, fill, file[1]);
+
+    for (size_t i = 0; i < 2; i++) {
+        size_t conv = task_add(g, i ? "conv menu" : "conv script", embed_conv, &job.strtabs[i]);
+        task_dep(g, conv, fill);
+        task_dep(g, conv, iconv);
+        wrap[i] = task_add(g, i ? "wrap menu" : "wrap script", embed_wrap, &job.strtabs[i]);
+        task_dep(g, wrap[i], conv);
+    }
 
-    if (!strtab_embed_ctx_with_file(strtab_scr, strtab_scr_fsz, ectx_scr) ||
-        !strtab_embed_ctx_with_file(strtab_menu, strtab_menu_fsz, ectx_menu))
-        goto done;
+    size_t split_Choice = task_add(g, "split Choice", embed_split_Choice, &job);
+    task_dep(g, split_Choice, wrap[0]);
+    task_dep(g, split_Choice, wrap[1]);
 
-    if (!ectx_scr || !ectx_menu)
-        goto done;
+    size_t split_ShowText = task_add(g, "split ShowText", embed_split_ShowText, &job);
+    task_dep(g, split_ShowText, split_Choice);
 
-    ectx_scr->rom_vma = strtab_scr_vma;
-    ectx_menu->rom_vma = strtab_menu_vma;
+    size_t assemble = task_add(g, "assemble", embed_assemble, &job);
+    task_dep(g, assemble, split_ShowText);
 
-    // fprintf(stderr, "ectx_scr %zu menu %zu\n", ectx_scr->nstrs, ectx_menu->nstrs);
+    size_t encode_scr = task_add(g, "encode script", embed_encode, &job.strtabs[0]);
+    task_dep(g, encode_scr, split_ShowText);
 
-    actx = script_as_ctx_new(pctx, &rom[script_offs], script_sz_max, ectx_scr, ectx_menu);
-    ret = script_fill_strtabs(actx);
+    size_t encode_menu = task_add(g, "encode menu", embed_encode, &job.strtabs[1]);
+    task_dep(g, encode_menu, wrap[1]);
 
-    ret = ret && ctx_conv(conv, ectx_scr) && ctx_conv(conv, ectx_menu);
-    if (ret) {
-        ctx_hard_wrap(ectx_scr);
-        ctx_hard_wrap(ectx_menu);
+    if (glyph_pos) {
+        size_t pos = task_add(g, "glyph pos", embed_glyph_pos, &job);
+        task_dep(g, pos, split_ShowText);
+    } else if (VMA2OFFS(GLYPH_POS_PTR_VMA) + sizeof(uint32_t) <= rom_sz) {
+        /* Positions stored by an earlier run are for other strings */
+        memset(&rom[VMA2OFFS(GLYPH_POS_PTR_VMA)], 0, sizeof(uint32_t));
     }
 
-    /* NOTE: As Choice splitting may generate new ShowText, it must be done in this order */
-    ret = ret && split_Choice_stmts(actx) && split_ShowText_stmts(actx);
-
-    size_t script_storage_used = 0;
+    ret = task_graph_run(g, 0);
 
-    ret = ret && script_assemble(actx) &&
-        patch_cksum_sz(rom, rom_sz,
-            (script_storage_used = script_sz((void*)&rom[script_offs]) + sizeof(struct script_hdr)),
-            sz_to_patch_vma) &&
-        patch_ptr(rom, rom_sz, OFFS2VMA(script_offs), script_ptr_vma) &&
-        embed_strtabs(rom, rom_sz, ectx_scr, ectx_menu, strtab_scr_sz, strtab_menu_sz, conv);
-
-    if (ret)
-        fprintf(stderr, "Embedded script at 0x%lx using %zu B\n", OFFS2VMA(script_offs),
-            script_sz((void*)&rom[script_offs]) + sizeof(struct script_hdr));
-    else
+    if (!ret)
         fprintf(stderr, "Failed to embed script\n");
+    if (print_critical_path)
+        task_graph_print_critical_path(g, stderr);
+
+    free(g);
 
 done:
-    if (conv != (iconv_t)-1) {
+    for (size_t i = 0; i < 2; i++) {
+        if (job.strtabs[i].conv != (iconv_t)-1) {
 #ifdef HAS_ICONV
-        iconv_close(conv);
+            iconv_close(job.strtabs[i].conv);
 #endif
+        }
+        if (job.strtabs[i].ectx)
+            strtab_embed_ctx_free(job.strtabs[i].ectx);
     }
-    if (fbuf)
-        free(fbuf);
-    if (pctx) {
-        script_parse_ctx_free(pctx);
-        free(pctx);
+    if (job.fbuf)
+        free(job.fbuf);
+    if (job.pctx) {
+        script_parse_ctx_free(job.pctx);
+        free(job.pctx);
     }
-    if (ectx_scr)
-        strtab_embed_ctx_free(ectx_scr);
-    if (ectx_menu)
-        strtab_embed_ctx_free(ectx_menu);
-    if (actx)
-        script_as_ctx_free(actx);
+    /* The parse context borrows strings from the mapping, so unmap it last */
+    if (job.ir != MAP_FAILED)
+        munmap(job.ir, script_fsz);
+    if (job.actx)
+        script_as_ctx_free(job.actx);
     return ret;
 }
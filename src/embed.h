@@ -20,15 +20,19 @@
 #define EMBED_STR_PLACEHOLDER ""
 #define EMBED_STR_PLACEHOLDER_IDX 0
 
+struct sjis_layout;
+
 struct strtab_embed_ctx {
     enum {STRTAB_ENC_UTF8, STRTAB_ENC_SJIS} enc;
     bool wrapped;
+    bool fit_frames; /* wrap with fit_wrap_sjis instead of hard_wrap_sjis */
     size_t nstrs; /* in total incl. placeholders */
     char* strs[EMBED_STRTAB_SZ];
     uint32_t rom_vma;
     struct {
         bool allocated; /* must be freed */
         bool used; /* is referenced */
+        struct sjis_layout* layout; /* cached by strtab_embed_layout */
     } allocated[EMBED_STRTAB_SZ];
 };
 
@@ -36,6 +40,9 @@ struct strtab_embed_ctx {
 #define STRTAB_MENU_PTR_VMA 0x8004C24
 
 iconv_t conv_for_embedding();
+/* Convert the strings to SJIS and hard wrap them, unless already done */
+bool strtab_embed_ctx_to_sjis(struct strtab_embed_ctx* ctx, iconv_t conv);
+
 bool embed_strtab(uint8_t* rom, size_t rom_sz, struct strtab_embed_ctx* ectx, size_t max_sz,
     uint32_t ptr_vma, iconv_t conv);
 bool embed_strtabs(uint8_t* rom, size_t rom_sz, struct strtab_embed_ctx* ectx_script,
@@ -44,8 +51,21 @@ bool embed_strtabs(uint8_t* rom, size_t rom_sz, struct strtab_embed_ctx* ectx_sc
 bool strtab_embed_ctx_with_file(FILE* fin, size_t sz, struct strtab_embed_ctx* ectx);
 struct strtab_embed_ctx* strtab_embed_ctx_new();
 void strtab_embed_ctx_free(struct strtab_embed_ctx* ctx);
+/**
+ * Layout of SJIS string idx, worked out on first use. The string must not change until the layout
+ * is dropped.
+ */
+const struct sjis_layout* strtab_embed_layout(struct strtab_embed_ctx* ctx, size_t idx);
+void strtab_embed_layout_drop(struct strtab_embed_ctx* ctx, size_t idx);
 size_t strtab_embed_min_rom_sz();
 
+/**
+ * Assemble the script from fscript (text or IR) into rom at script_offs and embed both strtabs.
+ * Independent stages run concurrently. If fit_frames is set, script strings are wrapped to take as
+ * few frames as possible. If glyph_pos is set, the glyph positions of script strings are stored at
+ * GLYPH_POS_VMA for render_sjis. If print_critical_path is set, the chain of stages that bounded
+ * the run time is printed to stderr.
+ */
 bool embed_script(uint8_t* rom, size_t rom_sz, size_t script_sz_max, size_t script_offs,
         bool use_rom_strtab,
         FILE* fscript, FILE* strtab_scr, FILE* strtab_menu,
@@ -53,6 +73,7 @@ bool embed_script(uint8_t* rom, size_t rom_sz, size_t script_sz_max, size_t scri
         size_t script_fsz, size_t strtab_scr_fsz, size_t strtab_menu_fsz,
         uint32_t strtab_scr_vma, uint32_t strtab_menu_vma,
         uint32_t strtab_scr_sz, uint32_t strtab_menu_sz,
-        uint32_t sz_to_patch_vma, uint32_t script_ptr_vma);
+        uint32_t sz_to_patch_vma, uint32_t script_ptr_vma,
+        bool fit_frames, bool glyph_pos, bool print_critical_path);
 
 #endif
@@ -0,0 +1,415 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "defs.h"
+#include "embed.h"
+#include "fts.h"
+#include "strtab.h"
+
+#define FTS_NSTRS_MAX (UINT16_MAX + 1)
+
+uint32_t do_crc32(const void* buf, size_t size);
+
+/* Digits of the trigram in a key (trigram << 16 | idx), sorted in two passes */
+#define KEY_DIGIT_BITS 12
+#define KEY_NDIGITS (1 << KEY_DIGIT_BITS)
+
+static uint8_t fold(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static uint32_t tri_at(const char* s) {
+    return (uint32_t)fold(s[0]) << 16 | (uint32_t)fold(s[1]) << 8 | fold(s[2]);
+}
+
+static size_t fts_sz(size_t nstrs, size_t ntris, size_t npostings, size_t text_sz) {
+    return sizeof(struct fts_hdr) + (nstrs + 1) * sizeof(uint32_t) +
+        (ntris + 1) * sizeof(struct fts_tri) + npostings * sizeof(uint16_t) + text_sz;
+}
+
+/* Point the arrays of f into buf, which holds an index of sz bytes. False if it is malformed */
+static bool fts_init(struct fts* f, void* buf, size_t sz) {
+    const struct fts_hdr* hdr = buf;
+
+    if (sz < sizeof(*hdr) || hdr->side.magic != FTS_MAGIC ||
+            hdr->side.version != FTS_VERSION ||
+            sz != fts_sz(hdr->nstrs, hdr->ntris, hdr->npostings, hdr->text_sz))
+        return false;
+
+    f->hdr = hdr;
+    f->str_offs = (const void*)(hdr + 1);
+    f->tris = (const void*)(f->str_offs + hdr->nstrs + 1);
+    f->postings = (const void*)(f->tris + hdr->ntris + 1);
+    f->text = (const void*)(f->postings + hdr->npostings);
+    f->buf = buf;
+
+    return f->str_offs[hdr->nstrs] == hdr->text_sz &&
+        f->tris[hdr->ntris].first == hdr->npostings && hdr->text_sz && !f->text[hdr->text_sz - 1];
+}
+
+/* Stable sort of keys by the trigram, so that the indices of each stay in ascending order */
+static void sort_keys(uint64_t* keys, uint64_t* tmp, size_t n) {
+    static_assert(2 * KEY_DIGIT_BITS >= 24, "");
+
+    for (unsigned shift = 16; shift < 16 + 2 * KEY_DIGIT_BITS; shift += KEY_DIGIT_BITS) {
+        size_t counts[KEY_NDIGITS] = {0};
+
+        for (size_t i = 0; i < n; i++)
+            counts[keys[i] >> shift & (KEY_NDIGITS - 1)]++;
+        for (size_t d = 0, sum = 0; d < KEY_NDIGITS; d++) {
+            size_t c = counts[d];
+            counts[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            tmp[counts[keys[i] >> shift & (KEY_NDIGITS - 1)]++] = keys[i];
+
+        memcpy(keys, tmp, n * sizeof(*keys));
+    }
+}
+
+bool fts_build(struct fts* f, char* const* strs, size_t nstrs) {
+    if (nstrs > FTS_NSTRS_MAX) {
+        fprintf(stderr, "Too many strings to index\n");
+        return false;
+    }
+
+    size_t text_sz = 0, nkeys = 0;
+    for (size_t i = 0; i < nstrs; i++) {
+        size_t len = strs[i] ? strlen(strs[i]) : 0;
+        text_sz += len + 1;
+        nkeys += len > 2 ? len - 2 : 0;
+    }
+    if (!text_sz)
+        text_sz = 1;
+
+    uint64_t* keys = malloc(nkeys * sizeof(*keys) + 1);
+    uint64_t* tmp = malloc(nkeys * sizeof(*tmp) + 1);
+    uint8_t* buf = NULL;
+    bool ret = false;
+
+    if (!keys || !tmp) {
+        perror("malloc");
+        goto done;
+    }
+
+    /* Strings are visited in order, so the keys of each trigram are already sorted by index */
+    size_t n = 0;
+    for (size_t i = 0; i < nstrs; i++) {
+        const char* s = strs[i];
+        for (size_t j = 0; s && s[j] && s[j + 1] && s[j + 2]; j++)
+            keys[n++] = (uint64_t)tri_at(&s[j]) << 16 | i;
+    }
+    sort_keys(keys, tmp, n);
+
+    /* Drop trigrams repeated within a string */
+    size_t npostings = 0, ntris = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i && keys[i] == keys[npostings - 1])
+            continue;
+        if (!npostings || keys[i] >> 16 != keys[npostings - 1] >> 16)
+            ntris++;
+        keys[npostings++] = keys[i];
+    }
+
+    size_t sz = fts_sz(nstrs, ntris, npostings, text_sz);
+    buf = malloc(sz);
+    if (!buf) {
+        perror("malloc");
+        goto done;
+    }
+
+    struct fts_hdr* hdr = (void*)buf;
+    *hdr = (struct fts_hdr){.side = {.magic = FTS_MAGIC, .version = FTS_VERSION}, .nstrs = nstrs,
+        .ntris = ntris, .npostings = npostings, .text_sz = text_sz};
+
+    uint32_t* str_offs = (void*)(hdr + 1);
+    struct fts_tri* tris = (void*)(str_offs + nstrs + 1);
+    uint16_t* postings = (void*)(tris + ntris + 1);
+    char* text = (void*)(postings + npostings);
+
+    size_t offs = 0;
+    for (size_t i = 0; i < nstrs; i++) {
+        size_t len = strs[i] ? strlen(strs[i]) : 0;
+        str_offs[i] = offs;
+        memcpy(&text[offs], strs[i] ? strs[i] : "", len + 1);
+        offs += len + 1;
+    }
+    str_offs[nstrs] = text_sz;
+    text[text_sz - 1] = '\0';
+
+    size_t t = 0;
+    for (size_t i = 0; i < npostings; i++) {
+        if (!i || keys[i] >> 16 != keys[i - 1] >> 16)
+            tris[t++] = (struct fts_tri){.tri = keys[i] >> 16, .first = i};
+        postings[i] = keys[i] & UINT16_MAX;
+    }
+    tris[ntris] = (struct fts_tri){.tri = UINT32_MAX, .first = npostings};
+
+    ret = fts_init(f, buf, sz);
+    f->map_sz = 0;
+
+done:
+    if (!ret)
+        free(buf);
+    free(keys);
+    free(tmp);
+    return ret;
+}
+
+bool fts_load(struct fts* f, const char* path, uint32_t src_sz, uint32_t src_crc,
+        uint32_t src_vma) {
+    struct side_file_hdr want = {FTS_MAGIC, FTS_VERSION, src_sz, src_crc};
+    size_t sz;
+    struct fts_hdr* hdr = side_file_map(path, &want, sizeof(struct fts_hdr), &sz);
+    if (!hdr)
+        return false;
+
+    if (hdr->src_vma != src_vma || !fts_init(f, hdr, sz)) {
+        side_file_free(hdr, sz);
+        return false;
+    }
+    f->map_sz = sz;
+    return true;
+}
+
+bool fts_save(const struct fts* f, const char* path, uint32_t src_sz, uint32_t src_crc,
+        uint32_t src_vma) {
+    struct fts_hdr hdr = *f->hdr;
+    hdr.side.src_sz = src_sz;
+    hdr.side.src_crc = src_crc;
+    hdr.src_vma = src_vma;
+
+    struct side_file_part parts[] = {
+        {&hdr, sizeof(hdr)},
+        {f->hdr + 1, fts_sz(hdr.nstrs, hdr.ntris, hdr.npostings, hdr.text_sz) - sizeof(hdr)}
+    };
+    return side_file_save(path, parts, sizeof(parts) / sizeof(*parts));
+}
+
+static bool fts_from_ectx(struct fts* f, const struct strtab_embed_ctx* ectx) {
+    char** strs = malloc(ectx->nstrs * sizeof(*strs) + 1);
+    if (!strs) {
+        perror("malloc");
+        return false;
+    }
+
+    /* Index 0 is a placeholder, and files may skip indices */
+    for (size_t i = 0; i < ectx->nstrs; i++)
+        strs[i] = i && ectx->allocated[i].allocated ? ectx->strs[i] : NULL;
+
+    bool ret = fts_build(f, strs, ectx->nstrs);
+    free(strs);
+    return ret;
+}
+
+/* Size and CRC of the bytes of the strtab file, read in full */
+static bool file_fingerprint(FILE* fin, const char* src_path, uint32_t* src_sz,
+        uint32_t* src_crc) {
+    struct stat st;
+    if (fstat(fileno(fin), &st) == -1) {
+        perror(src_path);
+        return false;
+    }
+
+    char* buf = malloc(st.st_size + 1);
+    if (!buf) {
+        perror("malloc");
+        return false;
+    }
+
+    bool ret = fread(buf, 1, st.st_size, fin) == (size_t)st.st_size;
+    if (ret) {
+        *src_sz = st.st_size;
+        *src_crc = do_crc32(buf, st.st_size);
+    } else {
+        fprintf(stderr, "Failed to fread %s\n", src_path);
+    }
+    free(buf);
+    return ret;
+}
+
+bool fts_for_strtab(struct fts* f, const char* path, const char* name, const char* src_path,
+        const uint8_t* rom, size_t rom_sz, uint32_t ptr_vma) {
+    bool ret = false;
+    FILE* fin = NULL;
+    struct strtab_embed_ctx* ectx = NULL;
+    uint32_t src_sz, src_crc, src_vma = 0;
+
+    if (src_path) {
+        fin = fopen(src_path, "rb");
+        if (!fin) {
+            perror(src_path);
+            return false;
+        }
+        if (!file_fingerprint(fin, src_path, &src_sz, &src_crc))
+            goto done;
+    } else {
+        if (VMA2OFFS(ptr_vma) + sizeof(uint32_t) > rom_sz) {
+            fprintf(stderr, "ROM too small for a %s strtab pointer\n", name);
+            return false;
+        }
+        memcpy(&src_vma, &rom[VMA2OFFS(ptr_vma)], sizeof(src_vma));
+
+        size_t strtab_sz;
+        if (!strtab_rom_sz(rom, rom_sz, src_vma, &strtab_sz))
+            return false;
+        src_sz = strtab_sz;
+        src_crc = do_crc32(&rom[VMA2OFFS(src_vma)], strtab_sz);
+    }
+
+    if (fts_load(f, path, src_sz, src_crc, src_vma)) {
+        ret = true;
+        goto done;
+    }
+
+    ectx = strtab_embed_ctx_new();
+    if (!ectx)
+        goto done;
+    if (src_path ? !strtab_embed_ctx_with_file(fin, src_sz, ectx) :
+            !strtab_from_rom(rom, rom_sz, src_vma, ectx))
+        goto done;
+
+    ret = fts_from_ectx(f, ectx);
+    if (ret) {
+        fprintf(stderr, "Indexed %u %s strings into %s\n", f->hdr->nstrs, name, path);
+        if (!fts_save(f, path, src_sz, src_crc, src_vma))
+            fprintf(stderr, "Failed to save index to %s\n", path);
+    }
+
+done:
+    if (fin && fclose(fin))
+        perror("fclose");
+    if (ectx)
+        strtab_embed_ctx_free(ectx);
+    return ret;
+}
+
+void fts_free(struct fts* f) {
+    side_file_free(f->buf, f->map_sz);
+    *f = (struct fts){0};
+}
+
+const char* fts_str(const struct fts* f, size_t idx) {
+    return idx < f->hdr->nstrs ? &f->text[f->str_offs[idx]] : "";
+}
+
+static bool contains(const char* s, const char* query, size_t len) {
+    for (; *s; s++) {
+        size_t i;
+        for (i = 0; i < len && s[i] && fold(s[i]) == fold(query[i]); i++)
+            ;
+        if (i == len)
+            return true;
+    }
+    return !len;
+}
+
+/* Posting list of a trigram, empty if it does not occur */
+static const uint16_t* postings_of(const struct fts* f, uint32_t tri, size_t* n) {
+    size_t l = 0, r = f->hdr->ntris;
+
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        if (f->tris[m].tri < tri)
+            l = m + 1;
+        else
+            r = m;
+    }
+
+    *n = l < f->hdr->ntris && f->tris[l].tri == tri ? f->tris[l + 1].first - f->tris[l].first : 0;
+    return &f->postings[f->tris[l].first];
+}
+
+struct list {
+    const uint16_t* postings;
+    size_t n;
+};
+
+static int cmp_list(const void* a, const void* b) {
+    const struct list* l = a, * r = b;
+    return l->n < r->n ? -1 : l->n > r->n;
+}
+
+/* Keep the candidates that are in list, both in ascending order */
+static size_t intersect(uint16_t* cands, size_t ncands, const struct list* list) {
+    size_t n = 0, j = 0;
+
+    for (size_t i = 0; i < ncands && j < list->n; i++) {
+        /* Candidates are few, so skip ahead by binary search */
+        size_t l = j, r = list->n;
+        while (l < r) {
+            size_t m = l + (r - l) / 2;
+            if (list->postings[m] < cands[i])
+                l = m + 1;
+            else
+                r = m;
+        }
+        j = l;
+        if (j < list->n && list->postings[j] == cands[i])
+            cands[n++] = cands[i];
+    }
+    return n;
+}
+
+uint16_t* fts_find(const struct fts* f, const char* query, size_t* n) {
+    size_t len = strlen(query);
+    size_t nstrs = f->hdr->nstrs;
+
+    uint16_t* cands = NULL;
+    struct list* lists = NULL;
+    size_t ncands = 0;
+
+    if (len < 3) {
+        /* No trigram to look up, so every string is a candidate */
+        cands = malloc(nstrs * sizeof(*cands) + 1);
+        if (!cands)
+            goto fail;
+        for (size_t i = 0; i < nstrs; i++)
+            cands[ncands++] = i;
+    } else {
+        size_t nlists = len - 2;
+        lists = malloc(nlists * sizeof(*lists));
+        if (!lists)
+            goto fail;
+
+        for (size_t i = 0; i < nlists; i++) {
+            lists[i].postings = postings_of(f, tri_at(&query[i]), &lists[i].n);
+            if (!lists[i].n)
+                nlists = 0;
+        }
+        qsort(lists, nlists, sizeof(*lists), cmp_list);
+
+        cands = malloc((nlists ? lists[0].n : 0) * sizeof(*cands) + 1);
+        if (!cands)
+            goto fail;
+        if (nlists) {
+            memcpy(cands, lists[0].postings, lists[0].n * sizeof(*cands));
+            ncands = lists[0].n;
+        }
+
+        for (size_t i = 1; i < nlists && ncands; i++)
+            ncands = intersect(cands, ncands, &lists[i]);
+        free(lists);
+        lists = NULL;
+    }
+
+    /* Trigrams may be spread over a string, so check that it contains the query */
+    *n = 0;
+    for (size_t i = 0; i < ncands; i++)
+        if (contains(fts_str(f, cands[i]), query, len))
+            cands[(*n)++] = cands[i];
+    return cands;
+
+fail:
+    perror("malloc");
+    free(lists);
+    return NULL;
+}
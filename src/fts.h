@@ -0,0 +1,81 @@
+#ifndef FTS_H
+#define FTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "side_file.h"
+
+/**
+ * Full text search over the UTF-8 strings of a strtab, by their byte trigrams (ASCII letters are
+ * case-folded). A query is answered by intersecting the posting lists of its trigrams, and then
+ * checking that the candidates contain it. The index is laid out like its file:
+ *
+ *   struct fts_hdr
+ *   uint32_t str_offs[nstrs + 1] -- into text, string idx spans [str_offs[idx], str_offs[idx + 1])
+ *   struct fts_tri tris[ntris + 1] -- sorted by trigram, the last one only ends the postings
+ *   uint16_t postings[npostings] -- ascending string indices for each trigram
+ *   char text[text_sz] -- NUL-terminated strings
+ *
+ * The source it was built from, a strtab of a ROM or a file, is identified by the size and CRC of
+ * its bytes and by its address, so that a stale index is rebuilt without the strtab being parsed
+ * to find out.
+ */
+
+#define FTS_MAGIC 0x53544653 /* SFTS */
+#define FTS_VERSION 2
+#define FTS_SUFFIX ".fts"
+
+struct fts_hdr {
+    struct side_file_hdr side; /* of the strtab */
+    uint32_t src_vma; /* 0 for a file */
+    uint32_t nstrs;
+    uint32_t ntris;
+    uint32_t npostings;
+    uint32_t text_sz;
+};
+
+struct fts_tri {
+    uint32_t tri; /* first byte in bits 16-23 */
+    uint32_t first; /* index of its first posting */
+};
+
+struct fts {
+    const struct fts_hdr* hdr;
+    const uint32_t* str_offs;
+    const struct fts_tri* tris;
+    const uint16_t* postings;
+    const char* text;
+
+    /* Either allocated by fts_build or mapped by fts_load */
+    void* buf;
+    size_t map_sz;
+};
+
+/* Index strs[0..nstrs), of which NULL ones are missing. nstrs must fit a posting */
+bool fts_build(struct fts* f, char* const* strs, size_t nstrs);
+/* Fails quietly if the file does not exist or is for another source */
+bool fts_load(struct fts* f, const char* path, uint32_t src_sz, uint32_t src_crc,
+    uint32_t src_vma);
+bool fts_save(const struct fts* f, const char* path, uint32_t src_sz, uint32_t src_crc,
+    uint32_t src_vma);
+/**
+ * Load the index at path of the strtab file at src_path, or of the strtab of rom that the word at
+ * ptr_vma points to when src_path is NULL. The strtab is only parsed if the index is missing or
+ * stale, and then the index is built and saved to path. name is only for messages.
+ */
+bool fts_for_strtab(struct fts* f, const char* path, const char* name, const char* src_path,
+    const uint8_t* rom, size_t rom_sz, uint32_t ptr_vma);
+void fts_free(struct fts* f);
+
+/* Empty if missing */
+const char* fts_str(const struct fts* f, size_t idx);
+
+/**
+ * Indices of the strings that contain query, in ascending order. Returns NULL on allocation
+ * failure, otherwise the caller frees the result.
+ */
+uint16_t* fts_find(const struct fts* f, const char* query, size_t* n);
+
+#endif
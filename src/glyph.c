@@ -4,193 +4,595 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "agb/config.h"
+#include "agb/glyph_layout.h"
 #include "agb/glyph_margins.h"
+#include "agb/glyph_pos.h"
 #include "glyph.h"
 
-static unsigned word_end(const char* sjis, unsigned xoffs) {
-    /* Maintain starting coordinate of a glyph */
-    unsigned ret = xoffs;
-
+/* Extent of a word in pixels, glyphs overlap by their margins */
+struct word_extent {
+    unsigned w; /* if the word follows something on its row */
+    unsigned lmargin; /* of the first glyph, which is not moved left at the start of a row */
+    size_t nglyphs; /* as counted by sjis_break_frame_at */
+};
+
+/**
+ * Measure the word starting at sjis[i] and return the index past it. Glyphs past a wait command
+ * within a word are skipped but not measured.
+ */
+static size_t word_measure(const char* sjis, size_t i, struct word_extent* ext) {
     struct glyph_margins margins = {0, 0};
     uint8_t rmargin_prev = 0;
 
     bool in_quotes = false;
+    bool measured = false, measuring = true;
+
+    *ext = (struct word_extent){0, 0, 0};
 
-    for (size_t i = 0; sjis[i];) {
+    while (sjis[i] && sjis[i] != ' ' && sjis[i] != '\n') {
         uint32_t first = sjis[i] & UINT8_MAX;
 
-        if (first == ' ' || first == '\n' || glyph_is_wait_cmd(&sjis[i]))
-            break;
+        if (glyph_is_wait_cmd(&sjis[i])) {
+            measuring = false;
+            i += 2;
+            continue;
+        }
+
+        size_t sz = 1;
 
         /* Known single-byte half-width char */
         if (glyph_is_hw(first)) {
-            margins = glyph_margin(first, in_quotes);
+            if (measuring)
+                margins = glyph_margin(first, in_quotes);
             if (sjis[i] == '"')
                 in_quotes = !in_quotes;
-            i++;
         } else if (sjis[i + 1]) { /* Possibly known two-byte full-width */
             uint32_t second = sjis[i + 1] & UINT8_MAX;
 
-            margins = glyph_margin((first << 8) | second, in_quotes);
-            i += 2;
+            if (measuring)
+                margins = glyph_margin((first << 8) | second, in_quotes);
+            sz = 2;
         } else { /* Unknown single-byte; skip */
             i++;
             continue;
         }
 
-        if (ret > RENDER_TEXT_LMARGIN)
-            ret -= margins.lmargin + rmargin_prev;
+        /* sjis_break_frame_at stops short of the last byte */
+        if (sjis[i + 1])
+            ext->nglyphs++;
+        i += sz;
 
-        ret += RENDER_GLYPH_DIM;
+        if (!measuring)
+            continue;
+
+        if (!measured)
+            ext->lmargin = margins.lmargin;
+        measured = true;
 
+        ext->w += RENDER_GLYPH_DIM - margins.lmargin - rmargin_prev;
         rmargin_prev = margins.rmargin;
     }
 
-    /* Return end coordinate of last glyph */
-    return ret + margins.lmargin - rmargin_prev;
+    /* Up to the end of last glyph */
+    ext->w += margins.lmargin - rmargin_prev;
+    return i;
+}
+
+/* Greedy wrapping from a row start */
+struct wrap_state {
+    size_t i;
+    size_t prev_space;
+    unsigned xoffs;
+    size_t nrows, nglyphs; /* so far */
+};
+
+static void wrap_init(struct wrap_state* st, size_t i) {
+    *st = (struct wrap_state){.i = i, .xoffs = RENDER_TEXT_LMARGIN, .nrows = 1};
+}
+
+static bool wrap_done(const char* sjis, const struct wrap_state* st) {
+    return !sjis[st->i] || (st->i != 0 && !sjis[st->i + 1]);
+}
+
+/**
+ * Consume a space, wait command, newline or word, each at least one byte. Return the index of the
+ * space to replace with a newline for the word to fit, or 0 if it fits.
+ */
+static size_t wrap_step(const char* sjis, struct wrap_state* st) {
+    size_t i = st->i;
+
+    if (sjis[i] == ' ') {
+        st->prev_space = i;
+        st->i++;
+        st->xoffs += RENDER_SPACE_W;
+        return 0;
+    }
+
+    if (glyph_is_wait_cmd(&sjis[i])) {
+        st->i += 2;
+        return 0;
+    }
+
+    if (sjis[i] == '\n') {
+        st->xoffs = RENDER_TEXT_LMARGIN;
+        st->prev_space = 0;
+        st->nrows++;
+        st->i++;
+        return 0;
+    }
+
+    struct word_extent ext;
+    st->i = word_measure(sjis, i, &ext);
+    st->nglyphs += ext.nglyphs;
+
+    size_t wrap_at = 0;
+
+    /* A word wider than a line is left as is, as there is no space to wrap it at */
+    if (st->xoffs + ext.w - RENDER_GLYPH_DIM >= RENDER_TEXT_RMARGIN && st->prev_space != 0) {
+        wrap_at = st->prev_space;
+        st->xoffs = RENDER_TEXT_LMARGIN;
+        st->prev_space = 0;
+        st->nrows++;
+    }
+
+    if (st->xoffs == RENDER_TEXT_LMARGIN)
+        st->xoffs += ext.lmargin;
+    st->xoffs += ext.w;
+    return wrap_at;
 }
 
+/**
+ * Wrap at the last space before a word that crosses the right margin. Every word is measured once
+ * and every step consumes input, so this always terminates.
+ */
 void hard_wrap_sjis(char* sjis) {
-    size_t prev_space = 0;
-    unsigned xoffs = RENDER_TEXT_LMARGIN;
+    struct wrap_state st;
 
-    for (size_t i = 0; sjis[i] && (i == 0 || sjis[i + 1]);) {
-        if (sjis[i] == ' ') {
-            prev_space = i++;
-            xoffs += RENDER_SPACE_W;
-            continue;
-        }
+    for (wrap_init(&st, 0); !wrap_done(sjis, &st);) {
+        size_t at = wrap_step(sjis, &st);
+        if (at)
+            sjis[at] = '\n';
+    }
+}
 
-        if (glyph_is_wait_cmd(&sjis[i])) {
-            i += 2;
-            continue;
-        }
+/* Best way to break text from some index on into frames */
+struct frame_fit {
+    size_t nframes, nrows;
+    size_t end; /* of the first frame, either a space or newline, or the end of text */
+};
 
-        if (sjis[i] == '\n') {
-            xoffs = RENDER_TEXT_LMARGIN;
-            prev_space = 0;
-            i++;
-            continue;
-        }
+static bool frame_fit_better(const struct frame_fit* a, const struct frame_fit* b) {
+    return a->nframes < b->nframes || (a->nframes == b->nframes && a->nrows <= b->nrows);
+}
 
-        unsigned end = word_end(&sjis[i], xoffs);
+/**
+ * Rows within a frame are wrapped greedily, which gives the fewest of them, so only frame ends
+ * are chosen. fits[s] is solved for every s that a frame may start at, from the end of text
+ * backwards. A frame fits if sjis_break_frame_at would not break it any earlier, and frames that
+ * end later win ties, so text that fits in a single frame is wrapped as by hard_wrap_sjis.
+ */
+void fit_wrap_sjis(char* sjis) {
+    size_t len = strlen(sjis);
+    struct frame_fit* fits = malloc(sizeof(struct frame_fit[len + 1]));
+    bool* is_break = calloc(len + 1, sizeof(bool));
+
+    if (!fits || !is_break) {
+        perror("malloc");
+        free(fits);
+        free(is_break);
+        hard_wrap_sjis(sjis);
+        return;
+    }
 
-        // fprintf(stderr, "i: %zu, xoffs %u end at %u\n", i, xoffs, end);
-        xoffs = end;
+    /* Frames may end at newlines, and at spaces unless followed by another one */
+    struct wrap_state st;
+    for (wrap_init(&st, 0); !wrap_done(sjis, &st); wrap_step(sjis, &st))
+        is_break[st.i] = sjis[st.i] == '\n' || (sjis[st.i] == ' ' && sjis[st.i + 1] != ' ');
 
-        if (end - RENDER_GLYPH_DIM >= RENDER_TEXT_RMARGIN && prev_space != 0) {
-            sjis[prev_space] = '\n';
-            xoffs = RENDER_TEXT_LMARGIN;
-            // fprintf(stderr, "\n");
+    fits[len] = (struct frame_fit){0, 0, len};
 
+    for (size_t s = len; s-- > 0;) {
+        if (s > 0 && !is_break[s - 1])
             continue;
+
+        /* If no frame fits, the one up to the first end is taken anyway */
+        bool found = false;
+        struct frame_fit best = {SIZE_MAX, SIZE_MAX, len};
+
+        for (wrap_init(&st, s); ; wrap_step(sjis, &st)) {
+            bool done = wrap_done(sjis, &st);
+            if (!done && !is_break[st.i])
+                continue;
+
+            bool fits_frame = st.nrows <= RENDER_NROWS_MAX && st.nglyphs < RENDER_NCHARS_MAX;
+            if (!fits_frame && found)
+                break;
+
+            const struct frame_fit* rest = done ? &fits[len] : &fits[st.i + 1];
+            struct frame_fit fit = {rest->nframes + 1, rest->nrows + st.nrows, done ? len : st.i};
+
+            if (!found || frame_fit_better(&fit, &best))
+                best = fit;
+            found = true;
+
+            if (done || !fits_frame)
+                break;
         }
 
-        /* Next word */
-        while (sjis[i] && sjis[i] != ' ' && sjis[i] != '\n')
-            if (!glyph_is_hw(sjis[i]) && sjis[i + 1])
-                i += 2;
-            else
-                i++;
+        fits[s] = best;
     }
+
+    for (size_t s = 0; s < len; s = fits[s].end + 1) {
+        if (fits[s].end == len)
+            break;
+        sjis[fits[s].end] = '\n';
+    }
+
+    free(fits);
+    free(is_break);
+
+    hard_wrap_sjis(sjis);
 }
 
-/* We can display max(6 rows, RENDER_NCHARS_MAX glyphs). The latter is more likely. */
-size_t sjis_break_frame_at(const char* sjis) {
-    size_t i = 0;
-    size_t nchars = 0;
-    size_t nrows = 0;
-    size_t nl_at = 0;
+/* Single pass over text as it is laid out, see sjis_layout_new */
+struct layout_state {
+    size_t i;
+    size_t nglyphs, nrows; /* as counted by sjis_nglyphs and sjis_nrows */
+    size_t word_end; /* past the word measured last */
+    unsigned xoffs; /* on the current row */
+    unsigned row_w; /* of the row ended last */
+
+    /* As by sjis_break_frame_at called again past every break */
+    size_t nframes;
+    size_t frame_break; /* last one */
+    bool breaking; /* false once a frame could not be broken */
+    bool overflows;
+    size_t frame_start, frame_nl_at; /* the latter relative to the former, 0 if none yet */
+    size_t frame_nrows, frame_nglyphs, row_nglyphs; /* the last on the row since frame_nl_at */
+};
+
+static void layout_init(struct layout_state* st) {
+    *st = (struct layout_state){.nrows = 1, .xoffs = RENDER_TEXT_LMARGIN, .nframes = 1,
+        .breaking = true};
+}
 
-    while (sjis[i] && (i == 0 || sjis[i + 1])) {
-        if (sjis[i] == ' ') {
-            i++;
-            continue;
-        }
+static bool layout_done(const char* sjis, const struct layout_state* st) {
+    return !sjis[st->i] || (st->i != st->frame_start && !sjis[st->i + 1]);
+}
 
-        if (glyph_is_wait_cmd(&sjis[i])) {
-            i += 2;
-            continue;
-        }
+/* Break the frame at frame_start + at, or stop breaking if there is nothing to break it at */
+static void layout_break_frame(struct layout_state* st, size_t at) {
+    if (at == 0) {
+        st->breaking = false;
+        st->overflows = st->frame_nglyphs == RENDER_NCHARS_MAX;
+        return;
+    }
 
-        if (sjis[i] == '\n') {
-            nl_at = i;
+    st->frame_break = st->frame_start + at;
+    st->frame_start = st->frame_break + 1;
+    st->nframes++;
 
-            if (++nrows == RENDER_NROWS_MAX)
-                return i;
+    /* The new frame starts with whatever followed the break on its row */
+    st->frame_nl_at = 0;
+    st->frame_nrows = 0;
+    st->frame_nglyphs = st->row_nglyphs;
 
-            i++;
-            continue;
+    if (st->frame_nglyphs == RENDER_NCHARS_MAX)
+        layout_break_frame(st, 0);
+}
+
+/**
+ * Consume a space, wait command, newline or glyph. Frames are broken where sjis_break_frame_at
+ * would break them, which may be behind st->i, but text is never walked twice.
+ */
+static void layout_step(const char* sjis, struct layout_state* st) {
+    size_t i = st->i;
+
+    /* sjis_nglyphs and sjis_nrows stop short of the last byte, and so does wrapping */
+    bool counted = i == 0 || sjis[i + 1];
+
+    if (sjis[i] == ' ') {
+        if (counted)
+            st->xoffs += RENDER_SPACE_W;
+        st->i++;
+        return;
+    }
+
+    if (glyph_is_wait_cmd(&sjis[i])) {
+        st->i += 2;
+        return;
+    }
+
+    if (sjis[i] == '\n') {
+        if (counted) {
+            st->row_w = st->xoffs - RENDER_TEXT_LMARGIN;
+            st->xoffs = RENDER_TEXT_LMARGIN;
+            st->nrows++;
         }
+        st->i++;
+        st->row_nglyphs = 0;
 
-        if (!glyph_is_hw(sjis[i]) && sjis[i + 1])
-            i += 2;
-        else
-            i++;
+        if (!st->breaking)
+            return;
 
-        if (++nchars == RENDER_NCHARS_MAX)
-            return nl_at;
+        st->frame_nl_at = i - st->frame_start;
+        if (++st->frame_nrows == RENDER_NROWS_MAX)
+            layout_break_frame(st, i - st->frame_start);
+        return;
     }
 
-    return 0;
+    /* Rows are measured word by word, the same way as they are wrapped */
+    if (counted && st->word_end <= i) {
+        struct word_extent ext;
+        st->word_end = word_measure(sjis, i, &ext);
+
+        if (st->xoffs == RENDER_TEXT_LMARGIN)
+            st->xoffs += ext.lmargin;
+        st->xoffs += ext.w;
+    }
+
+    if (!glyph_is_hw(sjis[i]) && sjis[i + 1])
+        st->i += 2;
+    else
+        st->i++;
+
+    if (counted)
+        st->nglyphs++;
+    st->row_nglyphs++;
+
+    if (st->breaking && ++st->frame_nglyphs == RENDER_NCHARS_MAX)
+        layout_break_frame(st, st->frame_nl_at);
 }
 
-size_t sjis_nglyphs(const char* sjis) {
-    size_t nglyphs = 0, i = 0;
+static bool grow(void** buf, size_t* cap, size_t want, size_t elem_sz) {
+    if (want <= *cap)
+        return true;
 
-    while (sjis[i] && (i == 0 || sjis[i + 1])) {
-        if (sjis[i] == ' ') {
-            i++;
-            continue;
-        }
+    size_t cap_new = *cap ? *cap * 2 : 8;
+    void* buf_new = realloc(*buf, cap_new * elem_sz);
+    if (!buf_new) {
+        perror("realloc");
+        return false;
+    }
+    *buf = buf_new;
+    *cap = cap_new;
+    return true;
+}
 
-        if (glyph_is_wait_cmd(&sjis[i])) {
-            i += 2;
-            continue;
+struct sjis_layout* sjis_layout_new(const char* sjis) {
+    struct sjis_layout* ret = calloc(1, sizeof(struct sjis_layout));
+    size_t rows_cap = 0, breaks_cap = 0;
+
+    if (!ret) {
+        perror("calloc");
+        return NULL;
+    }
+
+    if (!grow((void**)&ret->rows, &rows_cap, 1, sizeof(*ret->rows)))
+        goto fail;
+    ret->rows[0].start = 0;
+
+    struct layout_state st;
+    for (layout_init(&st); !layout_done(sjis, &st);) {
+        size_t nrows = st.nrows, nframes = st.nframes;
+
+        layout_step(sjis, &st);
+
+        if (st.nrows != nrows) {
+            if (!grow((void**)&ret->rows, &rows_cap, st.nrows, sizeof(*ret->rows)))
+                goto fail;
+            ret->rows[nrows - 1].w = st.row_w;
+            ret->rows[nrows].start = st.i;
         }
 
-        if (sjis[i] == '\n') {
-            i++;
-            continue;
+        if (st.nframes != nframes) {
+            if (!grow((void**)&ret->frame_breaks, &breaks_cap, st.nframes - 1,
+                    sizeof(*ret->frame_breaks)))
+                goto fail;
+            ret->frame_breaks[nframes - 1] = st.frame_break;
         }
+    }
+    ret->rows[st.nrows - 1].w = st.xoffs - RENDER_TEXT_LMARGIN;
 
-        if (!glyph_is_hw(sjis[i]) && sjis[i + 1])
-            i += 2;
-        else
-            i++;
-        nglyphs++;
+    ret->nglyphs = st.nglyphs;
+    ret->nrows = st.nrows;
+    ret->nframes = st.nframes;
+    ret->overflows = st.overflows;
+    return ret;
+
+fail:
+    sjis_layout_free(ret);
+    return NULL;
+}
+
+void sjis_layout_free(struct sjis_layout* layout) {
+    if (layout) {
+        free(layout->rows);
+        free(layout->frame_breaks);
+        free(layout);
     }
+}
+
+/* We can display max(6 rows, RENDER_NCHARS_MAX glyphs). The latter is more likely. */
+size_t sjis_break_frame_at(const char* sjis) {
+    struct layout_state st;
+
+    for (layout_init(&st); !layout_done(sjis, &st) && st.breaking;) {
+        layout_step(sjis, &st);
+        if (st.nframes > 1)
+            return st.frame_break;
+    }
+    return 0;
+}
+
+size_t sjis_nglyphs(const char* sjis) {
+    struct layout_state st;
 
-    return nglyphs;
+    for (layout_init(&st); !layout_done(sjis, &st);)
+        layout_step(sjis, &st);
+    return st.nglyphs;
 }
 
 size_t sjis_nrows(const char* sjis) {
-    size_t nrows = 1, i = 0;
+    struct layout_state st;
 
-    while (sjis[i] && (i == 0 || sjis[i + 1])) {
-        if (sjis[i] == ' ') {
-            i++;
+    for (layout_init(&st); !layout_done(sjis, &st);)
+        layout_step(sjis, &st);
+    return st.nrows;
+}
+
+/* A string to store glyph positions for */
+struct glyph_pos_str {
+    char* sjis; /* with \r line breaks */
+    uint32_t hash;
+    uint32_t bucket;
+    size_t len;
+    size_t npos;
+    bool dropped;
+};
+
+static int glyph_pos_str_cmp(const void* a, const void* b) {
+    const struct glyph_pos_str* x = a, * y = b;
+
+    if (x->bucket != y->bucket)
+        return x->bucket < y->bucket ? -1 : 1;
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    if (x->len != y->len)
+        return x->len < y->len ? -1 : 1;
+    return strcmp(x->sjis, y->sjis);
+}
+
+/**
+ * Place the glyphs that render_sjis draws for a frame into pos, if not NULL. Return how many there
+ * are, or SIZE_MAX if their positions do not fit in struct glyph_pos.
+ */
+static size_t glyph_pos_lay_out(const char* sjis, struct glyph_pos* pos) {
+    struct glyph_layout l;
+    size_t npos = 0;
+
+    glyph_layout_init(&l, sjis, 0, 0);
+
+    for (enum glyph_layout_tok tok; (tok = glyph_layout_next(&l)) != GLYPH_LAYOUT_END;) {
+        if (tok == GLYPH_LAYOUT_WAIT)
             continue;
-        }
+        if (npos > RENDER_NCHARS_MAX)
+            break;
 
-        if (glyph_is_wait_cmd(&sjis[i])) {
-            i += 2;
+        glyph_layout_place(&l);
+        if (l.hpos > UINT8_MAX || l.row > UINT8_MAX)
+            return SIZE_MAX;
+        if (pos)
+            pos[npos] = (struct glyph_pos){l.hpos, l.row};
+        npos++;
+    }
+    return npos;
+}
+
+bool glyph_pos_build(char* const* strs, size_t nstrs, uint8_t* out, size_t sz_max,
+    size_t* written, size_t* nstored) {
+    bool ret = false;
+    size_t n = 0;
+
+    struct glyph_pos_str* gstrs = malloc(sizeof(struct glyph_pos_str[nstrs ? nstrs : 1]));
+    if (!gstrs) {
+        perror("malloc");
+        return false;
+    }
+
+    for (size_t i = 0; i < nstrs; i++) {
+        if (!strs[i] || !strs[i][0])
             continue;
+
+        struct glyph_pos_str* g = &gstrs[n];
+        size_t len = strlen(strs[i]);
+        g->sjis = malloc(len + 1);
+        if (!g->sjis) {
+            perror("malloc");
+            goto done;
         }
+        memcpy(g->sjis, strs[i], len + 1);
+        n++;
 
-        if (sjis[i] == '\n') {
-            i++;
-            nrows++;
-            continue;
+        /* The strtab decoder replaces \n with \r */
+        for (char* c = g->sjis; *c; c++)
+            if (*c == '\n')
+                *c = '\r';
+
+        g->hash = glyph_pos_hash(g->sjis, &g->len);
+        g->npos = glyph_pos_lay_out(g->sjis, NULL);
+        g->dropped = g->len > UINT16_MAX || g->npos == SIZE_MAX;
+    }
+
+    uint32_t nbuckets;
+    for (nbuckets = 1; nbuckets < n; nbuckets *= 2)
+        ;
+    for (size_t i = 0; i < n; i++)
+        gstrs[i].bucket = gstrs[i].hash & (nbuckets - 1);
+    qsort(gstrs, n, sizeof(*gstrs), glyph_pos_str_cmp);
+
+    /* Keep one of equal strings, and none of those that only share a hash and length */
+    for (size_t i = 0, j; i < n; i = j) {
+        bool collides = false;
+
+        for (j = i + 1; j < n && gstrs[j].hash == gstrs[i].hash && gstrs[j].len == gstrs[i].len;
+                j++) {
+            collides |= strcmp(gstrs[j].sjis, gstrs[i].sjis) != 0;
+            gstrs[j].dropped = true;
         }
+        if (collides)
+            gstrs[i].dropped = true;
+    }
 
-        if (!glyph_is_hw(sjis[i]) && sjis[i + 1])
-            i += 2;
-        else
-            i++;
+    size_t nentries = 0, npos = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!gstrs[i].dropped) {
+            nentries++;
+            npos += gstrs[i].npos;
+        }
     }
 
-    return nrows;
+    size_t entries_offs = sizeof(struct glyph_pos_hdr) + sizeof(uint32_t[nbuckets + 1]);
+    size_t pos_offs = entries_offs + sizeof(struct glyph_pos_entry[nentries]);
+    size_t sz = pos_offs + sizeof(struct glyph_pos[npos]);
+
+    if (sz > sz_max) {
+        fprintf(stderr, "Glyph positions take %zu B, over the maximum of %zu B\n", sz, sz_max);
+        goto done;
+    }
+
+    struct glyph_pos_hdr hdr = {GLYPH_POS_MAGIC, nbuckets};
+    memcpy(out, &hdr, sizeof(hdr));
+
+    uint32_t* buckets = (void*)&out[sizeof(hdr)];
+    struct glyph_pos_entry* entries = (void*)&out[entries_offs];
+    struct glyph_pos* pos = (void*)&out[pos_offs];
+    size_t e = 0;
+
+    for (uint32_t b = 0, i = 0; b <= nbuckets; b++) {
+        buckets[b] = e;
+
+        for (; i < n && gstrs[i].bucket == b; i++) {
+            if (gstrs[i].dropped)
+                continue;
+
+            entries[e++] = (struct glyph_pos_entry){gstrs[i].hash, gstrs[i].len, gstrs[i].npos,
+                (uint8_t*)pos - out};
+            pos += glyph_pos_lay_out(gstrs[i].sjis, pos);
+        }
+    }
+
+    *written = sz;
+    *nstored = nentries;
+    ret = true;
+
+done:
+    for (size_t i = 0; i < n; i++)
+        free(gstrs[i].sjis);
+    free(gstrs);
+    return ret;
 }
@@ -7,8 +7,38 @@
 #include <stdio.h>
 
 void hard_wrap_sjis(char* sjis);
+/**
+ * Wrap like hard_wrap_sjis, but choose where text is broken into frames so that it takes as few
+ * frames as possible, and then as few rows. Frames are then split at the same newlines by
+ * sjis_break_frame_at.
+ */
+void fit_wrap_sjis(char* sjis);
 size_t sjis_break_frame_at(const char* sjis);
 size_t sjis_nglyphs(const char* sjis);
 size_t sjis_nrows(const char* sjis);
 
+/* Layout of a string as it is rendered, worked out in a single pass over it */
+struct sjis_layout {
+    size_t nglyphs; /* as by sjis_nglyphs */
+    size_t nrows; /* as by sjis_nrows */
+    struct sjis_row {
+        size_t start; /* offset of the first byte */
+        unsigned w; /* in pixels, as measured when wrapping */
+    }* rows;
+    size_t nframes;
+    size_t* frame_breaks; /* nframes - 1 newlines, as by sjis_break_frame_at on what follows */
+    bool overflows; /* the last frame has too many glyphs and no newline to break it at */
+};
+
+struct sjis_layout* sjis_layout_new(const char* sjis);
+void sjis_layout_free(struct sjis_layout* layout);
+
+/**
+ * Write the glyph positions of script strings, as in agb/glyph_pos.h, to out of at most sz_max
+ * bytes. Strings that cannot be stored, or that share a hash and length with another string, are
+ * left out, and the renderer lays them out itself.
+ */
+bool glyph_pos_build(char* const* strs, size_t nstrs, uint8_t* out, size_t sz_max,
+    size_t* written, size_t* nstored);
+
 #endif
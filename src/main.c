@@ -13,11 +13,19 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "agb/glyph_pos.h"
 #include "defs.h"
 #include "embed.h"
+#include "fts.h"
+#include "scan.h"
 #include "script_as.h"
 #include "script_disass.h"
+#include "script_index.h"
+#include "script_vm.h"
+#include "stats.h"
 #include "strtab.h"
+#include "tm.h"
+#include "xref.h"
 
 static void usage() {
     fprintf(stderr,
@@ -25,24 +33,66 @@ static void usage() {
     #ifdef HAS_ICONV
         "Built with iconv support"
     #endif
-        "\nusage: <ROM> <verb> [...]\n\n"
+        "\nusage: <ROM> <verb> [...] [options]\n\n"
         "ROM is the AGB-ASHJ ROM path\n"
         "Supported verbs:\n"
         "script <name> <vma> <strtab_script_vma> <strtab_menu_vma> <dump | embed>\n"
-        "\tdump [out] -- Dump script to file at \"out\" or to stdout\n"
+        "\tdump [out] [text | ir] -- Dump script to file at \"out\" or to stdout, either as text "
+        "or as binary IR\n"
         "\tembed <in> <use_rom_strtab> <size> <strtab> <menu> <strtab_sz> <menu_sz> <out> -- Embed script at \"in\" "
-        "with strtab at \"strtab\", menu strtab at \"menu\" into \"out\""
+        "with strtab at \"strtab\", menu strtab at \"menu\" into \"out\". \"in\" may be either text "
+        "or IR"
         "\n\n"
         "strtab <vma> <dump | embed>\n"
         "\tdump [out] [idx] -- Dump strtab entry at \"idx\" or all "
             "entries to file at \"out\" or stdout\n"
         "\tembed <in> <size> <Script|Menu> <out> -- Embed all strtab entries from file \"in\" to "
         "file \"out\""
+        "\n\n"
+        "scan strings [strtab_menu_vma] [out] -- Find SJIS strings that the ROM points to and write "
+        "them to file at \"out\" or stdout as entries of agb/static_strings.c, with indices of "
+        "equal strings of the menu strtab at \"strtab_menu_vma\""
+        "\n\n"
+        "xref <vma> [end_vma] -- List aligned words that point to \"vma\", or into "
+        "[vma, end_vma). The index is kept in <ROM>" XREF_SUFFIX " for later queries"
+        "\n\n"
+        "index [<name> <vma>]... -- Index the commands of the scripts at \"vma\" (by default, of "
+        "all scripts at their stock addresses) by the strtab entries and labels they refer to, "
+        "into <ROM>" SCRIPT_INDEX_SUFFIX
+        "\n\n"
+        "query <str | menu | label> <key> -- List the commands that show the script or menu "
+        "strtab entry \"key\", or that jump or branch to offset \"key\", using the index"
+        "\n\n"
+        "search <text> [<strtab_script> <strtab_menu>] -- List the strtab entries that contain "
+        "\"text\", of the ROM or of the files (as in scripts/*/strtab_*), and the commands that "
+        "show them if the ROM has been indexed. The strtabs are indexed into <ROM>.script" FTS_SUFFIX
+        ", <ROM>.menu" FTS_SUFFIX " or <strtab>" FTS_SUFFIX ", which are rebuilt when their strtab "
+        "changes"
+        "\n\n"
+        "tm <idx | text | dups> <strtab> [<translated_strtab>...] -- List the strings of the "
+        "strtab file \"strtab\" most similar to its entry \"idx\" or to \"text\", with their "
+        "translations from the other files (as in scripts/*/strtab_*). With \"dups\", list all "
+        "pairs of near-duplicate strings instead"
+        "\n\n"
+        "vm [<name> <vma>]... -- Run every path through the scripts at \"vma\" (by default, all "
+        "scripts at their stock addresses), taking each option of each choice, and list the "
+        "commands and labels that are never reached and the strtab entries that are never shown"
+        "\n\n"
+        "Supported options:\n"
+        "--fit-frames -- Wrap script text to take as few frames, and then rows, as possible when "
+        "embedding\n"
+        "--glyph-pos -- Store glyph positions of script strings for the renderer when embedding. "
+        "Pass it to the last script embedded, as it covers the final script strtab\n"
+        "--critical-path -- Print the chain of stages that bounded the time of script embedding\n"
+        "--stats -- Print time, allocations and processed items of each stage (needs STATS=1)\n"
+        "--trace <out> -- Write a timeline of the stages to \"out\" in Chrome trace event format "
+        "(needs STATS=1)"
         "\n\n");
 }
 
 static struct {
-    enum {VERB_NOP, VERB_SCRIPT, VERB_STRTAB} verb;
+    enum {VERB_NOP, VERB_SCRIPT, VERB_STRTAB, VERB_SCAN, VERB_XREF, VERB_INDEX,
+        VERB_QUERY, VERB_SEARCH, VERB_TM, VERB_VM} verb;
     union {
         enum {SCRIPT_DUMP, SCRIPT_EMBED} script_verb;
         enum {STRTAB_DUMP, STRTAB_EMBED} strtab_verb;
@@ -52,6 +102,12 @@ static struct {
     char* strtab_script_path, * strtab_menu_path;
     union {
         uint32_t strtab_vma; /* for strtab verb */
+        struct { uint32_t xref_lo, xref_hi; }; /* for xref verb */
+        /* for index and vm verbs, name/vma pairs */
+        struct { char* const* index_args; int index_nargs; };
+        struct { enum script_ref_kind query_kind; uint16_t query_key; }; /* for query verb */
+        const char* search_text; /* for search verb */
+        struct { const char* tm_query; char* const* tm_paths; int tm_npaths; }; /* for tm verb */
         struct {
             char* script_name;
             uint32_t script_vma, script_sz, strtab_script_vma, strtab_menu_vma;
@@ -65,6 +121,12 @@ static struct {
     bool has_strtab_idx;
     bool strtab_embed_script;
     bool use_rom_strtabs;
+    enum script_dump_fmt dump_fmt;
+    bool fit_frames;
+    bool glyph_pos;
+    bool critical_path;
+    bool stats;
+    const char* trace_path;
 } opts;
 
 /* FIXME: Refactor arg parsing.. */
@@ -127,6 +189,17 @@ static bool parse_script_verb(int argc, char* const* argv, int i) {
         return false;
     }
 
+    if (opts.script_verb == SCRIPT_DUMP && ++j < argc) {
+        if (!strcmp(argv[j], "ir"))
+            opts.dump_fmt = SCRIPT_DUMP_IR;
+        else if (!strcmp(argv[j], "text"))
+            opts.dump_fmt = SCRIPT_DUMP_TEXT;
+        else {
+            fprintf(stderr, "Unrecognised dump format %s\n", argv[j]);
+            return false;
+        }
+    }
+
     if (opts.script_verb == SCRIPT_EMBED && ++j < argc) {
         opts.use_rom_strtabs = atoi(argv[j]) > 0;
     } else if (opts.script_verb == SCRIPT_EMBED) {
@@ -247,7 +320,196 @@ static bool parse_strtab_verb(int argc, char* const* argv, int i) {
     return true;
 }
 
-static bool parse_argv(int argc, char* const* argv) {
+static bool parse_scan_verb(int argc, char* const* argv, int i) {
+    int j = i + 1;
+
+    if (j >= argc || strcmp(argv[j], "strings")) {
+        fprintf(stderr, "Missing or unrecognised argument for scan verb\n");
+        return false;
+    }
+
+    if (++j < argc) {
+        char* end;
+        opts.strtab_vma = strtoul(argv[j], &end, 0);
+        if (*end) {
+            fprintf(stderr, "Invalid menu strtab address %s\n", argv[j]);
+            return false;
+        }
+    }
+
+    if (++j < argc)
+        opts.out_path = argv[j];
+
+    return true;
+}
+
+static bool parse_xref_verb(int argc, char* const* argv, int i) {
+    int j = i + 1;
+    char* end;
+
+    if (j >= argc) {
+        fprintf(stderr, "Missing address for xref verb\n");
+        return false;
+    }
+    opts.xref_lo = strtoul(argv[j], &end, 0);
+    if (*end) {
+        fprintf(stderr, "Invalid address %s\n", argv[j]);
+        return false;
+    }
+    opts.xref_hi = opts.xref_lo + 1;
+
+    if (++j < argc) {
+        opts.xref_hi = strtoul(argv[j], &end, 0);
+        if (*end || opts.xref_hi <= opts.xref_lo) {
+            fprintf(stderr, "Invalid end address %s\n", argv[j]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#define INDEX_NSCRIPTS_MAX 16
+
+static bool parse_index_verb(int argc, char* const* argv, int i) {
+    int j = i + 1;
+
+    if ((argc - j) % 2) {
+        fprintf(stderr, "Missing address for script %s\n", argv[argc - 1]);
+        return false;
+    }
+
+    if ((argc - j) / 2 > INDEX_NSCRIPTS_MAX) {
+        fprintf(stderr, "Too many scripts\n");
+        return false;
+    }
+
+    for (int k = j; k < argc; k += 2) {
+        char* end;
+        if (!script_for_name(argv[k])) {
+            fprintf(stderr, "Unrecognized script %s\n", argv[k]);
+            return false;
+        }
+        strtoul(argv[k + 1], &end, 0);
+        if (*end || end == argv[k + 1]) {
+            fprintf(stderr, "Invalid script address %s\n", argv[k + 1]);
+            return false;
+        }
+    }
+
+    opts.index_args = &argv[j];
+    opts.index_nargs = argc - j;
+    return true;
+}
+
+static bool parse_query_verb(int argc, char* const* argv, int i) {
+    int j = i + 1;
+
+    if (j >= argc) {
+        fprintf(stderr, "Missing kind for query verb\n");
+        return false;
+    }
+    if (!strcmp(argv[j], "str"))
+        opts.query_kind = SCRIPT_REF_STR;
+    else if (!strcmp(argv[j], "menu"))
+        opts.query_kind = SCRIPT_REF_MENU_STR;
+    else if (!strcmp(argv[j], "label"))
+        opts.query_kind = SCRIPT_REF_LABEL;
+    else {
+        fprintf(stderr, "Unrecognised query kind %s\n", argv[j]);
+        return false;
+    }
+
+    if (++j >= argc) {
+        fprintf(stderr, "Missing key for query verb\n");
+        return false;
+    }
+    char* end;
+    unsigned long key = strtoul(argv[j], &end, 0);
+    if (*end || end == argv[j] || key > UINT16_MAX) {
+        fprintf(stderr, "Invalid key %s\n", argv[j]);
+        return false;
+    }
+    opts.query_key = key;
+
+    return true;
+}
+
+static bool parse_search_verb(int argc, char* const* argv, int i) {
+    int j = i + 1;
+
+    if (j >= argc || !*argv[j]) {
+        fprintf(stderr, "Missing text for search verb\n");
+        return false;
+    }
+    opts.search_text = argv[j];
+
+    if (j + 1 < argc) {
+        if (j + 2 >= argc) {
+            fprintf(stderr, "Missing menu strtab path\n");
+            return false;
+        }
+        opts.strtab_script_path = argv[j + 1];
+        opts.strtab_menu_path = argv[j + 2];
+    }
+
+    return true;
+}
+
+static bool parse_tm_verb(int argc, char* const* argv, int i) {
+    int j = i + 1;
+
+    if (j + 1 >= argc) {
+        fprintf(stderr, "Missing query or strtab path for tm verb\n");
+        return false;
+    }
+    opts.tm_query = argv[j];
+    opts.tm_paths = &argv[j + 1];
+    opts.tm_npaths = argc - j - 1;
+
+    return true;
+}
+
+/* Options may appear anywhere, they are removed from argv so that the rest is positional */
+static bool parse_options(int* argc, char** argv) {
+    int n = 1;
+
+    for (int i = 1; i < *argc; i++) {
+        if (strncmp(argv[i], "--", 2))
+            argv[n++] = argv[i];
+        else if (!strcmp(argv[i], "--fit-frames"))
+            opts.fit_frames = true;
+        else if (!strcmp(argv[i], "--glyph-pos"))
+            opts.glyph_pos = true;
+        else if (!strcmp(argv[i], "--critical-path"))
+            opts.critical_path = true;
+        else if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--trace")) {
+#ifndef SHPN_STATS
+            fprintf(stderr, "%s needs shpn-tool to be built with STATS=1\n", argv[i]);
+            return false;
+#endif
+            if (!strcmp(argv[i], "--stats"))
+                opts.stats = true;
+            else if (++i < *argc)
+                opts.trace_path = argv[i];
+            else {
+                fprintf(stderr, "Missing trace out file arg\n");
+                return false;
+            }
+        } else {
+            fprintf(stderr, "Unrecognised option %s\n", argv[i]);
+            return false;
+        }
+    }
+
+    *argc = n;
+    return true;
+}
+
+static bool parse_argv(int argc, char** argv) {
+    if (!parse_options(&argc, argv))
+        return false;
+
     if (argc >= 2)
         opts.rom_path = argv[1];
     else {
@@ -262,6 +524,27 @@ static bool parse_argv(int argc, char* const* argv) {
         } else if (!strcmp(argv[2], "strtab")) {
             opts.verb = VERB_STRTAB;
             return parse_strtab_verb(argc, argv, 2);
+        } else if (!strcmp(argv[2], "scan")) {
+            opts.verb = VERB_SCAN;
+            return parse_scan_verb(argc, argv, 2);
+        } else if (!strcmp(argv[2], "xref")) {
+            opts.verb = VERB_XREF;
+            return parse_xref_verb(argc, argv, 2);
+        } else if (!strcmp(argv[2], "index")) {
+            opts.verb = VERB_INDEX;
+            return parse_index_verb(argc, argv, 2);
+        } else if (!strcmp(argv[2], "query")) {
+            opts.verb = VERB_QUERY;
+            return parse_query_verb(argc, argv, 2);
+        } else if (!strcmp(argv[2], "search")) {
+            opts.verb = VERB_SEARCH;
+            return parse_search_verb(argc, argv, 2);
+        } else if (!strcmp(argv[2], "tm")) {
+            opts.verb = VERB_TM;
+            return parse_tm_verb(argc, argv, 2);
+        } else if (!strcmp(argv[2], "vm")) {
+            opts.verb = VERB_VM;
+            return parse_index_verb(argc, argv, 2);
         } else {
             fprintf(stderr, "Unrecognized verb %s\n", argv[2]);
             return false;
@@ -312,11 +595,9 @@ static bool script_verbs(uint8_t* rom, size_t sz) {
         }
     }
 
-    init_script_handlers();
-
     if (opts.script_verb == SCRIPT_DUMP)
-        ret = script_dump(rom, sz, opts.script_vma, desc, fout ? fout : stdout, opts.strtab_script_vma,
-            opts.strtab_menu_vma);
+        ret = script_dump(rom, sz, opts.script_vma, desc, fout ? fout : stdout, opts.dump_fmt,
+            opts.strtab_script_vma, opts.strtab_menu_vma);
     else if (opts.script_verb == SCRIPT_EMBED) {
         assert(fin && fout);
         assert(opts.strtab_script_path && opts.strtab_menu_path);
@@ -325,6 +606,8 @@ static bool script_verbs(uint8_t* rom, size_t sz) {
         size_t pad_sz = rom_pad_sz(sz, opts.strtab_script_vma, opts.strtab_script_sz) +
             rom_pad_sz(sz, opts.strtab_menu_vma, opts.strtab_menu_sz) +
             rom_pad_sz(sz, opts.script_vma, opts.script_sz);
+        if (opts.glyph_pos)
+            pad_sz += rom_pad_sz(sz + pad_sz, GLYPH_POS_VMA, GLYPH_POS_SZ_MAX);
         if (sz + pad_sz > MAX_ROM_SZ) {
             fprintf(stderr, "Embedding would exceed maximum allowed ROM size 0x%llx\n", MAX_ROM_SZ);
             goto done;
@@ -334,7 +617,14 @@ static bool script_verbs(uint8_t* rom, size_t sz) {
             regions_intersect(opts.strtab_script_vma, opts.strtab_script_sz,
             opts.script_vma, opts.script_sz) ||
             regions_intersect(opts.strtab_menu_vma, opts.strtab_menu_sz,
-                opts.script_vma, opts.script_sz)) {
+                opts.script_vma, opts.script_sz) ||
+            (opts.glyph_pos && (
+                regions_intersect(GLYPH_POS_VMA, GLYPH_POS_SZ_MAX,
+                    opts.strtab_script_vma, opts.strtab_script_sz) ||
+                regions_intersect(GLYPH_POS_VMA, GLYPH_POS_SZ_MAX,
+                    opts.strtab_menu_vma, opts.strtab_menu_sz) ||
+                regions_intersect(GLYPH_POS_VMA, GLYPH_POS_SZ_MAX,
+                    opts.script_vma, opts.script_sz)))) {
             fprintf(stderr, "Specified memory regions would intersect\n");
             goto done;
         }
@@ -389,10 +679,14 @@ static bool script_verbs(uint8_t* rom, size_t sz) {
                 sz_script, sz_strtab_scr, sz_strtab_menu,
                 opts.strtab_script_vma, opts.strtab_menu_vma,
                 opts.strtab_script_sz, opts.strtab_menu_sz,
-                desc->patch_info.size_vma, desc->patch_info.ptr_vma);
+                desc->patch_info.size_vma, desc->patch_info.ptr_vma,
+                opts.fit_frames, opts.glyph_pos, opts.critical_path);
 
         if (ret) {
+            STATS_BEGIN(span, STATS_WRITE);
             ret = fwrite(rom_cpy, 1, sz + pad_sz, fout) == sz + pad_sz;
+            STATS_ITEMS(STATS_WRITE, sz + pad_sz);
+            STATS_END(span);
             if (!ret)
                 perror("fwrite");
         }
@@ -482,10 +776,14 @@ static bool strtab_verbs(const uint8_t* rom, size_t sz) {
             if (conv == (iconv_t)-1 || !embed_strtab(rom_cpy, sz + pad_sz, ectx, opts.strtab_sz,
                 opts.strtab_embed_script ? STRTAB_SCRIPT_PTR_VMA : STRTAB_MENU_PTR_VMA, conv))
                 fprintf(stderr, "Failed to embed strtab from %s\n", opts.in_path);
-            else if (fwrite(rom_cpy, 1, sz + pad_sz, fout) < sz + pad_sz)
-                perror("fwrite");
-            else
-                ret = true;
+            else {
+                STATS_BEGIN(span, STATS_WRITE);
+                ret = fwrite(rom_cpy, 1, sz + pad_sz, fout) == sz + pad_sz;
+                STATS_ITEMS(STATS_WRITE, sz + pad_sz);
+                STATS_END(span);
+                if (!ret)
+                    perror("fwrite");
+            }
 #ifdef HAS_ICONV
             iconv_close(conv);
 #endif
@@ -506,8 +804,391 @@ done:
     return ret;
 }
 
+static bool scan_verbs(const uint8_t* rom, size_t sz) {
+    FILE* fout = stdout;
+
+    if (opts.out_path) {
+        fout = fopen(opts.out_path, "w");
+        if (!fout) {
+            perror("fopen");
+            return false;
+        }
+    }
+
+    bool ret = scan_strs_dump(rom, sz, opts.strtab_vma, fout);
+
+    if (fout != stdout && fclose(fout)) {
+        perror("fclose");
+        ret = false;
+    }
+    return ret;
+}
+
 uint32_t do_crc32(const void* buf, size_t size);
 
+/* Path of a file kept next to the ROM, to be freed by the caller */
+static char* rom_side_path(const char* suffix) {
+    size_t path_len = strlen(opts.rom_path), suffix_len = strlen(suffix);
+    char* path = malloc(path_len + suffix_len + 1);
+    if (!path) {
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(path, opts.rom_path, path_len);
+    memcpy(&path[path_len], suffix, suffix_len + 1);
+    return path;
+}
+
+/* The index is built on first use and saved next to the ROM, which is identified by its CRC */
+static bool xref_verbs(const uint8_t* rom, size_t sz, uint32_t crc) {
+    char* path = rom_side_path(XREF_SUFFIX);
+    if (!path)
+        return false;
+
+    struct xref x;
+    bool ret = xref_load(&x, path, sz, crc);
+    if (!ret) {
+        ret = xref_build(&x, rom, sz);
+        if (ret && !xref_save(&x, path, sz, crc))
+            fprintf(stderr, "Failed to save index to %s\n", path);
+    }
+    free(path);
+    if (!ret)
+        return false;
+
+    size_t n;
+    const struct scan_ptr* ptrs = xref_find(&x, opts.xref_lo, opts.xref_hi, &n);
+    for (size_t i = 0; i < n; i++)
+        printf("0x%x: 0x%x\n", ptrs[i].vma, ptrs[i].target);
+
+    fprintf(stderr, "%zu of %zu pointers\n", n, x.nptrs);
+    xref_free(&x);
+    return true;
+}
+
+/* The scripts named by the arguments of the index and vm verbs. Returns their amount */
+static size_t index_scripts(const struct script_desc** descs, uint32_t* vmas) {
+    size_t nscripts = 0;
+
+    if (!opts.index_nargs) {
+        const struct script_desc* desc;
+        for (; nscripts < INDEX_NSCRIPTS_MAX && (desc = script_for_idx(nscripts)); nscripts++) {
+            descs[nscripts] = desc;
+            vmas[nscripts] = desc->vma;
+        }
+    }
+    for (int i = 0; i < opts.index_nargs; i += 2, nscripts++) {
+        descs[nscripts] = script_for_name(opts.index_args[i]);
+        vmas[nscripts] = strtoul(opts.index_args[i + 1], NULL, 0);
+    }
+    return nscripts;
+}
+
+static bool index_verbs(const uint8_t* rom, size_t sz, uint32_t crc) {
+    const struct script_desc* descs[INDEX_NSCRIPTS_MAX];
+    uint32_t vmas[INDEX_NSCRIPTS_MAX];
+    size_t nscripts = index_scripts(descs, vmas);
+
+    char* path = rom_side_path(SCRIPT_INDEX_SUFFIX);
+    if (!path)
+        return false;
+
+    struct script_index idx;
+    bool ret = script_index_build(&idx, rom, sz, descs, vmas, nscripts);
+    if (ret) {
+        ret = script_index_save(&idx, path, sz, crc);
+        if (ret)
+            fprintf(stderr, "%zu references of %zu scripts in %s\n", idx.nrefs, idx.nscripts, path);
+        else
+            fprintf(stderr, "Failed to save index to %s\n", path);
+        script_index_free(&idx);
+    }
+    free(path);
+    return ret;
+}
+
+static void print_ref(const struct script_index* idx, const struct script_ref* ref,
+        const char* indent) {
+    const char* name = ref->op < SCRIPT_NOPS ? script_handlers[ref->op].name : NULL;
+
+    printf("%s%.*s 0x%x (L_0x%x) ", indent, SCRIPT_INDEX_NAME_SZ, idx->scripts[ref->script].name,
+        ref->offs, ref->label);
+    if (name)
+        printf("%s\n", name);
+    else
+        printf("OP_0x%x\n", ref->op);
+}
+
+/* Unlike xref, lookups never disassemble, as the index records where the scripts were */
+static bool query_verbs(size_t sz, uint32_t crc) {
+    char* path = rom_side_path(SCRIPT_INDEX_SUFFIX);
+    if (!path)
+        return false;
+
+    struct script_index idx;
+    bool ret = script_index_load(&idx, path, sz, crc);
+    if (!ret)
+        fprintf(stderr, "No index for this ROM in %s, run the index verb first\n", path);
+    free(path);
+    if (!ret)
+        return false;
+
+    size_t n;
+    const struct script_ref* refs = script_index_find(&idx, opts.query_kind, opts.query_key, &n);
+    for (size_t i = 0; i < n; i++)
+        print_ref(&idx, &refs[i], "");
+
+    fprintf(stderr, "%zu of %zu references\n", n, idx.nrefs);
+    script_index_free(&idx);
+    return true;
+}
+
+/* A strtab to search, of the ROM or of a file */
+struct search_src {
+    const char* name;
+    enum script_ref_kind kind;
+    uint32_t ptr_vma; /* of the pointer to the strtab of the ROM */
+    const char* path; /* NULL for the ROM */
+};
+
+/* Side file of the index of src, to be freed by the caller */
+static char* search_src_path(const struct search_src* src) {
+    if (!src->path) {
+        char suffix[sizeof(".script" FTS_SUFFIX)];
+        snprintf(suffix, sizeof(suffix), ".%s%s", src->name, FTS_SUFFIX);
+        return rom_side_path(suffix);
+    }
+
+    size_t path_len = strlen(src->path);
+    char* path = malloc(path_len + sizeof(FTS_SUFFIX));
+    if (!path) {
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(path, src->path, path_len);
+    memcpy(&path[path_len], FTS_SUFFIX, sizeof(FTS_SUFFIX));
+    return path;
+}
+
+static bool search_verbs(const uint8_t* rom, size_t sz, uint32_t crc) {
+    const struct search_src srcs[] = {
+        {"script", SCRIPT_REF_STR, STRTAB_SCRIPT_PTR_VMA, opts.strtab_script_path},
+        {"menu", SCRIPT_REF_MENU_STR, STRTAB_MENU_PTR_VMA, opts.strtab_menu_path}
+    };
+
+    /* Commands are listed only if the ROM has been indexed */
+    struct script_index idx = {0};
+    char* idx_path = rom_side_path(SCRIPT_INDEX_SUFFIX);
+    if (!idx_path)
+        return false;
+    bool has_idx = script_index_load(&idx, idx_path, sz, crc);
+    free(idx_path);
+
+    bool ret = true;
+    size_t nfound = 0;
+
+    for (size_t s = 0; ret && s < sizeof(srcs) / sizeof(*srcs); s++) {
+        struct fts f;
+        char* path = search_src_path(&srcs[s]);
+        ret = path && fts_for_strtab(&f, path, srcs[s].name, srcs[s].path, rom, sz,
+            srcs[s].ptr_vma);
+        free(path);
+        if (!ret)
+            break;
+
+        size_t n;
+        uint16_t* found = fts_find(&f, opts.search_text, &n);
+        ret = found != NULL;
+
+        for (size_t i = 0; i < n; i++) {
+            printf("%s %u: %s\n", srcs[s].name, found[i], fts_str(&f, found[i]));
+
+            size_t nrefs = 0;
+            const struct script_ref* refs = has_idx ?
+                script_index_find(&idx, srcs[s].kind, found[i], &nrefs) : NULL;
+            for (size_t r = 0; r < nrefs; r++)
+                print_ref(&idx, &refs[r], "    ");
+        }
+
+        nfound += n;
+        free(found);
+        fts_free(&f);
+    }
+
+    if (ret)
+        fprintf(stderr, "%zu strings found%s\n", nfound,
+            has_idx ? "" : ", run the index verb to list the commands that show them");
+    if (has_idx)
+        script_index_free(&idx);
+    return ret;
+}
+
+#define TM_NMATCHES 10
+#define TM_DUPS_SIM_MIN 0.8
+
+static struct strtab_embed_ctx* strtab_from_file(const char* path) {
+    struct stat st;
+    FILE* fin = fopen(path, "rb");
+    if (!fin || stat(path, &st) == -1) {
+        perror(path);
+        if (fin)
+            fclose(fin);
+        return NULL;
+    }
+
+    struct strtab_embed_ctx* ectx = strtab_embed_ctx_new();
+    if (ectx && !strtab_embed_ctx_with_file(fin, st.st_size, ectx)) {
+        fprintf(stderr, "Failed to read strtab from %s\n", path);
+        strtab_embed_ctx_free(ectx);
+        ectx = NULL;
+    }
+    if (fclose(fin))
+        perror("fclose");
+    return ectx;
+}
+
+static const char* strtab_str(const struct strtab_embed_ctx* ectx, size_t idx) {
+    return idx && idx < ectx->nstrs && ectx->allocated[idx].allocated ? ectx->strs[idx] : NULL;
+}
+
+/* Name of the directory of a strtab file, such as EN for scripts/EN/strtab_script */
+static void print_lang(const char* path) {
+    const char* end = strrchr(path, '/');
+    const char* start = end;
+
+    while (start && start > path && start[-1] != '/')
+        start--;
+    if (start && start < end)
+        printf("%.*s", (int)(end - start), start);
+    else
+        printf("%s", path);
+}
+
+static void print_tm_match(const struct strtab_embed_ctx* const* ectxs, size_t idx) {
+    printf("%zu: %s\n", idx, strtab_str(ectxs[0], idx));
+    for (int i = 1; i < opts.tm_npaths; i++) {
+        const char* str = strtab_str(ectxs[i], idx);
+        printf("    ");
+        print_lang(opts.tm_paths[i]);
+        printf(": %s\n", str ? str : "");
+    }
+}
+
+static bool tm_verbs() {
+    struct strtab_embed_ctx** ectxs = calloc(opts.tm_npaths, sizeof(*ectxs));
+    char** strs = NULL;
+    bool ret = false;
+    struct tm_index tm = {0};
+
+    if (!ectxs) {
+        perror("calloc");
+        return false;
+    }
+    for (int i = 0; i < opts.tm_npaths; i++)
+        if (!(ectxs[i] = strtab_from_file(opts.tm_paths[i])))
+            goto done;
+
+    strs = malloc(ectxs[0]->nstrs * sizeof(*strs));
+    if (!strs) {
+        perror("malloc");
+        goto done;
+    }
+    for (size_t i = 0; i < ectxs[0]->nstrs; i++)
+        strs[i] = (char*)strtab_str(ectxs[0], i);
+
+    if (!tm_build(&tm, strs, ectxs[0]->nstrs))
+        goto done;
+
+    const struct strtab_embed_ctx* const* cectxs = (const void*)ectxs;
+
+    if (!strcmp(opts.tm_query, "dups")) {
+        size_t n;
+        struct tm_pair* pairs = tm_dups(&tm, TM_DUPS_SIM_MIN, &n);
+        if (!pairs)
+            goto done;
+
+        for (size_t i = 0; i < n; i++) {
+            printf("%.2f ", pairs[i].sim);
+            print_tm_match(cectxs, pairs[i].a);
+            printf("     ");
+            print_tm_match(cectxs, pairs[i].b);
+        }
+        fprintf(stderr, "%zu pairs of similarity %.2f or more\n", n, TM_DUPS_SIM_MIN);
+        free(pairs);
+        ret = true;
+        goto done;
+    }
+
+    char* end;
+    size_t idx = strtoul(opts.tm_query, &end, 0);
+    const char* query = opts.tm_query;
+    if (!*end && end != opts.tm_query) {
+        query = strtab_str(ectxs[0], idx);
+        if (!query) {
+            fprintf(stderr, "No string at index %zu of %s\n", idx, opts.tm_paths[0]);
+            goto done;
+        }
+        print_tm_match(cectxs, idx);
+        printf("\n");
+    } else
+        idx = SIZE_MAX;
+
+    struct tm_match matches[TM_NMATCHES];
+    ptrdiff_t n = tm_query(&tm, query, idx, matches, TM_NMATCHES);
+    if (n < 0)
+        goto done;
+
+    for (ptrdiff_t i = 0; i < n; i++) {
+        printf("%.2f ", matches[i].sim);
+        print_tm_match(cectxs, matches[i].idx);
+        if (matches[i].nsame)
+            printf("     and %u identical strings\n", matches[i].nsame);
+    }
+    ret = true;
+
+done:
+    tm_free(&tm);
+    free(strs);
+    for (int i = 0; i < opts.tm_npaths; i++)
+        if (ectxs[i])
+            strtab_embed_ctx_free(ectxs[i]);
+    free(ectxs);
+    return ret;
+}
+
+static void print_vm_report(const struct script_desc* desc, const struct script_vm_report* r) {
+    printf("%s: %zu states from %zu starts in %zu steps, %zu/%zu commands and %zu/%zu Stop "
+        "commands reached\n", desc->name, r->nstates, r->nstarts, r->nsteps, r->nreached,
+        r->ninsts, r->nstops_reached, r->nstops);
+
+    for (size_t i = 0; i < r->nunreached; i++)
+        printf("    unreached 0x%x-0x%x (L_0x%x), %zu commands\n", r->unreached[i].offs,
+            r->unreached[i].end, r->unreached[i].label, r->unreached[i].ninsts);
+    for (size_t i = 0; i < r->ndead_labels; i++)
+        printf("    dead L_0x%x\n", r->dead_labels[i]);
+    for (size_t i = 0; i < r->nunshown_strs; i++)
+        printf("    unshown str %u\n", r->unshown_strs[i]);
+    for (size_t i = 0; i < r->nunshown_menu_strs; i++)
+        printf("    unshown menu %u\n", r->unshown_menu_strs[i]);
+}
+
+static bool vm_verbs(const uint8_t* rom, size_t sz) {
+    const struct script_desc* descs[INDEX_NSCRIPTS_MAX];
+    uint32_t vmas[INDEX_NSCRIPTS_MAX];
+    size_t nscripts = index_scripts(descs, vmas);
+
+    for (size_t i = 0; i < nscripts; i++) {
+        struct script_vm_report report;
+        if (!script_vm_explore(rom, sz, vmas[i], descs[i], &report)) {
+            fprintf(stderr, "Failed to explore script %s at 0x%x\n", descs[i]->name, vmas[i]);
+            return false;
+        }
+        print_vm_report(descs[i], &report);
+        script_vm_report_free(&report);
+    }
+    return true;
+}
+
 static bool host_is_le() {
     union {
         uint16_t u;
@@ -530,6 +1211,11 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+#ifdef SHPN_STATS
+    stats_enable(opts.stats, opts.trace_path);
+#endif
+    STATS_BEGIN(span, STATS_ROM_MAP);
+
     int rom_fd = open(opts.rom_path, O_RDWR | O_SYMLINK);
     if (rom_fd == -1) {
         perror("open");
@@ -548,9 +1234,12 @@ int main(int argc, char** argv) {
         goto done;
     }
 
-    if (do_crc32(rom, rom_st.st_size) != 0x318a1e9b) {
+    uint32_t crc = do_crc32(rom, rom_st.st_size);
+    if (crc != 0x318a1e9b) {
         fprintf(stderr, "ROM appears to be non-stock, proceeding..\n");
     }
+    STATS_ITEMS(STATS_ROM_MAP, rom_st.st_size);
+    STATS_END(span);
 
     switch (opts.verb) {
         case VERB_SCRIPT: {
@@ -563,6 +1252,41 @@ int main(int argc, char** argv) {
             break;
         }
 
+        case VERB_SCAN: {
+            ret = scan_verbs(rom, rom_st.st_size) ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        case VERB_XREF: {
+            ret = xref_verbs(rom, rom_st.st_size, crc) ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        case VERB_INDEX: {
+            ret = index_verbs(rom, rom_st.st_size, crc) ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        case VERB_QUERY: {
+            ret = query_verbs(rom_st.st_size, crc) ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        case VERB_SEARCH: {
+            ret = search_verbs(rom, rom_st.st_size, crc) ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        case VERB_TM: {
+            ret = tm_verbs() ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
+        case VERB_VM: {
+            ret = vm_verbs(rom, rom_st.st_size) ? EXIT_SUCCESS : EXIT_FAILURE;
+            break;
+        }
+
         case VERB_NOP:
         default:
             fprintf(stderr, "Unrecognized or missing verbs\n");
@@ -571,6 +1295,12 @@ int main(int argc, char** argv) {
             goto done;
     }
 
+#ifdef SHPN_STATS
+    stats_report(stderr);
+    if (!stats_write_trace())
+        ret = EXIT_FAILURE;
+#endif
+
 done:
     if (rom)
         munmap(rom, rom_st.st_size);
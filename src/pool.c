@@ -0,0 +1,79 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+struct pool_ctx {
+    size_t n;
+    atomic_size_t next;
+    atomic_bool ok;
+
+    bool (*fn)(size_t i, size_t tid, void* arg);
+    void* arg;
+};
+
+struct pool_worker {
+    struct pool_ctx* ctx;
+    size_t tid;
+    pthread_t thread;
+};
+
+size_t pool_nthreads() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        return 1;
+    return n < POOL_NTHREADS_MAX ? n : POOL_NTHREADS_MAX;
+}
+
+static void* pool_work(void* p) {
+    const struct pool_worker* w = p;
+    struct pool_ctx* ctx = w->ctx;
+
+    while (atomic_load(&ctx->ok)) {
+        size_t i = atomic_fetch_add(&ctx->next, 1);
+        if (i >= ctx->n)
+            break;
+
+        if (!ctx->fn(i, w->tid, ctx->arg))
+            atomic_store(&ctx->ok, false);
+    }
+
+    return NULL;
+}
+
+bool pool_for(size_t n, size_t nthreads, bool (*fn)(size_t i, size_t tid, void* arg), void* arg) {
+    struct pool_ctx ctx = {.n = n, .fn = fn, .arg = arg};
+    atomic_init(&ctx.next, 0);
+    atomic_init(&ctx.ok, true);
+
+    if (nthreads == 0)
+        nthreads = pool_nthreads();
+    if (nthreads > POOL_NTHREADS_MAX)
+        nthreads = POOL_NTHREADS_MAX;
+    if (nthreads > n)
+        nthreads = n > 0 ? n : 1;
+
+    struct pool_worker workers[POOL_NTHREADS_MAX];
+    size_t nstarted = 1;
+
+    /* If we cannot start a thread, the remaining items are left to those already running */
+    for (; nstarted < nthreads; nstarted++) {
+        workers[nstarted] = (struct pool_worker){.ctx = &ctx, .tid = nstarted};
+        if (pthread_create(&workers[nstarted].thread, NULL, pool_work, &workers[nstarted])) {
+            fprintf(stderr, "pthread_create failed, continuing with %zu threads\n", nstarted);
+            break;
+        }
+    }
+
+    workers[0] = (struct pool_worker){.ctx = &ctx, .tid = 0};
+    pool_work(&workers[0]);
+
+    for (size_t i = 1; i < nstarted; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    return atomic_load(&ctx.ok);
+}
@@ -0,0 +1,20 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define POOL_NTHREADS_MAX 64
+
+/* Amount of worker threads to use by default, at least 1 */
+size_t pool_nthreads();
+
+/**
+ * Call fn(i, tid, arg) for every i in [0, n) using nthreads threads (pool_nthreads() if 0).
+ * Items are handed out in ascending order, and the calling thread participates as tid 0, so
+ * with a single thread fn is called sequentially. tid is below nthreads and can be used to index
+ * per-thread resources. Once fn fails, no more items are started and false is returned.
+ */
+bool pool_for(size_t n, size_t nthreads, bool (*fn)(size_t i, size_t tid, void* arg), void* arg);
+
+#endif
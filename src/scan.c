@@ -0,0 +1,430 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAS_ICONV
+#include <iconv.h>
+#endif
+
+#include "defs.h"
+#include "embed.h"
+#include "scan.h"
+#include "stats.h"
+#include "strtab.h"
+
+/**
+ * The ROM is swept a vector at a time with GCC vector extensions, which become SSE2 or NEON on the
+ * usual hosts. Only vectors that may hold something of interest are looked at byte by byte.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define SCAN_VEC_SZ 16
+typedef uint8_t scan_vec8 __attribute__((vector_size(SCAN_VEC_SZ)));
+typedef uint32_t scan_vec32 __attribute__((vector_size(SCAN_VEC_SZ)));
+
+static bool scan_vec_any(scan_vec8 v) {
+    uint64_t u[2];
+    memcpy(u, &v, sizeof(u));
+    return u[0] | u[1];
+}
+
+static bool scan_vec_all(scan_vec8 v) {
+    uint64_t u[2];
+    memcpy(u, &v, sizeof(u));
+    return (u[0] & u[1]) == UINT64_MAX;
+}
+#endif
+
+#define SCAN_CHUNK 4096 /* initial capacity of results */
+
+static int scan_ptr_cmp(const void* a, const void* b) {
+    const struct scan_ptr* x = a, * y = b;
+
+    if (x->target != y->target)
+        return x->target < y->target ? -1 : 1;
+    return (x->vma > y->vma) - (x->vma < y->vma);
+}
+
+static bool scan_ptrs_push(struct scan_ptr** ptrs, size_t* n, size_t* cap, uint32_t target,
+    uint32_t vma) {
+    if (*n == *cap) {
+        size_t cap_new = *cap ? 2 * *cap : SCAN_CHUNK;
+        struct scan_ptr* p = realloc(*ptrs, sizeof(struct scan_ptr[cap_new]));
+        if (!p) {
+            perror("realloc");
+            return false;
+        }
+        *ptrs = p;
+        *cap = cap_new;
+    }
+    (*ptrs)[(*n)++] = (struct scan_ptr){target, vma};
+    return true;
+}
+
+struct scan_ptr* scan_ptrs(const uint8_t* rom, size_t sz, uint32_t lo, uint32_t hi, size_t* nptrs) {
+    struct scan_ptr* ptrs = NULL;
+    size_t n = 0, cap = 0, i = 0;
+
+    sz &= ~(sizeof(uint32_t) - 1);
+
+#ifdef SCAN_VEC_SZ
+    for (; i + SCAN_VEC_SZ <= sz; i += SCAN_VEC_SZ) {
+        scan_vec32 w;
+        memcpy(&w, &rom[i], sizeof(w));
+
+        /* Unsigned range check as a single compare */
+        scan_vec32 in = (scan_vec32)(w - lo < hi - lo);
+        if (!scan_vec_any((scan_vec8)in))
+            continue;
+
+        for (size_t j = 0; j < SCAN_VEC_SZ / sizeof(uint32_t); j++)
+            if (in[j] && !scan_ptrs_push(&ptrs, &n, &cap, w[j],
+                    OFFS2VMA(i + j * sizeof(uint32_t))))
+                goto fail;
+    }
+#endif
+
+    for (; i < sz; i += sizeof(uint32_t)) {
+        uint32_t w;
+        memcpy(&w, &rom[i], sizeof(w));
+
+        if (w - lo < hi - lo && !scan_ptrs_push(&ptrs, &n, &cap, w, OFFS2VMA(i)))
+            goto fail;
+    }
+
+    /* An empty result is not a failure */
+    if (!ptrs) {
+        ptrs = malloc(sizeof(*ptrs));
+        if (!ptrs) {
+            perror("malloc");
+            return NULL;
+        }
+    }
+
+    qsort(ptrs, n, sizeof(*ptrs), scan_ptr_cmp);
+    *nptrs = n;
+    return ptrs;
+
+fail:
+    free(ptrs);
+    return NULL;
+}
+
+/* Bytes that are neither NUL nor part of any SJIS text */
+static bool scan_is_bad(uint8_t c) {
+    return (c < 0x20 && c != '\0' && c != '\n' && c != '\r') || c == 0x7f || c > 0xfc;
+}
+
+static bool sjis_is_lead(uint8_t c) {
+    return (c >= 0x81 && c <= 0x9f) || (c >= 0xe0 && c <= 0xfc);
+}
+
+static bool sjis_is_trail(uint8_t c) {
+    return c >= 0x40 && c <= 0xfc && c != 0x7f;
+}
+
+/* Whether [str, end) is whole SJIS characters with at least SCAN_STR_FW_MIN full-width ones */
+static bool scan_is_sjis(const uint8_t* str, const uint8_t* end) {
+    size_t nfw = 0;
+
+    while (str < end) {
+        uint8_t c = *str;
+
+        if (sjis_is_lead(c)) {
+            if (str + 1 == end || !sjis_is_trail(str[1]))
+                return false;
+            nfw++;
+            str += 2;
+        } else if (c == '\n' || c == '\r' || (c >= 0x20 && c < 0x7f) || (c >= 0xa1 && c <= 0xdf))
+            str++;
+        else
+            return false;
+    }
+    return nfw >= SCAN_STR_FW_MIN;
+}
+
+struct scan_strs_job {
+    const uint8_t* rom;
+    struct scan_ptr* ptrs;
+    size_t nptrs;
+
+    struct scan_str* strs;
+    size_t nstrs, cap;
+};
+
+/* Add the strings that pointers into the run [start, end) of text bytes point to */
+static bool scan_run(struct scan_strs_job* job, size_t start, size_t end) {
+    uint32_t lo = OFFS2VMA(start), hi = OFFS2VMA(end);
+
+    /* Lower bound of lo */
+    size_t l = 0, r = job->nptrs;
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        if (job->ptrs[m].target < lo)
+            l = m + 1;
+        else
+            r = m;
+    }
+
+    while (l < job->nptrs && job->ptrs[l].target < hi) {
+        uint32_t target = job->ptrs[l].target;
+        size_t nptrs = 0;
+
+        for (; l < job->nptrs && job->ptrs[l].target == target; l++)
+            nptrs++;
+
+        if (target % SCAN_STR_ALIGN || !scan_is_sjis(&job->rom[VMA2OFFS(target)], &job->rom[end]))
+            continue;
+
+        if (job->nstrs == job->cap) {
+            size_t cap_new = job->cap ? 2 * job->cap : SCAN_CHUNK;
+            struct scan_str* p = realloc(job->strs, sizeof(struct scan_str[cap_new]));
+            if (!p) {
+                perror("realloc");
+                return false;
+            }
+            job->strs = p;
+            job->cap = cap_new;
+        }
+        job->strs[job->nstrs++] = (struct scan_str){target, hi - target, nptrs};
+    }
+    return true;
+}
+
+struct scan_str* scan_strs(const uint8_t* rom, size_t sz, size_t* nstrs) {
+    STATS_BEGIN(span, STATS_SCAN);
+
+    struct scan_strs_job job = {.rom = rom};
+    size_t start = 0, i = 0;
+
+    job.ptrs = scan_ptrs(rom, sz, OFFS2VMA(0), OFFS2VMA(sz), &job.nptrs);
+    if (!job.ptrs)
+        goto fail;
+
+#ifdef SCAN_VEC_SZ
+    for (; i + SCAN_VEC_SZ <= sz; i += SCAN_VEC_SZ) {
+        scan_vec8 v;
+        memcpy(&v, &rom[i], sizeof(v));
+
+        scan_vec8 nul = (scan_vec8)(v == 0);
+        scan_vec8 bad = (scan_vec8)((v < 0x20) & ~nul & (scan_vec8)(v != '\n') &
+            (scan_vec8)(v != '\r')) | (scan_vec8)(v == 0x7f) | (scan_vec8)(v > 0xfc);
+
+        /* Nothing but text goes on, nothing but non-text cannot start a string */
+        if (!scan_vec_any(nul | bad))
+            continue;
+        if (scan_vec_all(bad)) {
+            start = i + SCAN_VEC_SZ;
+            continue;
+        }
+
+        for (size_t j = i; j < i + SCAN_VEC_SZ; j++) {
+            if (bad[j - i])
+                start = j + 1;
+            else if (nul[j - i]) {
+                if (j > start && !scan_run(&job, start, j))
+                    goto fail;
+                start = j + 1;
+            }
+        }
+    }
+#endif
+
+    for (; i < sz; i++) {
+        if (scan_is_bad(rom[i]))
+            start = i + 1;
+        else if (!rom[i]) {
+            if (i > start && !scan_run(&job, start, i))
+                goto fail;
+            start = i + 1;
+        }
+    }
+
+    if (!job.strs) {
+        job.strs = malloc(sizeof(*job.strs));
+        if (!job.strs) {
+            perror("malloc");
+            goto fail;
+        }
+    }
+
+    free(job.ptrs);
+    *nstrs = job.nstrs;
+    STATS_ITEMS(STATS_SCAN, sz);
+    STATS_END(span);
+    return job.strs;
+
+fail:
+    free(job.ptrs);
+    free(job.strs);
+    STATS_END(span);
+    return NULL;
+}
+
+/* Convert n bytes of SJIS at in to UTF-8, or to \x escapes without iconv */
+static bool scan_conv(const char* in, size_t n, char** out, size_t* out_left, iconv_t conv) {
+    if (conv != (iconv_t)-1) {
+#ifdef HAS_ICONV
+        char* inp = (char*)in;
+
+        iconv(conv, NULL, NULL, NULL, NULL);
+        return iconv(conv, &inp, &n, out, out_left) != (size_t)-1;
+#endif
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (*out_left < sizeof("\\xff"))
+            return false;
+
+        int w = sprintf(*out, "\\x%02x", (uint8_t)in[i]);
+        *out += w;
+        *out_left -= w;
+    }
+    return true;
+}
+
+/**
+ * Decode the SJIS string at str of len bytes to out with escaped line breaks and quotes. With
+ * strtab_esc, they are escaped before conversion as strtab_dec_str does, so that the result can be
+ * compared to decoded strtab strings, which then have YEN SIGN in place of backslashes.
+ */
+static bool scan_str_dec(const uint8_t* str, size_t len, char* out, size_t out_sz, iconv_t conv,
+    bool strtab_esc) {
+    char buf[DEC_BUF_SZ_SJIS];
+    size_t n = 0;
+
+    if (out_sz < SJIS_TO_U8_MIN_SZ(sizeof(buf)))
+        return false;
+
+    char* outp = out;
+    size_t out_left = out_sz - 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (n + 2 >= sizeof(buf))
+            return false;
+
+        if (str[i] != '\n' && str[i] != '\r' && str[i] != '"') {
+            buf[n++] = str[i];
+            continue;
+        }
+
+        char esc[] = {'\\', str[i] == '\n' ? 'n' : str[i] == '\r' ? 'r' : '"'};
+        if (strtab_esc) {
+            memcpy(&buf[n], esc, sizeof(esc));
+            n += sizeof(esc);
+        } else {
+            if (!scan_conv(buf, n, &outp, &out_left, conv) || out_left < sizeof(esc))
+                return false;
+            memcpy(outp, esc, sizeof(esc));
+            outp += sizeof(esc);
+            out_left -= sizeof(esc);
+            n = 0;
+        }
+    }
+
+    if (!scan_conv(buf, n, &outp, &out_left, conv))
+        return false;
+    *outp = '\0';
+    return true;
+}
+
+static int strcmp_ptr(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+bool scan_strs_dump(const uint8_t* rom, size_t sz, uint32_t strtab_menu_vma, FILE* fout) {
+    bool ret = false;
+    size_t nstrs = 0, nmapped = 0, nmenu = 0, nskipped = 0;
+    char** menu = NULL;
+    iconv_t conv = (iconv_t)-1;
+
+    struct strtab_embed_ctx* ectx = strtab_embed_ctx_new();
+    struct scan_str* strs = scan_strs(rom, sz, &nstrs);
+    if (!ectx || !strs)
+        goto done;
+
+    /* Sorted menu strings, each followed by its index */
+    if (strtab_menu_vma) {
+        if (!strtab_from_rom(rom, sz, strtab_menu_vma, ectx))
+            goto done;
+
+        menu = malloc(sizeof(char*[ectx->nstrs]));
+        if (!menu) {
+            perror("malloc");
+            goto done;
+        }
+
+        for (size_t i = 1; i < ectx->nstrs; i++) {
+            if (!ectx->allocated[i].used)
+                continue;
+
+            size_t len = strlen(ectx->strs[i]);
+            char* s = realloc(ectx->strs[i], len + 1 + sizeof(uint16_t));
+            if (!s) {
+                perror("realloc");
+                goto done;
+            }
+            memcpy(&s[len + 1], &(uint16_t){i}, sizeof(uint16_t));
+            ectx->strs[i] = s;
+            menu[nmenu++] = s;
+        }
+        qsort(menu, nmenu, sizeof(*menu), strcmp_ptr);
+    }
+
+#ifdef HAS_ICONV
+    conv = iconv_open("UTF-8", "SJIS");
+    if (conv == (iconv_t)-1)
+        perror("iconv_open");
+#endif
+
+    char buf[SJIS_TO_U8_MIN_SZ(DEC_BUF_SZ_SJIS)];
+
+    for (size_t i = 0; i < nstrs; i++) {
+        const uint8_t* str = &rom[VMA2OFFS(strs[i].vma)];
+        uint16_t idx = 0;
+
+        /* Valid SJIS may still have no characters assigned */
+        if (menu) {
+            if (!scan_str_dec(str, strs[i].len, buf, sizeof(buf), conv, true)) {
+                nskipped++;
+                continue;
+            }
+
+            char* key = buf;
+            char** found = bsearch(&key, menu, nmenu, sizeof(*menu), strcmp_ptr);
+            if (found) {
+                memcpy(&idx, &(*found)[strlen(*found) + 1], sizeof(idx));
+                nmapped++;
+            }
+        }
+
+        if (!scan_str_dec(str, strs[i].len, buf, sizeof(buf), conv, false)) {
+            nskipped++;
+            continue;
+        }
+
+        /* Keep the comment closed */
+        for (char* c = strstr(buf, "*/"); c; c = strstr(c, "*/"))
+            *c = '+';
+
+        fprintf(fout, "    {0x%X, %u}, /* %s */\n", strs[i].vma, idx, buf);
+    }
+
+    fprintf(stderr, "Found %zu strings, %zu of them in the menu strtab, %zu undecodable\n",
+        nstrs - nskipped, nmapped, nskipped);
+    ret = true;
+
+done:
+#ifdef HAS_ICONV
+    if (conv != (iconv_t)-1)
+        iconv_close(conv);
+#endif
+    free(menu);
+    free(strs);
+    if (ectx)
+        strtab_embed_ctx_free(ectx);
+    return ret;
+}
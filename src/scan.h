@@ -0,0 +1,49 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* An aligned 32-bit word of the ROM at vma that holds target */
+struct scan_ptr {
+    uint32_t target;
+    uint32_t vma;
+};
+
+/* A NUL-terminated SJIS string that is pointed to from the ROM */
+struct scan_str {
+    uint32_t vma;
+    uint32_t len; /* in bytes, without NUL */
+    uint32_t nptrs;
+};
+
+/**
+ * Smallest number of full-width characters of a string, as shorter ones are mostly noise. String
+ * constants are word-aligned by the compiler, which rules out most of the rest.
+ */
+#define SCAN_STR_FW_MIN 1
+#define SCAN_STR_ALIGN 4
+
+/**
+ * Collect the aligned words of rom that point within [lo, hi), sorted by target and then vma.
+ * Returns NULL on allocation failure, otherwise the caller frees the result.
+ */
+struct scan_ptr* scan_ptrs(const uint8_t* rom, size_t sz, uint32_t lo, uint32_t hi, size_t* nptrs);
+
+/**
+ * Find NUL-terminated SJIS strings of rom that some aligned word points to, sorted by vma. Strings
+ * start at multiples of SCAN_STR_ALIGN.
+ * Returns NULL on allocation failure, otherwise the caller frees the result.
+ */
+struct scan_str* scan_strs(const uint8_t* rom, size_t sz, size_t* nstrs);
+
+/**
+ * Write the strings found by scan_strs in the format of agb/static_strings.c. Each one is mapped
+ * to the index of an equal string of the menu strtab at strtab_menu_vma, or to 0 if there is
+ * none or strtab_menu_vma is 0.
+ */
+bool scan_strs_dump(const uint8_t* rom, size_t sz, uint32_t strtab_menu_vma, FILE* fout);
+
+#endif
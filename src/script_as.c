@@ -26,6 +26,13 @@ struct script_as_ctx {
     struct strtab_embed_ctx* strs_menu;
     struct jump_refs_ctx* refs;
     const uint8_t* branch_info_begin, * branch_info_end;
+    size_t nstmts_inserted; /* by splitting */
+
+    /* Built by script_assemble, as splitting inserts statements until then */
+    size_t* pos; /* of each statement in order, indexed like pctx->stmts */
+    struct label_use* srcs; /* label arguments of branches and jumps */
+    struct label_use* dsts; /* labeled statements */
+    size_t nsrcs, ndsts;
 };
 
 FMT_PRINTF(4, 5)
@@ -55,18 +62,70 @@ struct jump_refs_ctx {
 
         const struct script_stmt* jump;
         uint8_t* emitted_jump;
+
+        size_t next_to_label; /* JUMP_REFS_SZ for the last one */
     } refs [JUMP_REFS_SZ];
+
+    /* First ref from a jump and refs to a label, indexed like stmts. JUMP_REFS_SZ for none */
+    const struct script_stmt* stmts;
+    size_t* from_jump;
+    size_t* to_label, * to_label_last;
 };
 
 static bool jump_refs_add(struct jump_refs_ctx* refs, const struct script_stmt* jump,
     const struct script_stmt* label, uint8_t* ejump, uint16_t elabel) {
     if (refs->nrefs >= JUMP_REFS_SZ)
         return false;
-    refs->refs[refs->nrefs++] = (struct jump_ref){.label = label, .jump = jump,
-        .emitted_jump = ejump, .emitted_label = elabel};
+
+    size_t i = refs->nrefs++;
+    refs->refs[i] = (struct jump_ref){.label = label, .jump = jump,
+        .emitted_jump = ejump, .emitted_label = elabel, .next_to_label = JUMP_REFS_SZ};
+
+    size_t ijump = jump - refs->stmts, ilabel = label - refs->stmts;
+    if (refs->from_jump[ijump] == JUMP_REFS_SZ)
+        refs->from_jump[ijump] = i;
+    if (refs->to_label[ilabel] == JUMP_REFS_SZ)
+        refs->to_label[ilabel] = i;
+    else
+        refs->refs[refs->to_label_last[ilabel]].next_to_label = i;
+    refs->to_label_last[ilabel] = i;
     return true;
 }
 
+/* A label argument of a branch or jump, or a labeled statement */
+struct label_use {
+    const char* label;
+    size_t ord; /* of stmt, in order for arguments and in storage for statements */
+    const struct script_stmt* stmt;
+};
+
+static int cmp_label_use(const void* a, const void* b) {
+    const struct label_use* ua = a, * ub = b;
+    int cmp = strcmp(ua->label, ub->label);
+
+    if (cmp)
+        return cmp;
+    return (ua->ord > ub->ord) - (ua->ord < ub->ord);
+}
+
+/* The n uses of label in uses, which are sorted by cmp_label_use */
+static const struct label_use* find_label_uses(const struct label_use* uses, size_t nuses,
+        const char* label, size_t* n) {
+    size_t lo = 0, hi = nuses;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(uses[mid].label, label) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (*n = 0; lo + *n < nuses && !strcmp(uses[lo + *n].label, label); (*n)++)
+        ;
+    return &uses[lo];
+}
+
 static bool emit_byte(const struct script_stmt* stmt, struct script_as_ctx* actx) {
     assert(stmt->ty == STMT_TY_BYTE);
 
@@ -101,12 +160,11 @@ static bool emit_arg_num(const struct script_stmt* stmt, const struct script_arg
     return true;
 }
 
-static const struct script_stmt* find_labeled_stmt(const struct script_parse_ctx* pctx,
+static const struct script_stmt* find_labeled_stmt(const struct script_as_ctx* actx,
         const char* label) {
-    for (size_t i = 0; i < pctx->nstmts; i++)
-        if (pctx->stmts[i].label && !strcmp(pctx->stmts[i].label, label))
-            return &pctx->stmts[i];
-    return NULL;
+    size_t n;
+    const struct label_use* dst = find_label_uses(actx->dsts, actx->ndsts, label, &n);
+    return n ? dst->stmt : NULL;
 }
 
 static bool emit_arg_label(const struct script_stmt* stmt, const struct script_arg* arg,
@@ -122,19 +180,16 @@ static bool emit_arg_label(const struct script_stmt* stmt, const struct script_a
      * Check if destination label occured before the jump. In that case, it must have been added
      * to the refs already.
      */
-    for (size_t i = 0; i < actx->refs->nrefs; i++) {
-        if (stmt == actx->refs->refs[i].jump) {
-            bdst = actx->refs->refs[i].emitted_label;
-            break;
-        }
-    }
+    size_t iref = actx->refs->from_jump[stmt - actx->pctx->stmts];
+    if (iref != JUMP_REFS_SZ)
+        bdst = actx->refs->refs[iref].emitted_label;
     /**
      * If destination label is somewhere ahead, write zero for now and overwrite the value when we
      * try to emit statement at that label.
      */
     memcpy(actx->dst, &bdst, sizeof(bdst));
     if (bdst == UINT16_MAX) {
-        const struct script_stmt* labeled_stmt = find_labeled_stmt(actx->pctx, arg->label);
+        const struct script_stmt* labeled_stmt = find_labeled_stmt(actx, arg->label);
         if (!labeled_stmt) {
             log(true, stmt, actx->pctx, "label %s not found", arg->label);
             return false;
@@ -263,35 +318,14 @@ enum stmt_order {
     STMT_ORD_GT
 };
 
-static enum stmt_order stmt_order(const struct script_stmt* first, const struct script_stmt* second) {
-    if (first == second)
-        return STMT_ORD_EQ;
+static enum stmt_order stmt_order(const struct script_as_ctx* actx,
+        const struct script_stmt* first, const struct script_stmt* second) {
+    size_t pfirst = actx->pos[first - actx->pctx->stmts];
+    size_t psecond = actx->pos[second - actx->pctx->stmts];
 
-    while (first) {
-        if (first->next == second)
-            return STMT_ORD_LT;
-        first = first->next;
-    }
-    return STMT_ORD_GT;
-}
-
-static bool branch_src(const struct script_stmt* stmt, const struct script_stmt** bsrc) {
-    for (; *bsrc; *bsrc = (*bsrc)->next) {
-        if ((*bsrc)->ty != STMT_TY_OP)
-            continue;
-
-        union script_cmd cmd = {.op = (*bsrc)->op.idx};
-        if (cmd_is_branch(&cmd) || cmd_is_jump(&cmd)) {
-            for (int j = 0; j < (*bsrc)->op.args.nargs; j++)
-                if ((*bsrc)->op.args.args[j].type == ARG_TY_LABEL &&
-                    !strcmp((*bsrc)->op.args.args[j].label, stmt->label)) {
-                // fprintf(stderr, "%zu -> %zu\n", src->line, stmt->line);
-                return true;
-            }
-        }
-    }
-
-    return false;
+    if (pfirst == psecond)
+        return STMT_ORD_EQ;
+    return pfirst < psecond ? STMT_ORD_LT : STMT_ORD_GT;
 }
 
 static bool section_stmt(const struct script_stmt* stmt, struct script_as_ctx* actx) {
@@ -318,17 +352,16 @@ static bool fixup_jumps(const struct script_stmt* stmt, struct script_as_ctx* ac
     assert(stmt->label);
 
     /* For all jumps to stmt emitted before stmt, set their dst to stmt emitted loc */
-    for (size_t i = 0; i < actx->refs->nrefs; i++) {
-        if (actx->refs->refs[i].label == stmt) {
-            if (actx->dst - actx->dst_start > UINT16_MAX) {
-                log(true, stmt, actx->pctx,
-                    "jump to this location from line %zu cannot be encoded",
-                    actx->refs->refs[i].jump->line);
-                return false;
-            }
-            *(uint16_t*)actx->refs->refs[i].emitted_jump =
-                (uint16_t)(actx->dst - actx->dst_start);
+    for (size_t i = actx->refs->to_label[stmt - actx->pctx->stmts]; i != JUMP_REFS_SZ;
+            i = actx->refs->refs[i].next_to_label) {
+        if (actx->dst - actx->dst_start > UINT16_MAX) {
+            log(true, stmt, actx->pctx,
+                "jump to this location from line %zu cannot be encoded",
+                actx->refs->refs[i].jump->line);
+            return false;
         }
+        *(uint16_t*)actx->refs->refs[i].emitted_jump =
+            (uint16_t)(actx->dst - actx->dst_start);
     }
 
     return true;
@@ -337,16 +370,21 @@ static bool fixup_jumps(const struct script_stmt* stmt, struct script_as_ctx* ac
 static bool process_label_refs(const struct script_stmt* stmt, struct script_as_ctx* actx) {
     assert(stmt->label);
 
-    const struct script_stmt* bsrc = &actx->pctx->stmts[0];
-    bool checked_refs = false;
+    size_t nsrcs;
+    const struct label_use* srcs = find_label_uses(actx->srcs, actx->nsrcs, stmt->label, &nsrcs);
+    if (!nsrcs)
+        log(false, stmt, actx->pctx, "label %s unreferenced", stmt->label);
+
+    for (size_t i = 0; i < nsrcs; i++) {
+        const struct script_stmt* bsrc = srcs[i].stmt;
+
+        /* A command may take the label more than once */
+        if (i > 0 && bsrc == srcs[i - 1].stmt)
+            continue;
 
-    do {
-        if (!branch_src(stmt, &bsrc)) {
-            if (!checked_refs)
-                log(false, stmt, actx->pctx, "label %s unreferenced", stmt->label);
-        } else if (cmd_is_branch(&(union script_cmd){.op = bsrc->op.idx})) {
+        if (cmd_is_branch(&(union script_cmd){.op = bsrc->op.idx})) {
             /* Check if stmt is reachable for branching from src */
-            if (stmt_order(stmt, bsrc) != STMT_ORD_GT) {
+            if (stmt_order(actx, stmt, bsrc) != STMT_ORD_GT) {
                 log(true, stmt, actx->pctx, "cannot branch from line %zu backwards to label here",
                     bsrc->line);
                 return false;
@@ -372,7 +410,7 @@ static bool process_label_refs(const struct script_stmt* stmt, struct script_as_
             }
         } else if (cmd_is_jump(STMT_TO_CMD(bsrc))) {
             /* Label occurs before a jump to it; create source-dst entry to be handled by jump later */
-            if (stmt_order(stmt, bsrc) == STMT_ORD_LT) {
+            if (stmt_order(actx, stmt, bsrc) == STMT_ORD_LT) {
                 if ((actx->dst - actx->dst_start) > UINT16_MAX) {
                     log(true, stmt, actx->pctx, "jump to this location from line %zu cannot be encoded",
                         bsrc->line);
@@ -384,11 +422,7 @@ static bool process_label_refs(const struct script_stmt* stmt, struct script_as_
                 }
             }
         }
-        checked_refs = true;
-        /* Keep looking for more refs to the label */
-        if (bsrc)
-            bsrc = bsrc->next;
-    } while (bsrc);
+    }
 
     return true;
 }
@@ -429,6 +463,7 @@ static bool arg_numbered_str_to_strtab(struct script_stmt* stmt, struct script_a
     //         cmd_uses_menu_strtab(STMT_TO_CMD(stmt)) ? "menu" : "script",
     //         arg->numbered_str.num);
 
+    strtab_embed_layout_drop(strs, arg->numbered_str.num);
     if (strs->allocated[arg->numbered_str.num].allocated)
         free(strs->strs[arg->numbered_str.num]);
 
@@ -478,16 +513,17 @@ static bool arg_str_to_strtab(struct script_stmt* stmt, struct script_as_ctx* ac
         if (!strs->allocated[i].used)
             break;
 
-    if (strs->allocated[i].allocated) {
-        free(strs->strs[i]);
-        strs->allocated[i].allocated = false;
-    }
-
     if (i == EMBED_STRTAB_SZ) {
         log(true, stmt, actx->pctx, "too many strings in program");
         return false;
     }
 
+    strtab_embed_layout_drop(strs, i);
+    if (strs->allocated[i].allocated) {
+        free(strs->strs[i]);
+        strs->allocated[i].allocated = false;
+    }
+
     /* Convert arg to NUMBERED_STR */
     const char* str = arg->str;
     arg->numbered_str.num = i;
@@ -560,6 +596,8 @@ static bool insert_ShowText(struct script_as_ctx* actx, struct script_stmt* stmt
         return false;
     }
 
+    actx->nstmts_inserted++;
+
     /* stmt_new should be at stmt->next now */
     return stmt_str_to_strtab(stmt->next, actx);
 }
@@ -584,6 +622,7 @@ static bool insert_HandleInput(struct script_as_ctx* actx, struct script_stmt* s
         return false;
     }
 
+    actx->nstmts_inserted++;
     return true;
 }
 
@@ -608,16 +647,26 @@ bool split_ShowText_stmt(struct script_as_ctx* actx, struct script_stmt* stmt,
          * FIXME: We could potentially avoid str realloc at split here, but allocated[i] does not
          * let us tell if a string is unreferenced.
          */
+        const struct sjis_layout* layout = strtab_embed_layout(strtab, idx);
+        if (!layout) {
+            log(true, stmt, actx->pctx, "failed to lay out text");
+            return false;
+        }
+
+        if (layout->overflows)
+            log(false, stmt, actx->pctx, "text does not fit in %zu frames", layout->nframes);
+
         char* str = strtab->strs[idx];
-        size_t at = sjis_break_frame_at(str);
-        bool first = true;
+        size_t start = 0;
+
+        for (size_t i = 0; i + 1 < layout->nframes; i++) {
+            size_t at = layout->frame_breaks[i];
 
-        while (at) {
             assert(str[at] == '\n');
             str[at] = '\0';
 
-            if (!first) {
-                if (!insert_ShowText(actx, stmt, str))
+            if (i > 0) {
+                if (!insert_ShowText(actx, stmt, &str[start]))
                     return false;
                 stmt = stmt->next;
             }
@@ -626,13 +675,14 @@ bool split_ShowText_stmt(struct script_as_ctx* actx, struct script_stmt* stmt,
                 return false;
             stmt = stmt->next;
 
-            str = &str[at + 1];
-            first = false;
-            at = sjis_break_frame_at(str);
+            start = at + 1;
         }
 
-        if (!first) {
-            if (!insert_ShowText(actx, stmt, str))
+        if (layout->nframes > 1) {
+            /* The string now ends with its first frame */
+            strtab_embed_layout_drop(strtab, idx);
+
+            if (!insert_ShowText(actx, stmt, &str[start]))
                 return false;
             *next = stmt->next;
 
@@ -642,8 +692,9 @@ bool split_ShowText_stmt(struct script_as_ctx* actx, struct script_stmt* stmt,
     return true;
 }
 
+/* Set *split if the strings from arg_start on do not fit in a frame, return false on error */
 static bool should_split_Choice(const struct script_stmt* stmt, struct strtab_embed_ctx* strtab,
-    size_t arg_start, size_t* first_str_arg) {
+    size_t arg_start, size_t* first_str_arg, bool* split) {
     assert(strtab->enc == STRTAB_ENC_SJIS);
 
     const struct script_op_stmt* op = &stmt->op;
@@ -658,10 +709,12 @@ static bool should_split_Choice(const struct script_stmt* stmt, struct strtab_em
             assert(strtab->allocated[num].allocated);
             assert(num < strtab->nstrs);
 
-            const char* sjis = strtab->strs[num];
+            const struct sjis_layout* layout = strtab_embed_layout(strtab, num);
+            if (!layout)
+                return false;
 
-            nrows += sjis_nrows(sjis);
-            nglyphs += sjis_nglyphs(sjis);
+            nrows += layout->nrows;
+            nglyphs += layout->nglyphs;
 
             if (first_str_arg && !first_str) {
                 first_str = true;
@@ -670,7 +723,8 @@ static bool should_split_Choice(const struct script_stmt* stmt, struct strtab_em
         }
     }
 
-    return nrows > RENDER_NROWS_MAX || nglyphs > RENDER_NCHARS_MAX;
+    *split = nrows > RENDER_NROWS_MAX || nglyphs > RENDER_NCHARS_MAX;
+    return true;
 }
 
 /**
@@ -684,12 +738,21 @@ bool split_Choice_stmt(struct script_as_ctx* actx, struct script_stmt* stmt) {
 
     if (is_choice_stmt(stmt)) {
         size_t first_str_arg = 0;
+        bool split;
 
-        if (!should_split_Choice(stmt, actx->strs_menu, 0, &first_str_arg))
+        if (!should_split_Choice(stmt, actx->strs_menu, 0, &first_str_arg, &split)) {
+            log(true, stmt, actx->pctx, "failed to lay out text");
+            return false;
+        }
+        if (!split)
             return true;
 
         /* Does it fit if we ignore the pretext? */
-        if (should_split_Choice(stmt, actx->strs_menu, first_str_arg + 1, NULL)) {
+        if (!should_split_Choice(stmt, actx->strs_menu, first_str_arg + 1, NULL, &split)) {
+            log(true, stmt, actx->pctx, "failed to lay out text");
+            return false;
+        }
+        if (split) {
             log(false, stmt, actx->pctx, "Choice does not fit after splitting");
             // return false;
         }
@@ -736,7 +799,8 @@ bool split_Choice_stmt(struct script_as_ctx* actx, struct script_stmt* stmt) {
          * Choice((i)"long pretext"); ShowText(i) somewhere, we'll set i for Choice, but the
          * ShowText may still expect to have "long text" at i.
          */
-        if (pretext_arg->numbered_str.str)
+        if (pretext_arg->numbered_str.str &&
+            script_parse_ctx_owns(actx->pctx, pretext_arg->numbered_str.str))
             free((void*)pretext_arg->numbered_str.str);
 
         pretext_arg->num = EMBED_STR_PLACEHOLDER_IDX;
@@ -854,9 +918,91 @@ void script_as_ctx_free(struct script_as_ctx* actx) {
     }
 }
 
+size_t script_as_nstmts_inserted(const struct script_as_ctx* actx) {
+    return actx->nstmts_inserted;
+}
+
+static bool is_label_src(const struct script_stmt* stmt) {
+    if (stmt->ty != STMT_TY_OP)
+        return false;
+
+    union script_cmd cmd = {.op = stmt->op.idx};
+    return cmd_is_branch(&cmd) || cmd_is_jump(&cmd);
+}
+
+/* Index the statements once they are final, so that labels are not resolved by list walks */
+static bool index_stmts(struct script_as_ctx* actx) {
+    const struct script_parse_ctx* pctx = actx->pctx;
+    struct jump_refs_ctx* refs = actx->refs;
+    size_t n = pctx->nstmts;
+
+    size_t nsrcs = 0, ndsts = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct script_stmt* stmt = &pctx->stmts[i];
+
+        ndsts += stmt->label != NULL;
+        if (is_label_src(stmt))
+            for (int j = 0; j < stmt->op.args.nargs; j++)
+                nsrcs += stmt->op.args.args[j].type == ARG_TY_LABEL;
+    }
+
+    size_t* idx = malloc(4 * n * sizeof(*idx) + 1);
+    struct label_use* uses = malloc((nsrcs + ndsts) * sizeof(*uses) + 1);
+    if (!idx || !uses) {
+        perror("malloc");
+        free(idx);
+        free(uses);
+        return false;
+    }
+
+    actx->pos = idx;
+    actx->srcs = uses;
+    actx->dsts = &uses[nsrcs];
+    actx->nsrcs = nsrcs;
+    actx->ndsts = ndsts;
+
+    refs->stmts = pctx->stmts;
+    refs->from_jump = &idx[n];
+    refs->to_label = &idx[2 * n];
+    refs->to_label_last = &idx[3 * n];
+    for (size_t i = 0; i < n; i++)
+        refs->from_jump[i] = refs->to_label[i] = JUMP_REFS_SZ;
+
+    size_t isrc = 0, idst = 0, pos = 0;
+    for (const struct script_stmt* stmt = n ? &pctx->stmts[0] : NULL; stmt; stmt = stmt->next) {
+        actx->pos[stmt - pctx->stmts] = pos++;
+
+        if (is_label_src(stmt))
+            for (int j = 0; j < stmt->op.args.nargs; j++)
+                if (stmt->op.args.args[j].type == ARG_TY_LABEL)
+                    actx->srcs[isrc++] = (struct label_use){stmt->op.args.args[j].label, pos, stmt};
+    }
+    for (size_t i = 0; i < n; i++)
+        if (pctx->stmts[i].label)
+            actx->dsts[idst++] = (struct label_use){pctx->stmts[i].label, i, &pctx->stmts[i]};
+    assert(isrc <= nsrcs && idst == ndsts);
+
+    /* Unlinked statements are not referenced */
+    actx->nsrcs = isrc;
+    qsort(actx->srcs, actx->nsrcs, sizeof(*actx->srcs), cmp_label_use);
+    qsort(actx->dsts, actx->ndsts, sizeof(*actx->dsts), cmp_label_use);
+    return true;
+}
+
+static void index_stmts_free(struct script_as_ctx* actx) {
+    free(actx->pos);
+    free(actx->srcs);
+    actx->pos = NULL;
+    actx->srcs = actx->dsts = NULL;
+    actx->refs->from_jump = actx->refs->to_label = actx->refs->to_label_last = NULL;
+}
+
 bool script_assemble(struct script_as_ctx* actx) {
     assert(actx);
 
+    if (!index_stmts(actx))
+        return false;
+
     bool ret = true;
     const struct script_stmt* stmt = &actx->pctx->stmts[0];
     size_t nstmts_left = actx->pctx->nstmts;
@@ -883,5 +1029,6 @@ bool script_assemble(struct script_as_ctx* actx) {
             .bytes_to_end = actx->dst - actx->branch_info_end
         }, sizeof(struct script_hdr));
 
+    index_stmts_free(actx);
     return ret;
 }
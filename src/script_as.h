@@ -23,6 +23,8 @@ bool script_assemble(struct script_as_ctx* actx);
 
 bool split_ShowText_stmts(struct script_as_ctx* actx);
 bool split_Choice_stmts(struct script_as_ctx* actx);
+/* ShowText and HandleInput statements inserted by splitting so far */
+size_t script_as_nstmts_inserted(const struct script_as_ctx* actx);
 bool split_ShowText_stmt(struct script_as_ctx* actx, struct script_stmt* stmt,
     struct strtab_embed_ctx* strtab, struct script_stmt** next);
 
@@ -1,17 +1,25 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <sys/uio.h>
 
 #include "defs.h"
+#include "pool.h"
 #include "script_disass.h"
+#include "script_ir.h"
+#include "script_parse_ctx.h"
 #include "strtab.h"
 
-static struct script_desc scripts[] = {
+static const struct script_desc scripts[] = {
     {
         .name = "Harry",
         .vma = 0x82316DC,
@@ -26,75 +34,395 @@ static struct script_desc scripts[] = {
     }
 };
 
-extern struct script_cmd_handler script_handlers[SCRIPT_NOPS];
-
 static bool is_valid_cmd(const union script_cmd* cmd) {
     return cmd->op < SCRIPT_NOPS;
 }
 
-static uint16_t dis_cmd(const union script_cmd* cmd, struct script_state* state, FILE* fout,
-    bool at_label) {
+static uint16_t dis_cmd(const union script_cmd* cmd, struct script_state* state) {
     assert(is_valid_cmd(cmd));
 
     const struct script_cmd_handler* handler = &script_handlers[cmd->op];
 
-    uint16_t ret = handler->handler(cmd->arg >> 16, cmd->arg, state);
+    state->has_err = false;
+    uint16_t ret = handler->handler ? handler->handler(cmd->arg >> 16, cmd->arg, state) : 0;
 
     if (state->has_err) {
         // fprintf(stderr, "Error dumping op 0x%x at cmd_offs=0x%x, stopping\n", cmd->op,
         //     state->cmd_offs);
         ret = UINT16_MAX;
+    }
+
+    return ret;
+}
+
+/* Text formatted for a part of the dump. Out of memory is only checked once formatting is done */
+struct text_buf {
+    char* buf;
+    size_t len, cap;
+    bool oom;
+};
 
-        return ret;
+#define TEXT_BUF_INIT_SZ 4096
+
+static bool buf_reserve(struct text_buf* b, size_t n) {
+    if (b->oom)
+        return false;
+    if (b->len + n <= b->cap)
+        return true;
+
+    size_t cap = b->cap ? b->cap : TEXT_BUF_INIT_SZ;
+    while (cap < b->len + n)
+        cap *= 2;
+
+    char* buf = realloc(b->buf, cap);
+    if (!buf) {
+        perror("realloc");
+        b->oom = true;
+        return false;
     }
+    b->buf = buf;
+    b->cap = cap;
+    return true;
+}
 
-    if (state->dumping && at_label)
-        fprintf(fout, "L_0x%x:\n", state->cmd_offs);
+static void buf_put(struct text_buf* b, const char* s, size_t n) {
+    if (!buf_reserve(b, n))
+        return;
+    memcpy(&b->buf[b->len], s, n);
+    b->len += n;
+}
 
-    if (ret != UINT16_MAX && state->dumping) {
-        if (handler->name)
-            fprintf(fout, "%s(", handler->name);
-        else
-            fprintf(fout, "OP_0x%x(", cmd->op);
+static void buf_puts(struct text_buf* b, const char* s) {
+    buf_put(b, s, strlen(s));
+}
 
-        // fprintf(fout, "0x%x, 0x%x", cmd->arg >> 16, cmd->arg);
+/* Same as printf("%0*x", width, v), with width 0 meaning no padding */
+static void buf_hex(struct text_buf* b, uint32_t v, unsigned width) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[8];
+    unsigned n = 0;
+
+    do {
+        tmp[n++] = digits[v & 0xf];
+        v >>= 4;
+    } while (v);
+    while (n < width)
+        tmp[n++] = '0';
+
+    if (!buf_reserve(b, n))
+        return;
+    while (n)
+        b->buf[b->len++] = tmp[--n];
+}
 
-        if (handler->has_va)
-            fprintf(fout, "%s", state->va_ctx.buf);
-        else {
-            for (size_t i = 0; i < cmd->arg; i++) {
-                uint16_t arg = script_next_cmd_arg(cmd->arg >> 16, i + 1, state);
-                fprintf(fout, "%s0x%x", i > 0 ? ", " : "", arg);
-            }
+static void buf_num(struct text_buf* b, uint32_t v) {
+    buf_put(b, "0x", 2);
+    buf_hex(b, v, 0);
+}
+
+static void buf_label(struct text_buf* b, uint16_t offs) {
+    buf_put(b, "L_0x", 4);
+    buf_hex(b, offs, 0);
+}
+
+static void buf_dec(struct text_buf* b, uint32_t v) {
+    char tmp[10];
+    unsigned n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+
+    if (!buf_reserve(b, n))
+        return;
+    while (n)
+        b->buf[b->len++] = tmp[--n];
+}
+
+static bool dec_str(const struct script_inst_arg* arg, const struct script_state* state,
+        iconv_t conv, char* buf, size_t sz) {
+    const uint8_t* strtab = arg->type == INST_ARG_MENU_STR ? state->strtab_menu : state->strtab;
+    size_t dec_len = 0;
+
+    if (!strtab_dec_str(strtab, state->rom_end, arg->val, buf, sz, &dec_len, conv, true)) {
+        fprintf(stderr, "Failed to decode line %d\n", arg->val);
+        return false;
+    }
+    return true;
+}
+
+/* Arguments of handlers without varargs are read back from the command buffer */
+static uint16_t inst_cmd_arg(const struct script_inst* inst, size_t i,
+        const struct script_state* state) {
+    const union script_cmd* cmd = (void*)&((uint8_t*)state->cmds)[inst->offs];
+    return script_cmd_arg(cmd + 1, inst->cmd.arg >> 16, i + 1);
+}
+
+static bool ir_add_stmt(struct script_stmt* stmt, uint16_t offs, bool at_label,
+        const struct script_state* state) {
+    char label[sizeof("L_0xffff")];
+
+    if (at_label) {
+        snprintf(label, sizeof(label), "L_0x%x", offs);
+        stmt->label = label;
+    }
+
+    if (!script_ir_writer_add_stmt(state->ir, stmt)) {
+        fprintf(stderr, "Failed to add IR statement at 0x%x\n", offs);
+        return false;
+    }
+    return true;
+}
+
+static bool ir_dump_inst(const struct script_inst* inst, bool at_label,
+        const struct script_state* state) {
+    const struct script_cmd_handler* handler = &script_handlers[inst->cmd.op];
+    size_t nargs = handler->has_va ? inst->nargs : inst->cmd.arg;
+
+    if (nargs > SCRIPT_PARSE_CTX_ARGS_SZ) {
+        fprintf(stderr, "Too many arguments for op 0x%x at 0x%x\n", inst->cmd.op, inst->offs);
+        return false;
+    }
+
+    /* The writer copies the strings, so they can live on the stack */
+    char labels[SCRIPT_PARSE_CTX_ARGS_SZ][sizeof("L_0xffff")];
+    char strs[SCRIPT_PARSE_CTX_ARGS_SZ][SJIS_TO_U8_MIN_SZ(DEC_BUF_SZ_SJIS)];
+
+    struct script_stmt stmt = {.ty = STMT_TY_OP, .op = {.idx = inst->cmd.op, .args = {
+        .nargs = nargs}}};
+
+    for (size_t i = 0; i < nargs; i++) {
+        struct script_arg* arg = &stmt.op.args.args[i];
+
+        if (!handler->has_va) {
+            *arg = (struct script_arg){.type = ARG_TY_NUM, .num = inst_cmd_arg(inst, i, state)};
+            continue;
+        }
+
+        const struct script_inst_arg* iarg = &inst->args[i];
+        switch (iarg->type) {
+            case INST_ARG_NUM:
+                *arg = (struct script_arg){.type = ARG_TY_NUM, .num = iarg->val};
+                break;
+            case INST_ARG_LABEL:
+                snprintf(labels[i], sizeof(labels[i]), "L_0x%x", iarg->val);
+                *arg = (struct script_arg){.type = ARG_TY_LABEL, .label = labels[i]};
+                break;
+            case INST_ARG_STR:
+            case INST_ARG_MENU_STR:
+                if (!dec_str(iarg, state, state->conv, strs[i], sizeof(strs[i])))
+                    return false;
+                *arg = (struct script_arg){.type = ARG_TY_NUMBERED_STR,
+                    .numbered_str = {iarg->val, strs[i]}};
+                break;
+            default:
+                assert(false);
         }
-        fprintf(fout, "); // 0x%x: %08x\n", state->cmd_offs, cmd->ival);
     }
 
-    return ret;
+    return ir_add_stmt(&stmt, inst->offs, at_label, state);
 }
 
-bool has_label(uint16_t offs, const struct script_state* state);
+static bool dump_inst(const struct script_inst* inst, bool at_label,
+        const struct script_state* state, iconv_t conv, struct text_buf* out) {
+    assert(inst->valid);
 
-static void dump_uint32(const union script_cmd* cmd, bool at_label,
-        const struct script_state* state, FILE* fout) {
+    if (state->ir)
+        return ir_dump_inst(inst, at_label, state);
+
+    const struct script_cmd_handler* handler = &script_handlers[inst->cmd.op];
+
+    if (at_label) {
+        buf_label(out, inst->offs);
+        buf_put(out, ":\n", 2);
+    }
+
+    if (handler->name)
+        buf_puts(out, handler->name);
+    else {
+        buf_put(out, "OP_", 3);
+        buf_num(out, inst->cmd.op);
+    }
+    buf_put(out, "(", 1);
+
+    // fprintf(fout, "0x%x, 0x%x", cmd->arg >> 16, cmd->arg);
+
+    if (handler->has_va) {
+        for (size_t i = 0; i < inst->nargs; i++) {
+            const struct script_inst_arg* arg = &inst->args[i];
+            char buf[SJIS_TO_U8_MIN_SZ(DEC_BUF_SZ_SJIS)];
+
+            if (i > 0)
+                buf_put(out, ", ", 2);
+
+            switch (arg->type) {
+                case INST_ARG_NUM:
+                    buf_num(out, arg->val);
+                    break;
+                case INST_ARG_LABEL:
+                    buf_label(out, arg->val);
+                    break;
+                case INST_ARG_STR:
+                case INST_ARG_MENU_STR:
+                    if (!dec_str(arg, state, conv, buf, sizeof(buf)))
+                        return false;
+                    buf_put(out, "(", 1);
+                    buf_dec(out, arg->val);
+                    buf_put(out, ")\"", 2);
+                    buf_puts(out, buf);
+                    buf_put(out, "\"", 1);
+                    break;
+                default:
+                    assert(false);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < inst->cmd.arg; i++) {
+            if (i > 0)
+                buf_put(out, ", ", 2);
+            buf_num(out, inst_cmd_arg(inst, i, state));
+        }
+    }
+
+    buf_put(out, "); // ", 6);
+    buf_num(out, inst->offs);
+    buf_put(out, ": ", 2);
+    buf_hex(out, inst->cmd.ival, 8);
+    buf_put(out, "\n", 1);
+
+    return true;
+}
+
+static bool dump_uint32(const union script_cmd* cmd, uint16_t offs, bool at_label,
+        const struct script_state* state, struct text_buf* out) {
     /* Allow dumping valid code as bytes as well as interpretation doesn't matter at that point */
     // assert(!is_valid_cmd(cmd) && "Trying to dump valid cmd as uint32");
 
     /* Some dead code might perform jumps that make no sense, so ignore this for now */
-    // assert(!has_label(state->cmd_offs, state) && "Branch to unrecognised cmd");
-    if (at_label)
-        fprintf(fout, "L_0x%x:\n", state->cmd_offs);
-    fprintf(fout, ".4byte 0x%x // 0x%x\n", cmd->ival, state->cmd_offs);
+    // assert(!has_label(offs, state) && "Branch to unrecognised cmd");
+    if (state->ir) {
+        struct script_stmt stmt = {.ty = STMT_TY_BYTE, .byte = {.n = 4, .val = cmd->ival}};
+        return ir_add_stmt(&stmt, offs, at_label, state);
+    }
+
+    if (at_label) {
+        buf_label(out, offs);
+        buf_put(out, ":\n", 2);
+    }
+    buf_put(out, ".4byte ", 7);
+    buf_num(out, cmd->ival);
+    buf_put(out, " // ", 4);
+    buf_num(out, offs);
+    buf_put(out, "\n", 1);
+    return true;
 }
 
-static void dump_uint8(const uint8_t* b, bool at_label,
-        const struct script_state* state, FILE* fout) {
-    if (at_label)
-        fprintf(fout, "L_0x%x:\n", state->cmd_offs);
-    fprintf(fout, ".byte 0x%x // 0x%x\n", *b, state->cmd_offs);
+static bool dump_uint8(const uint8_t* b, uint16_t offs, const struct script_state* state,
+        struct text_buf* out) {
+    if (state->ir) {
+        struct script_stmt stmt = {.ty = STMT_TY_BYTE, .byte = {.n = 1, .val = *b}};
+        return ir_add_stmt(&stmt, offs, false, state);
+    }
+
+    buf_put(out, ".byte ", 6);
+    buf_num(out, *b);
+    buf_put(out, " // ", 4);
+    buf_num(out, offs);
+    buf_put(out, "\n", 1);
+    return true;
 }
 
-#define SCRIPT_CKSUM_SEED 0x5678
+static bool dump_section(const char* section, bool begin, const struct script_state* state,
+        struct text_buf* out) {
+    if (state->ir) {
+        struct script_stmt stmt = {.ty = STMT_TY_BEGIN_END,
+            .begin_end = {.begin = begin, .section = section}};
+        return ir_add_stmt(&stmt, 0, false, state);
+    }
+
+    buf_puts(out, begin ? ".begin " : ".end ");
+    buf_puts(out, section);
+    buf_put(out, "\n", 1);
+    return true;
+}
+
+/* Commands from a label up to the next one */
+struct dump_region {
+    uint16_t end; /* offset at which dumping stopped */
+    struct text_buf text; /* reused between windows */
+};
+
+#define DUMP_WINDOW_SZ 256 /* regions formatted before writing them out */
+
+struct dump_ctx {
+    const struct script_state* state;
+    uint16_t cmd_end; /* offset of branch_info */
+    size_t first; /* label index of regions[0] */
+    struct dump_region* regions;
+    iconv_t convs[POOL_NTHREADS_MAX]; /* iconv descriptors cannot be shared between threads */
+};
+
+static bool dump_region(size_t i, size_t tid, void* arg) {
+    struct dump_ctx* ctx = arg;
+    const struct script_state* state = ctx->state;
+    struct dump_region* r = &ctx->regions[i];
+
+    size_t label_idx = ctx->first + i;
+    uint16_t label = state->label_ctx.labels[label_idx];
+    /* A region ends at the next label, even if a command there was decoded from this one */
+    uint32_t label_next = label_idx + 1 < state->label_ctx.nlabels ?
+        state->label_ctx.labels[label_idx + 1] : UINT32_MAX;
+
+    bool ok = true;
+    uint16_t offs;
+
+    r->text.len = 0;
+
+    for (offs = label; ok && offs < ctx->cmd_end && offs < label_next;) {
+        const struct script_inst* inst = script_inst_at(offs, state);
+        assert(inst && "Dumping a command that was not decoded");
+
+        if (inst->valid)
+            ok = dump_inst(inst, offs == label, state, ctx->convs[tid], &r->text);
+        else
+            ok = dump_uint32(&inst->cmd, offs, offs == label, state, &r->text);
+
+        offs = inst->offs_next;
+    }
+
+    r->end = offs;
+    return ok && !r->text.oom;
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static bool write_all(int fd, struct iovec* iov, size_t n) {
+    while (n > 0) {
+        ssize_t nwritten = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+        if (nwritten < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("writev");
+            return false;
+        }
+
+        /* Skip what has been written, which may end in the middle of a buffer */
+        size_t left = nwritten;
+        while (n > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
 
 uint16_t script_cksum(const uint8_t* buf, size_t sz, uint32_t seed) {
     uint64_t ret = (uint64_t)(seed & UINT16_MAX) << 24;
@@ -117,42 +445,67 @@ const struct script_desc* script_for_name(const char* name) {
     return NULL;
 }
 
-#define VA_BUF_DEFAULT_SZ (SJIS_TO_U8_MIN_SZ(DEC_BUF_SZ_SJIS) * 4)
+const struct script_desc* script_for_idx(size_t idx) {
+    return idx < sizeof(scripts) / sizeof(*scripts) ? &scripts[idx] : NULL;
+}
+
+/* One bit per possible uint16_t offset */
+#define LABEL_BITS_SZ ((UINT16_MAX + 1) / 64)
+
+static iconv_t conv_open() {
+#ifdef HAS_ICONV
+    return iconv_open("UTF-8", "SJIS");
+#else
+    return (iconv_t)-1;
+#endif
+}
+
+static void script_state_free(struct script_state* state);
 
+/* Buffers are sized after cmds_sz, the offset of branch_info */
 static
-void script_state_init(struct script_state* state, const uint8_t* rom_end, const uint8_t* strtab,
-    const uint8_t* strtab_menu,
-    const union script_cmd* cmds, uint16_t* labels, const char* branch_info) {
+bool script_state_init(struct script_state* state, const uint8_t* rom_end, const uint8_t* strtab,
+    const uint8_t* strtab_menu, const union script_cmd* cmds, const char* branch_info) {
     assert(state);
 
     /* Those are the "default" non thread-safe buffers (OK for now) */
     // static uint8_t arg_tab_default[0x56 * sizeof(uint32_t)]; /* FIXME: Size, r/w access? */
-    static char va_buf_default[VA_BUF_DEFAULT_SZ];
 
     memset(state, 0, sizeof(*state));
     // state->arg_tab = arg_tab_default;
 
-    state->va_ctx.buf = va_buf_default;
-    state->va_ctx.sz = sizeof(va_buf_default);
-
     state->strtab = strtab;
     state->strtab_menu = strtab_menu;
 
     state->cmds = cmds;
     state->rom_end = rom_end;
 
-    state->label_ctx.labels = labels;
-
     state->branch_info = branch_info;
 
     assert(state->branch_info > (char*)state->cmds &&
         "branch_info is expected to terminate cmds");
 
-    state->conv = (iconv_t)-1;
+    size_t cmds_sz = state->branch_info - (char*)state->cmds;
 
-#ifdef HAS_ICONV
-    state->conv = iconv_open("UTF-8", "SJIS");
-#endif
+    /**
+     * Every command is decoded at most once, and creates at most one label. So there are no more
+     * commands than offsets in cmds, and at most one more label than that (the initial one).
+     * Commands take at least 4 bytes, so that is a good guess for the instruction table size.
+     */
+    state->label_ctx.labels = malloc((cmds_sz + 1) * sizeof(*state->label_ctx.labels));
+    state->label_ctx.bits = calloc(LABEL_BITS_SZ, sizeof(*state->label_ctx.bits));
+    state->inst_ctx.at = calloc(cmds_sz, sizeof(*state->inst_ctx.at));
+    state->inst_ctx.cap = cmds_sz / sizeof(union script_cmd) + 1;
+    state->inst_ctx.insts = malloc(state->inst_ctx.cap * sizeof(*state->inst_ctx.insts));
+
+    state->conv = conv_open();
+
+    if (!state->label_ctx.labels || !state->label_ctx.bits || !state->inst_ctx.at ||
+        !state->inst_ctx.insts) {
+        perror("malloc");
+        script_state_free(state);
+        return false;
+    }
 
     if (state->conv == (iconv_t)-1) {
 #ifdef HAS_ICONV
@@ -160,6 +513,7 @@ void script_state_init(struct script_state* state, const uint8_t* rom_end, const
 #endif
         fprintf(stderr, "iconv_open failed; will dump raw values\n");
     }
+    return true;
 }
 
 static void script_state_free(struct script_state* state) {
@@ -167,36 +521,33 @@ static void script_state_free(struct script_state* state) {
     if (state->conv != (iconv_t)-1) {
         iconv_close(state->conv);
     }
-#else
-    (void)state;
 #endif
+    script_ir_writer_free(state->ir);
+    free(state->label_ctx.labels);
+    free(state->label_ctx.bits);
+    free(state->inst_ctx.at);
+    free(state->inst_ctx.insts);
 }
 
-#define SCRIPT_DUMP_NCMDS_MAX 15000u
-
-#define NLABELS_MAX SCRIPT_DUMP_NCMDS_MAX /* worst case */
-static uint16_t labels[NLABELS_MAX]; /* offsets into cmd buffer */
+bool has_label(uint16_t offs, const struct script_state* state) {
+    return state->label_ctx.bits[offs / 64] & ((uint64_t)1 << offs % 64);
+}
 
 bool make_label(uint16_t offs, struct script_state* state) {
     /**
-     * Because we disassemble instructions at different offsets in the second phase, we might
-     * create new labels then, but they are meaningless (and will break the command order in the
-     * dump), so this should be prohibited.
+     * Handlers only run during the first phase. The second phase never creates labels, as they
+     * would be meaningless there (and would break the command order in the dump).
      */
-    assert(!state->dumping);
-
-    size_t i = 0;
 
-    for (; i < state->label_ctx.nlabels; i++) {
-        /* Label already exists */
-        if (labels[i] == offs)
-            return false;
-    }
+    /* Label already exists */
+    if (has_label(offs, state))
+        return false;
 
-    assert(i < NLABELS_MAX && "Out of label space");
+    assert(state->label_ctx.nlabels <= (size_t)(state->branch_info - (char*)state->cmds) &&
+        "Out of label space");
 
-    state->label_ctx.labels[i] = offs;
-    state->label_ctx.nlabels++;
+    state->label_ctx.bits[offs / 64] |= (uint64_t)1 << offs % 64;
+    state->label_ctx.labels[state->label_ctx.nlabels++] = offs;
 
     return true;
 }
@@ -211,21 +562,68 @@ static uint16_t curr_label(struct script_state* state) {
     return state->label_ctx.labels[state->label_ctx.curr_label];
 }
 
-static int label_cmp(const void* lhs, const void* rhs) {
-    const uint16_t* ulhs = lhs, * urhs = rhs;
-    if (*ulhs < *urhs)
-        return -1;
-    if (*ulhs > *urhs)
-        return 1;
-    return 0;
+const struct script_inst* script_inst_at(uint16_t offs, const struct script_state* state) {
+    if ((char*)state->cmds + offs >= state->branch_info)
+        return NULL;
+
+    uint32_t idx = state->inst_ctx.at[offs];
+    return idx ? &state->inst_ctx.insts[idx - 1] : NULL;
 }
 
-/* FIXME: Should hash labels to get rid of O(n^2) running time.. */
-bool has_label(uint16_t offs, const struct script_state* state) {
-    for (size_t i = 0; i < state->label_ctx.nlabels; i++)
-        if (state->label_ctx.labels[i] == offs)
-            return true;
-    return false;
+/* Decode the command at cmd_offs, unless it has been decoded when exploring another label */
+static const struct script_inst* record_inst(const union script_cmd* cmd,
+        struct script_state* state) {
+    const struct script_inst* prev = script_inst_at(state->cmd_offs, state);
+    if (prev)
+        return prev;
+
+    if (state->inst_ctx.ninsts == state->inst_ctx.cap) {
+        size_t cap = state->inst_ctx.cap * 2;
+        struct script_inst* insts = realloc(state->inst_ctx.insts, cap * sizeof(*insts));
+        if (!insts) {
+            perror("realloc");
+            return NULL;
+        }
+        state->inst_ctx.insts = insts;
+        state->inst_ctx.cap = cap;
+    }
+
+    struct script_inst* inst = &state->inst_ctx.insts[state->inst_ctx.ninsts];
+    *inst = (struct script_inst){.offs = state->cmd_offs, .cmd = *cmd};
+    state->inst_ctx.curr = inst;
+
+    /* Skip the args buffer */
+    state->cmd_offs_next = state->cmd_offs + sizeof(*cmd) + 2 * cmd->arg;
+    state->args = cmd + 1;
+
+    inst->valid = is_valid_cmd(cmd) && dis_cmd(cmd, state) != UINT16_MAX &&
+        state->cmd_offs_next >= state->cmd_offs;
+
+    if (inst->valid)
+        inst->offs_next = state->cmd_offs_next;
+    else {
+        /* Cannot disassemble at this address, so it will be dumped as uint32 */
+        inst->nargs = 0;
+        /* Don't trust the encoded cmd_offs_next */
+        inst->offs_next = state->cmd_offs + sizeof(*cmd);
+    }
+
+    state->inst_ctx.at[inst->offs] = ++state->inst_ctx.ninsts;
+    return inst;
+}
+
+/* Rewrite the label list in ascending order by scanning the membership bitmap */
+static void sort_labels(struct script_state* state) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < LABEL_BITS_SZ; i++) {
+        uint64_t w = state->label_ctx.bits[i];
+        for (unsigned bit = 0; w; bit++, w >>= 1)
+            if (w & 1)
+                state->label_ctx.labels[n++] = i * 64 + bit;
+    }
+
+    assert(n == state->label_ctx.nlabels);
 }
 
 /**
@@ -239,24 +637,28 @@ bool has_label(uint16_t offs, const struct script_state* state) {
  * label that has just been processed is marked as explored. The process repeats until there is no
  * unexplored label in the list.
  *
- * During the second phase, the list of labels is sorted, resulting in a linear map of dumpable
- * code regions, each either terminated by an invalid instruction, branch instruction, or another
- * label. Then the textual representation of instructions is dumped starting at each label address
- * from the list. If an invalid instruction is encountered, then the data starting at that address
- * is dumped as is until the next label is encountered, so there need not be set-location directive.
+ * Each command is decoded at most once, when it is first reached, and its handler records the
+ * arguments into an instruction table.
+ *
+ * During the second phase, the list of labels is sorted (by a scan of the label bitmap), resulting
+ * in a linear map of dumpable code regions, each either terminated by an invalid instruction,
+ * branch instruction, or another label. Then the recorded instructions are formatted starting at
+ * each label address from the list, without running the handlers again. If an invalid instruction
+ * is encountered, then the data starting at that address is dumped as is until the next label is
+ * encountered, so there need not be set-location directive.
  *
  * Because there are finitely many branch/jump instructions in a script, finitely many labels will be
  * created, so the procedure will terminate.
  */
-bool script_dump(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
-    const struct script_desc* desc, FILE* fout,
-    uint32_t strtab_script_vma, uint32_t strtab_menu_vma) {
+/* Validates the header of the script at script_vma, or returns NULL */
+static const struct script_hdr* script_hdr_at(const uint8_t* rom, size_t rom_sz,
+        uint32_t script_vma, const struct script_desc* desc) {
     const struct script_hdr* hdr = (void*)&rom[VMA2OFFS(script_vma)];
     static_assert(sizeof(*hdr) == sizeof(uint16_t[3]), "");
 
     if ((uint8_t*)hdr + sizeof(hdr) >= rom + rom_sz) {
         fprintf(stderr, "Past EOF script header\n");
-        return false;
+        return NULL;
     }
 
     uint16_t cks = script_cksum((uint8_t*)hdr, script_sz(hdr) + sizeof(struct script_hdr),
@@ -265,134 +667,227 @@ bool script_dump(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
         fprintf(stderr, "Ignoring script checksum mismatch (computed 0x%x != 0x%x)\n",
             cks, desc->cksum);
 
-    const union script_cmd* cmds = (void*)&((uint8_t*)hdr)[sizeof(*hdr)];
+    const uint8_t* cmds = (uint8_t*)hdr + sizeof(*hdr);
 
-    /* We'll dump everything past cmd buffer as bytes */
-    const void* cmd_end = &((uint8_t*)cmds)[hdr->branch_info_offs];
-
-    if ((void*)cmds >= cmd_end) {
+    if (!hdr->branch_info_offs) {
         fprintf(stderr, "Script is too short\n");
-        return false;
+        return NULL;
     }
 
-    if ((uint8_t*)cmd_end + hdr->branch_info_sz + hdr->bytes_to_end >= rom_sz + rom) {
+    if (cmds + hdr->branch_info_offs + hdr->branch_info_sz + hdr->bytes_to_end >= rom_sz + rom) {
         fprintf(stderr, "Script ends past EOF (incorrect script header?)\n");
-        return false;
+        return NULL;
     }
+    return hdr;
+}
 
-    struct script_state state;
-    script_state_init(&state, rom + rom_sz,
-        &rom[VMA2OFFS(strtab_script_vma)], &rom[VMA2OFFS(strtab_menu_vma)],
-        cmds, labels, cmd_end);
-
-    /* Phase one: read code and create labels */
-    make_label(0, &state); /* The initial label */
+/* Phase one: read code and create labels */
+static bool read_cmds(struct script_state* state) {
+    make_label(0, state); /* The initial label */
 
-    size_t ninst = 0;
-phase:
-    while (has_labels(&state)) {
-        state.cmd_offs_next = curr_label(&state);
+    while (has_labels(state)) {
+        state->cmd_offs_next = curr_label(state);
 
         /* Should we check if there is a label at cmd_offs? Omit for first cmd at label */
         bool chk_label = false;
 
         /* Start disassembling instructions at this address */
         while (true) {
-            if (ninst == SCRIPT_DUMP_NCMDS_MAX) {
-                /* Stop adding labels at this point */
-                if (!state.dumping)
-                    break;
-                fprintf(stderr, "Dump length exceeds %u, stopping...\n", SCRIPT_DUMP_NCMDS_MAX);
+            state->cmd_offs = state->cmd_offs_next;
+            const union script_cmd* cmd = (void*)&((uint8_t*)state->cmds)[state->cmd_offs];
+
+            if ((char*)cmd >= state->branch_info || /* Reached end of command buffer */
+                (chk_label && has_label(state->cmd_offs, state))) /* Encountered a label */
+                break; /* Stop and pick another unprocessed label */
+
+            const struct script_inst* inst = record_inst(cmd, state);
+            if (!inst)
                 return false;
-            }
 
-            state.cmd_offs = state.cmd_offs_next;
-            const union script_cmd* cmd = (void*)&((uint8_t*)cmds)[state.cmd_offs];
+            state->cmd_offs_next = inst->offs_next;
+            chk_label = true;
+        }
+        state->label_ctx.curr_label++;
+    }
+    return true;
+}
 
-            bool at_label = has_label(state.cmd_offs, &state);
-            bool past_label = state.dumping &&
-                state.label_ctx.curr_label + 1 < state.label_ctx.nlabels &&
-                state.label_ctx.labels[state.label_ctx.curr_label + 1] <= state.cmd_offs;
+bool script_dump(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
+    const struct script_desc* desc, FILE* fout, enum script_dump_fmt fmt,
+    uint32_t strtab_script_vma, uint32_t strtab_menu_vma) {
+    const struct script_hdr* hdr = script_hdr_at(rom, rom_sz, script_vma, desc);
+    if (!hdr)
+        return false;
 
-            if (cmd >= (union script_cmd*)cmd_end || /* Reached end of command buffer */
-                (chk_label && at_label) || /* Encountered a label at this address  */
-                past_label) /* When dumping, we would have disassembled past next label */
-                break; /* Stop and pick another unprocessed label */
+    const union script_cmd* cmds = (void*)&((uint8_t*)hdr)[sizeof(*hdr)];
 
-            /* Skip the args buffer */
-            state.cmd_offs_next += sizeof(*cmd) + 2 * cmd->arg;
-            state.args = cmd + 1;
+    /* We'll dump everything past cmd buffer as bytes */
+    const void* cmd_end = &((uint8_t*)cmds)[hdr->branch_info_offs];
 
-            uint16_t dis_ret = is_valid_cmd(cmd) ?
-                dis_cmd(cmd, &state, fout, at_label) : UINT16_MAX;
+    struct script_state state;
+    if (!script_state_init(&state, rom + rom_sz,
+        &rom[VMA2OFFS(strtab_script_vma)], &rom[VMA2OFFS(strtab_menu_vma)], cmds, cmd_end))
+        return false;
 
-            /* Cannot disassemble at this address */
-            if (dis_ret == UINT16_MAX || state.cmd_offs_next < state.cmd_offs) {
-                /* Just dump it as uint32, we don't really care what it does */
-                if (state.dumping)
-                    dump_uint32(cmd, at_label, &state, fout);
-                /* In either phase, don't trust the encoded cmd_offs_next */
-                state.cmd_offs_next = state.cmd_offs + sizeof(*cmd);
-            }
+    if (fmt == SCRIPT_DUMP_IR) {
+        state.ir = script_ir_writer_new();
+        if (!state.ir) {
+            script_state_free(&state);
+            return false;
+        }
+    }
 
-            chk_label = true;
-            ninst++;
+    if (!read_cmds(&state)) {
+        script_state_free(&state);
+        return false;
+    }
+
+    /**
+     * Second phase: format the regions between consecutive labels concurrently. Regions are
+     * processed in windows, which are written out as soon as they are formatted, so memory use
+     * does not depend on the script length.
+     */
+    sort_labels(&state);
+
+    /* The IR writer is shared, so IR is produced sequentially */
+    size_t nthreads = state.ir ? 1 : pool_nthreads();
+
+    struct dump_region regions[DUMP_WINDOW_SZ];
+    memset(regions, 0, sizeof(regions));
+
+    struct dump_ctx ctx = {.state = &state, .cmd_end = hdr->branch_info_offs, .regions = regions};
+    struct text_buf tail = {0};
+    bool ok = false;
+
+    ctx.convs[0] = state.conv;
+    for (size_t i = 1; i < nthreads; i++) {
+        ctx.convs[i] = state.conv != (iconv_t)-1 ? conv_open() : (iconv_t)-1;
+        /* All regions must be decoded alike, so rather use fewer threads */
+        if (ctx.convs[i] == (iconv_t)-1 && state.conv != (iconv_t)-1) {
+            nthreads = i;
+            break;
         }
-        state.label_ctx.curr_label++;
     }
 
-    /* Second phase complete */
-    if (state.dumping) {
-        /* Dump branch info and remaining bytes */
-        const uint8_t* end = (uint8_t*)cmd_end + hdr->branch_info_sz + hdr->bytes_to_end;
-        const uint8_t* cmd = (uint8_t*)cmds + state.cmd_offs;
+    if (!state.ir && fflush(fout)) {
+        perror("fflush");
+        goto done;
+    }
 
-        if (cmd < end)
-            fprintf(fout, ".begin branch_info\n");
+    size_t nregions = 0;
+    for (; ctx.first < state.label_ctx.nlabels; ctx.first += nregions) {
+        nregions = state.label_ctx.nlabels - ctx.first;
+        if (nregions > DUMP_WINDOW_SZ)
+            nregions = DUMP_WINDOW_SZ;
 
-        bool past_info = false;
-        while (cmd < end) {
-            if (!past_info && cmd + sizeof(uint32_t) > end - hdr->bytes_to_end) {
-                while (cmd < end - hdr->bytes_to_end) {
-                    dump_uint8(cmd, false, &state, fout);
-                    state.cmd_offs++;
-                    cmd++;
-                }
+        if (!pool_for(nregions, nthreads, dump_region, &ctx))
+            goto done;
 
-                fprintf(fout, ".end branch_info\n");
-                past_info = true;
-                continue;
-            }
+        if (state.ir)
+            continue;
 
-            if (end - cmd >= (ptrdiff_t)sizeof(union script_cmd)) {
-                dump_uint32((union script_cmd*)cmd, false, &state, fout);
-                cmd += sizeof(union script_cmd);
-                state.cmd_offs += sizeof(union script_cmd);
-            } else {
-                dump_uint8(cmd, false, &state, fout);
+        /* Bypass stdio and write the whole window at once */
+        struct iovec iov[DUMP_WINDOW_SZ];
+        for (size_t i = 0; i < nregions; i++)
+            iov[i] = (struct iovec){regions[i].text.buf, regions[i].text.len};
+        if (!write_all(fileno(fout), iov, nregions))
+            goto done;
+    }
+
+    /* Dump branch info and remaining bytes */
+    uint16_t offs = regions[nregions - 1].end;
+    const uint8_t* end = (uint8_t*)cmd_end + hdr->branch_info_sz + hdr->bytes_to_end;
+    const uint8_t* cmd = (uint8_t*)cmds + offs;
+
+    ok = true;
+    if (cmd < end)
+        ok &= dump_section("branch_info", true, &state, &tail);
+
+    bool past_info = false;
+    while (ok && cmd < end) {
+        if (!past_info && cmd + sizeof(uint32_t) > end - hdr->bytes_to_end) {
+            while (ok && cmd < end - hdr->bytes_to_end) {
+                ok &= dump_uint8(cmd, offs, &state, &tail);
+                offs++;
                 cmd++;
-                state.cmd_offs++;
             }
-        }
 
-        /* Got 4B-divisible branch_info */
-        if (!past_info)
-            fprintf(fout, ".end branch_info\n");
+            ok &= dump_section("branch_info", false, &state, &tail);
+            past_info = true;
+            continue;
+        }
 
-        script_state_free(&state);
-        return true;
+        if (end - cmd >= (ptrdiff_t)sizeof(union script_cmd)) {
+            ok &= dump_uint32((union script_cmd*)cmd, offs, false, &state, &tail);
+            cmd += sizeof(union script_cmd);
+            offs += sizeof(union script_cmd);
+        } else {
+            ok &= dump_uint8(cmd, offs, &state, &tail);
+            cmd++;
+            offs++;
+        }
     }
 
-    /* Second phase */
-    state.dumping = true;
-    state.label_ctx.curr_label = 0;
-    qsort(state.label_ctx.labels, state.label_ctx.nlabels, sizeof(*state.label_ctx.labels),
-        label_cmp);
-    ninst = 0;
-    /* Repeat phase one, but now dump commands starting at each label */
-    goto phase;
+    /* Got 4B-divisible branch_info */
+    if (ok && !past_info)
+        ok &= dump_section("branch_info", false, &state, &tail);
+
+    if (!ok || tail.oom)
+        ok = false;
+    else if (state.ir)
+        ok = script_ir_writer_write(state.ir, fout);
+    else
+        ok = write_all(fileno(fout), &(struct iovec){tail.buf, tail.len}, 1);
+
+done:
+    for (size_t i = 0; i < DUMP_WINDOW_SZ; i++)
+        free(regions[i].text.buf);
+    free(tail.buf);
+#ifdef HAS_ICONV
+    for (size_t i = 1; i < nthreads; i++)
+        if (ctx.convs[i] != (iconv_t)-1)
+            iconv_close(ctx.convs[i]);
+#endif
+
+    script_state_free(&state);
+    return ok;
+}
+
+bool script_walk(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
+    const struct script_desc* desc, script_walk_fn fn, void* arg) {
+    const struct script_hdr* hdr = script_hdr_at(rom, rom_sz, script_vma, desc);
+    if (!hdr)
+        return false;
+
+    const union script_cmd* cmds = (void*)&((uint8_t*)hdr)[sizeof(*hdr)];
+
+    /* Strings are not decoded, so the strtabs are not needed */
+    struct script_state state;
+    if (!script_state_init(&state, rom + rom_sz, NULL, NULL, cmds,
+        &((char*)cmds)[hdr->branch_info_offs]))
+        return false;
+
+    bool ok = read_cmds(&state);
+    if (ok)
+        sort_labels(&state);
+
+    /* Same regions as in the second phase of script_dump */
+    for (size_t i = 0; ok && i < state.label_ctx.nlabels; i++) {
+        uint16_t label = state.label_ctx.labels[i];
+        uint32_t label_next = i + 1 < state.label_ctx.nlabels ?
+            state.label_ctx.labels[i + 1] : UINT32_MAX;
+
+        for (uint16_t offs = label; ok && offs < hdr->branch_info_offs && offs < label_next;) {
+            const struct script_inst* inst = script_inst_at(offs, &state);
+            assert(inst && "Walking a command that was not decoded");
+
+            ok = fn(inst, label, arg);
+            offs = inst->offs_next;
+        }
+    }
 
-    assert(false); /* Unreachable */
+    script_state_free(&state);
+    return ok;
 }
 
 size_t script_sz(const struct script_hdr* hdr) {
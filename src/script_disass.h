@@ -42,6 +42,32 @@ struct script_desc {
     } patch_info;
 };
 
+enum script_inst_arg_ty {
+    INST_ARG_NUM,
+    INST_ARG_LABEL, /* offset into cmd buffer */
+    INST_ARG_STR, /* script strtab index */
+    INST_ARG_MENU_STR /* menu strtab index */
+};
+
+#define SCRIPT_INST_ARGS_SZ 11 /* ChoiceIdx destination and up to 10 choices */
+
+/**
+ * A command decoded during the first phase of disassembly.
+ * Only the arguments of handlers with varargs are recorded, the rest can be read back from the
+ * command buffer.
+ */
+struct script_inst {
+    uint16_t offs;
+    uint16_t offs_next; /* where decoding continues after this command */
+    union script_cmd cmd;
+    bool valid; /* If false, the command is dumped as data */
+    uint8_t nargs;
+    struct script_inst_arg {
+        uint8_t type; /* enum script_inst_arg_ty */
+        uint16_t val;
+    } args[SCRIPT_INST_ARGS_SZ];
+};
+
 struct script_state {
     /**
      * Byte offset into cmd buffer.
@@ -56,13 +82,22 @@ struct script_state {
     const uint8_t* rom_end;
 
     struct {
+        /**
+         * Offsets in discovery order during the first phase, which makes it the worklist of
+         * unexplored labels. In the second phase they are in ascending order.
+         */
         uint16_t* labels;
+        uint64_t* bits; /* label membership indexed by offset */
         size_t nlabels; /* amount of labels in buffer */
         size_t curr_label; /* index of label being processed */
     } label_ctx;
 
-    /* If false, handler must not output anything to va_ctx */
-    bool dumping;
+    struct {
+        struct script_inst* insts; /* in decoding order */
+        size_t ninsts, cap;
+        uint32_t* at; /* 1-based index into insts for each offset, 0 if not decoded */
+        struct script_inst* curr; /* being recorded by a handler */
+    } inst_ctx;
 
     /* Used in next_cmd_arg */
     const union script_cmd* args; /* 0x3001E58 */
@@ -74,10 +109,8 @@ struct script_state {
     const uint8_t* strtab, * strtab_menu;
     const char* branch_info;
 
-    struct {
-        char* buf; /* any extra arguments to be logged by a handler */
-        size_t sz;
-    } va_ctx;
+    /* If set, the second phase formats the recorded commands as IR rather than text */
+    struct script_ir_writer* ir;
 
     bool has_err;
 
@@ -87,7 +120,7 @@ struct script_state {
 struct script_cmd_handler {
     const char* name;
     // int nargs;
-    bool has_va; /* If true, we trust the handler to output at least all the varargs */
+    bool has_va; /* If true, we trust the handler to record at least all the varargs */
 
     /**
      * arg0 -- Never encountered arg0=1 so far, uses some state
@@ -96,14 +129,31 @@ struct script_cmd_handler {
      * As the actually useful arguments seem to be encoded in state.args, we should eventually
      * omit these in disassembly.
      */
-    uint16_t (*handler)(uint16_t, uint16_t, struct script_state*);
+    uint16_t (*handler)(uint16_t, uint16_t, struct script_state*); /* may be NULL */
+};
+
+extern const struct script_cmd_handler script_handlers[SCRIPT_NOPS];
+
+enum script_dump_fmt {
+    SCRIPT_DUMP_TEXT,
+    SCRIPT_DUMP_IR /* see script_ir.h */
 };
 
-void init_script_handlers();
 bool script_dump(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
-    const struct script_desc* desc, FILE* fout,
+    const struct script_desc* desc, FILE* fout, enum script_dump_fmt fmt,
     uint32_t strtab_script_vma, uint32_t strtab_menu_vma);
 const struct script_desc* script_for_name(const char* name);
+const struct script_desc* script_for_idx(size_t idx); /* NULL past the last script */
+
+/* Called with each decoded command and the label of the region it belongs to */
+typedef bool (*script_walk_fn)(const struct script_inst* inst, uint16_t label, void* arg);
+
+/**
+ * Decode the script like script_dump does, then call fn on the commands in ascending order of
+ * offset. Stops at the first call that returns false.
+ */
+bool script_walk(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
+    const struct script_desc* desc, script_walk_fn fn, void* arg);
 
 /**
  * Used by branch command handlers to mark their destination.
@@ -119,10 +169,16 @@ bool cmd_is_choice_idx(const union script_cmd* cmd);
 
 bool has_label(uint16_t offs, const struct script_state* state);
 
+/* NULL if no command was decoded at offs */
+const struct script_inst* script_inst_at(uint16_t offs, const struct script_state* state);
+
 uint32_t script_next_cmd_arg(uint16_t a1, uint16_t w, const struct script_state* state);
+uint32_t script_cmd_arg(const union script_cmd* args, uint16_t a1, uint16_t w);
 
 /* minus sizeof(*hdr) */
 size_t script_sz(const struct script_hdr* hdr);
+
+#define SCRIPT_CKSUM_SEED 0x5678
 uint16_t script_cksum(const uint8_t* buf, size_t sz, uint32_t seed);
 
 #endif
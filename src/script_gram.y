@@ -123,7 +123,7 @@ STMT: BEGIN_END_STMT {
         };
     } | ID '(' ARGS ')' ';' {
         $$ = (struct script_stmt){.ty = STMT_TY_OP, .label = NULL, .line = @$.first_line};
-        if (!script_op_idx($1, &$$.op.idx))
+        if (!script_op_idx(ctx, $1, &$$.op.idx))
             yyerror(&@$, ctx, scanner, "Unrecognised operation");
         $$.op.args = $3;
     };
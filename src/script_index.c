@@ -0,0 +1,189 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "script_disass.h"
+#include "script_index.h"
+
+struct build_ctx {
+    uint8_t script;
+    struct script_ref* refs;
+    size_t nrefs, cap;
+};
+
+static bool add_ref(struct build_ctx* ctx, enum script_ref_kind kind, uint16_t key,
+        const struct script_inst* inst, uint16_t label) {
+    if (ctx->nrefs == ctx->cap) {
+        size_t cap = ctx->cap ? ctx->cap * 2 : 1024;
+        struct script_ref* refs = realloc(ctx->refs, cap * sizeof(*refs));
+        if (!refs) {
+            perror("realloc");
+            return false;
+        }
+        ctx->refs = refs;
+        ctx->cap = cap;
+    }
+
+    ctx->refs[ctx->nrefs++] = (struct script_ref){.kind = kind, .script = ctx->script,
+        .key = key, .offs = inst->offs, .label = label, .op = inst->cmd.op};
+    return true;
+}
+
+static bool index_inst(const struct script_inst* inst, uint16_t label, void* arg) {
+    struct build_ctx* ctx = arg;
+
+    if (!inst->valid)
+        return true;
+
+    for (size_t i = 0; i < inst->nargs; i++) {
+        const struct script_inst_arg* iarg = &inst->args[i];
+        bool ok = true;
+
+        switch (iarg->type) {
+            case INST_ARG_STR:
+                ok = add_ref(ctx, SCRIPT_REF_STR, iarg->val, inst, label);
+                break;
+            case INST_ARG_MENU_STR:
+                ok = add_ref(ctx, SCRIPT_REF_MENU_STR, iarg->val, inst, label);
+                break;
+            case INST_ARG_LABEL:
+                ok = add_ref(ctx, SCRIPT_REF_LABEL, iarg->val, inst, label);
+                break;
+            default:
+                break;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+static int cmp_ref(const void* a, const void* b) {
+    const struct script_ref* l = a, * r = b;
+
+    if (l->kind != r->kind)
+        return l->kind < r->kind ? -1 : 1;
+    if (l->key != r->key)
+        return l->key < r->key ? -1 : 1;
+    if (l->script != r->script)
+        return l->script < r->script ? -1 : 1;
+    return l->offs < r->offs ? -1 : l->offs > r->offs;
+}
+
+bool script_index_build(struct script_index* idx, const uint8_t* rom, size_t rom_sz,
+        const struct script_desc* const* descs, const uint32_t* vmas, size_t nscripts) {
+    if (nscripts > UINT8_MAX + 1) {
+        fprintf(stderr, "Too many scripts to index\n");
+        return false;
+    }
+
+    struct build_ctx ctx = {0};
+    bool ret = false;
+
+    /* Commands come in ascending order of offset, so refs are only sorted by key afterwards */
+    for (size_t i = 0; i < nscripts; i++) {
+        ctx.script = i;
+        if (!script_walk(rom, rom_sz, vmas[i], descs[i], index_inst, &ctx)) {
+            fprintf(stderr, "Failed to index script %s at 0x%x\n", descs[i]->name, vmas[i]);
+            goto done;
+        }
+    }
+    qsort(ctx.refs, ctx.nrefs, sizeof(*ctx.refs), cmp_ref);
+
+    /* Laid out like in the file */
+    size_t scripts_sz = nscripts * sizeof(struct script_index_script);
+    uint8_t* buf = malloc(scripts_sz + ctx.nrefs * sizeof(*ctx.refs));
+    if (!buf) {
+        perror("malloc");
+        goto done;
+    }
+
+    struct script_index_script* scripts = (void*)buf;
+    for (size_t i = 0; i < nscripts; i++) {
+        scripts[i] = (struct script_index_script){.vma = vmas[i]};
+        strncpy(scripts[i].name, descs[i]->name, sizeof(scripts[i].name) - 1);
+    }
+    memcpy(&buf[scripts_sz], ctx.refs, ctx.nrefs * sizeof(*ctx.refs));
+
+    *idx = (struct script_index){.scripts = scripts, .nscripts = nscripts,
+        .refs = (void*)&buf[scripts_sz], .nrefs = ctx.nrefs, .buf = buf};
+    ret = true;
+
+done:
+    free(ctx.refs);
+    return ret;
+}
+
+bool script_index_load(struct script_index* idx, const char* path, size_t rom_sz,
+        uint32_t rom_crc) {
+    struct side_file_hdr want = {SCRIPT_INDEX_MAGIC, SCRIPT_INDEX_VERSION, rom_sz, rom_crc};
+    size_t sz;
+    const struct script_index_hdr* hdr = side_file_map(path, &want,
+        sizeof(struct script_index_hdr), &sz);
+    if (!hdr)
+        return false;
+
+    if (sz != sizeof(*hdr) + (size_t)hdr->nscripts * sizeof(struct script_index_script) +
+            (size_t)hdr->nrefs * sizeof(struct script_ref)) {
+        side_file_free((void*)hdr, sz);
+        return false;
+    }
+
+    idx->scripts = (const void*)(hdr + 1);
+    idx->nscripts = hdr->nscripts;
+    idx->refs = (const void*)(idx->scripts + idx->nscripts);
+    idx->nrefs = hdr->nrefs;
+    idx->buf = (void*)hdr;
+    idx->map_sz = sz;
+    return true;
+}
+
+bool script_index_save(const struct script_index* idx, const char* path, size_t rom_sz,
+        uint32_t rom_crc) {
+    if (idx->nrefs > UINT32_MAX || rom_sz > UINT32_MAX)
+        return false;
+
+    struct script_index_hdr hdr = {{SCRIPT_INDEX_MAGIC, SCRIPT_INDEX_VERSION, rom_sz, rom_crc},
+        idx->nscripts, idx->nrefs};
+    struct side_file_part parts[] = {
+        {&hdr, sizeof(hdr)},
+        {idx->scripts, idx->nscripts * sizeof(*idx->scripts)},
+        {idx->refs, idx->nrefs * sizeof(*idx->refs)}
+    };
+    return side_file_save(path, parts, sizeof(parts) / sizeof(*parts));
+}
+
+void script_index_free(struct script_index* idx) {
+    side_file_free(idx->buf, idx->map_sz);
+    *idx = (struct script_index){0};
+}
+
+/* Index of the first reference to at least (kind, key) */
+static size_t ref_lower_bound(const struct script_index* idx, uint8_t kind, uint16_t key) {
+    size_t l = 0, r = idx->nrefs;
+
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        const struct script_ref* ref = &idx->refs[m];
+        if (ref->kind < kind || (ref->kind == kind && ref->key < key))
+            l = m + 1;
+        else
+            r = m;
+    }
+    return l;
+}
+
+const struct script_ref* script_index_find(const struct script_index* idx,
+        enum script_ref_kind kind, uint16_t key, size_t* n) {
+    size_t first = ref_lower_bound(idx, kind, key);
+    size_t last = first;
+
+    while (last < idx->nrefs && idx->refs[last].kind == kind && idx->refs[last].key == key)
+        last++;
+
+    *n = last - first;
+    return &idx->refs[first];
+}
@@ -0,0 +1,80 @@
+#ifndef SCRIPT_INDEX_H
+#define SCRIPT_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "script_disass.h"
+#include "side_file.h"
+
+/**
+ * Index of the commands of the scripts that refer to strtab entries or to labels, sorted by what
+ * they refer to so that lookups are a binary search. It may be saved next to the ROM:
+ *
+ *   struct script_index_hdr
+ *   struct script_index_script scripts[nscripts]
+ *   struct script_ref refs[nrefs]
+ *
+ * and is only loaded back for a ROM of the same size and CRC.
+ */
+
+#define SCRIPT_INDEX_MAGIC 0x58444953 /* SIDX */
+#define SCRIPT_INDEX_VERSION 1
+#define SCRIPT_INDEX_SUFFIX ".sidx"
+
+#define SCRIPT_INDEX_NAME_SZ 16
+
+enum script_ref_kind {
+    SCRIPT_REF_STR, /* key is a script strtab index */
+    SCRIPT_REF_MENU_STR, /* key is a menu strtab index */
+    SCRIPT_REF_LABEL /* key is the destination of a jump or branch */
+};
+
+/* A command at offs, in the region starting at label, that refers to key */
+struct script_ref {
+    uint8_t kind; /* enum script_ref_kind */
+    uint8_t script; /* index into scripts */
+    uint16_t key;
+    uint16_t offs;
+    uint16_t label;
+    uint16_t op;
+};
+
+struct script_index_script {
+    char name[SCRIPT_INDEX_NAME_SZ];
+    uint32_t vma;
+};
+
+struct script_index_hdr {
+    struct side_file_hdr side; /* of the ROM */
+    uint32_t nscripts;
+    uint32_t nrefs;
+};
+
+struct script_index {
+    const struct script_index_script* scripts;
+    size_t nscripts;
+    const struct script_ref* refs;
+    size_t nrefs;
+
+    /* Either allocated by script_index_build or mapped by script_index_load */
+    void* buf;
+    size_t map_sz;
+};
+
+/* Index the nscripts scripts described by descs, found at vmas */
+bool script_index_build(struct script_index* idx, const uint8_t* rom, size_t rom_sz,
+    const struct script_desc* const* descs, const uint32_t* vmas, size_t nscripts);
+/* Fails quietly if the file does not exist or is for another ROM */
+bool script_index_load(struct script_index* idx, const char* path, size_t rom_sz,
+    uint32_t rom_crc);
+bool script_index_save(const struct script_index* idx, const char* path, size_t rom_sz,
+    uint32_t rom_crc);
+void script_index_free(struct script_index* idx);
+
+/* References of kind to key, sorted by script and then by offset */
+const struct script_ref* script_index_find(const struct script_index* idx,
+    enum script_ref_kind kind, uint16_t key, size_t* n);
+
+#endif
@@ -0,0 +1,331 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "defs.h"
+#define _GNU_SOURCE
+#include "search.h"
+#undef _GNU_SOURCE
+#include "script_ir.h"
+#include "script_parse_ctx.h"
+
+struct script_ir_writer {
+    struct script_ir_stmt* stmts;
+    size_t nstmts, stmts_cap;
+
+    char* pool;
+    size_t pool_sz, pool_cap;
+
+    /* Interned strings: key is an owned copy, data is the pool offset */
+    struct hsearch_data htab;
+    char** keys;
+    size_t nkeys, keys_cap;
+};
+
+#define SCRIPT_IR_NSTMTS_INIT 1024
+#define SCRIPT_IR_POOL_INIT 4096
+
+static bool grow(void** buf, size_t* cap, size_t want, size_t elem_sz) {
+    if (want <= *cap)
+        return true;
+
+    size_t cap_new = *cap ? *cap : 1;
+    while (cap_new < want)
+        cap_new *= 2;
+
+    void* buf_new = realloc(*buf, cap_new * elem_sz);
+    if (!buf_new) {
+        perror("realloc");
+        return false;
+    }
+    *buf = buf_new;
+    *cap = cap_new;
+    return true;
+}
+
+struct script_ir_writer* script_ir_writer_new() {
+    struct script_ir_writer* w = calloc(1, sizeof(*w));
+    if (!w) {
+        perror("calloc");
+        return NULL;
+    }
+
+    if (hcreate_r(SCRIPT_IR_NSTMTS_INIT, &w->htab) == 0) {
+        perror("hcreate");
+        free(w);
+        return NULL;
+    }
+
+    if (!grow((void**)&w->stmts, &w->stmts_cap, SCRIPT_IR_NSTMTS_INIT, sizeof(*w->stmts)) ||
+        !grow((void**)&w->pool, &w->pool_cap, SCRIPT_IR_POOL_INIT, 1)) {
+        script_ir_writer_free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void script_ir_writer_free(struct script_ir_writer* w) {
+    if (!w)
+        return;
+
+    hdestroy_r(&w->htab);
+    for (size_t i = 0; i < w->nkeys; i++)
+        free(w->keys[i]);
+    free(w->keys);
+    free(w->stmts);
+    free(w->pool);
+    free(w);
+}
+
+/* Returns pool offset of s, adding it if it has not been seen before */
+static uint32_t intern(struct script_ir_writer* w, const char* s) {
+    if (!s)
+        return SCRIPT_IR_NONE;
+
+    ENTRY query = {.key = (char*)s, .data = NULL};
+    ENTRY* entry;
+    if (hsearch_r(query, FIND, &entry, &w->htab))
+        return (uint32_t)(uintptr_t)entry->data;
+
+    size_t len = strlen(s) + 1;
+    if (w->pool_sz + len >= SCRIPT_IR_NONE) {
+        fprintf(stderr, "IR string pool is too large\n");
+        return SCRIPT_IR_NONE;
+    }
+
+    if (!grow((void**)&w->pool, &w->pool_cap, w->pool_sz + len, 1) ||
+        !grow((void**)&w->keys, &w->keys_cap, w->nkeys + 1, sizeof(*w->keys)))
+        return SCRIPT_IR_NONE;
+
+    char* key = strdup(s);
+    if (!key) {
+        perror("strdup");
+        return SCRIPT_IR_NONE;
+    }
+    w->keys[w->nkeys++] = key;
+
+    uint32_t offs = w->pool_sz;
+    memcpy(&w->pool[offs], s, len);
+    w->pool_sz += len;
+
+    query = (ENTRY){.key = key, .data = (void*)(uintptr_t)offs};
+    if (hsearch_r(query, ENTER, &entry, &w->htab) == 0) {
+        perror("hsearch");
+        return SCRIPT_IR_NONE;
+    }
+
+    return offs;
+}
+
+static bool intern_chk(struct script_ir_writer* w, const char* s, uint32_t* dst) {
+    *dst = intern(w, s);
+    return !s || *dst != SCRIPT_IR_NONE;
+}
+
+bool script_ir_writer_add_stmt(struct script_ir_writer* w, const struct script_stmt* stmt) {
+    if (!grow((void**)&w->stmts, &w->stmts_cap, w->nstmts + 1, sizeof(*w->stmts)))
+        return false;
+
+    struct script_ir_stmt ir;
+    memset(&ir, 0, sizeof(ir));
+
+    ir.ty = stmt->ty;
+    if (!intern_chk(w, stmt->label, &ir.label))
+        return false;
+
+    for (size_t i = 0; i < SCRIPT_PARSE_CTX_ARGS_SZ; i++)
+        ir.args[i].str = SCRIPT_IR_NONE;
+
+    switch (stmt->ty) {
+        case STMT_TY_OP: {
+            assert(stmt->op.args.nargs <= SCRIPT_PARSE_CTX_ARGS_SZ);
+            ir.op = stmt->op.idx;
+            ir.n = stmt->op.args.nargs;
+
+            for (int i = 0; i < stmt->op.args.nargs; i++) {
+                const struct script_arg* arg = &stmt->op.args.args[i];
+                struct script_ir_arg* ir_arg = &ir.args[i];
+
+                ir_arg->type = arg->type;
+                switch (arg->type) {
+                    case ARG_TY_NUM:
+                        ir_arg->num = arg->num;
+                        break;
+                    case ARG_TY_STR:
+                    case ARG_TY_LABEL:
+                        if (!intern_chk(w, arg->str, &ir_arg->str))
+                            return false;
+                        break;
+                    case ARG_TY_NUMBERED_STR:
+                        ir_arg->num = arg->numbered_str.num;
+                        if (!intern_chk(w, arg->numbered_str.str, &ir_arg->str))
+                            return false;
+                        break;
+                    default:
+                        assert(false);
+                }
+            }
+            break;
+        }
+
+        case STMT_TY_BYTE:
+            ir.n = stmt->byte.n;
+            ir.val = stmt->byte.val;
+            break;
+
+        case STMT_TY_BEGIN_END:
+            ir.n = stmt->begin_end.begin;
+            if (!intern_chk(w, stmt->begin_end.section, &ir.val))
+                return false;
+            break;
+
+        default:
+            assert(false && "Unsupported stmt type");
+    }
+
+    w->stmts[w->nstmts++] = ir;
+    return true;
+}
+
+bool script_ir_writer_write(const struct script_ir_writer* w, FILE* fout) {
+    struct script_ir_hdr hdr = {
+        .magic = SCRIPT_IR_MAGIC,
+        .nstmts = w->nstmts,
+        .stmts_offs = sizeof(hdr),
+        .pool_offs = sizeof(hdr) + w->nstmts * sizeof(*w->stmts),
+        .pool_sz = w->pool_sz
+    };
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fout) != 1 ||
+        fwrite(w->stmts, sizeof(*w->stmts), w->nstmts, fout) != w->nstmts ||
+        fwrite(w->pool, 1, w->pool_sz, fout) != w->pool_sz) {
+        perror("fwrite");
+        return false;
+    }
+
+    return true;
+}
+
+bool script_ir_is_ir(const void* buf, size_t sz) {
+    return sz >= sizeof(struct script_ir_hdr) &&
+        !memcmp(buf, SCRIPT_IR_MAGIC, sizeof(((struct script_ir_hdr*)NULL)->magic));
+}
+
+static const char* pool_str(const char* pool, size_t pool_sz, uint32_t offs, bool* ok) {
+    if (offs == SCRIPT_IR_NONE)
+        return NULL;
+    /* The pool is NUL-terminated, so any in-bounds offset yields a valid string */
+    if (offs >= pool_sz) {
+        *ok = false;
+        return NULL;
+    }
+    return &pool[offs];
+}
+
+static bool load_stmt(const struct script_ir_stmt* ir, const char* pool, size_t pool_sz,
+    struct script_stmt* stmt) {
+    bool ok = true;
+
+    stmt->label = pool_str(pool, pool_sz, ir->label, &ok);
+
+    switch (ir->ty) {
+        case STMT_TY_OP: {
+            if (!script_op_idx_chk(ir->op) || ir->n > SCRIPT_PARSE_CTX_ARGS_SZ)
+                return false;
+
+            stmt->ty = STMT_TY_OP;
+            stmt->op.idx = ir->op;
+            stmt->op.args.nargs = ir->n;
+
+            for (int i = 0; i < stmt->op.args.nargs; i++) {
+                const struct script_ir_arg* ir_arg = &ir->args[i];
+                struct script_arg* arg = &stmt->op.args.args[i];
+
+                switch (ir_arg->type) {
+                    case ARG_TY_NUM:
+                        *arg = (struct script_arg){.type = ARG_TY_NUM, .num = ir_arg->num};
+                        break;
+                    case ARG_TY_STR:
+                    case ARG_TY_LABEL:
+                        *arg = (struct script_arg){.type = ir_arg->type,
+                            .str = pool_str(pool, pool_sz, ir_arg->str, &ok)};
+                        ok &= arg->str != NULL;
+                        break;
+                    case ARG_TY_NUMBERED_STR:
+                        *arg = (struct script_arg){.type = ARG_TY_NUMBERED_STR,
+                            .numbered_str = {ir_arg->num,
+                                pool_str(pool, pool_sz, ir_arg->str, &ok)}};
+                        ok &= arg->numbered_str.str != NULL;
+                        break;
+                    default:
+                        return false;
+                }
+            }
+            break;
+        }
+
+        case STMT_TY_BYTE:
+            if (ir->n == 0 || ir->n > sizeof(uint32_t))
+                return false;
+            stmt->ty = STMT_TY_BYTE;
+            stmt->byte = (struct script_byte_stmt){.n = ir->n, .val = ir->val};
+            break;
+
+        case STMT_TY_BEGIN_END:
+            stmt->ty = STMT_TY_BEGIN_END;
+            stmt->begin_end = (struct script_begin_end_stmt){.begin = ir->n,
+                .section = pool_str(pool, pool_sz, ir->val, &ok)};
+            break;
+
+        default:
+            return false;
+    }
+
+    return ok;
+}
+
+bool script_ir_load(struct script_parse_ctx* ctx, const void* buf, size_t sz) {
+    if (!script_ir_is_ir(buf, sz))
+        return false;
+
+    const struct script_ir_hdr* hdr = buf;
+
+    if (hdr->stmts_offs > sz || (sz - hdr->stmts_offs) / sizeof(struct script_ir_stmt) <
+            hdr->nstmts ||
+        hdr->pool_offs > sz || sz - hdr->pool_offs < hdr->pool_sz ||
+        hdr->stmts_offs % sizeof(uint32_t) ||
+        (hdr->pool_sz > 0 && ((const char*)buf)[hdr->pool_offs + hdr->pool_sz - 1] != '\0')) {
+        script_parse_ctx_add_diag(ctx, &(struct script_diag){.kind = DIAG_ERR,
+            .msg = "malformed IR header"});
+        return false;
+    }
+
+    const struct script_ir_stmt* ir = (void*)&((const uint8_t*)buf)[hdr->stmts_offs];
+    const char* pool = &((const char*)buf)[hdr->pool_offs];
+
+    ctx->borrowed = pool;
+    ctx->borrowed_sz = hdr->pool_sz;
+
+    for (size_t i = 0; i < hdr->nstmts; i++) {
+        struct script_stmt stmt = {.line = i + 1};
+
+        if (!load_stmt(&ir[i], pool, hdr->pool_sz, &stmt)) {
+            script_parse_ctx_add_diag(ctx, &(struct script_diag){.kind = DIAG_ERR,
+                .line = i + 1, .msg = "malformed IR statement"});
+            return false;
+        }
+
+        if (!script_ctx_add_stmt(ctx, &stmt)) {
+            script_parse_ctx_add_diag(ctx, &(struct script_diag){.kind = DIAG_ERR,
+                .line = i + 1, .msg = "Too many statements"});
+            return false;
+        }
+    }
+
+    return ctx->ndiags == 0;
+}
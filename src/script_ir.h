@@ -0,0 +1,68 @@
+#ifndef SCRIPT_IR_H
+#define SCRIPT_IR_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "script_parse_ctx.h"
+
+/**
+ * Binary intermediate representation of a script.
+ * It holds the same statements as the textual dump, but can be loaded into script_parse_ctx
+ * without lexing and parsing. All strings (labels, string arguments, section names) are interned
+ * in a single pool of NUL-terminated strings referenced by offset.
+ *
+ * The layout is little-endian:
+ *   struct script_ir_hdr
+ *   struct script_ir_stmt[nstmts]
+ *   char pool[pool_sz]
+ */
+#define SCRIPT_IR_MAGIC "SHPNIR\x00\x01"
+#define SCRIPT_IR_NONE UINT32_MAX /* No pool string */
+
+struct script_ir_hdr {
+    char magic[8];
+    uint32_t nstmts;
+    uint32_t stmts_offs;
+    uint32_t pool_offs;
+    uint32_t pool_sz;
+};
+static_assert(sizeof(struct script_ir_hdr) == sizeof(uint32_t[6]), "");
+
+struct script_ir_arg {
+    uint8_t type; /* ARG_TY_* */
+    uint8_t pad;
+    uint16_t num;
+    uint32_t str; /* string or label */
+};
+static_assert(sizeof(struct script_ir_arg) == sizeof(uint32_t[2]), "");
+
+struct script_ir_stmt {
+    uint8_t ty; /* STMT_TY_* */
+    uint8_t n; /* nargs for op, width for byte, begin flag for begin_end */
+    uint16_t op;
+    uint32_t label;
+    uint32_t val; /* byte value, or section name for begin_end */
+    struct script_ir_arg args[SCRIPT_PARSE_CTX_ARGS_SZ];
+};
+static_assert(sizeof(struct script_ir_stmt) ==
+    sizeof(uint32_t[3]) + sizeof(struct script_ir_arg[SCRIPT_PARSE_CTX_ARGS_SZ]), "");
+
+struct script_ir_writer* script_ir_writer_new();
+void script_ir_writer_free(struct script_ir_writer* w);
+
+/* Strings referenced by stmt are copied into the writer */
+bool script_ir_writer_add_stmt(struct script_ir_writer* w, const struct script_stmt* stmt);
+bool script_ir_writer_write(const struct script_ir_writer* w, FILE* fout);
+
+bool script_ir_is_ir(const void* buf, size_t sz);
+
+/**
+ * Load IR at buf into an initialised ctx. The strings are not copied, so buf must outlive ctx.
+ */
+bool script_ir_load(struct script_parse_ctx* ctx, const void* buf, size_t sz);
+
+#endif
@@ -11,19 +11,18 @@
 #include "script_lex.yy.h"
 #include "script_parse_ctx.h"
 
-/* Needed for script name lookup */
-void init_script_handlers();
-extern struct script_cmd_handler script_handlers[SCRIPT_NOPS];
-
-/* Never freed */
-static struct hsearch_data handlers_htab;
-
-static bool init_handlers_htab() {
-    static bool ok;
-    if (ok)
-        return true;
+bool script_parse_ctx_init(struct script_parse_ctx* ctx, const char* script) {
+    ctx->ndiags = 0;
+    ctx->nstmts = 0;
+    ctx->last = NULL;
+    ctx->script = script;
+    ctx->borrowed = NULL;
+    ctx->borrowed_sz = 0;
+    ctx->filename = NULL;
 
-    if (hcreate_r(SCRIPT_NOPS, &handlers_htab) == 0) {
+    /* Op names are looked up per context, so that contexts can be used from different threads */
+    memset(&ctx->ops_htab, 0, sizeof(ctx->ops_htab));
+    if (hcreate_r(SCRIPT_NOPS, &ctx->ops_htab) == 0) {
         perror("hcreate");
         return false;
     }
@@ -33,26 +32,16 @@ static bool init_handlers_htab() {
 
         ENTRY query = {.key = (void*)script_handlers[i].name, .data = (void*)i};
         ENTRY* entry;
-        if (hsearch_r(query, ENTER, &entry, &handlers_htab) == 0) {
+        if (hsearch_r(query, ENTER, &entry, &ctx->ops_htab) == 0) {
             perror("hsearch");
-            hdestroy_r(&handlers_htab);
+            hdestroy_r(&ctx->ops_htab);
             return false;
         }
     }
 
-    ok = true;
     return true;
 }
 
-bool script_parse_ctx_init(struct script_parse_ctx* ctx, const char* script) {
-    ctx->ndiags = 0;
-    ctx->nstmts = 0;
-    ctx->script = script;
-    ctx->filename = NULL;
-    init_script_handlers();
-    return init_handlers_htab();
-}
-
 bool script_parse_ctx_parse(struct script_parse_ctx* ctx) {
     yyscan_t scanner;
 
@@ -90,12 +79,9 @@ bool script_ctx_insert_next_stmt(struct script_parse_ctx* ctx, const struct scri
     if (ctx->nstmts >= SCRIPT_PARSE_CTX_STMTS_SZ)
         return false;
 
-    /* If prev is not passed, we need to discover it in order */
-    if (!prev && ctx->nstmts > 0) {
-        prev = &ctx->stmts[0];
-        while (prev->next)
-            prev = prev->next;
-    }
+    /* If prev is not passed, append */
+    if (!prev)
+        prev = ctx->last;
 
     struct script_stmt* dst = &ctx->stmts[ctx->nstmts++];
     *dst = *stmt;
@@ -111,10 +97,12 @@ bool script_ctx_insert_next_stmt(struct script_parse_ctx* ctx, const struct scri
     dst->next = next;
     if (next)
         next->prev = dst;
+    else
+        ctx->last = dst;
     return true;
 }
 
-bool script_op_idx(const char* name, size_t* dst) {
+bool script_op_idx(struct script_parse_ctx* ctx, const char* name, size_t* dst) {
     assert(name);
     if (!strncmp(name, "OP_", 3) && strlen(name) > 3) {
         size_t idx = strtoumax(&name[3], NULL, 0);
@@ -126,7 +114,7 @@ bool script_op_idx(const char* name, size_t* dst) {
 
     ENTRY query = {.key = (char*)name, .data = NULL};
     ENTRY* res;
-    if (hsearch_r(query, FIND, &res, &handlers_htab) == 0)
+    if (hsearch_r(query, FIND, &res, &ctx->ops_htab) == 0)
         return false;
     *dst = (size_t)res->data;
     return true;
@@ -143,7 +131,19 @@ void script_arg_free(const struct script_arg* arg) {
         free((void*)arg->numbered_str.str);
 }
 
-void script_stmt_free(struct script_stmt* stmt, bool inorder) {
+bool script_parse_ctx_owns(const struct script_parse_ctx* ctx, const char* str) {
+    return !ctx->borrowed || str < ctx->borrowed || str >= ctx->borrowed + ctx->borrowed_sz;
+}
+
+static bool arg_owned(const struct script_parse_ctx* ctx, const struct script_arg* arg) {
+    if (arg->type == ARG_TY_STR || arg->type == ARG_TY_LABEL)
+        return script_parse_ctx_owns(ctx, arg->str);
+    if (arg->type == ARG_TY_NUMBERED_STR)
+        return script_parse_ctx_owns(ctx, arg->numbered_str.str);
+    return true;
+}
+
+void script_stmt_free(struct script_parse_ctx* ctx, struct script_stmt* stmt, bool inorder) {
     assert(stmt);
 
     if (inorder) {
@@ -152,16 +152,20 @@ void script_stmt_free(struct script_stmt* stmt, bool inorder) {
             prev->next = next;
         if (next)
             next->prev = prev;
+        else
+            ctx->last = prev;
     }
 
-    if (stmt->label)
+    if (stmt->label && script_parse_ctx_owns(ctx, stmt->label))
         free((void*)stmt->label);
     if (stmt->ty == STMT_TY_OP)
         for (int i = 0; i < stmt->op.args.nargs; i++)
-            script_arg_free((void*)&stmt->op.args.args[i]);
+            if (arg_owned(ctx, &stmt->op.args.args[i]))
+                script_arg_free((void*)&stmt->op.args.args[i]);
 }
 
 void script_parse_ctx_free(struct script_parse_ctx* ctx) {
     for (size_t i = 0; i < ctx->nstmts; i++)
-        script_stmt_free(&ctx->stmts[i], false);
+        script_stmt_free(ctx, &ctx->stmts[i], false);
+    hdestroy_r(&ctx->ops_htab);
 }
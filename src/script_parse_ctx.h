@@ -6,11 +6,21 @@
 #include <stdint.h>
 
 #include "defs.h"
+#define _GNU_SOURCE
+#include "search.h"
+#undef _GNU_SOURCE
 
 struct script_parse_ctx {
     const char* filename;
     const char* script;
 
+    /* Strings within this region are not owned by the context (e.g. a loaded script IR pool) */
+    const char* borrowed;
+    size_t borrowed_sz;
+
+    /* Op name to index */
+    struct hsearch_data ops_htab;
+
 #define SCRIPT_PARSE_DIAGS_SZ 10
     struct script_diag {
         enum {/*DIAG_WARN,*/ DIAG_ERR} kind;
@@ -68,6 +78,7 @@ struct script_parse_ctx {
         };
     } stmts[SCRIPT_PARSE_CTX_STMTS_SZ];
     size_t nstmts;
+    struct script_stmt* last; /* in order, so that appending does not walk the list */
 };
 
 bool script_parse_ctx_init(struct script_parse_ctx* ctx, const char* script);
@@ -75,9 +86,10 @@ bool script_parse_ctx_parse(struct script_parse_ctx* ctx);
 bool script_parse_ctx_add_diag(struct script_parse_ctx* ctx, const struct script_diag* diag);
 bool script_arg_list_add_arg(struct script_arg_list* args, const struct script_arg* arg);
 void script_arg_free(const struct script_arg* arg);
-void script_stmt_free(struct script_stmt* stmt, bool inorder);
+void script_stmt_free(struct script_parse_ctx* ctx, struct script_stmt* stmt, bool inorder);
+bool script_parse_ctx_owns(const struct script_parse_ctx* ctx, const char* str);
 void script_parse_ctx_free(struct script_parse_ctx* ctx);
-bool script_op_idx(const char* name, size_t* dst);
+bool script_op_idx(struct script_parse_ctx* ctx, const char* name, size_t* dst);
 bool script_op_idx_chk(size_t idx);
 bool script_ctx_add_stmt(struct script_parse_ctx* ctx, const struct script_stmt* stmt);
 bool script_ctx_insert_next_stmt(struct script_parse_ctx* ctx, const struct script_stmt* stmt,
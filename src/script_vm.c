@@ -0,0 +1,692 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "defs.h"
+#include "pool.h"
+#include "script_disass.h"
+#include "script_vm.h"
+
+enum {
+    OP_JUMP = 1,
+    OP_BRANCH_IF = 4,
+    OP_BRANCH_ELIF = 5,
+    OP_BRANCH_ELSE = 6,
+    OP_CHOICE = 0x11,
+    OP_CHOICE_IDX = 0x35,
+    OP_SAVE_VARIABLE = 0x37,
+    OP_STOP = 0x63
+};
+
+enum vm_kind {
+    VM_NEXT,
+    VM_JUMP,
+    VM_IF,
+    VM_ELIF,
+    VM_ELSE,
+    VM_CHOICE,
+    VM_SAVE,
+    VM_STOP,
+    VM_HALT /* invalid command */
+};
+
+#define VM_NONE UINT32_MAX
+#define VM_VAR_ANY UINT8_MAX /* a condition that cannot be tested, or a choice that is not stored */
+#define VM_NCHOICES_MAX SCRIPT_INST_ARGS_SZ
+#define VM_CHUNK_SZ 64 /* recorded states run by a thread at a time */
+#define VM_NSTARTS_MAX 4096
+#define VM_NSTATES_MAX (1u << 24)
+#define VM_NSTRS (UINT16_MAX + 1)
+
+static_assert(SCRIPT_VM_NVARS <= 16, "variables must fit liveness masks");
+
+struct vm_inst {
+    uint8_t kind; /* enum vm_kind */
+    uint8_t var;
+    uint16_t val;
+    uint32_t next, dst; /* indices into code, VM_NONE if there is no command there */
+    uint16_t live; /* variables read on some path from here before being stored */
+    bool label;
+    uint8_t nchoices;
+    uint16_t choices[VM_NCHOICES_MAX]; /* menu strtab indices of the options */
+};
+
+struct vm_state {
+    uint32_t pc; /* index into code */
+    uint32_t fell; /* reached by falling off the end of the previous command */
+    uint16_t vars[SCRIPT_VM_NVARS];
+};
+
+struct vm_states {
+    struct vm_state* states;
+    size_t n, cap;
+};
+
+struct vm_prog {
+    const union script_cmd* cmds;
+    uint16_t cmd_end;
+    const char* branch_info;
+    size_t branch_info_sz;
+
+    /* Decoded commands in ascending order of offset, with the label of their region */
+    struct script_inst* insts;
+    uint16_t* labels;
+    size_t ninsts, cap;
+
+    struct vm_inst* code; /* for each of insts */
+    uint32_t* at; /* 1-based index into code for each offset, 0 if no command starts there */
+};
+
+struct vm_ctx {
+    const struct vm_inst* code;
+    const struct vm_state* frontier;
+    size_t nfrontier;
+
+    /* Per thread */
+    struct vm_states* out;
+    uint64_t* reached;
+    size_t nwords;
+};
+
+static bool add_inst(const struct script_inst* inst, uint16_t label, void* arg) {
+    struct vm_prog* prog = arg;
+
+    if (prog->ninsts == prog->cap) {
+        size_t cap = prog->cap ? prog->cap * 2 : 1024;
+        struct script_inst* insts = realloc(prog->insts, cap * sizeof(*insts));
+        if (!insts) {
+            perror("realloc");
+            return false;
+        }
+        prog->insts = insts;
+
+        uint16_t* labels = realloc(prog->labels, cap * sizeof(*labels));
+        if (!labels) {
+            perror("realloc");
+            return false;
+        }
+        prog->labels = labels;
+        prog->cap = cap;
+    }
+
+    prog->insts[prog->ninsts] = *inst;
+    prog->labels[prog->ninsts++] = label;
+    return true;
+}
+
+static uint32_t code_at(const struct vm_prog* prog, uint32_t offs) {
+    return offs < prog->cmd_end && prog->at[offs] ? prog->at[offs] - 1 : VM_NONE;
+}
+
+static bool parse_num(const char** s, const char* end, uint32_t max, uint32_t* val) {
+    const char* p = *s;
+
+    for (*val = 0; p < end && *p >= '0' && *p <= '9'; p++) {
+        *val = *val * 10 + (*p - '0');
+        if (*val > max)
+            return false;
+    }
+    if (p == *s)
+        return false;
+
+    *s = p;
+    return true;
+}
+
+/* Parses the condition "s<var>=<val>" at offs into branch_info */
+static bool parse_cond(const struct vm_prog* prog, uint16_t offs, uint8_t* var, uint16_t* val) {
+    const char* s = &prog->branch_info[offs];
+    const char* end = &prog->branch_info[prog->branch_info_sz];
+    uint32_t v, x;
+
+    if (offs >= prog->branch_info_sz || *s++ != 's' ||
+        !parse_num(&s, end, SCRIPT_VM_NVARS - 1, &v) || s == end || *s++ != '=' ||
+        !parse_num(&s, end, UINT16_MAX, &x) || s == end || *s)
+        return false;
+
+    *var = v;
+    *val = x;
+    return true;
+}
+
+static void compile_inst(const struct vm_prog* prog, size_t i) {
+    const struct script_inst* inst = &prog->insts[i];
+    struct vm_inst* in = &prog->code[i];
+    size_t first_choice = 1;
+
+    *in = (struct vm_inst){.kind = VM_NEXT, .var = VM_VAR_ANY, .next = VM_NONE, .dst = VM_NONE,
+        .label = inst->offs == prog->labels[i]};
+
+    if (!inst->valid) {
+        in->kind = VM_HALT;
+        return;
+    }
+    in->next = code_at(prog, inst->offs_next);
+
+    switch (inst->cmd.op) {
+        case OP_JUMP:
+            in->kind = VM_JUMP;
+            in->dst = code_at(prog, inst->args[0].val);
+            break;
+        case OP_BRANCH_IF:
+        case OP_BRANCH_ELIF:
+        case OP_BRANCH_ELSE:
+            in->kind = inst->cmd.op == OP_BRANCH_IF ? VM_IF :
+                inst->cmd.op == OP_BRANCH_ELIF ? VM_ELIF : VM_ELSE;
+            in->dst = code_at(prog, inst->args[1].val);
+            if (in->kind != VM_ELSE && !parse_cond(prog, inst->args[0].val, &in->var, &in->val))
+                in->var = VM_VAR_ANY;
+            break;
+        case OP_CHOICE_IDX:
+            first_choice = 2;
+            if (inst->args[0].val < SCRIPT_VM_NVARS)
+                in->var = inst->args[0].val;
+            /* fallthrough */
+        case OP_CHOICE:
+            if (inst->cmd.op == OP_CHOICE)
+                in->var = 0;
+            /* The first menu string is the prompt */
+            for (size_t a = first_choice; a < inst->nargs; a++)
+                in->choices[in->nchoices++] = inst->args[a].val;
+            if (in->nchoices)
+                in->kind = VM_CHOICE;
+            break;
+        case OP_SAVE_VARIABLE: {
+            if (inst->cmd.arg < 2)
+                break;
+            const union script_cmd* args = (void*)&((uint8_t*)prog->cmds)[inst->offs + 4];
+            uint16_t var = script_cmd_arg(args, 0, 1);
+            if (var < SCRIPT_VM_NVARS) {
+                in->kind = VM_SAVE;
+                in->var = var;
+                in->val = script_cmd_arg(args, 0, 2);
+            }
+            break;
+        }
+        case OP_STOP:
+            in->kind = VM_STOP;
+            break;
+        default:
+            break;
+    }
+}
+
+static uint16_t live_in(const struct vm_inst* code, uint32_t i) {
+    return i == VM_NONE ? 0 : code[i].live;
+}
+
+/* Backwards dataflow until nothing changes, as loops are few */
+static void compute_liveness(struct vm_inst* code, size_t n) {
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        for (size_t i = n; i-- > 0;) {
+            struct vm_inst* in = &code[i];
+            uint16_t live = 0;
+
+            if (in->kind != VM_JUMP && in->kind != VM_STOP && in->kind != VM_HALT)
+                live |= live_in(code, in->next);
+            if (in->kind == VM_JUMP || in->kind == VM_IF || in->kind == VM_ELIF ||
+                in->kind == VM_ELSE)
+                live |= live_in(code, in->dst);
+
+            if ((in->kind == VM_CHOICE || in->kind == VM_SAVE) && in->var != VM_VAR_ANY)
+                live &= ~(1u << in->var);
+            if ((in->kind == VM_IF || in->kind == VM_ELIF) && in->var != VM_VAR_ANY)
+                live |= 1u << in->var;
+
+            if (live != in->live) {
+                in->live = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+static void normalize(const struct vm_inst* code, struct vm_state* s) {
+    const struct vm_inst* in = &code[s->pc];
+
+    for (size_t v = 0; v < SCRIPT_VM_NVARS; v++)
+        if (!(in->live & (1u << v)))
+            s->vars[v] = 0;
+    s->fell = s->fell && (in->kind == VM_ELIF || in->kind == VM_ELSE);
+}
+
+static bool push_state(struct vm_states* out, const struct vm_state* s) {
+    if (out->n == out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : 256;
+        struct vm_state* states = realloc(out->states, cap * sizeof(*states));
+        if (!states) {
+            perror("realloc");
+            return false;
+        }
+        out->states = states;
+        out->cap = cap;
+    }
+
+    out->states[out->n++] = *s;
+    return true;
+}
+
+static bool emit(const struct vm_ctx* ctx, size_t tid, struct vm_state s) {
+    if (s.pc == VM_NONE)
+        return true;
+
+    normalize(ctx->code, &s);
+    return push_state(&ctx->out[tid], &s);
+}
+
+/* Run a recorded state until it reaches the next ones */
+static bool run(const struct vm_ctx* ctx, size_t tid, struct vm_state s) {
+    uint64_t* reached = &ctx->reached[tid * ctx->nwords];
+
+    for (bool first = true; s.pc != VM_NONE; first = false) {
+        const struct vm_inst* in = &ctx->code[s.pc];
+        if (!first && in->label)
+            return emit(ctx, tid, s);
+
+        reached[s.pc / 64] |= 1ull << (s.pc % 64);
+
+        switch (in->kind) {
+            case VM_JUMP:
+                s.pc = in->dst;
+                s.fell = false;
+                break;
+            case VM_IF:
+            case VM_ELIF:
+            case VM_ELSE:
+                /* The previous arm was taken */
+                if (in->kind != VM_IF && s.fell) {
+                    s.pc = in->dst;
+                    s.fell = false;
+                    break;
+                }
+
+                if (in->kind != VM_ELSE && in->var == VM_VAR_ANY) {
+                    struct vm_state taken = s;
+                    taken.pc = in->next;
+                    taken.fell = true;
+                    s.pc = in->dst;
+                    s.fell = false;
+                    return emit(ctx, tid, taken) && emit(ctx, tid, s);
+                }
+
+                if (in->kind == VM_ELSE || s.vars[in->var] == in->val) {
+                    s.pc = in->next;
+                    s.fell = true;
+                } else {
+                    s.pc = in->dst;
+                    s.fell = false;
+                }
+                break;
+            case VM_CHOICE:
+                s.pc = in->next;
+                s.fell = true;
+                for (size_t i = 0; i < in->nchoices; i++) {
+                    if (in->var != VM_VAR_ANY)
+                        s.vars[in->var] = in->choices[i];
+                    if (!emit(ctx, tid, s))
+                        return false;
+                }
+                return true;
+            case VM_SAVE:
+                s.vars[in->var] = in->val;
+                s.pc = in->next;
+                s.fell = true;
+                break;
+            case VM_STOP:
+            case VM_HALT:
+                return true;
+            default:
+                s.pc = in->next;
+                s.fell = true;
+                break;
+        }
+    }
+    return true;
+}
+
+static bool run_chunk(size_t i, size_t tid, void* arg) {
+    const struct vm_ctx* ctx = arg;
+    size_t end = (i + 1) * VM_CHUNK_SZ < ctx->nfrontier ? (i + 1) * VM_CHUNK_SZ : ctx->nfrontier;
+
+    for (size_t j = i * VM_CHUNK_SZ; j < end; j++)
+        if (!run(ctx, tid, ctx->frontier[j]))
+            return false;
+    return true;
+}
+
+/* Set of recorded states, open addressing over their 1-based indices */
+struct vm_set {
+    struct vm_states all;
+    uint32_t* slots;
+    size_t nslots;
+};
+
+static uint64_t hash_state(const struct vm_state* s) {
+    uint64_t h = 0;
+    const uint32_t* w = (const uint32_t*)s;
+
+    static_assert(sizeof(*s) % sizeof(*w) == 0, "");
+    for (size_t i = 0; i < sizeof(*s) / sizeof(*w); i++) {
+        h = (h ^ w[i]) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static bool set_grow(struct vm_set* set) {
+    size_t nslots = set->nslots ? set->nslots * 2 : 1 << 12;
+    uint32_t* slots = calloc(nslots, sizeof(*slots));
+    if (!slots) {
+        perror("calloc");
+        return false;
+    }
+
+    for (size_t i = 0; i < set->all.n; i++) {
+        size_t h = hash_state(&set->all.states[i]) & (nslots - 1);
+        while (slots[h])
+            h = (h + 1) & (nslots - 1);
+        slots[h] = i + 1;
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->nslots = nslots;
+    return true;
+}
+
+/* Returns false on failure, with *ins telling if s was new */
+static bool set_insert(struct vm_set* set, const struct vm_state* s, bool* ins) {
+    if (2 * (set->all.n + 1) > set->nslots && !set_grow(set))
+        return false;
+
+    size_t h = hash_state(s) & (set->nslots - 1);
+    for (; set->slots[h]; h = (h + 1) & (set->nslots - 1))
+        if (!memcmp(&set->all.states[set->slots[h] - 1], s, sizeof(*s))) {
+            *ins = false;
+            return true;
+        }
+
+    if (set->all.n == VM_NSTATES_MAX) {
+        fprintf(stderr, "More than %u states to explore\n", VM_NSTATES_MAX);
+        return false;
+    }
+    if (!push_state(&set->all, s))
+        return false;
+
+    set->slots[h] = set->all.n;
+    *ins = true;
+    return true;
+}
+
+/**
+ * Every combination of the values of the variables that are tested but never stored, which are
+ * those tested against and the least one that is not.
+ */
+static bool add_starts(const struct vm_inst* code, size_t n, struct vm_set* set) {
+    uint16_t stored = 0, tested = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if ((code[i].kind == VM_CHOICE || code[i].kind == VM_SAVE) && code[i].var != VM_VAR_ANY)
+            stored |= 1u << code[i].var;
+        if ((code[i].kind == VM_IF || code[i].kind == VM_ELIF) && code[i].var != VM_VAR_ANY)
+            tested |= 1u << code[i].var;
+    }
+
+    uint16_t* vals[SCRIPT_VM_NVARS] = {0};
+    size_t nvals[SCRIPT_VM_NVARS] = {0}, pos[SCRIPT_VM_NVARS] = {0};
+    uint8_t* seen = calloc(VM_NSTRS, 1);
+    size_t nstarts = 1;
+    bool ok = false;
+
+    if (!seen) {
+        perror("calloc");
+        return false;
+    }
+
+    for (size_t v = 0; v < SCRIPT_VM_NVARS; v++) {
+        if (!(tested & ~stored & (1u << v)))
+            continue;
+
+        memset(seen, 0, VM_NSTRS);
+        for (size_t i = 0; i < n; i++)
+            if ((code[i].kind == VM_IF || code[i].kind == VM_ELIF) && code[i].var == v)
+                seen[code[i].val] = true;
+
+        vals[v] = malloc(VM_NSTRS * sizeof(*vals[v]));
+        if (!vals[v]) {
+            perror("malloc");
+            goto done;
+        }
+
+        bool untested = false;
+        for (size_t x = 0; x < VM_NSTRS; x++)
+            if (seen[x] || !untested) {
+                untested |= !seen[x];
+                vals[v][nvals[v]++] = x;
+            }
+
+        nstarts *= nvals[v];
+        if (nstarts > VM_NSTARTS_MAX) {
+            fprintf(stderr, "More than %u starting states\n", VM_NSTARTS_MAX);
+            goto done;
+        }
+    }
+
+    for (size_t k = 0; k < nstarts; k++) {
+        struct vm_state s = {.pc = 0};
+        for (size_t v = 0; v < SCRIPT_VM_NVARS; v++)
+            if (vals[v])
+                s.vars[v] = vals[v][pos[v]];
+        normalize(code, &s);
+
+        bool ins;
+        if (!set_insert(set, &s, &ins))
+            goto done;
+
+        /* Next combination */
+        for (size_t v = 0; v < SCRIPT_VM_NVARS; v++)
+            if (vals[v] && ++pos[v] < nvals[v])
+                break;
+            else
+                pos[v] = 0;
+    }
+    ok = true;
+
+done:
+    for (size_t v = 0; v < SCRIPT_VM_NVARS; v++)
+        free(vals[v]);
+    free(seen);
+    return ok;
+}
+
+static bool explore(const struct vm_prog* prog, struct script_vm_report* report,
+        uint64_t* reached) {
+    size_t nthreads = pool_nthreads();
+    size_t nwords = (prog->ninsts + 63) / 64;
+    struct vm_set set = {0};
+    bool ok = false;
+
+    struct vm_ctx ctx = {.code = prog->code, .nwords = nwords};
+    ctx.out = calloc(nthreads, sizeof(*ctx.out));
+    ctx.reached = calloc(nthreads * nwords + 1, sizeof(*ctx.reached));
+    if (!ctx.out || !ctx.reached) {
+        perror("calloc");
+        goto done;
+    }
+
+    if (prog->ninsts && !add_starts(prog->code, prog->ninsts, &set))
+        goto done;
+    report->nstarts = set.all.n;
+
+    for (size_t first = 0, end = set.all.n; first < end; first = end, end = set.all.n) {
+        ctx.frontier = &set.all.states[first];
+        ctx.nfrontier = end - first;
+        for (size_t t = 0; t < nthreads; t++)
+            ctx.out[t].n = 0;
+
+        if (!pool_for((ctx.nfrontier + VM_CHUNK_SZ - 1) / VM_CHUNK_SZ, nthreads, run_chunk, &ctx))
+            goto done;
+        report->nsteps++;
+
+        for (size_t t = 0; t < nthreads; t++) {
+            report->nedges += ctx.out[t].n;
+            for (size_t i = 0; i < ctx.out[t].n; i++) {
+                bool ins;
+                if (!set_insert(&set, &ctx.out[t].states[i], &ins))
+                    goto done;
+            }
+        }
+    }
+    report->nstates = set.all.n;
+
+    for (size_t t = 0; t < nthreads; t++)
+        for (size_t w = 0; w < nwords; w++)
+            reached[w] |= ctx.reached[t * nwords + w];
+    ok = true;
+
+done:
+    for (size_t t = 0; ctx.out && t < nthreads; t++)
+        free(ctx.out[t].states);
+    free(ctx.out);
+    free(ctx.reached);
+    free(set.all.states);
+    free(set.slots);
+    return ok;
+}
+
+static bool is_reached(const uint64_t* reached, size_t i) {
+    return reached[i / 64] & (1ull << (i % 64));
+}
+
+/* Indices that are set in refs but not in shown */
+static uint16_t* unshown(const uint64_t* refs, const uint64_t* shown, size_t* n) {
+    *n = 0;
+    for (size_t i = 0; i < VM_NSTRS; i++)
+        *n += !!(refs[i / 64] & ~shown[i / 64] & (1ull << (i % 64)));
+
+    uint16_t* strs = malloc(*n * sizeof(*strs) + 1);
+    if (!strs) {
+        perror("malloc");
+        return NULL;
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < VM_NSTRS; i++)
+        if (refs[i / 64] & ~shown[i / 64] & (1ull << (i % 64)))
+            strs[k++] = i;
+    return strs;
+}
+
+static bool make_report(const struct vm_prog* prog, const uint64_t* reached,
+        struct script_vm_report* report) {
+    /* Referenced and shown, for script and menu strings */
+    uint64_t* strs = calloc(4 * VM_NSTRS / 64, sizeof(*strs));
+    report->dead_labels = malloc(prog->ninsts * sizeof(*report->dead_labels) + 1);
+    report->unreached = malloc(prog->ninsts * sizeof(*report->unreached) + 1);
+    if (!strs || !report->dead_labels || !report->unreached) {
+        perror("malloc");
+        free(strs);
+        return false;
+    }
+
+    for (size_t i = 0; i < prog->ninsts; i++) {
+        const struct script_inst* inst = &prog->insts[i];
+        bool ran = is_reached(reached, i);
+
+        if (prog->code[i].label && !ran)
+            report->dead_labels[report->ndead_labels++] = inst->offs;
+        if (!inst->valid)
+            continue;
+
+        report->ninsts++;
+        report->nreached += ran;
+        report->nstops += prog->code[i].kind == VM_STOP;
+        report->nstops_reached += prog->code[i].kind == VM_STOP && ran;
+
+        /* Runs of consecutive commands */
+        struct script_vm_run* last = report->nunreached ?
+            &report->unreached[report->nunreached - 1] : NULL;
+        if (!ran && last && last->end == inst->offs && i && prog->insts[i - 1].valid) {
+            last->end = inst->offs_next;
+            last->ninsts++;
+        } else if (!ran)
+            report->unreached[report->nunreached++] = (struct script_vm_run){.offs = inst->offs,
+                .end = inst->offs_next, .label = prog->labels[i], .ninsts = 1};
+
+        for (size_t a = 0; a < inst->nargs; a++) {
+            uint16_t val = inst->args[a].val;
+            uint64_t* bits = inst->args[a].type == INST_ARG_STR ? strs :
+                inst->args[a].type == INST_ARG_MENU_STR ? &strs[2 * VM_NSTRS / 64] : NULL;
+            if (!bits)
+                continue;
+
+            bits[val / 64] |= 1ull << (val % 64);
+            if (ran)
+                bits[VM_NSTRS / 64 + val / 64] |= 1ull << (val % 64);
+        }
+    }
+
+    report->unshown_strs = unshown(strs, &strs[VM_NSTRS / 64], &report->nunshown_strs);
+    report->unshown_menu_strs = unshown(&strs[2 * VM_NSTRS / 64], &strs[3 * VM_NSTRS / 64],
+        &report->nunshown_menu_strs);
+    free(strs);
+    return report->unshown_strs && report->unshown_menu_strs;
+}
+
+bool script_vm_explore(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
+        const struct script_desc* desc, struct script_vm_report* report) {
+    struct vm_prog prog = {0};
+    uint64_t* reached = NULL;
+    bool ok = false;
+
+    memset(report, 0, sizeof(*report));
+
+    if (!script_walk(rom, rom_sz, script_vma, desc, add_inst, &prog))
+        goto done;
+
+    /* The header was validated by script_walk */
+    const struct script_hdr* hdr = (void*)&rom[VMA2OFFS(script_vma)];
+    prog.cmds = (void*)&((uint8_t*)hdr)[sizeof(*hdr)];
+    prog.cmd_end = hdr->branch_info_offs;
+    prog.branch_info = &((char*)prog.cmds)[hdr->branch_info_offs];
+    prog.branch_info_sz = hdr->branch_info_sz;
+
+    prog.code = malloc(prog.ninsts * sizeof(*prog.code) + 1);
+    prog.at = calloc(prog.cmd_end + 1, sizeof(*prog.at));
+    reached = calloc((prog.ninsts + 63) / 64 + 1, sizeof(*reached));
+    if (!prog.code || !prog.at || !reached) {
+        perror("malloc");
+        goto done;
+    }
+
+    for (size_t i = 0; i < prog.ninsts; i++)
+        prog.at[prog.insts[i].offs] = i + 1;
+    for (size_t i = 0; i < prog.ninsts; i++)
+        compile_inst(&prog, i);
+    compute_liveness(prog.code, prog.ninsts);
+
+    ok = explore(&prog, report, reached) && make_report(&prog, reached, report);
+
+done:
+    if (!ok)
+        script_vm_report_free(report);
+    free(prog.insts);
+    free(prog.labels);
+    free(prog.code);
+    free(prog.at);
+    free(reached);
+    return ok;
+}
+
+void script_vm_report_free(struct script_vm_report* report) {
+    free(report->unreached);
+    free(report->dead_labels);
+    free(report->unshown_strs);
+    free(report->unshown_menu_strs);
+    memset(report, 0, sizeof(*report));
+}
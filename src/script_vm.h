@@ -0,0 +1,69 @@
+#ifndef SCRIPT_VM_H
+#define SCRIPT_VM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "script_disass.h"
+
+/**
+ * Headless interpreter of the control flow of a script, which explores every path the player may
+ * take through it. Only the commands that decide where the script goes are run:
+ *
+ * - Jump goes to its label.
+ * - Branch4 tests the condition "s<var>=<val>" at its offset into branch_info, and goes to the
+ *   next command if it holds, or else to the destination found by branch_dst. Branch5 tests the
+ *   same way, and Branch6 always holds, unless they are reached by falling off the end of the
+ *   previous arm, in which case they go to their destination (if/elif/else, closed by Nop7).
+ * - Choice stores the menu strtab index of the option taken in s0, ChoiceIdx in the variable of
+ *   its first argument, and SaveVariable stores its second argument in the variable of its first.
+ *   ReadVariable loads a saved variable for a branch, and as the interpreter keeps a single value
+ *   of each variable, it does nothing.
+ * - Stop, an invalid command or the end of the commands ends a path.
+ *
+ * The rest of the commands go to the next one. Variables that are tested but never stored, like
+ * s1 which picks the chapter to start from, take each of the values they are tested against, and
+ * one that they are not. Variables that are not read again before being stored are cleared, so
+ * that states that only differ by them are merged.
+ *
+ * States are recorded when they reach a label, a choice or an untestable branch, and each is
+ * explored once. Each step runs the states found by the previous one in parallel, from each up
+ * to the next recorded state.
+ */
+
+#define SCRIPT_VM_NVARS 16
+
+struct script_vm_report {
+    size_t nstarts; /* initial states */
+    size_t nstates; /* distinct recorded states */
+    size_t nedges; /* transitions between recorded states, including repeated ones */
+    size_t nsteps; /* steps until no new state was found */
+    size_t ninsts, nreached; /* valid commands, and how many of them were run */
+    size_t nstops, nstops_reached;
+
+    /* Ascending runs of consecutive valid commands that were never run */
+    struct script_vm_run {
+        uint16_t offs, end; /* of the first command and past the last one */
+        uint16_t label; /* of the region of the first command */
+        size_t ninsts;
+    }* unreached;
+    size_t nunreached;
+
+    /* Ascending labels whose command was never run */
+    uint16_t* dead_labels;
+    size_t ndead_labels;
+
+    /* Ascending strtab indices that the script refers to but never shows */
+    uint16_t* unshown_strs;
+    size_t nunshown_strs;
+    uint16_t* unshown_menu_strs;
+    size_t nunshown_menu_strs;
+};
+
+/* Decodes the script at script_vma like script_walk does and explores it */
+bool script_vm_explore(const uint8_t* rom, size_t rom_sz, uint32_t script_vma,
+    const struct script_desc* desc, struct script_vm_report* report);
+void script_vm_report_free(struct script_vm_report* report);
+
+#endif
@@ -0,0 +1,96 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "side_file.h"
+
+void* side_file_map(const char* path, const struct side_file_hdr* hdr, size_t hdr_sz, size_t* sz) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT)
+            perror(path);
+        return NULL;
+    }
+
+    void* ret = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        goto done;
+    }
+
+    *sz = st.st_size;
+    if (*sz < hdr_sz)
+        goto done;
+
+    void* map = mmap(NULL, *sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        goto done;
+    }
+
+    if (memcmp(map, hdr, sizeof(*hdr))) {
+        munmap(map, *sz);
+        goto done;
+    }
+    ret = map;
+
+done:
+    close(fd);
+    return ret;
+}
+
+bool side_file_save(const char* path, const struct side_file_part* parts, size_t nparts) {
+    size_t path_len = strlen(path);
+    char* tmp = malloc(path_len + sizeof(".tmp"));
+    if (!tmp) {
+        perror("malloc");
+        return false;
+    }
+    memcpy(tmp, path, path_len);
+    memcpy(&tmp[path_len], ".tmp", sizeof(".tmp"));
+
+    bool ret = false;
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        perror(tmp);
+        goto done;
+    }
+
+    ret = true;
+    for (size_t i = 0; ret && i < nparts; i++)
+        ret = fwrite(parts[i].buf, 1, parts[i].sz, f) == parts[i].sz;
+    if (!ret)
+        perror("fwrite");
+    if (fclose(f)) {
+        perror("fclose");
+        ret = false;
+    }
+
+    if (ret && rename(tmp, path)) {
+        perror("rename");
+        ret = false;
+    }
+    if (!ret)
+        remove(tmp);
+
+done:
+    free(tmp);
+    return ret;
+}
+
+void side_file_free(void* buf, size_t map_sz) {
+    if (map_sz)
+        munmap(buf, map_sz);
+    else
+        free(buf);
+}
@@ -0,0 +1,37 @@
+#ifndef SIDE_FILE_H
+#define SIDE_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Indices that are built once and kept in files next to what they were built from, the ROM or a
+ * strtab file. Each file starts with a header whose first fields are struct side_file_hdr, and
+ * is only loaded back for the same format and source.
+ */
+
+struct side_file_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t src_sz;
+    uint32_t src_crc;
+};
+
+/* A piece of the file, written in order */
+struct side_file_part {
+    const void* buf;
+    size_t sz;
+};
+
+/**
+ * Map the file at path if it is at least hdr_sz bytes and starts with hdr, and store its size in
+ * *sz. Fails quietly if the file does not exist or is for another source.
+ */
+void* side_file_map(const char* path, const struct side_file_hdr* hdr, size_t hdr_sz, size_t* sz);
+/* Written under a temporary name first, so that a partial index is never loaded */
+bool side_file_save(const char* path, const struct side_file_part* parts, size_t nparts);
+/* Free buf as allocated when map_sz is 0, or else unmap it */
+void side_file_free(void* buf, size_t map_sz);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+#define STATS_TRACE_SZ 65536 /* events past this are dropped */
+
+static const struct {
+    const char* name;
+    const char* unit; /* of items */
+} stages[STATS_NSTAGES] = {
+    [STATS_ROM_MAP] = {"rom map", "bytes"},
+    [STATS_PARSE] = {"parse", "statements"},
+    [STATS_FILL] = {"fill", "strings"},
+    [STATS_CONV] = {"conv", "strings"},
+    [STATS_WRAP] = {"wrap", "strings"},
+    [STATS_SPLIT] = {"split", "statements"},
+    [STATS_ASSEMBLE] = {"assemble", "bytes"},
+    [STATS_MAKE_STRTAB] = {"make_strtab", "bytes"},
+    [STATS_WRITE] = {"write", "bytes"},
+    [STATS_SCAN] = {"scan", "bytes"}
+};
+
+/* Instrumentation is process-wide, so everything here is either atomic or set before use */
+static struct {
+    bool stats;
+    const char* trace_path;
+    struct timespec t0;
+
+    struct {
+        atomic_uint_least64_t wall_ns, cpu_ns, nallocs, alloc_sz, items;
+    } stages[STATS_NSTAGES];
+
+    struct stats_event {
+        int stage;
+        unsigned tid;
+        uint64_t ts_ns, dur_ns;
+    } events[STATS_TRACE_SZ];
+    atomic_size_t nevents;
+
+    atomic_uint ntids;
+} stats;
+
+static _Thread_local int stage_curr = -1;
+static _Thread_local unsigned tid_curr; /* 1-based, 0 if not assigned yet */
+
+static uint64_t now_ns(clockid_t clk) {
+    struct timespec t;
+    clock_gettime(clk, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+void stats_enable(bool enable_stats, const char* trace_path) {
+    stats.stats = enable_stats;
+    stats.trace_path = trace_path;
+    clock_gettime(CLOCK_MONOTONIC, &stats.t0);
+}
+
+static bool enabled() {
+    return stats.stats || stats.trace_path;
+}
+
+void stats_begin(struct stats_span* span, enum stats_stage stage, bool worker) {
+    span->active = enabled() && !(worker && stage_curr == (int)stage);
+    if (!span->active)
+        return;
+
+    span->worker = worker;
+    span->stage = stage;
+    span->prev = stage_curr;
+    span->wall_ns = now_ns(CLOCK_MONOTONIC);
+    span->cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    stage_curr = stage;
+}
+
+void stats_end(const struct stats_span* span) {
+    if (!span->active)
+        return;
+
+    uint64_t wall_end = now_ns(CLOCK_MONOTONIC);
+
+    /* The wall time of worker spans is covered by the span of the stage they help with */
+    if (!span->worker)
+        atomic_fetch_add(&stats.stages[span->stage].wall_ns, wall_end - span->wall_ns);
+    atomic_fetch_add(&stats.stages[span->stage].cpu_ns,
+        now_ns(CLOCK_THREAD_CPUTIME_ID) - span->cpu_ns);
+    stage_curr = span->prev;
+
+    if (!stats.trace_path)
+        return;
+
+    if (tid_curr == 0)
+        tid_curr = atomic_fetch_add(&stats.ntids, 1) + 1;
+
+    size_t idx = atomic_fetch_add(&stats.nevents, 1);
+    if (idx < STATS_TRACE_SZ) {
+        uint64_t t0 = (uint64_t)stats.t0.tv_sec * 1000000000ull + stats.t0.tv_nsec;
+        stats.events[idx] = (struct stats_event){.stage = span->stage, .tid = tid_curr,
+            .ts_ns = span->wall_ns - t0, .dur_ns = wall_end - span->wall_ns};
+    }
+}
+
+void stats_items(enum stats_stage stage, uint64_t n) {
+    if (enabled())
+        atomic_fetch_add(&stats.stages[stage].items, n);
+}
+
+void stats_report(FILE* fout) {
+    if (!stats.stats)
+        return;
+
+    fprintf(fout, "%-12s %10s %10s %8s %10s %10s\n", "stage", "wall ms", "cpu ms", "allocs",
+        "alloc KiB", "items");
+    for (size_t i = 0; i < STATS_NSTAGES; i++) {
+        uint64_t wall_ns = atomic_load(&stats.stages[i].wall_ns);
+        uint64_t cpu_ns = atomic_load(&stats.stages[i].cpu_ns);
+        uint64_t items = atomic_load(&stats.stages[i].items);
+
+        fprintf(fout, "%-12s %10.3f %10.3f %8llu %10.1f %10llu %s", stages[i].name, wall_ns / 1e6,
+            cpu_ns / 1e6, (unsigned long long)atomic_load(&stats.stages[i].nallocs),
+            atomic_load(&stats.stages[i].alloc_sz) / 1024.0, (unsigned long long)items,
+            stages[i].unit);
+
+        /* Throughput only makes sense for stages that actually took some time */
+        if (wall_ns >= 1000)
+            fprintf(fout, " (%.0f/s)", items / (wall_ns / 1e9));
+        fprintf(fout, "\n");
+    }
+}
+
+/* Chrome trace event format, load in about:tracing or Perfetto */
+bool stats_write_trace() {
+    if (!stats.trace_path)
+        return true;
+
+    FILE* fout = fopen(stats.trace_path, "w");
+    if (!fout) {
+        perror("fopen");
+        return false;
+    }
+
+    size_t nevents = atomic_load(&stats.nevents);
+    if (nevents > STATS_TRACE_SZ) {
+        fprintf(stderr, "Trace is limited to %d events, dropped %zu\n", STATS_TRACE_SZ,
+            nevents - STATS_TRACE_SZ);
+        nevents = STATS_TRACE_SZ;
+    }
+
+    fprintf(fout, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (size_t i = 0; i < nevents; i++) {
+        const struct stats_event* ev = &stats.events[i];
+        fprintf(fout, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+            "\"ts\": %.3f, \"dur\": %.3f}%s\n", stages[ev->stage].name, ev->tid,
+            ev->ts_ns / 1e3, ev->dur_ns / 1e3, i + 1 < nevents ? "," : "");
+    }
+    fprintf(fout, "]}\n");
+
+    bool ret = !ferror(fout);
+    if (fclose(fout) || !ret) {
+        perror("fclose");
+        return false;
+    }
+    return true;
+}
+
+static void count_alloc(size_t sz) {
+    if (stage_curr < 0)
+        return;
+    atomic_fetch_add(&stats.stages[stage_curr].nallocs, 1);
+    atomic_fetch_add(&stats.stages[stage_curr].alloc_sz, sz);
+}
+
+void* stats_malloc(size_t sz) {
+    count_alloc(sz);
+    return malloc(sz);
+}
+
+void* stats_calloc(size_t n, size_t sz) {
+    count_alloc(n * sz);
+    return calloc(n, sz);
+}
+
+void* stats_realloc(void* p, size_t sz) {
+    count_alloc(sz);
+    return realloc(p, sz);
+}
+
+char* stats_strdup(const char* s) {
+    count_alloc(strlen(s) + 1);
+    return strdup(s);
+}
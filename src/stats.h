@@ -0,0 +1,72 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Per-stage instrumentation of embedding: wall and CPU time, allocations and processed items.
+ * It is only compiled in with SHPN_STATS (make STATS=1). Otherwise the macros below expand to
+ * nothing, so instrumented code is the same as if it was not instrumented.
+ */
+enum stats_stage {
+    STATS_ROM_MAP, /* map the ROM and check its CRC */
+    STATS_PARSE,
+    STATS_FILL, /* script_fill_strtabs */
+    STATS_CONV, /* ctx_conv */
+    STATS_WRAP, /* ctx_hard_wrap */
+    STATS_SPLIT, /* split Choice and ShowText */
+    STATS_ASSEMBLE,
+    STATS_MAKE_STRTAB,
+    STATS_WRITE, /* output ROM write */
+    STATS_SCAN, /* scan strings */
+    STATS_NSTAGES
+};
+
+#ifdef SHPN_STATS
+
+struct stats_span {
+    bool active, worker;
+    int stage;
+    int prev; /* stage of the enclosing span in this thread, restored at stats_end */
+    uint64_t wall_ns, cpu_ns;
+};
+
+/* Either may be disabled (false, NULL), in which case nothing is recorded for it */
+void stats_enable(bool stats, const char* trace_path);
+
+/**
+ * Spans of the same stage may run concurrently and their wall time is summed. A worker span only
+ * adds CPU time and allocations done on a helper thread of an already running stage, and it is
+ * ignored if the thread is already within that stage.
+ */
+void stats_begin(struct stats_span* span, enum stats_stage stage, bool worker);
+void stats_end(const struct stats_span* span);
+void stats_items(enum stats_stage stage, uint64_t n);
+
+void stats_report(FILE* fout);
+bool stats_write_trace();
+
+/* Allocations are attributed to the stage of the calling thread, see defs.h */
+void* stats_malloc(size_t sz);
+void* stats_calloc(size_t n, size_t sz);
+void* stats_realloc(void* p, size_t sz);
+char* stats_strdup(const char* s);
+
+#define STATS_BEGIN(span, stage) struct stats_span span; stats_begin(&span, stage, false)
+#define STATS_BEGIN_WORKER(span, stage) struct stats_span span; stats_begin(&span, stage, true)
+#define STATS_END(span) stats_end(&span)
+#define STATS_ITEMS(stage, n) stats_items(stage, n)
+
+#else
+
+#define STATS_BEGIN(span, stage) do {} while (0)
+#define STATS_BEGIN_WORKER(span, stage) do {} while (0)
+#define STATS_END(span) do {} while (0)
+#define STATS_ITEMS(stage, n) do {} while (0)
+
+#endif
+
+#endif
@@ -237,6 +237,58 @@ bool strtab_dec_str(const uint8_t* strtab, const uint8_t* rom_end, uint32_t idx,
     return cstatus != (size_t)-1;
 }
 
+/* Messages are written in order, so the one at the highest offset ends the strtab */
+bool strtab_rom_sz(const uint8_t* rom, size_t rom_sz, uint32_t vma, size_t* sz) {
+    if (VMA2OFFS(vma) >= rom_sz) {
+        fprintf(stderr, "Past EOF strtab vma 0x%x\n", vma);
+        return false;
+    }
+    const uint8_t* strtab = &rom[VMA2OFFS(vma)];
+    const uint8_t* rom_end = rom + rom_sz;
+    const struct strtab_header* hdr = (const struct strtab_header*)strtab;
+
+    if (!chk_hdr(hdr, rom_end) || !hdr->nentries)
+        return false;
+
+    const uint8_t* msg_offsp = &strtab[hdr->msgs_offs];
+    if ((size_t)(rom_end - msg_offsp) < MSG_OFFS_SZ * (size_t)hdr->nentries) {
+        fprintf(stderr, "Past ROM end msg_offsp\n");
+        return false;
+    }
+
+    uint32_t last_offs = 0;
+    for (size_t i = 0; i < hdr->nentries; i++) {
+        uint32_t msg_offs = 0;
+        memcpy(&msg_offs, &msg_offsp[MSG_OFFS_SZ * i], MSG_OFFS_SZ);
+        if (msg_offs > last_offs)
+            last_offs = msg_offs;
+    }
+
+    const uint8_t* msg = &strtab[hdr->msgs_offs + last_offs];
+    const struct dict_node* dict = (void*)&strtab[hdr->dict_offs];
+    if (msg >= rom_end) {
+        fprintf(stderr, "msg past rom end\n");
+        return false;
+    }
+
+    char buf[DEC_BUF_SZ_SJIS];
+    size_t len = 0;
+    uint8_t bits = *msg;
+    int nbits = 0;
+    int err = 0;
+
+    while (strtab_dec_msg(dict, &msg, &bits, &nbits, &buf[len], &len, sizeof(buf), &err, rom_end))
+        ;
+    if (err) {
+        fprintf(stderr, "strtab_dec_msg failed\n");
+        return false;
+    }
+
+    /* msg is left at the byte holding the last bit */
+    *sz = msg + 1 - strtab;
+    return true;
+}
+
 bool strtab_from_rom(const uint8_t* rom, size_t rom_sz, uint32_t vma, struct strtab_embed_ctx* ectx) {
     if (VMA2OFFS(vma) >= rom_sz) {
         fprintf(stderr, "Past EOF strtab vma 0x%x\n", vma);
@@ -321,20 +373,20 @@ bool strtab_dump(const uint8_t* rom, size_t rom_sz, uint32_t vma, uint32_t idx,
 #define DICT_SZ_MAX 500
 
 /* Intermediate dict_node format used for building a dictionary */
-static struct dict_node_inter {
+struct dict_node_inter {
     struct dict_node node;
     unsigned long freq;
     bool has_parent;
     size_t parent_idx;
-} dict [DICT_SZ_MAX];
+};
 
-static size_t cpy_pre_order(const struct dict_node_inter* root, struct dict_node_inter* dst,
-    size_t idx) {
+static size_t cpy_pre_order(const struct dict_node_inter* dict,
+    const struct dict_node_inter* root, struct dict_node_inter* dst, size_t idx) {
     dst[idx] = *root;
 
     if (!is_leaf(&root->node)) {
-        size_t lidx = cpy_pre_order(&dict[root->node.offs_l], dst, idx + 1);
-        size_t ridx = cpy_pre_order(&dict[root->node.offs_r], dst, lidx + 1);
+        size_t lidx = cpy_pre_order(dict, &dict[root->node.offs_l], dst, idx + 1);
+        size_t ridx = cpy_pre_order(dict, &dict[root->node.offs_r], dst, lidx + 1);
 
         dst[idx].node.offs_l = idx + 1;
         dst[idx].node.offs_r = lidx + 1;
@@ -356,9 +408,11 @@ static uint32_t adds32(uint32_t a, uint32_t b) {
     return c;
 }
 
-static bool make_dict(const uint8_t** strs, size_t nstrs, size_t* nentries) {
+/* dict must have room for DICT_SZ_MAX entries */
+static bool make_dict(const uint8_t** strs, size_t nstrs, struct dict_node_inter* dict,
+    size_t* nentries) {
     /* We use a temporary frequency array here to make sure the dictionary array isn't sparse */
-    static uint32_t char_freqs[UINT8_MAX + 1];
+    uint32_t char_freqs[UINT8_MAX + 1];
     memset(char_freqs, 0, sizeof(char_freqs));
 
     /* First, make leaves for each char encountered in strs */
@@ -439,7 +493,7 @@ static bool make_dict(const uint8_t** strs, size_t nstrs, size_t* nentries) {
     if (!dict_pre_order)
         return false;
 
-    cpy_pre_order(&dict[dict_nitems - 1], dict_pre_order, 0);
+    cpy_pre_order(dict, &dict[dict_nitems - 1], dict_pre_order, 0);
     memcpy(dict, dict_pre_order, sizeof(struct dict_node_inter[dict_nitems]));
 
     free(dict_pre_order);
@@ -448,14 +502,15 @@ static bool make_dict(const uint8_t** strs, size_t nstrs, size_t* nentries) {
     return true;
 }
 
-static UNUSED void dump_dict(const struct dict_node_inter* root) {
+static UNUSED void dump_dict(const struct dict_node_inter* dict,
+    const struct dict_node_inter* root) {
     // if (root->has_parent)
     //     fprintf(stderr, "0x%zx -> ", root->parent_idx);
     fprintf(stderr, "0x%lx: ", root - dict);
     if (!is_leaf(&root->node)) {
         fprintf(stderr, "0x%x, 0x%x\n", root->node.offs_l, root->node.offs_r);
-        dump_dict(&dict[root->node.offs_l]);
-        dump_dict(&dict[root->node.offs_r]);
+        dump_dict(dict, &dict[root->node.offs_l]);
+        dump_dict(dict, &dict[root->node.offs_r]);
     }
     else
         fprintf(stderr, "0x%x\n", root->node.val & UINT8_MAX);
@@ -469,7 +524,8 @@ struct char_bits {
 
 static_assert(CHAR_BIT == 8, "Where are we?");
 
-static bool bits_for_char(char c, struct char_bits* dst, size_t dict_sz) {
+static bool bits_for_char(const struct dict_node_inter* dict, char c, struct char_bits* dst,
+    size_t dict_sz) {
     bool leaf_found = false;
     size_t leaf_idx = 0;
 
@@ -515,19 +571,26 @@ bool make_strtab(const uint8_t** strs, size_t nstrs, uint8_t* dst, size_t dst_sz
         return false;
     }
 
+    struct dict_node_inter* dict = malloc(sizeof(struct dict_node_inter[DICT_SZ_MAX]));
+    if (!dict) {
+        perror("malloc");
+        return false;
+    }
+
     struct hsearch_data msgs_htab;
     memset(&msgs_htab, '\0', sizeof(msgs_htab));
     if (hcreate_r(nstrs /* worst case */, &msgs_htab) == 0) {
         perror("hcreate");
+        free(dict);
         return false;
     }
 
-    if (!make_dict(strs, nstrs, &dict_nentries)) {
+    if (!make_dict(strs, nstrs, dict, &dict_nentries)) {
         fprintf(stderr, "Failed to create dictionary\n");
         goto fail;
     }
 
-    // dump_dict(dict);
+    // dump_dict(dict, dict);
 
     if (dict_nentries * sizeof(struct dict_node) + sizeof(struct strtab_header) > dst_sz) {
         fprintf(stderr, "Out of space writing dictionary\n");
@@ -540,7 +603,7 @@ bool make_strtab(const uint8_t** strs, size_t nstrs, uint8_t* dst, size_t dst_sz
 
     for (size_t i = 0; i < nstrs; i++)
         for (const uint8_t* str = strs[i]; ; str++) {
-            if (!bits_for_char(*str, &bits_for_chars[(size_t)*str], dict_nentries)) {
+            if (!bits_for_char(dict, *str, &bits_for_chars[(size_t)*str], dict_nentries)) {
                 fprintf(stderr, "Failed to encode char 0x%x\n", *str & UINT8_MAX);
                 goto fail;
             }
@@ -551,7 +614,7 @@ bool make_strtab(const uint8_t** strs, size_t nstrs, uint8_t* dst, size_t dst_sz
 
     /* Now that we have our dict, check if header + all the entries fit */
     if (dst_sz < sizeof(struct strtab_header) + sizeof(struct dict_node) * dict_nentries)
-        return false;
+        goto fail;
 
     memcpy(dst, &(struct strtab_header){
             .dict_offs = sizeof(struct strtab_header),
@@ -648,7 +711,7 @@ bool make_strtab(const uint8_t** strs, size_t nstrs, uint8_t* dst, size_t dst_sz
                     // fprintf(stderr, "writing val=0x%x\n", val);
                     if (dst_sz < 1) {
                         fprintf(stderr, "Out of space writing bits for string at %zu\n", i);
-                        return false;
+                        goto fail;
                     }
 
                     *msg++ = val;
@@ -668,7 +731,7 @@ bool make_strtab(const uint8_t** strs, size_t nstrs, uint8_t* dst, size_t dst_sz
             val >>= 1;
             val <<= 8 - nbits % 8;
             if (dst_sz < 1)
-                return false;
+                goto fail;
             *msg++ = val;
             // fprintf(stderr, "writing (padded with %zu) val=0x%x\n", 8 - nbits % 8, val);
             dst_sz--;
@@ -681,10 +744,12 @@ bool make_strtab(const uint8_t** strs, size_t nstrs, uint8_t* dst, size_t dst_sz
 #undef MSG_OFFS_MAX
 
     hdestroy_r(&msgs_htab);
+    free(dict);
     *nwritten = dst_sz_init - dst_sz + 1;
     return true;
 fail:
     hdestroy_r(&msgs_htab);
+    free(dict);
     return false;
 }
 
@@ -709,7 +774,8 @@ static size_t next_esc(const char* str) {
     return i;
 }
 
-static const char* buf_for_esc(const char* esc, size_t* cons, size_t* prod) {
+/* hbuf receives the bytes of a \\x escape */
+static const char* buf_for_esc(const char* esc, size_t* cons, size_t* prod, char hbuf[4]) {
     size_t el = esclen(esc);
     esc += el;
     if (*esc == '\0')
@@ -728,10 +794,10 @@ static const char* buf_for_esc(const char* esc, size_t* cons, size_t* prod) {
         *prod = 1;
         return "\"";
     } else if (*esc == 'x') {
-        static char hbuf[4];
         char* end = 0;
         uint32_t val = strtoul(esc + 1, &end, 16);
         *cons = end - esc + el;
+        *prod = 0;
 
         for (size_t i = 0; i < 4; i++) {
             hbuf[i] = val & (0xffu << (8 * i));
@@ -786,7 +852,8 @@ char* mk_strtab_str(const char* u8str, iconv_t conv) {
         /* We would have converted either until escape char or end of string */
         if (*u8iter) {
             size_t cons, prod;
-            const char* escb = buf_for_esc(u8iter, &cons, &prod);
+            char hbuf[4];
+            const char* escb = buf_for_esc(u8iter, &cons, &prod, hbuf);
             if (!escb)
                 goto fail;
             if (*escb == '\n' && until_newline >= SJIS_LEN_UNTIL_NEWLINE_MAX)
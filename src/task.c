@@ -0,0 +1,263 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pool.h"
+#include "task.h"
+
+/* Each task is pushed at most once, so indices never wrap */
+struct task_deque {
+    pthread_mutex_t lock;
+    size_t items[TASK_GRAPH_SZ];
+    size_t head, tail; /* items[head..tail) are queued */
+};
+
+struct task_run {
+    struct task_graph* g;
+    struct task_deque deques[POOL_NTHREADS_MAX];
+    size_t nworkers;
+    struct timespec t0;
+
+    /* Protects the fields below, cv is signalled whenever any of them changes */
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    size_t nready; /* tasks queued in any deque */
+    size_t nleft; /* tasks not finished yet */
+    bool failed;
+};
+
+struct task_worker {
+    struct task_run* run;
+    size_t id;
+    pthread_t thread;
+};
+
+void task_graph_init(struct task_graph* g) {
+    g->ntasks = 0;
+    g->wall_ns = 0;
+}
+
+size_t task_add(struct task_graph* g, const char* name, bool (*fn)(void* arg), void* arg) {
+    assert(g->ntasks < TASK_GRAPH_SZ);
+
+    struct task* t = &g->tasks[g->ntasks];
+    t->name = name;
+    t->fn = fn;
+    t->arg = arg;
+    t->ndeps = 0;
+    t->nsuccs = 0;
+    atomic_init(&t->npending, 0);
+    t->start_ns = t->end_ns = 0;
+    t->done = false;
+
+    return g->ntasks++;
+}
+
+void task_dep(struct task_graph* g, size_t task, size_t dep) {
+    assert(task < g->ntasks && dep < task);
+
+    struct task* t = &g->tasks[task];
+    assert(t->ndeps < TASK_DEPS_SZ);
+    t->deps[t->ndeps++] = dep;
+    g->tasks[dep].succs[g->tasks[dep].nsuccs++] = task;
+}
+
+static uint64_t elapsed_ns(const struct timespec* t0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - t0->tv_sec) * 1000000000ull + now.tv_nsec - t0->tv_nsec;
+}
+
+static void deque_push(struct task_deque* dq, size_t task) {
+    pthread_mutex_lock(&dq->lock);
+    assert(dq->tail < TASK_GRAPH_SZ);
+    dq->items[dq->tail++] = task;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+/* The owner takes the most recently pushed task, whose inputs are most likely still in cache */
+static bool deque_pop(struct task_deque* dq, size_t* task) {
+    pthread_mutex_lock(&dq->lock);
+    bool ret = dq->head < dq->tail;
+    if (ret)
+        *task = dq->items[--dq->tail];
+    pthread_mutex_unlock(&dq->lock);
+    return ret;
+}
+
+static bool deque_steal(struct task_deque* dq, size_t* task) {
+    pthread_mutex_lock(&dq->lock);
+    bool ret = dq->head < dq->tail;
+    if (ret)
+        *task = dq->items[dq->head++];
+    pthread_mutex_unlock(&dq->lock);
+    return ret;
+}
+
+static bool next_task(struct task_run* run, size_t id, size_t* task) {
+    if (deque_pop(&run->deques[id], task))
+        return true;
+
+    for (size_t i = 1; i < run->nworkers; i++)
+        if (deque_steal(&run->deques[(id + i) % run->nworkers], task))
+            return true;
+
+    return false;
+}
+
+static void* task_work(void* p) {
+    const struct task_worker* w = p;
+    struct task_run* run = w->run;
+    struct task_graph* g = run->g;
+
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+        while (run->nready == 0 && run->nleft > 0 && !run->failed)
+            pthread_cond_wait(&run->cv, &run->lock);
+        bool stop = run->nleft == 0 || run->failed;
+        pthread_mutex_unlock(&run->lock);
+
+        if (stop)
+            break;
+
+        /* The task counted as ready may have been taken by another worker in the meantime */
+        size_t idx;
+        if (!next_task(run, w->id, &idx))
+            continue;
+
+        pthread_mutex_lock(&run->lock);
+        run->nready--;
+        pthread_mutex_unlock(&run->lock);
+
+        struct task* t = &g->tasks[idx];
+        t->start_ns = elapsed_ns(&run->t0);
+        bool ok = t->fn(t->arg);
+        t->end_ns = elapsed_ns(&run->t0);
+        t->done = ok;
+
+        size_t nready = 0;
+        for (size_t i = 0; ok && i < t->nsuccs; i++) {
+            struct task* succ = &g->tasks[t->succs[i]];
+            if (atomic_fetch_sub(&succ->npending, 1) == 1) {
+                deque_push(&run->deques[w->id], t->succs[i]);
+                nready++;
+            }
+        }
+
+        pthread_mutex_lock(&run->lock);
+        run->nready += nready;
+        run->nleft--;
+        run->failed |= !ok;
+        pthread_cond_broadcast(&run->cv);
+        pthread_mutex_unlock(&run->lock);
+    }
+
+    return NULL;
+}
+
+bool task_graph_run(struct task_graph* g, size_t nthreads) {
+    struct task_run run;
+    memset(&run, 0, sizeof(run));
+
+    if (nthreads == 0)
+        nthreads = pool_nthreads();
+    if (nthreads > POOL_NTHREADS_MAX)
+        nthreads = POOL_NTHREADS_MAX;
+    if (nthreads > g->ntasks)
+        nthreads = g->ntasks > 0 ? g->ntasks : 1;
+
+    run.g = g;
+    run.nworkers = nthreads;
+    run.nleft = g->ntasks;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.cv, NULL);
+    for (size_t i = 0; i < nthreads; i++)
+        pthread_mutex_init(&run.deques[i].lock, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &run.t0);
+
+    /* Spread the initially ready tasks over the workers */
+    for (size_t i = 0; i < g->ntasks; i++) {
+        struct task* t = &g->tasks[i];
+        atomic_store(&t->npending, t->ndeps);
+        t->done = false;
+        if (t->ndeps == 0)
+            deque_push(&run.deques[run.nready++ % nthreads], i);
+    }
+
+    struct task_worker workers[POOL_NTHREADS_MAX];
+    size_t nstarted = 1;
+
+    for (; nstarted < nthreads; nstarted++) {
+        workers[nstarted] = (struct task_worker){.run = &run, .id = nstarted};
+        if (pthread_create(&workers[nstarted].thread, NULL, task_work, &workers[nstarted])) {
+            fprintf(stderr, "pthread_create failed, continuing with %zu threads\n", nstarted);
+            break;
+        }
+    }
+    /* Tasks queued for workers that did not start are stolen by the rest */
+
+    workers[0] = (struct task_worker){.run = &run, .id = 0};
+    task_work(&workers[0]);
+
+    for (size_t i = 1; i < nstarted; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    g->wall_ns = elapsed_ns(&run.t0);
+
+    for (size_t i = 0; i < nthreads; i++)
+        pthread_mutex_destroy(&run.deques[i].lock);
+    pthread_cond_destroy(&run.cv);
+    pthread_mutex_destroy(&run.lock);
+
+    return !run.failed;
+}
+
+void task_graph_print_critical_path(const struct task_graph* g, FILE* fout) {
+    /* Longest path ending at each task, weighted by run time */
+    uint64_t len[TASK_GRAPH_SZ];
+    size_t pred[TASK_GRAPH_SZ];
+    size_t last = SIZE_MAX;
+
+    /* Dependencies precede their dependents, so one forward pass suffices */
+    for (size_t i = 0; i < g->ntasks; i++) {
+        const struct task* t = &g->tasks[i];
+        len[i] = 0;
+        pred[i] = SIZE_MAX;
+        if (!t->done)
+            continue;
+
+        for (size_t j = 0; j < t->ndeps; j++) {
+            if (len[t->deps[j]] > len[i]) {
+                len[i] = len[t->deps[j]];
+                pred[i] = t->deps[j];
+            }
+        }
+        len[i] += t->end_ns - t->start_ns;
+
+        if (last == SIZE_MAX || len[i] > len[last])
+            last = i;
+    }
+
+    if (last == SIZE_MAX)
+        return;
+
+    size_t path[TASK_GRAPH_SZ];
+    size_t npath = 0;
+    for (size_t i = last; i != SIZE_MAX; i = pred[i])
+        path[npath++] = i;
+
+    fprintf(fout, "Critical path %.3f ms of %.3f ms wall time:\n", len[last] / 1e6,
+        g->wall_ns / 1e6);
+    while (npath > 0) {
+        const struct task* t = &g->tasks[path[--npath]];
+        fprintf(fout, "  %-20s %9.3f ms (at %.3f ms)\n", t->name,
+            (t->end_ns - t->start_ns) / 1e6, t->start_ns / 1e6);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TASK_GRAPH_SZ 32
+#define TASK_DEPS_SZ 8
+
+/**
+ * A fixed-size graph of tasks with dependencies.
+ * Tasks may only depend on tasks added before them, so the graph is acyclic by construction.
+ */
+struct task_graph {
+    struct task {
+        const char* name;
+        bool (*fn)(void* arg);
+        void* arg;
+
+        size_t deps[TASK_DEPS_SZ];
+        size_t ndeps;
+        size_t succs[TASK_GRAPH_SZ];
+        size_t nsuccs;
+
+        atomic_size_t npending; /* deps which have not finished yet */
+        uint64_t start_ns, end_ns; /* relative to the start of task_graph_run */
+        bool done;
+    } tasks[TASK_GRAPH_SZ];
+    size_t ntasks;
+
+    uint64_t wall_ns;
+};
+
+void task_graph_init(struct task_graph* g);
+
+/* Returns the id of the added task */
+size_t task_add(struct task_graph* g, const char* name, bool (*fn)(void* arg), void* arg);
+
+/* task will not start before dep is done */
+void task_dep(struct task_graph* g, size_t task, size_t dep);
+
+/**
+ * Run all tasks on nthreads work-stealing workers (pool_nthreads() if 0), the calling thread
+ * included. A task becomes ready once its dependencies are done and is pushed to the deque of the
+ * worker which completed the last of them. Workers pop their own deque from the back and steal
+ * from the front of others. Once a task fails, no more tasks are started and false is returned.
+ */
+bool task_graph_run(struct task_graph* g, size_t nthreads);
+
+/* Print the chain of tasks with the longest total run time from the last run */
+void task_graph_print_critical_path(const struct task_graph* g, FILE* fout);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pool.h"
+#include "tm.h"
+
+#define YEN_SIGN 0xa5
+#define IDEOGRAPHIC_SPACE 0x3000
+
+#define SIG_CHUNK_SZ 256 /* strings per pool item */
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    return x ^ x >> 31;
+}
+
+/* Next code point of s, or a byte of invalid UTF-8 as is */
+static uint32_t next_cp(const char** s) {
+    const uint8_t* p = (const uint8_t*)*s;
+    uint32_t cp = *p;
+    size_t len = 1;
+
+    if (cp >= 0xc0 && cp < 0xe0 && (p[1] & 0xc0) == 0x80) {
+        cp = (cp & 0x1f) << 6 | (p[1] & 0x3f);
+        len = 2;
+    } else if (cp >= 0xe0 && cp < 0xf0 && (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80) {
+        cp = (cp & 0xf) << 12 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+        len = 3;
+    }
+
+    *s += len;
+    return cp;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t l = *(const uint32_t*)a, r = *(const uint32_t*)b;
+    return l < r ? -1 : l > r;
+}
+
+/**
+ * Write the sorted hashes of the bigrams of str to out, which holds at least strlen(str) of them,
+ * and return how many there are. A string of a single character has that as its only bigram.
+ */
+static size_t shingles_of(const char* str, uint32_t* out) {
+    uint32_t prev = UINT32_MAX;
+    size_t n = 0;
+
+    while (*str) {
+        uint32_t cp = next_cp(&str);
+
+        if (cp == ' ' || cp == IDEOGRAPHIC_SPACE)
+            continue;
+        if (cp == YEN_SIGN || cp == '\\') {
+            if (*str)
+                next_cp(&str);
+            continue;
+        }
+
+        if (prev != UINT32_MAX)
+            out[n++] = mix64((uint64_t)prev << 32 | cp);
+        prev = cp;
+    }
+
+    if (!n && prev != UINT32_MAX)
+        out[n++] = mix64((uint64_t)UINT32_MAX << 32 | prev);
+
+    qsort(out, n, sizeof(*out), cmp_u32);
+
+    size_t nuniq = 0;
+    for (size_t i = 0; i < n; i++)
+        if (!nuniq || out[i] != out[nuniq - 1])
+            out[nuniq++] = out[i];
+    return nuniq;
+}
+
+static void sig_of(const uint32_t* shingles, size_t n, uint32_t* sig) {
+    for (size_t k = 0; k < TM_NHASHES; k++)
+        sig[k] = UINT32_MAX;
+
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = 0; k < TM_NHASHES; k++) {
+            uint32_t h = mix64(shingles[i] ^ (k + 1) * 0x9e3779b97f4a7c15) >> 32;
+            if (h < sig[k])
+                sig[k] = h;
+        }
+}
+
+static uint64_t band_key(const uint32_t* sig, size_t band) {
+    uint64_t key = band;
+    for (size_t r = 0; r < TM_NROWS; r++)
+        key = mix64(key ^ sig[band * TM_NROWS + r]);
+    return key;
+}
+
+static double jaccard(const uint32_t* a, size_t na, const uint32_t* b, size_t nb) {
+    size_t inter = 0;
+
+    for (size_t i = 0, j = 0; i < na && j < nb;) {
+        if (a[i] < b[j])
+            i++;
+        else if (a[i] > b[j])
+            j++;
+        else {
+            inter++;
+            i++;
+            j++;
+        }
+    }
+    return na + nb ? (double)inter / (na + nb - inter) : 0;
+}
+
+static size_t nshingles(const struct tm_index* tm, size_t idx) {
+    return tm->shingle_offs[idx + 1] - tm->shingle_offs[idx];
+}
+
+static bool sig_chunk(size_t i, size_t tid, void* arg) {
+    struct tm_index* tm = arg;
+    size_t end = (i + 1) * SIG_CHUNK_SZ < tm->nstrs ? (i + 1) * SIG_CHUNK_SZ : tm->nstrs;
+    (void)tid;
+
+    for (size_t idx = i * SIG_CHUNK_SZ; idx < end; idx++)
+        if (tm->rep[idx] == idx)
+            sig_of(&tm->shingles[tm->shingle_offs[idx]], nshingles(tm, idx),
+                &tm->sigs[idx * TM_NHASHES]);
+    return true;
+}
+
+static int cmp_band_entry(const void* a, const void* b) {
+    const struct tm_band_entry* l = a, * r = b;
+    if (l->key != r->key)
+        return l->key < r->key ? -1 : 1;
+    return l->idx < r->idx ? -1 : l->idx > r->idx;
+}
+
+static bool same_shingles(const struct tm_index* tm, size_t a, size_t b) {
+    return nshingles(tm, a) == nshingles(tm, b) && !memcmp(&tm->shingles[tm->shingle_offs[a]],
+        &tm->shingles[tm->shingle_offs[b]], nshingles(tm, a) * sizeof(*tm->shingles));
+}
+
+/**
+ * Group the strings by their set of bigrams, which is hashed so that equal sets are adjacent
+ * after sorting. Returns the number of classes.
+ */
+static size_t make_classes(struct tm_index* tm, struct tm_band_entry* by_set, uint32_t* tail) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < tm->nstrs; i++) {
+        tm->rep[i] = tm->next[i] = TM_NONE;
+        if (!nshingles(tm, i))
+            continue;
+
+        uint64_t key = 0;
+        for (size_t j = tm->shingle_offs[i]; j < tm->shingle_offs[i + 1]; j++)
+            key = mix64(key ^ tm->shingles[j]);
+        by_set[n++] = (struct tm_band_entry){key, i};
+    }
+    qsort(by_set, n, sizeof(*by_set), cmp_band_entry);
+
+    size_t nclasses = 0;
+    for (size_t first = 0, last; first < n; first = last) {
+        for (last = first + 1; last < n && by_set[last].key == by_set[first].key; last++)
+            ;
+
+        /* Sorted by index within a run, and hashes rarely collide between different sets */
+        for (size_t i = first; i < last; i++) {
+            uint32_t idx = by_set[i].idx;
+            size_t j;
+            for (j = first; j < i && !(tm->rep[by_set[j].idx] == by_set[j].idx &&
+                same_shingles(tm, by_set[j].idx, idx)); j++)
+                ;
+
+            if (j == i) {
+                tm->rep[idx] = tail[idx] = idx;
+                tm->class_sz[idx] = 1;
+                nclasses++;
+            } else {
+                uint32_t rep = by_set[j].idx;
+                tm->rep[idx] = rep;
+                tm->next[tail[rep]] = idx;
+                tail[rep] = idx;
+                tm->class_sz[rep]++;
+            }
+        }
+    }
+    return nclasses;
+}
+
+bool tm_build(struct tm_index* tm, char* const* strs, size_t nstrs) {
+    memset(tm, 0, sizeof(*tm));
+    tm->nstrs = nstrs;
+
+    size_t cap = 0;
+    for (size_t i = 0; i < nstrs; i++)
+        cap += strs[i] ? strlen(strs[i]) : 0;
+
+    struct tm_band_entry* by_set = malloc(nstrs * sizeof(*by_set) + 1);
+    uint32_t* tail = malloc(nstrs * sizeof(*tail) + 1);
+
+    tm->shingles = malloc(cap * sizeof(*tm->shingles) + 1);
+    tm->shingle_offs = malloc((nstrs + 1) * sizeof(*tm->shingle_offs));
+    tm->rep = malloc(nstrs * sizeof(*tm->rep) + 1);
+    tm->next = malloc(nstrs * sizeof(*tm->next) + 1);
+    tm->class_sz = malloc(nstrs * sizeof(*tm->class_sz) + 1);
+    tm->sigs = malloc(nstrs * TM_NHASHES * sizeof(*tm->sigs) + 1);
+    if (!by_set || !tail || !tm->shingles || !tm->shingle_offs || !tm->rep || !tm->next ||
+        !tm->class_sz || !tm->sigs)
+        goto fail;
+
+    size_t n = 0;
+    for (size_t i = 0; i < nstrs; i++) {
+        tm->shingle_offs[i] = n;
+        if (strs[i])
+            n += shingles_of(strs[i], &tm->shingles[n]);
+    }
+    tm->shingle_offs[nstrs] = n;
+
+    size_t nclasses = make_classes(tm, by_set, tail);
+
+    if (!pool_for((nstrs + SIG_CHUNK_SZ - 1) / SIG_CHUNK_SZ, 0, sig_chunk, tm))
+        goto fail;
+
+    /* Strings without bigrams are similar to nothing */
+    tm->nband_entries = nclasses;
+    for (size_t b = 0; b < TM_NBANDS; b++) {
+        tm->bands[b] = malloc(nclasses * sizeof(*tm->bands[b]) + 1);
+        if (!tm->bands[b])
+            goto fail;
+
+        size_t e = 0;
+        for (size_t i = 0; i < nstrs; i++)
+            if (tm->rep[i] == i)
+                tm->bands[b][e++] = (struct tm_band_entry){
+                    band_key(&tm->sigs[i * TM_NHASHES], b), i};
+        qsort(tm->bands[b], nclasses, sizeof(*tm->bands[b]), cmp_band_entry);
+    }
+
+    free(by_set);
+    free(tail);
+    return true;
+
+fail:
+    perror("malloc");
+    free(by_set);
+    free(tail);
+    tm_free(tm);
+    return false;
+}
+
+void tm_free(struct tm_index* tm) {
+    free(tm->sigs);
+    free(tm->shingles);
+    free(tm->shingle_offs);
+    free(tm->rep);
+    free(tm->next);
+    free(tm->class_sz);
+    for (size_t b = 0; b < TM_NBANDS; b++)
+        free(tm->bands[b]);
+    memset(tm, 0, sizeof(*tm));
+}
+
+/* Index of the first entry of band with at least key */
+static size_t band_lower_bound(const struct tm_index* tm, size_t band, uint64_t key) {
+    size_t l = 0, r = tm->nband_entries;
+
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        if (tm->bands[band][m].key < key)
+            l = m + 1;
+        else
+            r = m;
+    }
+    return l;
+}
+
+static int cmp_match(const void* a, const void* b) {
+    const struct tm_match* l = a, * r = b;
+    if (l->sim != r->sim)
+        return l->sim > r->sim ? -1 : 1;
+    return l->idx < r->idx ? -1 : l->idx > r->idx;
+}
+
+ptrdiff_t tm_query(const struct tm_index* tm, const char* str, size_t skip, struct tm_match* matches,
+        size_t nmatches) {
+    uint32_t* shingles = malloc(strlen(str) * sizeof(*shingles) + 1);
+    uint32_t* cands = NULL;
+    struct tm_match* scored = NULL;
+    ptrdiff_t ret = -1;
+
+    if (!shingles)
+        goto done;
+
+    size_t n = shingles_of(str, shingles);
+    if (!n) {
+        ret = 0;
+        goto done;
+    }
+
+    uint32_t sig[TM_NHASHES];
+    sig_of(shingles, n, sig);
+
+    /* Gather the strings that share a band */
+    size_t ncands = 0, cap = 64;
+    cands = malloc(cap * sizeof(*cands));
+    if (!cands)
+        goto done;
+
+    for (size_t b = 0; b < TM_NBANDS; b++) {
+        uint64_t key = band_key(sig, b);
+        for (size_t e = band_lower_bound(tm, b, key);
+                e < tm->nband_entries && tm->bands[b][e].key == key; e++) {
+            if (ncands == cap) {
+                uint32_t* tmp = realloc(cands, 2 * cap * sizeof(*cands));
+                if (!tmp)
+                    goto done;
+                cands = tmp;
+                cap *= 2;
+            }
+            cands[ncands++] = tm->bands[b][e].idx;
+        }
+    }
+    qsort(cands, ncands, sizeof(*cands), cmp_u32);
+
+    scored = malloc(ncands * sizeof(*scored) + 1);
+    if (!scored)
+        goto done;
+
+    size_t nscored = 0;
+    for (size_t i = 0; i < ncands; i++) {
+        if (i && cands[i] == cands[i - 1])
+            continue;
+
+        /* Stand for the class by a string other than skip */
+        uint32_t idx = cands[i];
+        uint32_t nsame = tm->class_sz[idx] - 1;
+        if (skip < tm->nstrs && tm->rep[skip] == idx) {
+            if (!nsame)
+                continue;
+            idx = idx == skip ? tm->next[idx] : idx;
+            nsame--;
+        }
+
+        scored[nscored++] = (struct tm_match){idx, nsame, jaccard(shingles, n,
+            &tm->shingles[tm->shingle_offs[idx]], nshingles(tm, idx))};
+    }
+    qsort(scored, nscored, sizeof(*scored), cmp_match);
+
+    ret = nscored < nmatches ? nscored : nmatches;
+    memcpy(matches, scored, ret * sizeof(*matches));
+
+done:
+    if (ret < 0)
+        perror("malloc");
+    free(shingles);
+    free(cands);
+    free(scored);
+    return ret;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t l = *(const uint64_t*)a, r = *(const uint64_t*)b;
+    return l < r ? -1 : l > r;
+}
+
+static int cmp_pair(const void* a, const void* b) {
+    const struct tm_pair* l = a, * r = b;
+    if (l->sim != r->sim)
+        return l->sim > r->sim ? -1 : 1;
+    if (l->a != r->a)
+        return l->a < r->a ? -1 : 1;
+    return l->b < r->b ? -1 : l->b > r->b;
+}
+
+struct tm_pair* tm_dups(const struct tm_index* tm, double sim_min, size_t* npairs) {
+    uint64_t* cands = NULL;
+    struct tm_pair* pairs = NULL;
+    size_t ncands = 0, cap = 1024;
+
+    cands = malloc(cap * sizeof(*cands));
+    if (!cands)
+        goto fail;
+
+    /* Every pair of representatives within a group of equal keys of a band is a candidate */
+    for (size_t b = 0; b < TM_NBANDS; b++) {
+        const struct tm_band_entry* band = tm->bands[b];
+
+        for (size_t first = 0, last; first < tm->nband_entries; first = last) {
+            for (last = first + 1; last < tm->nband_entries && band[last].key == band[first].key;
+                last++)
+                ;
+
+            for (size_t i = first; i < last; i++)
+                for (size_t j = i + 1; j < last; j++) {
+                    if (ncands == cap) {
+                        uint64_t* tmp = realloc(cands, 2 * cap * sizeof(*cands));
+                        if (!tmp)
+                            goto fail;
+                        cands = tmp;
+                        cap *= 2;
+                    }
+                    /* Entries of a group are sorted by idx */
+                    cands[ncands++] = (uint64_t)band[i].idx << 32 | band[j].idx;
+                }
+        }
+    }
+    qsort(cands, ncands, sizeof(*cands), cmp_u64);
+
+    size_t nsame = 0;
+    for (size_t i = 0; i < tm->nstrs; i++)
+        nsame += tm->rep[i] != TM_NONE && tm->rep[i] != i;
+
+    pairs = malloc((ncands + nsame) * sizeof(*pairs) + 1);
+    if (!pairs)
+        goto fail;
+
+    size_t n = 0;
+    for (size_t i = 0; i < tm->nstrs; i++)
+        if (tm->rep[i] != TM_NONE && tm->rep[i] != i)
+            pairs[n++] = (struct tm_pair){tm->rep[i], i, 1};
+
+    for (size_t i = 0; i < ncands; i++) {
+        if (i && cands[i] == cands[i - 1])
+            continue;
+
+        uint32_t a = cands[i] >> 32, b = cands[i];
+        double sim = jaccard(&tm->shingles[tm->shingle_offs[a]], nshingles(tm, a),
+            &tm->shingles[tm->shingle_offs[b]], nshingles(tm, b));
+        if (sim >= sim_min)
+            pairs[n++] = (struct tm_pair){a, b, sim};
+    }
+    qsort(pairs, n, sizeof(*pairs), cmp_pair);
+
+    free(cands);
+    *npairs = n;
+    return pairs;
+
+fail:
+    perror("malloc");
+    free(cands);
+    free(pairs);
+    return NULL;
+}
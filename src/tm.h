@@ -0,0 +1,74 @@
+#ifndef TM_H
+#define TM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Translation memory: finds the strings of a strtab that are similar to a given one, by the
+ * Jaccard similarity of their sets of character bigrams. Each string gets a MinHash signature of
+ * TM_NHASHES hashes, and strings whose signatures agree on the TM_NROWS hashes of some band are
+ * candidates (locality-sensitive hashing), so that only those are compared. With 16 bands of 4
+ * rows, strings of similarity 0.5 are found half of the time, and of 0.8 almost always.
+ *
+ * Escapes (like ¥n) and spaces do not count as characters. Strings with equal bigram sets form a
+ * class, represented by its first string, and only representatives are hashed into bands.
+ */
+
+#define TM_NONE UINT32_MAX
+
+#define TM_NBANDS 16
+#define TM_NROWS 4
+#define TM_NHASHES (TM_NBANDS * TM_NROWS)
+
+struct tm_band_entry {
+    uint64_t key; /* hash of the rows of a band of a signature */
+    uint32_t idx;
+};
+
+struct tm_index {
+    size_t nstrs;
+    uint32_t* sigs; /* TM_NHASHES for each string */
+    /* Sorted bigram hashes, those of idx span [shingle_offs[idx], shingle_offs[idx + 1]) */
+    uint32_t* shingles;
+    size_t* shingle_offs;
+    uint32_t* rep; /* representative of the class of idx, TM_NONE if it has no bigrams */
+    uint32_t* next; /* next string of the class of idx, TM_NONE for the last one */
+    uint32_t* class_sz; /* strings in the class of a representative */
+    /* For each band, entries of the representatives sorted by key */
+    struct tm_band_entry* bands[TM_NBANDS];
+    size_t nband_entries;
+};
+
+struct tm_match {
+    uint32_t idx;
+    uint32_t nsame; /* other strings identical to idx, which are not listed */
+    double sim;
+};
+
+struct tm_pair {
+    uint32_t a, b; /* a < b */
+    double sim;
+};
+
+/* Index strs[0..nstrs), of which NULL ones are missing */
+bool tm_build(struct tm_index* tm, char* const* strs, size_t nstrs);
+void tm_free(struct tm_index* tm);
+
+/**
+ * Find up to nmatches strings most similar to str, by descending similarity, leaving out the
+ * string at skip (which may be out of range). Returns the number of matches, or -1 on failure.
+ */
+ptrdiff_t tm_query(const struct tm_index* tm, const char* str, size_t skip, struct tm_match* matches,
+    size_t nmatches);
+
+/**
+ * Find all pairs of strings of similarity at least sim_min, sorted by descending similarity. Each
+ * string is paired with the representative of its class, and only representatives are paired
+ * across classes, so that the output stays linear in the number of identical strings.
+ * Returns NULL on allocation failure, otherwise the caller frees the result.
+ */
+struct tm_pair* tm_dups(const struct tm_index* tm, double sim_min, size_t* npairs);
+
+#endif
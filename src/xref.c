@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "defs.h"
+#include "scan.h"
+#include "xref.h"
+
+bool xref_build(struct xref* x, const uint8_t* rom, size_t rom_sz) {
+    struct scan_ptr* ptrs = scan_ptrs(rom, rom_sz, OFFS2VMA(0), OFFS2VMA(rom_sz), &x->nptrs);
+    if (!ptrs)
+        return false;
+
+    x->ptrs = ptrs;
+    x->buf = ptrs;
+    x->map_sz = 0;
+    return true;
+}
+
+bool xref_load(struct xref* x, const char* path, size_t rom_sz, uint32_t rom_crc) {
+    struct side_file_hdr want = {XREF_MAGIC, XREF_VERSION, rom_sz, rom_crc};
+    size_t sz;
+    const struct xref_hdr* hdr = side_file_map(path, &want, sizeof(struct xref_hdr), &sz);
+    if (!hdr)
+        return false;
+
+    if (sz != sizeof(*hdr) + sizeof(struct scan_ptr[hdr->nptrs])) {
+        side_file_free((void*)hdr, sz);
+        return false;
+    }
+
+    x->ptrs = (const void*)(hdr + 1);
+    x->nptrs = hdr->nptrs;
+    x->buf = (void*)hdr;
+    x->map_sz = sz;
+    return true;
+}
+
+bool xref_save(const struct xref* x, const char* path, size_t rom_sz, uint32_t rom_crc) {
+    if (x->nptrs > UINT32_MAX || rom_sz > UINT32_MAX)
+        return false;
+
+    struct xref_hdr hdr = {{XREF_MAGIC, XREF_VERSION, rom_sz, rom_crc}, x->nptrs};
+    struct side_file_part parts[] = {
+        {&hdr, sizeof(hdr)},
+        {x->ptrs, x->nptrs * sizeof(*x->ptrs)}
+    };
+    return side_file_save(path, parts, sizeof(parts) / sizeof(*parts));
+}
+
+void xref_free(struct xref* x) {
+    side_file_free(x->buf, x->map_sz);
+    x->buf = NULL;
+    x->ptrs = NULL;
+    x->nptrs = 0;
+}
+
+/* Index of the first pointer to at least target */
+static size_t xref_lower_bound(const struct xref* x, uint32_t target) {
+    size_t l = 0, r = x->nptrs;
+
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        if (x->ptrs[m].target < target)
+            l = m + 1;
+        else
+            r = m;
+    }
+    return l;
+}
+
+const struct scan_ptr* xref_find(const struct xref* x, uint32_t lo, uint32_t hi, size_t* n) {
+    size_t first = xref_lower_bound(x, lo);
+
+    *n = hi > lo ? xref_lower_bound(x, hi) - first : 0;
+    return &x->ptrs[first];
+}
@@ -0,0 +1,48 @@
+#ifndef XREF_H
+#define XREF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scan.h"
+#include "side_file.h"
+
+/**
+ * Index of the aligned words of the ROM that point into it, sorted by target so that pointers to
+ * an address or into a range are found by binary search. It may be saved next to the ROM:
+ *
+ *   struct xref_hdr
+ *   struct scan_ptr ptrs[nptrs]
+ *
+ * and is only loaded back for a ROM of the same size and CRC.
+ */
+
+#define XREF_MAGIC 0x52585053 /* SPXR */
+#define XREF_VERSION 1
+#define XREF_SUFFIX ".xref"
+
+struct xref_hdr {
+    struct side_file_hdr side; /* of the ROM */
+    uint32_t nptrs;
+};
+
+struct xref {
+    const struct scan_ptr* ptrs;
+    size_t nptrs;
+
+    /* Either allocated by xref_build or mapped by xref_load */
+    void* buf;
+    size_t map_sz;
+};
+
+bool xref_build(struct xref* x, const uint8_t* rom, size_t rom_sz);
+/* Fails quietly if the file does not exist or is for another ROM */
+bool xref_load(struct xref* x, const char* path, size_t rom_sz, uint32_t rom_crc);
+bool xref_save(const struct xref* x, const char* path, size_t rom_sz, uint32_t rom_crc);
+void xref_free(struct xref* x);
+
+/* Pointers to [lo, hi), sorted by target and then by their own address */
+const struct scan_ptr* xref_find(const struct xref* x, uint32_t lo, uint32_t hi, size_t* n);
+
+#endif
@@ -7,12 +7,23 @@
 #include "glyph.h"
 
 static void test_break(char* str, size_t* broken_at) {
+    struct sjis_layout* layout = sjis_layout_new(str);
+    assert(layout);
+
+    size_t offs = 0, nframes = 1;
     while (*broken_at) {
-        size_t at = sjis_break_frame_at(str);
+        size_t at = sjis_break_frame_at(&str[offs]);
         assert(at == *broken_at);
+
+        /* The layout has every break at once */
+        assert(nframes < layout->nframes && layout->frame_breaks[nframes - 1] == offs + at);
+        nframes++;
+
         broken_at++;
-        str = &str[at + 1];
+        offs += at + 1;
     }
+    assert(layout->nframes == nframes);
+    sjis_layout_free(layout);
 }
 
 int main() {
@@ -34,8 +45,8 @@ int main() {
             (size_t[]){125, 0}
         },
         {
-            "Longer\nthan\nsix\nrows\nof\ntext\nhere",
-            (size_t[]){28, 0}
+            "Longer\nthan\nseven\nrows\nof\ntext\nright\nhere",
+            (size_t[]){36, 0}
         },
         {
             "AAAAAAAAAAAAAAAAAAAAA\nAAAAAAAAAAAAAAAAAAAAA\nAAAAAAAAAAAAAAAAAAAAA\n"
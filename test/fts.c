@@ -0,0 +1,111 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fts.h"
+#include "test/rng.h"
+
+#define NSTRS 2000
+
+static char* strs[NSTRS];
+
+static bool contains_folded(const char* s, const char* query) {
+    size_t len = strlen(query);
+
+    for (; *s; s++) {
+        size_t i;
+        for (i = 0; i < len && s[i]; i++) {
+            char a = s[i] >= 'A' && s[i] <= 'Z' ? s[i] - 'A' + 'a' : s[i];
+            char b = query[i] >= 'A' && query[i] <= 'Z' ? query[i] - 'A' + 'a' : query[i];
+            if (a != b)
+                break;
+        }
+        if (i == len)
+            return true;
+    }
+    return false;
+}
+
+/* Compare to a linear scan */
+static void check_find(const struct fts* f, const char* query) {
+    size_t n, nexp = 0;
+    uint16_t* found = fts_find(f, query, &n);
+    assert(found);
+
+    for (size_t i = 0; i < NSTRS; i++) {
+        if (!strs[i] || !contains_folded(strs[i], query))
+            continue;
+        assert(nexp < n && found[nexp] == i);
+        nexp++;
+    }
+    assert(n == nexp);
+    free(found);
+}
+
+static void check(const struct fts* f) {
+    for (size_t i = 0; i < NSTRS; i++)
+        assert(!strcmp(fts_str(f, i), strs[i] ? strs[i] : ""));
+    assert(!strcmp(fts_str(f, NSTRS), ""));
+
+    const char* queries[] = {"Cheryl", "cHERYL", "ryl", "1", "12", "alone", "aaaa", "¥n",
+        "シェリル", "の", "Harry and Cheryl", "zzz", "Cheryl 1"};
+    for (size_t i = 0; i < sizeof(queries) / sizeof(*queries); i++)
+        check_find(f, queries[i]);
+
+    for (size_t i = 0; i < NSTRS; i += 97)
+        if (strs[i])
+            check_find(f, strs[i]);
+}
+
+int main() {
+    const char* words[] = {"Cheryl", "Harry", "alone", "and", "aaaaa", "¥n", "シェリル", "の",
+        "cheryl", "HARRY"};
+    uint32_t rng = 1;
+
+    for (size_t i = 1; i < NSTRS; i++) {
+        /* Some indices are missing, as in strtab files */
+        if (i % 13 == 0)
+            continue;
+
+        char buf[256];
+        size_t len = snprintf(buf, sizeof(buf), "%zu", i);
+        for (size_t w = 0; w < 4; w++) {
+            len += snprintf(&buf[len], sizeof(buf) - len, " %s",
+                words[rng_below(&rng, sizeof(words) / sizeof(*words))]);
+        }
+        strs[i] = malloc(len + 1);
+        assert(strs[i]);
+        memcpy(strs[i], buf, len + 1);
+    }
+
+    struct fts f;
+    assert(fts_build(&f, strs, NSTRS));
+    check(&f);
+
+    /* Saved and loaded back for the same strtab address, see test/side_file.c for the rest */
+    const char* path = "build/test/fts" FTS_SUFFIX;
+
+    assert(fts_save(&f, path, 0x1000, 0x1234, 0x8800000));
+    fts_free(&f);
+
+    assert(!fts_load(&f, path, 0x1000, 0x1234, 0));
+    assert(fts_load(&f, path, 0x1000, 0x1234, 0x8800000));
+    check(&f);
+    fts_free(&f);
+
+    /* Nothing to index */
+    assert(fts_build(&f, strs, 1));
+    size_t n;
+    uint16_t* found = fts_find(&f, "Cheryl", &n);
+    assert(found && n == 0);
+    free(found);
+    fts_free(&f);
+
+    remove(path);
+    for (size_t i = 0; i < NSTRS; i++)
+        free(strs[i]);
+    return 0;
+}
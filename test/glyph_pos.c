@@ -0,0 +1,83 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agb/config.h"
+#include "agb/glyph_layout.h"
+#include "agb/glyph_pos.h"
+#include "glyph.h"
+
+#define TABLE_SZ 0x1000
+
+/* Table positions must be those the renderer would work out itself */
+static void check_pos(const struct glyph_pos_hdr* hdr, const char* sjis) {
+    size_t npos = 0;
+    const struct glyph_pos* pos = glyph_pos_find(hdr, sjis, &npos);
+    assert(pos);
+
+    struct glyph_layout l;
+    size_t n = 0;
+    glyph_layout_init(&l, sjis, 0, 0);
+
+    for (enum glyph_layout_tok tok; (tok = glyph_layout_next(&l)) != GLYPH_LAYOUT_END;) {
+        if (tok == GLYPH_LAYOUT_WAIT)
+            continue;
+        if (n > RENDER_NCHARS_MAX)
+            break;
+
+        glyph_layout_place(&l);
+        assert(n < npos);
+        assert(pos[n].hpos == l.hpos);
+        assert(pos[n].row == l.row);
+        n++;
+    }
+    assert(n == npos);
+}
+
+int main() {
+    /* "glbvs" and "yacxa" share a hash */
+    char* strs[] = {
+        "", "Hello, world!", "Two\nlines", NULL, "W2Wait \"quoted\"", "Hello, world!",
+        "glbvs", "yacxa", "\x84\x70\x84\x71 \x84\x72"
+    };
+    size_t nstrs = sizeof(strs) / sizeof(*strs);
+
+    size_t len0, len1;
+    assert(glyph_pos_hash("glbvs", &len0) == glyph_pos_hash("yacxa", &len1) && len0 == len1);
+
+    uint8_t* table = malloc(TABLE_SZ);
+    assert(table);
+
+    /* No table */
+    size_t npos;
+    memset(table, '\0', TABLE_SZ);
+    assert(!glyph_pos_find((void*)table, "Hello, world!", &npos));
+
+    size_t written = 0, nstored = 0;
+    assert(glyph_pos_build(strs, nstrs, table, TABLE_SZ, &written, &nstored));
+    assert(written <= TABLE_SZ);
+    assert(nstored == 4);
+
+    const struct glyph_pos_hdr* hdr = (void*)table;
+    assert(hdr->magic == GLYPH_POS_MAGIC);
+
+    /* The strtab decoder replaces \n with \r */
+    check_pos(hdr, "Hello, world!");
+    check_pos(hdr, "Two\rlines");
+    check_pos(hdr, "W2Wait \"quoted\"");
+    check_pos(hdr, "\x84\x70\x84\x71 \x84\x72");
+
+    assert(!glyph_pos_find(hdr, "Two\nlines", &npos));
+    assert(!glyph_pos_find(hdr, "glbvs", &npos));
+    assert(!glyph_pos_find(hdr, "yacxa", &npos));
+    assert(!glyph_pos_find(hdr, "Not embedded", &npos));
+
+    /* Too small */
+    assert(!glyph_pos_build(strs, nstrs, table, written - 1, &written, &nstored));
+
+    free(table);
+    return 0;
+}
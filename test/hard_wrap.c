@@ -1,5 +1,6 @@
 #undef NDEBUG
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 #include "agb/config.h"
 #include "agb/glyph_margins.h"
 #include "glyph.h"
+#include "test/rng.h"
 
 static void test_wrap(char* str, char* wrapped) {
     char* cpy = strdup(str);
@@ -14,6 +16,11 @@ static void test_wrap(char* str, char* wrapped) {
     hard_wrap_sjis(cpy);
     // fprintf(stderr, "%s\n", cpy);
     assert(!strcmp(cpy, wrapped));
+
+    /* Text that fits in a frame is wrapped the same way */
+    strcpy(cpy, str);
+    fit_wrap_sjis(cpy);
+    assert(!strcmp(cpy, wrapped));
     free(cpy);
 }
 
@@ -23,6 +30,42 @@ static char long_line_cyr[] = {0x84, 0x51, 0x84, 0x70, 0x84, 0x71, 0x84, 0x80, 0
     0x74, 0x84, 0x80, 0x84, 0x82, 0x84, 0x80, 0x84, 0x73, 0x84, 0x70, 0x2E, 0x20, 0x84, 0x4F, 0x84, 0x7E, 0x84, 0x70, 0x20, 0x84, 0x74, 0x84, 0x80, 0x84, 0x7C, 0x84, 0x73, 0x84, 0x80, 0x20, 0x84, 0x79, 0x20, 0x84, 0x83, 0x0A, 0x84, 0x7E, 0x84, 0x75, 0x84, 0x84, 0x84, 0x75, 0x84, 0x82, 0x84, 0x81, 0x84, 0x75, 0x84,
     0x7E, 0x84, 0x79, 0x84, 0x75, 0x84, 0x7D, 0x20, 0x84, 0x77, 0x84, 0x74, 0x84, 0x70, 0x84, 0x7C, 0x84, 0x70, 0x20, 0x84, 0x8F, 0x84, 0x84, 0x84, 0x80, 0x84, 0x7A, 0x0A, 0x84, 0x81, 0x84, 0x80, 0x84, 0x75, 0x84, 0x78, 0x84, 0x74, 0x84, 0x7B, 0x84, 0x79, 0x2E, 0x00 };
 
+#define NFUZZ 10000
+#define FUZZ_LEN_MAX 400
+
+/* Random mixes of words, spaces, newlines, wait commands and stray bytes must terminate */
+static void test_fuzz() {
+    static const char* toks[] = {
+        " ", "\n", "W2", "W", "2", "a", "M", ".", "\"", ",", "i", "hello", "\x84\x70", "\x84\x91",
+        "\x82\xa0", "\x81\x40", "\x88", "\xff"
+    };
+    static char str[FUZZ_LEN_MAX + sizeof("hello")], wrapped[sizeof(str)];
+    uint32_t rng = 1;
+
+    for (size_t i = 0; i < NFUZZ; i++) {
+        size_t len = 0;
+
+        for (size_t len_max = rng_below(&rng, FUZZ_LEN_MAX); len < len_max;) {
+            const char* tok = toks[rng_below(&rng, sizeof(toks) / sizeof(*toks))];
+            memcpy(&str[len], tok, strlen(tok));
+            len += strlen(tok);
+        }
+        str[len] = '\0';
+
+        memcpy(wrapped, str, len + 1);
+        hard_wrap_sjis(wrapped);
+
+        /* Only spaces may become newlines */
+        for (size_t j = 0; j <= len; j++)
+            assert(wrapped[j] == str[j] || (str[j] == ' ' && wrapped[j] == '\n'));
+
+        memcpy(wrapped, str, len + 1);
+        fit_wrap_sjis(wrapped);
+        for (size_t j = 0; j <= len; j++)
+            assert(wrapped[j] == str[j] || (str[j] == ' ' && wrapped[j] == '\n'));
+    }
+}
+
 int main() {
     static struct {
         char* str, * wrapped;
@@ -55,4 +98,6 @@ int main() {
 
     for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++)
         test_wrap(cases[i].str, cases[i].wrapped);
+
+    test_fuzz();
 }
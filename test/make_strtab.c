@@ -16,6 +16,10 @@ static void make_and_cmp(const char** strs, size_t nstrs) {
         make_strtab((void*)strs, nstrs, strtab, sizeof(strtab), &nwritten) &&
         "Failed to make strtab");
 
+    /* The strtab ends with its last message */
+    size_t sz;
+    assert(strtab_rom_sz(strtab, sizeof(strtab), OFFS2VMA(0), &sz) && sz == nwritten - 1);
+
     // strtab_dump(strtab, ROM_BASE, 0, false, stderr);
 
     static char dec_buf[10000];
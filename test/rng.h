@@ -0,0 +1,19 @@
+#ifndef TEST_RNG_H
+#define TEST_RNG_H
+
+#include <stdint.h>
+
+/* xorshift32 for the tests and benches, so that their inputs are the same on every host */
+static inline uint32_t rng_next(uint32_t* rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    return *rng;
+}
+
+/* In [0, n) */
+static inline uint32_t rng_below(uint32_t* rng, uint32_t n) {
+    return rng_next(rng) % n;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "scan.h"
+#include "strtab.h"
+
+#define ROM_SZ 0x10000
+#define STRTAB_MENU_OFFS 0xc000
+
+static uint8_t rom[ROM_SZ];
+
+static void put_str(size_t offs, const char* s) {
+    memcpy(&rom[offs], s, strlen(s) + 1);
+}
+
+static void put_ptr(size_t offs, uint32_t vma) {
+    memcpy(&rom[offs], &vma, sizeof(vma));
+}
+
+int main() {
+    memset(rom, 0xff, sizeof(rom));
+
+    /* はい, pointed to twice */
+    put_str(0x1000, "\x82\xcd\x82\xa2");
+    put_ptr(0x8000, OFFS2VMA(0x1000));
+    put_ptr(0x9000, OFFS2VMA(0x1000));
+
+    /* A line break and ASCII, with a pointer to its second line */
+    put_str(0x1010, "SAVE \x83\x47\x83\x89\x81\x5b\n\x82\xa0");
+    put_ptr(0x8004, OFFS2VMA(0x1010));
+    put_ptr(0x8008, OFFS2VMA(0x101c));
+
+    /* Not word-aligned */
+    put_str(0x1031, "\x82\xa0");
+    put_ptr(0x800c, OFFS2VMA(0x1031));
+
+    /* Nothing points here */
+    put_str(0x2000, "\x82\xa0\x82\xa2");
+
+    /* Not SJIS, or with no full-width characters */
+    put_str(0x3000, "\x82\x10");
+    put_ptr(0x8010, OFFS2VMA(0x3000));
+    put_str(0x3010, "ascii");
+    put_ptr(0x8014, OFFS2VMA(0x3010));
+
+    /* Unaligned words are not pointers */
+    put_str(0x4000, "\x82\xa4");
+    put_ptr(0x8019, OFFS2VMA(0x4000));
+
+    /* Past the end of the ROM */
+    put_ptr(0x801c, OFFS2VMA(ROM_SZ));
+
+    size_t nptrs;
+    struct scan_ptr* ptrs = scan_ptrs(rom, ROM_SZ, OFFS2VMA(0), OFFS2VMA(ROM_SZ), &nptrs);
+    assert(ptrs);
+    assert(nptrs == 7);
+    for (size_t i = 1; i < nptrs; i++)
+        assert(ptrs[i - 1].target < ptrs[i].target ||
+            (ptrs[i - 1].target == ptrs[i].target && ptrs[i - 1].vma < ptrs[i].vma));
+    assert(ptrs[0].target == OFFS2VMA(0x1000) && ptrs[0].vma == OFFS2VMA(0x8000));
+    assert(ptrs[1].target == OFFS2VMA(0x1000) && ptrs[1].vma == OFFS2VMA(0x9000));
+    free(ptrs);
+
+    size_t nstrs;
+    struct scan_str* strs = scan_strs(rom, ROM_SZ, &nstrs);
+    assert(strs);
+    assert(nstrs == 3);
+
+    assert(strs[0].vma == OFFS2VMA(0x1000) && strs[0].len == 4 && strs[0].nptrs == 2);
+    assert(strs[1].vma == OFFS2VMA(0x1010) && strs[1].len == 14 && strs[1].nptrs == 1);
+    assert(strs[2].vma == OFFS2VMA(0x101c) && strs[2].len == 2 && strs[2].nptrs == 1);
+    free(strs);
+
+    /* Entries of agb/static_strings.c */
+    FILE* f = tmpfile();
+    assert(f);
+    assert(scan_strs_dump(rom, ROM_SZ, 0, f));
+    rewind(f);
+
+    char line[256];
+    assert(fgets(line, sizeof(line), f));
+    assert(!strncmp(line, "    {0x8001000, 0}, /* ", strlen("    {0x8001000, 0}, /* ")));
+    assert(fgets(line, sizeof(line), f));
+    assert(strstr(line, "\\n"));
+    assert(fgets(line, sizeof(line), f));
+    assert(!fgets(line, sizeof(line), f));
+    fclose(f);
+
+#ifdef HAS_ICONV
+    /* Strings of the menu strtab get its indices */
+    const char* menu[] = {"", "\x82\xa0", "SAVE \x83\x47\x83\x89\x81\x5b\n\x82\xa0",
+        "\x82\xcd\x82\xa2"};
+    size_t nwritten;
+    assert(make_strtab((void*)menu, sizeof(menu) / sizeof(*menu), &rom[STRTAB_MENU_OFFS],
+        ROM_SZ - STRTAB_MENU_OFFS, &nwritten));
+
+    f = tmpfile();
+    assert(f);
+    assert(scan_strs_dump(rom, ROM_SZ, OFFS2VMA(STRTAB_MENU_OFFS), f));
+    rewind(f);
+
+    assert(fgets(line, sizeof(line), f));
+    assert(!strncmp(line, "    {0x8001000, 3}, /* ", strlen("    {0x8001000, 3}, /* ")));
+    assert(fgets(line, sizeof(line), f));
+    assert(!strncmp(line, "    {0x8001010, 2}, /* ", strlen("    {0x8001010, 2}, /* ")));
+    assert(fgets(line, sizeof(line), f));
+    assert(!strncmp(line, "    {0x800101C, 1}, /* ", strlen("    {0x800101C, 1}, /* ")));
+    fclose(f);
+#endif
+
+    return 0;
+}
@@ -104,6 +104,7 @@ void test_as(struct script_parse_ctx* pctx) {
     //     fprintf(stderr, "%02x", rom[i]);
     // fprintf(stderr, "\n");
 
+    script_parse_ctx_free(pctx);
     strtab_embed_ctx_free(ectx_script);
     strtab_embed_ctx_free(ectx_menu);
     free(rom);
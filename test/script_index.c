@@ -0,0 +1,124 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "script_disass.h"
+#include "script_index.h"
+
+#define ROM_SZ 0x400000
+#define NGROUPS 16
+
+enum {OP_JUMP = 1, OP_SHOW_TEXT = 0xc, OP_CHOICE = 0x11, OP_STOP = 0x63};
+
+static uint8_t* rom;
+static uint16_t groups[NGROUPS];
+
+static uint8_t* emit_cmd(uint8_t* p, unsigned op, const uint16_t* args, unsigned nargs) {
+    union script_cmd cmd = {.op = op, .arg = nargs};
+    memcpy(p, &cmd, sizeof(cmd));
+    memcpy(p + sizeof(cmd), args, nargs * sizeof(*args));
+    return p + sizeof(cmd) + nargs * sizeof(*args);
+}
+
+/**
+ * Each group shows a string and offers a choice of two menu strings. Every fourth one jumps back
+ * to the group at half its index.
+ */
+static void make_script(uint8_t* hdr) {
+    uint8_t* start = hdr + sizeof(struct script_hdr);
+    uint8_t* p = start;
+
+    for (uint16_t i = 0; i < NGROUPS; i++) {
+        groups[i] = p - start;
+        p = emit_cmd(p, OP_SHOW_TEXT, (uint16_t[]){i}, 1);
+        p = emit_cmd(p, OP_CHOICE, (uint16_t[]){i % 3, 100}, 2);
+
+        if (i % 4 == 3)
+            p = emit_cmd(p, OP_JUMP, (uint16_t[]){groups[i / 2]}, 1);
+    }
+    p = emit_cmd(p, OP_STOP, NULL, 0);
+
+    struct script_hdr h = {.branch_info_offs = p - start, .branch_info_sz = 1, .bytes_to_end = 1};
+    *p++ = 0;
+    *p++ = 0;
+    memcpy(hdr, &h, sizeof(h));
+}
+
+static void check(const struct script_index* idx) {
+    size_t n;
+    const struct script_ref* refs;
+
+    assert(idx->nscripts == 2);
+    assert(!strcmp(idx->scripts[0].name, "Harry") && !strcmp(idx->scripts[1].name, "Cybil"));
+
+    for (uint16_t i = 0; i < NGROUPS; i++) {
+        refs = script_index_find(idx, SCRIPT_REF_STR, i, &n);
+        assert(n == 2);
+        assert(refs[0].script == 0 && refs[1].script == 1);
+        assert(refs[0].offs == groups[i] && refs[0].op == OP_SHOW_TEXT);
+    }
+
+    script_index_find(idx, SCRIPT_REF_STR, NGROUPS, &n);
+    assert(n == 0);
+
+    refs = script_index_find(idx, SCRIPT_REF_MENU_STR, 100, &n);
+    assert(n == 2 * NGROUPS);
+    for (size_t i = 1; i < n; i++)
+        assert(refs[i - 1].script < refs[i].script ||
+            (refs[i - 1].script == refs[i].script && refs[i - 1].offs < refs[i].offs));
+
+    refs = script_index_find(idx, SCRIPT_REF_MENU_STR, 1, &n);
+    assert(n == 2 * (NGROUPS / 3));
+    assert(refs[0].op == OP_CHOICE);
+
+    /* Jump sources, with the label of their region */
+    refs = script_index_find(idx, SCRIPT_REF_LABEL, groups[1], &n);
+    assert(n == 2 && refs[0].script == 0);
+    assert(refs[0].op == OP_JUMP && refs[0].label == groups[3]);
+
+    refs = script_index_find(idx, SCRIPT_REF_LABEL, groups[5], &n);
+    assert(n == 2 && refs[0].label == groups[7]);
+
+    script_index_find(idx, SCRIPT_REF_LABEL, groups[2], &n);
+    assert(n == 0);
+}
+
+int main() {
+    const struct script_desc* descs[2] = {script_for_name("Harry"), script_for_name("Cybil")};
+    assert(descs[0] && descs[1]);
+    assert(script_for_idx(0) == descs[0] && script_for_idx(1) == descs[1] && !script_for_idx(2));
+
+    rom = malloc(ROM_SZ);
+    assert(rom);
+    memset(rom, 0xff, ROM_SZ);
+
+    uint32_t vmas[2];
+    for (size_t i = 0; i < 2; i++) {
+        vmas[i] = descs[i]->vma;
+        make_script(&rom[VMA2OFFS(vmas[i])]);
+    }
+
+    struct script_index idx;
+    assert(script_index_build(&idx, rom, ROM_SZ, descs, vmas, 2));
+    check(&idx);
+
+    /* Saved and loaded back, see test/side_file.c for stale files */
+    const char* path = "build/test/script_index" SCRIPT_INDEX_SUFFIX;
+
+    assert(script_index_save(&idx, path, ROM_SZ, 0x1234));
+    size_t nrefs = idx.nrefs;
+    script_index_free(&idx);
+
+    assert(script_index_load(&idx, path, ROM_SZ, 0x1234));
+    assert(idx.nrefs == nrefs);
+    check(&idx);
+    script_index_free(&idx);
+
+    remove(path);
+    free(rom);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "script_disass.h"
+#include "script_vm.h"
+
+#define ROM_SZ 0x400000
+
+enum {
+    OP_JUMP = 1,
+    OP_BRANCH_IF = 4,
+    OP_BRANCH_ELIF = 5,
+    OP_BRANCH_ELSE = 6,
+    OP_BRANCH_END = 7,
+    OP_SHOW_TEXT = 0xc,
+    OP_CHOICE = 0x11,
+    OP_CHOICE_IDX = 0x35,
+    OP_SAVE_VARIABLE = 0x37,
+    OP_READ_VARIABLE = 0x38,
+    OP_STOP = 0x63
+};
+
+/* Jump destinations */
+enum {A, B, DEAD, NTARGETS};
+
+static const char* conds[] = {"s1=0", "s1=1", "s3=11", "s2=5", "s2=6", "s2=7", "v"};
+enum {S1_0, S1_1, S3_11, S2_5, S2_6, S2_7, BOGUS};
+
+struct script {
+    uint16_t targets[NTARGETS];
+    uint16_t cond_offs[sizeof(conds) / sizeof(*conds)];
+    uint16_t dead_jump, dead_show_text, dead_stop;
+};
+
+static uint8_t* emit_cmd(uint8_t* p, unsigned op, const uint16_t* args, unsigned nargs) {
+    union script_cmd cmd = {.op = op, .arg = nargs};
+    memcpy(p, &cmd, sizeof(cmd));
+    if (nargs)
+        memcpy(p + sizeof(cmd), args, nargs * sizeof(*args));
+    return p + sizeof(cmd) + nargs * sizeof(*args);
+}
+
+#define EMIT(op, ...) \
+    (p = emit_cmd(p, op, (uint16_t[]){__VA_ARGS__}, sizeof((uint16_t[]){__VA_ARGS__}) / 2))
+#define EMIT0(op) (p = emit_cmd(p, op, NULL, 0))
+
+/**
+ * s1 picks where to start: at A, at B which shows a choice and then goes to A, or else at the
+ * end after an untestable branch. The chain that tests it has a duplicate condition, so that the
+ * jump to DEAD is never taken. A stores the option taken in s3, and stores s2 in either arm of an
+ * if/else on it, which s2 is then tested for, once with a value that it never has.
+ */
+static void make_script(uint8_t* hdr, struct script* s) {
+    uint8_t* start = hdr + sizeof(struct script_hdr);
+    uint8_t* p = start;
+
+    EMIT(OP_BRANCH_IF, s->cond_offs[S1_0]);
+    EMIT(OP_JUMP, s->targets[A]);
+    EMIT(OP_BRANCH_ELIF, s->cond_offs[S1_1]);
+    EMIT(OP_JUMP, s->targets[B]);
+    EMIT(OP_BRANCH_ELIF, s->cond_offs[S1_0]);
+    s->dead_jump = p - start;
+    EMIT(OP_JUMP, s->targets[DEAD]);
+    EMIT0(OP_BRANCH_END);
+    EMIT(OP_BRANCH_IF, s->cond_offs[BOGUS]);
+    EMIT(OP_SHOW_TEXT, 0);
+    EMIT0(OP_BRANCH_END);
+    EMIT0(OP_STOP);
+
+    s->targets[A] = p - start;
+    EMIT(OP_SHOW_TEXT, 1);
+    EMIT(OP_CHOICE_IDX, 3, 10, 11, 12);
+    EMIT(OP_READ_VARIABLE, 3);
+    EMIT(OP_BRANCH_IF, s->cond_offs[S3_11]);
+    EMIT(OP_SAVE_VARIABLE, 2, 5);
+    EMIT(OP_BRANCH_ELSE, 0);
+    EMIT(OP_SAVE_VARIABLE, 2, 6);
+    EMIT0(OP_BRANCH_END);
+    EMIT(OP_BRANCH_IF, s->cond_offs[S2_5]);
+    EMIT(OP_SHOW_TEXT, 2);
+    EMIT0(OP_BRANCH_END);
+    EMIT(OP_BRANCH_IF, s->cond_offs[S2_6]);
+    EMIT(OP_SHOW_TEXT, 3);
+    EMIT0(OP_BRANCH_END);
+    EMIT(OP_BRANCH_IF, s->cond_offs[S2_7]);
+    s->dead_show_text = p - start;
+    EMIT(OP_SHOW_TEXT, 4);
+    EMIT0(OP_BRANCH_END);
+    EMIT0(OP_STOP);
+
+    s->targets[B] = p - start;
+    EMIT(OP_SHOW_TEXT, 5);
+    EMIT(OP_CHOICE, 20, 21, 22);
+    EMIT(OP_JUMP, s->targets[A]);
+
+    s->targets[DEAD] = p - start;
+    EMIT(OP_SHOW_TEXT, 6);
+    s->dead_stop = p - start;
+    EMIT0(OP_STOP);
+
+    uint8_t* branch_info = p;
+    for (size_t i = 0; i < sizeof(conds) / sizeof(*conds); i++) {
+        s->cond_offs[i] = p - branch_info;
+        memcpy(p, conds[i], strlen(conds[i]) + 1);
+        p += strlen(conds[i]) + 1;
+    }
+
+    struct script_hdr h = {.branch_info_offs = branch_info - start,
+        .branch_info_sz = p - branch_info, .bytes_to_end = 1};
+    *p++ = 0;
+    memcpy(hdr, &h, sizeof(h));
+}
+
+int main() {
+    const struct script_desc* desc = script_for_name("Harry");
+    assert(desc);
+
+    uint8_t* rom = malloc(ROM_SZ);
+    assert(rom);
+    memset(rom, 0xff, ROM_SZ);
+
+    /* The second pass knows where the first one placed everything */
+    struct script s = {0};
+    make_script(&rom[VMA2OFFS(desc->vma)], &s);
+    make_script(&rom[VMA2OFFS(desc->vma)], &s);
+
+    struct script_vm_report r;
+    assert(script_vm_explore(rom, ROM_SZ, desc->vma, desc, &r));
+
+    /* s1 is 0, 1 or neither */
+    assert(r.nstarts == 3);
+    assert(r.nstops == 3 && r.nstops_reached == 2);
+    assert(r.ninsts - r.nreached == 4);
+
+    assert(r.nunreached == 3);
+    assert(r.unreached[0].offs == s.dead_jump && r.unreached[0].ninsts == 1);
+    assert(r.unreached[1].offs == s.dead_show_text && r.unreached[1].ninsts == 1);
+    assert(r.unreached[2].offs == s.targets[DEAD] && r.unreached[2].ninsts == 2);
+    assert(r.unreached[2].label == s.targets[DEAD] && r.unreached[2].end == s.dead_stop + 4);
+
+    assert(r.ndead_labels == 1 && r.dead_labels[0] == s.targets[DEAD]);
+
+    /* Both arms of the if/else were taken, and the option prompts count as shown */
+    assert(r.nunshown_strs == 2 && r.unshown_strs[0] == 4 && r.unshown_strs[1] == 6);
+    assert(r.nunshown_menu_strs == 0);
+    script_vm_report_free(&r);
+
+    free(rom);
+    return 0;
+}
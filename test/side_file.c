@@ -0,0 +1,56 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "side_file.h"
+
+#define MAGIC 0x54534554 /* TEST */
+
+struct test_hdr {
+    struct side_file_hdr side;
+    uint32_t n;
+};
+
+int main() {
+    const char* path = "build/test/side_file.idx";
+    struct test_hdr hdr = {{MAGIC, 1, 0x1000, 0x1234}, 3};
+    uint32_t vals[3] = {1, 2, 3};
+    struct side_file_part parts[] = {{&hdr, sizeof(hdr)}, {vals, sizeof(vals)}};
+
+    remove(path);
+    size_t sz;
+    assert(!side_file_map(path, &hdr.side, sizeof(hdr), &sz));
+
+    assert(side_file_save(path, parts, 2));
+    FILE* f = fopen("build/test/side_file.idx.tmp", "rb");
+    assert(!f);
+
+    /* Only loaded back for the same format and source */
+    struct side_file_hdr others[] = {
+        {MAGIC + 1, 1, 0x1000, 0x1234},
+        {MAGIC, 2, 0x1000, 0x1234},
+        {MAGIC, 1, 0x1004, 0x1234},
+        {MAGIC, 1, 0x1000, 0x1235}
+    };
+    for (size_t i = 0; i < sizeof(others) / sizeof(*others); i++)
+        assert(!side_file_map(path, &others[i], sizeof(hdr), &sz));
+    assert(!side_file_map(path, &hdr.side, sizeof(hdr) + sizeof(vals) + 1, &sz));
+
+    const struct test_hdr* map = side_file_map(path, &hdr.side, sizeof(hdr), &sz);
+    assert(map && sz == sizeof(hdr) + sizeof(vals));
+    assert(map->n == 3 && !memcmp(map + 1, vals, sizeof(vals)));
+    side_file_free((void*)map, sz);
+
+    /* Replaced as a whole */
+    hdr.n = 0;
+    assert(side_file_save(path, parts, 1));
+    map = side_file_map(path, &hdr.side, sizeof(hdr), &sz);
+    assert(map && sz == sizeof(hdr) && map->n == 0);
+    side_file_free((void*)map, sz);
+
+    remove(path);
+    return 0;
+}
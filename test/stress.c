@@ -0,0 +1,211 @@
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "embed.h"
+#include "script_disass.h"
+#include "strtab.h"
+
+/**
+ * Runs dumps and embeds of both scripts, from their text and from their IR, concurrently on a
+ * synthetic ROM and checks that every result matches the one produced by a single thread. Meant to
+ * be run with SANITIZE=thread.
+ */
+
+#define NTHREADS 8
+#define NROUNDS 4
+
+#define ROM_SZ 0x400000
+#define STRTAB_SCRIPT_OFFS 0x100000
+#define STRTAB_MENU_OFFS 0x110000
+#define STRTAB_SZ 0x8000
+#define SCRIPT_SZ_MAX 0x8000
+
+#define NSTRS 64
+#define NGROUPS 64
+
+enum {OP_JUMP = 1, OP_SHOW_TEXT = 0xc, OP_HANDLE_INPUT = 0x10, OP_CHOICE = 0x11,
+    OP_WAIT_TIME = 0x1f, OP_STOP = 0x63};
+
+static uint8_t* rom;
+static const struct script_desc* descs[2];
+
+/* Results of a single thread run, indexed like descs */
+static struct {
+    char* dump;
+    size_t dump_sz;
+    char* ir;
+    size_t ir_sz;
+    uint8_t* rom; /* embedded from ir */
+    uint8_t* text_rom; /* embedded from dump */
+} refs[2];
+
+static uint8_t* emit_cmd(uint8_t* p, unsigned op, const uint16_t* args, unsigned nargs) {
+    union script_cmd cmd = {.op = op, .arg = nargs};
+    memcpy(p, &cmd, sizeof(cmd));
+    memcpy(p + sizeof(cmd), args, nargs * sizeof(*args));
+    return p + sizeof(cmd) + nargs * sizeof(*args);
+}
+
+static void make_script(uint8_t* hdr) {
+    uint8_t* start = hdr + sizeof(struct script_hdr);
+    uint8_t* p = start;
+    uint16_t groups[NGROUPS];
+
+    for (uint16_t i = 0; i < NGROUPS; i++) {
+        groups[i] = p - start;
+        p = emit_cmd(p, OP_SHOW_TEXT, (uint16_t[]){i % NSTRS}, 1);
+        p = emit_cmd(p, OP_HANDLE_INPUT, NULL, 0);
+        /* Pretext at idx % 10 == 0 is not selectable */
+        p = emit_cmd(p, OP_CHOICE, (uint16_t[]){i % (NSTRS / 10) * 10, (i + 1) % NSTRS}, 2);
+        p = emit_cmd(p, OP_WAIT_TIME, (uint16_t[]){i}, 1);
+
+        /* Every few groups, jump back to create labels */
+        if (i % 4 == 3)
+            p = emit_cmd(p, OP_JUMP, (uint16_t[]){groups[i / 2]}, 1);
+    }
+    p = emit_cmd(p, OP_STOP, NULL, 0);
+
+    struct script_hdr h = {.branch_info_offs = p - start, .branch_info_sz = 1, .bytes_to_end = 1};
+    *p++ = 0;
+    *p++ = 0;
+    memcpy(hdr, &h, sizeof(h));
+}
+
+static void make_rom() {
+    rom = malloc(ROM_SZ);
+    assert(rom);
+    memset(rom, 0xff, ROM_SZ);
+
+    static char bufs[NSTRS][32];
+    const uint8_t* strs[NSTRS];
+    for (size_t i = 0; i < NSTRS; i++) {
+        snprintf(bufs[i], sizeof(bufs[i]), "String %zu", i);
+        strs[i] = (void*)bufs[i];
+    }
+
+    size_t nwritten;
+    assert(make_strtab(strs, NSTRS, &rom[STRTAB_SCRIPT_OFFS], STRTAB_SZ, &nwritten));
+    assert(make_strtab(strs, NSTRS, &rom[STRTAB_MENU_OFFS], STRTAB_SZ, &nwritten));
+
+    for (size_t i = 0; i < 2; i++)
+        make_script(&rom[VMA2OFFS(descs[i]->vma)]);
+}
+
+static char* slurp(FILE* f, size_t* sz) {
+    assert(fseek(f, 0, SEEK_END) == 0);
+    long end = ftell(f);
+    assert(end >= 0);
+    rewind(f);
+
+    char* buf = malloc(end + 1);
+    assert(buf);
+    assert(fread(buf, 1, end, f) == (size_t)end);
+    buf[end] = '\0';
+    *sz = end;
+    return buf;
+}
+
+static char* dump(const struct script_desc* desc, enum script_dump_fmt fmt, size_t* sz) {
+    FILE* f = tmpfile();
+    assert(f);
+    assert(script_dump(rom, ROM_SZ, desc->vma, desc, f, fmt, OFFS2VMA(STRTAB_SCRIPT_OFFS),
+        OFFS2VMA(STRTAB_MENU_OFFS)));
+
+    char* ret = slurp(f, sz);
+    fclose(f);
+    return ret;
+}
+
+/* script is either text or IR */
+static uint8_t* embed(const struct script_desc* desc, const char* script, size_t script_sz) {
+    uint8_t* dst = malloc(ROM_SZ);
+    assert(dst);
+    memcpy(dst, rom, ROM_SZ);
+
+    FILE* fscript = tmpfile(), * fstrtab_scr = tmpfile(), * fstrtab_menu = tmpfile();
+    assert(fscript && fstrtab_scr && fstrtab_menu);
+    assert(fwrite(script, 1, script_sz, fscript) == script_sz);
+    assert(fflush(fscript) == 0);
+
+    assert(embed_script(dst, ROM_SZ, SCRIPT_SZ_MAX, VMA2OFFS(desc->vma), false,
+        fscript, fstrtab_scr, fstrtab_menu, desc->name, script_sz, 0, 0,
+        OFFS2VMA(STRTAB_SCRIPT_OFFS), OFFS2VMA(STRTAB_MENU_OFFS), STRTAB_SZ, STRTAB_SZ,
+        desc->patch_info.size_vma, desc->patch_info.ptr_vma, false, false, false));
+
+    fclose(fscript);
+    fclose(fstrtab_scr);
+    fclose(fstrtab_menu);
+    return dst;
+}
+
+static void* work(void* arg) {
+    size_t tid = (size_t)arg;
+
+    for (size_t i = 0; i < NROUNDS; i++) {
+        /* Mix scripts and operations among threads */
+        size_t d = (tid + i) % 2;
+
+        switch ((tid / 2 + i) % 3) {
+            case 0: {
+                size_t sz;
+                char* text = dump(descs[d], SCRIPT_DUMP_TEXT, &sz);
+                assert(sz == refs[d].dump_sz && !memcmp(text, refs[d].dump, sz));
+                free(text);
+                break;
+            }
+            case 1: {
+                uint8_t* dst = embed(descs[d], refs[d].ir, refs[d].ir_sz);
+                assert(!memcmp(dst, refs[d].rom, ROM_SZ));
+                free(dst);
+                break;
+            }
+            default: {
+                /* Goes through the text parser rather than the IR reader */
+                uint8_t* dst = embed(descs[d], refs[d].dump, refs[d].dump_sz);
+                assert(!memcmp(dst, refs[d].text_rom, ROM_SZ));
+                free(dst);
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int main() {
+    assert(HAS_ICONV);
+
+    descs[0] = script_for_name("Harry");
+    descs[1] = script_for_name("Cybil");
+    assert(descs[0] && descs[1]);
+
+    make_rom();
+
+    for (size_t i = 0; i < 2; i++) {
+        refs[i].dump = dump(descs[i], SCRIPT_DUMP_TEXT, &refs[i].dump_sz);
+        refs[i].ir = dump(descs[i], SCRIPT_DUMP_IR, &refs[i].ir_sz);
+        refs[i].rom = embed(descs[i], refs[i].ir, refs[i].ir_sz);
+        refs[i].text_rom = embed(descs[i], refs[i].dump, refs[i].dump_sz);
+    }
+
+    pthread_t threads[NTHREADS];
+    for (size_t i = 0; i < NTHREADS; i++)
+        assert(pthread_create(&threads[i], NULL, work, (void*)i) == 0);
+    for (size_t i = 0; i < NTHREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    for (size_t i = 0; i < 2; i++) {
+        free(refs[i].dump);
+        free(refs[i].ir);
+        free(refs[i].rom);
+        free(refs[i].text_rom);
+    }
+    free(rom);
+}
@@ -0,0 +1,91 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "task.h"
+
+#define NCHAINS 6
+#define CHAIN_LEN 4
+
+static atomic_size_t clock_;
+
+struct item {
+    bool ok;
+    size_t at; /* completion order */
+};
+
+static bool run_item(void* arg) {
+    struct item* item = arg;
+    item->at = atomic_fetch_add(&clock_, 1) + 1;
+    return item->ok;
+}
+
+/* Several chains joined by a final task: every task must run after its dependencies */
+static void test_order(size_t nthreads) {
+    struct task_graph* g = malloc(sizeof(*g));
+    assert(g);
+    task_graph_init(g);
+
+    static struct item items[NCHAINS * CHAIN_LEN + 1];
+    size_t ids[NCHAINS * CHAIN_LEN + 1];
+
+    for (size_t c = 0; c < NCHAINS; c++) {
+        for (size_t i = 0; i < CHAIN_LEN; i++) {
+            size_t idx = c * CHAIN_LEN + i;
+            items[idx] = (struct item){.ok = true};
+            ids[idx] = task_add(g, "chain", run_item, &items[idx]);
+            if (i > 0)
+                task_dep(g, ids[idx], ids[idx - 1]);
+        }
+    }
+
+    size_t last = NCHAINS * CHAIN_LEN;
+    items[last] = (struct item){.ok = true};
+    ids[last] = task_add(g, "join", run_item, &items[last]);
+    for (size_t c = 0; c < NCHAINS; c++)
+        task_dep(g, ids[last], ids[c * CHAIN_LEN + CHAIN_LEN - 1]);
+
+    atomic_store(&clock_, 0);
+    assert(task_graph_run(g, nthreads));
+
+    for (size_t c = 0; c < NCHAINS; c++)
+        for (size_t i = 1; i < CHAIN_LEN; i++)
+            assert(items[c * CHAIN_LEN + i].at > items[c * CHAIN_LEN + i - 1].at);
+    assert(items[last].at == last + 1);
+
+    free(g);
+}
+
+/* Dependents of a failed task must not run */
+static void test_fail(size_t nthreads) {
+    struct task_graph* g = malloc(sizeof(*g));
+    assert(g);
+    task_graph_init(g);
+
+    static struct item items[3];
+    items[0] = (struct item){.ok = false};
+    items[1] = (struct item){.ok = true};
+    items[2] = (struct item){.ok = true};
+
+    size_t a = task_add(g, "fail", run_item, &items[0]);
+    size_t b = task_add(g, "after fail", run_item, &items[1]);
+    size_t c = task_add(g, "after after fail", run_item, &items[2]);
+    task_dep(g, b, a);
+    task_dep(g, c, b);
+
+    atomic_store(&clock_, 0);
+    assert(!task_graph_run(g, nthreads));
+    assert(items[0].at == 1 && items[1].at == 0 && items[2].at == 0);
+
+    free(g);
+}
+
+int main() {
+    for (size_t nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        test_order(nthreads);
+        test_fail(nthreads);
+    }
+}
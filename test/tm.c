@@ -0,0 +1,129 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test/rng.h"
+#include "tm.h"
+
+#define NSTRS 1000
+
+static char* strs[NSTRS];
+
+static double jaccard(const struct tm_index* tm, size_t a, size_t b) {
+    const uint32_t* sa = &tm->shingles[tm->shingle_offs[a]];
+    const uint32_t* sb = &tm->shingles[tm->shingle_offs[b]];
+    size_t na = tm->shingle_offs[a + 1] - tm->shingle_offs[a];
+    size_t nb = tm->shingle_offs[b + 1] - tm->shingle_offs[b];
+    size_t same = 0;
+
+    for (size_t i = 0; i < na; i++)
+        for (size_t j = 0; j < nb; j++)
+            same += sa[i] == sb[j];
+    return na + nb ? (double)same / (na + nb - same) : 0;
+}
+
+static void check_dups(const struct tm_index* tm, double sim_min) {
+    size_t nstrs = tm->nstrs;
+    size_t n;
+    struct tm_pair* pairs = tm_dups(tm, sim_min, &n);
+    assert(pairs);
+
+    size_t nsame = 0;
+    for (size_t i = 0; i < n; i++) {
+        assert(pairs[i].a < pairs[i].b);
+        assert(!i || pairs[i].sim <= pairs[i - 1].sim);
+        assert(pairs[i].sim >= sim_min);
+        assert(pairs[i].sim == jaccard(tm, pairs[i].a, pairs[i].b));
+        if (pairs[i].sim == 1)
+            nsame++;
+    }
+
+    /* Every string identical to another one is paired with the first of them */
+    size_t nexp = 0;
+    for (size_t i = 0; i < nstrs; i++)
+        for (size_t j = 0; j < i; j++)
+            if (strs[i] && strs[j] && tm->rep[i] != i && jaccard(tm, i, j) == 1) {
+                nexp++;
+                break;
+            }
+    assert(nsame == nexp);
+    free(pairs);
+}
+
+int main() {
+    const char* words[] = {"シェリル", "ハリー", "の", "行方", "学校", "¥n", "…", "Cheryl"};
+    uint32_t rng = 1;
+
+    for (size_t i = 1; i < NSTRS; i++) {
+        if (i % 17 == 0)
+            continue;
+
+        /* Many copies of a single string, as in the scripts */
+        char buf[256];
+        size_t len = 0;
+        if (i % 3 == 0) {
+            len = snprintf(buf, sizeof(buf), "データがありません。");
+        } else {
+            for (size_t w = 0; w < 6; w++) {
+                len += snprintf(&buf[len], sizeof(buf) - len, "%s",
+                    words[rng_below(&rng, sizeof(words) / sizeof(*words))]);
+            }
+        }
+        strs[i] = malloc(len + 1);
+        assert(strs[i]);
+        memcpy(strs[i], buf, len + 1);
+    }
+
+    struct tm_index tm;
+    assert(tm_build(&tm, strs, NSTRS));
+
+    /* Spaces and escapes are left out */
+    struct tm_match matches[8];
+    ptrdiff_t n = tm_query(&tm, "データ　が ありません。¥n", SIZE_MAX, matches, 8);
+    assert(n == 1 && matches[0].idx == 3 && matches[0].sim == 1);
+    assert(matches[0].nsame == (NSTRS - 1) / 3 - (NSTRS - 1) / 51 - 1);
+
+    /* A string is not its own match, but identical ones are */
+    n = tm_query(&tm, strs[3], 3, matches, 8);
+    assert(n == 1 && matches[0].idx == 6);
+    assert(matches[0].nsame == (NSTRS - 1) / 3 - (NSTRS - 1) / 51 - 2);
+
+    /* Near-duplicates are found, by descending similarity */
+    n = tm_query(&tm, "データがありませんでした。", SIZE_MAX, matches, 8);
+    assert(n == 1 && matches[0].idx == 3 && matches[0].sim > 0.5 && matches[0].sim < 1);
+
+    for (size_t i = 1; i < NSTRS; i += 7) {
+        if (!strs[i])
+            continue;
+        n = tm_query(&tm, strs[i], i, matches, 8);
+        assert(n >= 0);
+        for (ptrdiff_t j = 0; j < n; j++) {
+            assert(matches[j].idx != i);
+            assert(!j || matches[j].sim <= matches[j - 1].sim);
+            assert(matches[j].sim == jaccard(&tm, i, matches[j].idx));
+        }
+    }
+
+    n = tm_query(&tm, "", SIZE_MAX, matches, 8);
+    assert(n == 0);
+    n = tm_query(&tm, "zzzzzz", SIZE_MAX, matches, 8);
+    assert(n == 0);
+
+    check_dups(&tm, 0.8);
+    check_dups(&tm, 1);
+    tm_free(&tm);
+
+    /* Nothing to index */
+    assert(tm_build(&tm, strs, 1));
+    n = tm_query(&tm, "シェリル", SIZE_MAX, matches, 8);
+    assert(n == 0);
+    check_dups(&tm, 0.8);
+    tm_free(&tm);
+
+    for (size_t i = 0; i < NSTRS; i++)
+        free(strs[i]);
+    return 0;
+}
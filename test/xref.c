@@ -0,0 +1,88 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "test/rng.h"
+#include "xref.h"
+
+#define ROM_SZ 0x10000
+#define NPTRS 1000
+
+static uint8_t rom[ROM_SZ];
+
+static void put_ptr(size_t offs, uint32_t vma) {
+    memcpy(&rom[offs], &vma, sizeof(vma));
+}
+
+/* Compare to a linear scan */
+static void check_find(const struct xref* x, uint32_t lo, uint32_t hi) {
+    size_t n, nexp = 0;
+    const struct scan_ptr* ptrs = xref_find(x, lo, hi, &n);
+
+    for (size_t offs = 0; offs < ROM_SZ; offs += sizeof(uint32_t)) {
+        uint32_t w;
+        memcpy(&w, &rom[offs], sizeof(w));
+        if (w < lo || w >= hi)
+            continue;
+
+        size_t i;
+        for (i = 0; i < n && ptrs[i].vma != OFFS2VMA(offs); i++)
+            ;
+        assert(i < n && ptrs[i].target == w);
+        nexp++;
+    }
+    assert(n == nexp);
+
+    for (size_t i = 1; i < n; i++)
+        assert(ptrs[i - 1].target < ptrs[i].target ||
+            (ptrs[i - 1].target == ptrs[i].target && ptrs[i - 1].vma < ptrs[i].vma));
+}
+
+int main() {
+    uint32_t rng = 1;
+
+    memset(rom, 0xff, sizeof(rom));
+    for (size_t i = 0; i < NPTRS; i++) {
+        uint32_t r = rng_next(&rng);
+        put_ptr((r % (ROM_SZ / sizeof(uint32_t))) * sizeof(uint32_t),
+            OFFS2VMA((r >> 16) % (ROM_SZ / 16) * 16));
+    }
+
+    /* Unaligned, outside of the ROM, or in a mirror */
+    put_ptr(0x101, OFFS2VMA(0x100));
+    put_ptr(0x104, OFFS2VMA(ROM_SZ));
+    put_ptr(0x108, OFFS2VMA(0x100) + 0x2000000);
+
+    struct xref x;
+    assert(xref_build(&x, rom, ROM_SZ));
+
+    check_find(&x, OFFS2VMA(0), OFFS2VMA(ROM_SZ));
+    check_find(&x, OFFS2VMA(0x100), OFFS2VMA(0x101));
+    check_find(&x, OFFS2VMA(0x1000), OFFS2VMA(0x2000));
+    check_find(&x, OFFS2VMA(0x1001), OFFS2VMA(0x1002));
+
+    size_t n;
+    xref_find(&x, OFFS2VMA(0x200), OFFS2VMA(0x100), &n);
+    assert(n == 0);
+
+    /* Saved and loaded back, see test/side_file.c for stale files */
+    const char* path = "build/test/xref" XREF_SUFFIX;
+
+    assert(xref_save(&x, path, ROM_SZ, 0x1234));
+    size_t nptrs = x.nptrs;
+    xref_free(&x);
+
+    assert(xref_load(&x, path, ROM_SZ, 0x1234));
+    assert(x.nptrs == nptrs);
+
+    check_find(&x, OFFS2VMA(0), OFFS2VMA(ROM_SZ));
+    check_find(&x, OFFS2VMA(0x1000), OFFS2VMA(0x2000));
+    xref_free(&x);
+
+    remove(path);
+    return 0;
+}